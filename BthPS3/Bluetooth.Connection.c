@@ -74,16 +74,34 @@ BthPS3_IndicationCallback(
 			Parameters->BtAddress
 		);
 
+		//
+		// Device was found unsupported recently, deny without identifying it again
+		// 
+		if (BthPS3_DenyCacheLookup(&devCtx->Header, Parameters->BtAddress))
+		{
+			(void)L2CAP_PS3_DenyRemoteConnect(devCtx, Parameters);
+
+			break;
+		}
+
 		if (KeGetCurrentIrql() <= PASSIVE_LEVEL)
 		{
 			//
 			// Main entry point for a new connection, decides if valid etc.
 			// 
-			L2CAP_PS3_HandleRemoteConnect(devCtx, Parameters);
+			L2CAP_PS3_HandleRemoteConnect(devCtx, Parameters, KeQueryInterruptTime());
 
 			break;
 		}
 
+		//
+		// Known devices can be accepted right away without a work item round-trip
+		// 
+		if (NT_SUCCESS(L2CAP_PS3_HandleKnownRemoteConnect(devCtx, Parameters)))
+		{
+			break;
+		}
+
 		//
 		// Can be DPC level, enqueue work item
 		// 
@@ -99,15 +117,14 @@ BthPS3_IndicationCallback(
 		qwi.IndicationParameters = *Parameters;
 		qwi.Context.Server = devCtx;
 
-		if (!NT_SUCCESS(status = DMF_QueuedWorkItem_Enqueue(
-			devCtx->Header.QueuedWorkItemModule,
-			&qwi,
-			sizeof(BTHPS3_QWI_CONTEXT)
+		if (!NT_SUCCESS(status = BthPS3_QueuedWorkItemEnqueue(
+			&devCtx->Header,
+			&qwi
 		)))
 		{
 			TraceError(
 				TRACE_BTH,
-				"DMF_QueuedWorkItem_Enqueue failed with status %!STATUS!",
+				"BthPS3_QueuedWorkItemEnqueue failed with status %!STATUS!",
 				status
 			);
 
@@ -52,15 +52,11 @@ BthPS3_DeviceContextHeaderInit(
 {
 	NTSTATUS status;
 	WDF_OBJECT_ATTRIBUTES attributes;
-	WDFKEY hKey = NULL;
-	ULONG length, type;
 
 	FuncEntry(TRACE_BTH);
 
 	PAGED_CODE();
 
-	DECLARE_CONST_UNICODE_STRING(slots, BTHPS3_REG_VALUE_SLOTS);
-
 	Header->Device = Device;
 
 	Header->IoTarget = WdfDeviceGetIoTarget(Device);
@@ -112,40 +108,18 @@ BthPS3_DeviceContextHeaderInit(
 			break;
 		}
 
-		//
-		// Open
-		//   HKEY_LOCAL_MACHINE\SYSTEM\CurrentControlSet\Services\BthPS3\Parameters
-		// key
-		// 
-		if (!NT_SUCCESS(status = WdfDriverOpenParametersRegistryKey(
-			WdfGetDriver(),
-			STANDARD_RIGHTS_READ,
-			WDF_NO_OBJECT_ATTRIBUTES,
-			&hKey
-		)))
+		if (!NT_SUCCESS(status = BthPS3_SlotsInit(Header)))
 		{
 			break;
 		}
 
-		//
-		// Restore persisted slots, if any
-		// 
-		(void)WdfRegistryQueryValue(
-			hKey,
-			&slots,
-			sizeof(Header->Slots),
-			&Header->Slots,
-			&length,
-			&type
-		);
+		if (!NT_SUCCESS(status = BthPS3_NameCacheInit(Header)))
+		{
+			break;
+		}
 
 	} while (FALSE);
 
-	if (hKey)
-	{
-		WdfRegistryClose(hKey);
-	}
-
 	FuncExit(TRACE_BTH, "status=%!STATUS!", status);
 
 	return status;
@@ -198,37 +172,18 @@ BthPS3_ServerContextInit(
 		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
 		attributes.ParentObject = Device;
 
-		if (!NT_SUCCESS(status = WdfCollectionCreate(
-			&attributes,
-			&Context->Settings.SIXAXISSupportedNames
-		)))
-		{
-			break;
-		}
-
-		if (!NT_SUCCESS(status = WdfCollectionCreate(
-			&attributes,
-			&Context->Settings.NAVIGATIONSupportedNames
-		)))
-		{
-			break;
-		}
-
-		if (!NT_SUCCESS(status = WdfCollectionCreate(
+		if (!NT_SUCCESS(status = WdfWaitLockCreate(
 			&attributes,
-			&Context->Settings.MOTIONSupportedNames
+			&Context->Settings.NotifyLock
 		)))
 		{
 			break;
 		}
 
-		if (!NT_SUCCESS(status = WdfCollectionCreate(
-			&attributes,
-			&Context->Settings.WIRELESSSupportedNames
-		)))
-		{
-			break;
-		}
+		//
+		// No notification pending yet
+		// 
+		KeInitializeEvent(&Context->Settings.NotifyStopped, NotificationEvent, TRUE);
 
 		//
 		// Query registry for dynamic values
@@ -242,150 +197,3 @@ BthPS3_ServerContextInit(
 	return status;
 }
 #pragma code_seg()
-
-//
-// Read runtime properties from registry
-// 
-#pragma code_seg("PAGE")
-_IRQL_requires_max_(PASSIVE_LEVEL)
-NTSTATUS
-BthPS3_SettingsContextInit(
-	PBTHPS3_SERVER_CONTEXT Context
-)
-{
-	NTSTATUS status;
-	WDFKEY hKey = NULL;
-	WDF_OBJECT_ATTRIBUTES attributes;
-
-	PAGED_CODE();
-
-	DECLARE_CONST_UNICODE_STRING(autoEnableFilter, BTHPS3_REG_VALUE_AUTO_ENABLE_FILTER);
-	DECLARE_CONST_UNICODE_STRING(autoDisableFilter, BTHPS3_REG_VALUE_AUTO_DISABLE_FILTER);
-	DECLARE_CONST_UNICODE_STRING(autoEnableFilterDelay, BTHPS3_REG_VALUE_AUTO_ENABLE_FILTER_DELAY);
-
-	DECLARE_CONST_UNICODE_STRING(isSIXAXISSupported, BTHPS3_REG_VALUE_IS_SIXAXIS_SUPPORTED);
-	DECLARE_CONST_UNICODE_STRING(isNAVIGATIONSupported, BTHPS3_REG_VALUE_IS_NAVIGATION_SUPPORTED);
-	DECLARE_CONST_UNICODE_STRING(isMOTIONSupported, BTHPS3_REG_VALUE_IS_MOTION_SUPPORTED);
-	DECLARE_CONST_UNICODE_STRING(isWIRELESSSupported, BTHPS3_REG_VALUE_IS_WIRELESS_SUPPORTED);
-
-	DECLARE_CONST_UNICODE_STRING(SIXAXISSupportedNames, BTHPS3_REG_VALUE_SIXAXIS_SUPPORTED_NAMES);
-	DECLARE_CONST_UNICODE_STRING(NAVIGATIONSupportedNames, BTHPS3_REG_VALUE_NAVIGATION_SUPPORTED_NAMES);
-	DECLARE_CONST_UNICODE_STRING(MOTIONSupportedNames, BTHPS3_REG_VALUE_MOTION_SUPPORTED_NAMES);
-	DECLARE_CONST_UNICODE_STRING(WIRELESSSupportedNames, BTHPS3_REG_VALUE_WIRELESS_SUPPORTED_NAMES);
-
-	//
-	// Set default values
-	//
-	Context->Settings.AutoEnableFilter = TRUE;
-	Context->Settings.AutoDisableFilter = TRUE;
-	Context->Settings.AutoEnableFilterDelay = 10; // Seconds
-
-	Context->Settings.IsSIXAXISSupported = TRUE;
-	Context->Settings.IsNAVIGATIONSupported = TRUE;
-	Context->Settings.IsMOTIONSupported = TRUE;
-	Context->Settings.IsWIRELESSSupported = TRUE;
-
-	//
-	// Open
-	//   HKEY_LOCAL_MACHINE\SYSTEM\CurrentControlSet\Services\BthPS3\Parameters
-	// key
-	// 
-	status = WdfDriverOpenParametersRegistryKey(
-		WdfGetDriver(),
-		STANDARD_RIGHTS_READ,
-		WDF_NO_OBJECT_ATTRIBUTES,
-		&hKey
-	);
-
-	//
-	// On success, read configuration values
-	// 
-	if (NT_SUCCESS(status))
-	{
-		//
-		// Don't care, if it fails, keep default value
-		// 
-		(void)WdfRegistryQueryULong(
-			hKey,
-			&autoEnableFilter,
-			&Context->Settings.AutoEnableFilter
-		);
-
-		(void)WdfRegistryQueryULong(
-			hKey,
-			&autoDisableFilter,
-			&Context->Settings.AutoDisableFilter
-		);
-
-		(void)WdfRegistryQueryULong(
-			hKey,
-			&autoEnableFilterDelay,
-			&Context->Settings.AutoEnableFilterDelay
-		);
-
-		(void)WdfRegistryQueryULong(
-			hKey,
-			&isSIXAXISSupported,
-			&Context->Settings.IsSIXAXISSupported
-		);
-
-		(void)WdfRegistryQueryULong(
-			hKey,
-			&isNAVIGATIONSupported,
-			&Context->Settings.IsNAVIGATIONSupported
-		);
-
-		(void)WdfRegistryQueryULong(
-			hKey,
-			&isMOTIONSupported,
-			&Context->Settings.IsMOTIONSupported
-		);
-
-		(void)WdfRegistryQueryULong(
-			hKey,
-			&isWIRELESSSupported,
-			&Context->Settings.IsWIRELESSSupported
-		);
-
-		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
-		attributes.ParentObject = Context->Settings.SIXAXISSupportedNames;
-		(void)WdfRegistryQueryMultiString(
-			hKey,
-			&SIXAXISSupportedNames,
-			&attributes,
-			Context->Settings.SIXAXISSupportedNames
-		);
-
-		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
-		attributes.ParentObject = Context->Settings.NAVIGATIONSupportedNames;
-		(void)WdfRegistryQueryMultiString(
-			hKey,
-			&NAVIGATIONSupportedNames,
-			&attributes,
-			Context->Settings.NAVIGATIONSupportedNames
-		);
-
-		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
-		attributes.ParentObject = Context->Settings.MOTIONSupportedNames;
-		(void)WdfRegistryQueryMultiString(
-			hKey,
-			&MOTIONSupportedNames,
-			&attributes,
-			Context->Settings.MOTIONSupportedNames
-		);
-
-		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
-		attributes.ParentObject = Context->Settings.WIRELESSSupportedNames;
-		(void)WdfRegistryQueryMultiString(
-			hKey,
-			&WIRELESSSupportedNames,
-			&attributes,
-			Context->Settings.WIRELESSSupportedNames
-		);
-
-		WdfRegistryClose(hKey);
-	}
-
-	return status;
-}
-#pragma code_seg()
@@ -0,0 +1,181 @@
+#include "Driver.h"
+#include "Bluetooth.DenyCache.tmh"
+
+
+//
+// Checks if connections from a remote address should be denied right away
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+BthPS3_DenyCacheLookup(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	BTH_ADDR RemoteAddress
+)
+{
+	BOOLEAN found = FALSE;
+	const ULONGLONG now = KeQueryInterruptTime();
+
+	InterlockedIncrement(&Header->DenyCache.Lookups);
+
+	const KIRQL irql = ExAcquireSpinLockShared(&Header->DenyCache.Lock);
+
+	for (ULONG index = 0; index < BTHPS3_DENY_CACHE_SIZE; index++)
+	{
+		if (Header->DenyCache.Entries[index].RemoteAddress == RemoteAddress
+			&& Header->DenyCache.Entries[index].ExpiresAt > now)
+		{
+			found = TRUE;
+			break;
+		}
+	}
+
+	ExReleaseSpinLockShared(&Header->DenyCache.Lock, irql);
+
+	if (found)
+	{
+		const LONG hits = InterlockedIncrement(&Header->DenyCache.Hits);
+
+		TraceVerbose(
+			TRACE_BTH,
+			"Device %012llX is denied (hits: %d, lookups: %d)",
+			RemoteAddress,
+			hits,
+			Header->DenyCache.Lookups
+		);
+	}
+
+	return found;
+}
+
+//
+// Remembers a remote address to deny connections from for the given time
+// 
+// Replaces the entry of the same address, an expired one or the one expiring first.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthPS3_DenyCacheInsert(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	BTH_ADDR RemoteAddress,
+	ULONG TimeoutSeconds
+)
+{
+	ULONG victim = 0;
+
+	if (TimeoutSeconds == 0 || RemoteAddress == 0)
+	{
+		return;
+	}
+
+	const ULONGLONG expiresAt = KeQueryInterruptTime() + TimeoutSeconds * 10000000ULL;
+
+	const KIRQL irql = ExAcquireSpinLockExclusive(&Header->DenyCache.Lock);
+
+	for (ULONG index = 0; index < BTHPS3_DENY_CACHE_SIZE; index++)
+	{
+		if (Header->DenyCache.Entries[index].RemoteAddress == RemoteAddress)
+		{
+			victim = index;
+			break;
+		}
+
+		if (Header->DenyCache.Entries[index].ExpiresAt < Header->DenyCache.Entries[victim].ExpiresAt)
+		{
+			victim = index;
+		}
+	}
+
+	Header->DenyCache.Entries[victim].RemoteAddress = RemoteAddress;
+	Header->DenyCache.Entries[victim].ExpiresAt = expiresAt;
+
+	ExReleaseSpinLockExclusive(&Header->DenyCache.Lock, irql);
+
+	TraceInformation(
+		TRACE_BTH,
+		"Denying device %012llX for %d seconds",
+		RemoteAddress,
+		TimeoutSeconds
+	);
+}
+
+//
+// Forgets all denied addresses, e.g. after supported devices changed
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthPS3_DenyCacheClear(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header
+)
+{
+	const KIRQL irql = ExAcquireSpinLockExclusive(&Header->DenyCache.Lock);
+
+	RtlZeroMemory(Header->DenyCache.Entries, sizeof(Header->DenyCache.Entries));
+
+	ExReleaseSpinLockExclusive(&Header->DenyCache.Lock, irql);
+}
+
+//
+// Copies the lookup counters and the number of currently denied addresses
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthPS3_DenyCacheGetStats(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	PBTHPS3_DENY_CACHE_STATS Stats
+)
+{
+	const ULONGLONG now = KeQueryInterruptTime();
+
+	Stats->Lookups = (ULONG)InterlockedCompareExchange(&Header->DenyCache.Lookups, 0, 0);
+	Stats->Hits = (ULONG)InterlockedCompareExchange(&Header->DenyCache.Hits, 0, 0);
+	Stats->Entries = 0;
+
+	const KIRQL irql = ExAcquireSpinLockShared(&Header->DenyCache.Lock);
+
+	for (ULONG index = 0; index < BTHPS3_DENY_CACHE_SIZE; index++)
+	{
+		if (Header->DenyCache.Entries[index].RemoteAddress != 0
+			&& Header->DenyCache.Entries[index].ExpiresAt > now)
+		{
+			Stats->Entries++;
+		}
+	}
+
+	ExReleaseSpinLockShared(&Header->DenyCache.Lock, irql);
+}
+
+//
+// Handles IOCTL_BTHPS3_GET_DENY_CACHE_STATS on the bus interface
+// 
+NTSTATUS
+BthPS3_HandleGetDenyCacheStats(
+	_In_ DMFMODULE DmfModule,
+	_In_ WDFQUEUE Queue,
+	_In_ WDFREQUEST Request,
+	_In_ ULONG IoctlCode,
+	_In_reads_(InputBufferSize) VOID* InputBuffer,
+	_In_ size_t InputBufferSize,
+	_Out_writes_(OutputBufferSize) VOID* OutputBuffer,
+	_In_ size_t OutputBufferSize,
+	_Out_ size_t* BytesReturned
+)
+{
+	UNREFERENCED_PARAMETER(Queue);
+	UNREFERENCED_PARAMETER(Request);
+	UNREFERENCED_PARAMETER(IoctlCode);
+	UNREFERENCED_PARAMETER(InputBuffer);
+	UNREFERENCED_PARAMETER(InputBufferSize);
+	UNREFERENCED_PARAMETER(OutputBufferSize);
+
+	FuncEntry(TRACE_BTH);
+
+	const WDFDEVICE device = DMF_ParentDeviceGet(DmfModule);
+
+	BthPS3_DenyCacheGetStats(&GetServerDeviceContext(device)->Header, OutputBuffer);
+
+	*BytesReturned = sizeof(BTHPS3_DENY_CACHE_STATS);
+
+	FuncExitNoReturn(TRACE_BTH);
+
+	return STATUS_SUCCESS;
+}
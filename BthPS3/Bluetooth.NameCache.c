@@ -0,0 +1,367 @@
+#include "Driver.h"
+#include "Bluetooth.NameCache.tmh"
+
+
+static EVT_WDF_WORKITEM BthPS3_NameCacheEvtRefresh;
+
+
+//
+// Sets up locks and the refresh work item, called once on device creation
+// 
+#pragma code_seg("PAGE")
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+BthPS3_NameCacheInit(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header
+)
+{
+	NTSTATUS status;
+	WDF_OBJECT_ATTRIBUTES attributes;
+	WDF_WORKITEM_CONFIG workItemCfg;
+
+	FuncEntry(TRACE_BTH);
+
+	PAGED_CODE();
+
+	WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+	attributes.ParentObject = Header->Device;
+
+	Header->NameCache.MaxDevices = BTH_DEVICE_INFO_MAX_COUNT;
+
+	do
+	{
+		if (!NT_SUCCESS(status = WdfWaitLockCreate(
+			&attributes,
+			&Header->NameCache.Lock
+		)))
+		{
+			break;
+		}
+
+		if (!NT_SUCCESS(status = WdfWaitLockCreate(
+			&attributes,
+			&Header->NameCache.FetchLock
+		)))
+		{
+			break;
+		}
+
+		WDF_WORKITEM_CONFIG_INIT(&workItemCfg, BthPS3_NameCacheEvtRefresh);
+
+		if (!NT_SUCCESS(status = WdfWorkItemCreate(
+			&workItemCfg,
+			&attributes,
+			&Header->NameCache.RefreshWorkItem
+		)))
+		{
+			TraceError(
+				TRACE_BTH,
+				"WdfWorkItemCreate failed with status %!STATUS!",
+				status
+			);
+			break;
+		}
+
+	} while (FALSE);
+
+	FuncExit(TRACE_BTH, "status=%!STATUS!", status);
+
+	return status;
+}
+#pragma code_seg()
+
+//
+// Waits for a pending refresh to finish
+// 
+#pragma code_seg("PAGE")
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+BthPS3_NameCacheFlush(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header
+)
+{
+	PAGED_CODE();
+
+	if (Header->NameCache.RefreshWorkItem)
+	{
+		WdfWorkItemFlush(Header->NameCache.RefreshWorkItem);
+	}
+}
+#pragma code_seg()
+
+//
+// Fetches all devices known to the radio into the retained list buffer
+// 
+// Caller must hold FetchLock. The buffer only grows if the radio reports it too small.
+// 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+static NTSTATUS
+BthPS3_NameCacheFetchList(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	PBTH_DEVICE_INFO_LIST* DeviceInfoList
+)
+{
+	NTSTATUS status = STATUS_INVALID_BUFFER_SIZE;
+	WDF_OBJECT_ATTRIBUTES attributes;
+	WDF_MEMORY_DESCRIPTOR memoryDescriptor;
+	const ULONG maxDevicesLimit = BTH_DEVICE_INFO_MAX_COUNT * (BTH_DEVICE_INFO_MAX_RETRIES + 1);
+
+	WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+	attributes.ParentObject = Header->Device;
+
+	while (status == STATUS_INVALID_BUFFER_SIZE)
+	{
+		if (Header->NameCache.DeviceInfoList == NULL)
+		{
+			if (!NT_SUCCESS(status = WdfMemoryCreate(
+				&attributes,
+				NonPagedPoolNx,
+				POOLTAG_BTHPS3,
+				sizeof(BTH_DEVICE_INFO_LIST) + (sizeof(BTH_DEVICE_INFO) * Header->NameCache.MaxDevices),
+				&Header->NameCache.DeviceInfoList,
+				NULL
+			)))
+			{
+				TraceError(
+					TRACE_BTH,
+					"WdfMemoryCreate failed with status %!STATUS!",
+					status
+				);
+				return status;
+			}
+		}
+
+		WDF_MEMORY_DESCRIPTOR_INIT_HANDLE(
+			&memoryDescriptor,
+			Header->NameCache.DeviceInfoList,
+			NULL
+		);
+
+		status = WdfIoTargetSendIoctlSynchronously(
+			Header->IoTarget,
+			NULL,
+			IOCTL_BTH_GET_DEVICE_INFO,
+			&memoryDescriptor,
+			&memoryDescriptor,
+			NULL,
+			NULL
+		);
+
+		if (status != STATUS_INVALID_BUFFER_SIZE)
+		{
+			break;
+		}
+
+		if (Header->NameCache.MaxDevices >= maxDevicesLimit)
+		{
+			break;
+		}
+
+		//
+		// _A lot_ of devices are cached, grow buffer for this and future fetches
+		// 
+		WdfObjectDelete(Header->NameCache.DeviceInfoList);
+		Header->NameCache.DeviceInfoList = NULL;
+		Header->NameCache.MaxDevices = min(Header->NameCache.MaxDevices * 2, maxDevicesLimit);
+
+		TraceVerbose(
+			TRACE_BTH,
+			"Growing device info list to %d entries",
+			Header->NameCache.MaxDevices
+		);
+	}
+
+	if (NT_SUCCESS(status))
+	{
+		*DeviceInfoList = WdfMemoryGetBuffer(Header->NameCache.DeviceInfoList, NULL);
+	}
+
+	return status;
+}
+
+//
+// Stores a name, replacing the entry fetched longest ago if full
+// 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+static VOID
+BthPS3_NameCacheInsert(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	BTH_ADDR RemoteAddress,
+	PCSTR Name
+)
+{
+	PBTHPS3_NAME_CACHE_ENTRY pEntry = NULL;
+
+	WdfWaitLockAcquire(Header->NameCache.Lock, NULL);
+
+	for (ULONG index = 0; index < BTHPS3_NAME_CACHE_SIZE; index++)
+	{
+		const PBTHPS3_NAME_CACHE_ENTRY pCurrent = &Header->NameCache.Entries[index];
+
+		if (pCurrent->RemoteAddress == RemoteAddress)
+		{
+			pEntry = pCurrent;
+			break;
+		}
+
+		if (pEntry == NULL || pCurrent->UpdatedAt < pEntry->UpdatedAt)
+		{
+			pEntry = pCurrent;
+		}
+	}
+
+	pEntry->RemoteAddress = RemoteAddress;
+	pEntry->UpdatedAt = KeQueryInterruptTime();
+	strcpy_s(pEntry->Name, BTH_MAX_NAME_SIZE, Name);
+
+	WdfWaitLockRelease(Header->NameCache.Lock);
+}
+
+//
+// Gets the remote name from cache or from the radio
+// 
+// Cached names older than BTHPS3_NAME_CACHE_REFRESH_MS are still returned
+// right away while a refresh gets queued.
+// 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+BthPS3_GetDeviceName(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	BTH_ADDR RemoteAddress,
+	PCHAR Name
+)
+{
+	NTSTATUS status = STATUS_NOT_FOUND;
+	BOOLEAN isStale = FALSE;
+	PBTH_DEVICE_INFO_LIST pDeviceInfoList = NULL;
+
+	FuncEntry(TRACE_BTH);
+
+	WdfWaitLockAcquire(Header->NameCache.Lock, NULL);
+
+	for (ULONG index = 0; index < BTHPS3_NAME_CACHE_SIZE; index++)
+	{
+		const PBTHPS3_NAME_CACHE_ENTRY pEntry = &Header->NameCache.Entries[index];
+
+		if (pEntry->RemoteAddress == RemoteAddress)
+		{
+			strcpy_s(Name, BTH_MAX_NAME_SIZE, pEntry->Name);
+
+			//
+			// Interrupt time is in 100ns units
+			// 
+			isStale = (KeQueryInterruptTime() - pEntry->UpdatedAt)
+				> BTHPS3_NAME_CACHE_REFRESH_MS * 10000ULL;
+			status = STATUS_SUCCESS;
+			break;
+		}
+	}
+
+	WdfWaitLockRelease(Header->NameCache.Lock);
+
+	if (NT_SUCCESS(status))
+	{
+		TraceVerbose(
+			TRACE_BTH,
+			"Name of %012llX served from cache (stale: %d)",
+			RemoteAddress,
+			isStale
+		);
+
+		if (isStale)
+		{
+			WdfWorkItemEnqueue(Header->NameCache.RefreshWorkItem);
+		}
+
+		FuncExit(TRACE_BTH, "status=%!STATUS!", status);
+
+		return status;
+	}
+
+	WdfWaitLockAcquire(Header->NameCache.FetchLock, NULL);
+
+	if (NT_SUCCESS(status = BthPS3_NameCacheFetchList(Header, &pDeviceInfoList)))
+	{
+		status = STATUS_NOT_FOUND;
+
+		for (ULONG index = 0; index < pDeviceInfoList->numOfDevices; index++)
+		{
+			const PBTH_DEVICE_INFO pDeviceInfo = &pDeviceInfoList->deviceList[index];
+
+			if (pDeviceInfo->address == RemoteAddress)
+			{
+				strcpy_s(Name, BTH_MAX_NAME_SIZE, pDeviceInfo->name);
+				status = STATUS_SUCCESS;
+				break;
+			}
+		}
+	}
+
+	WdfWaitLockRelease(Header->NameCache.FetchLock);
+
+	if (NT_SUCCESS(status))
+	{
+		BthPS3_NameCacheInsert(Header, RemoteAddress, Name);
+	}
+
+	FuncExit(TRACE_BTH, "status=%!STATUS!", status);
+
+	return status;
+}
+
+//
+// Updates all cached names from a single device info list fetch
+// 
+_Use_decl_annotations_
+VOID
+BthPS3_NameCacheEvtRefresh(
+	WDFWORKITEM WorkItem
+)
+{
+	NTSTATUS status;
+	const PBTHPS3_DEVICE_CONTEXT_HEADER header =
+		&GetServerDeviceContext(WdfWorkItemGetParentObject(WorkItem))->Header;
+	PBTH_DEVICE_INFO_LIST pDeviceInfoList = NULL;
+
+	FuncEntry(TRACE_BTH);
+
+	WdfWaitLockAcquire(header->NameCache.FetchLock, NULL);
+
+	if (NT_SUCCESS(status = BthPS3_NameCacheFetchList(header, &pDeviceInfoList)))
+	{
+		const ULONGLONG now = KeQueryInterruptTime();
+
+		WdfWaitLockAcquire(header->NameCache.Lock, NULL);
+
+		for (ULONG index = 0; index < pDeviceInfoList->numOfDevices; index++)
+		{
+			const PBTH_DEVICE_INFO pDeviceInfo = &pDeviceInfoList->deviceList[index];
+
+			for (ULONG entry = 0; entry < BTHPS3_NAME_CACHE_SIZE; entry++)
+			{
+				const PBTHPS3_NAME_CACHE_ENTRY pEntry = &header->NameCache.Entries[entry];
+
+				if (pEntry->RemoteAddress == pDeviceInfo->address)
+				{
+					strcpy_s(pEntry->Name, BTH_MAX_NAME_SIZE, pDeviceInfo->name);
+					pEntry->UpdatedAt = now;
+					break;
+				}
+			}
+		}
+
+		WdfWaitLockRelease(header->NameCache.Lock);
+	}
+	else
+	{
+		TraceError(
+			TRACE_BTH,
+			"BthPS3_NameCacheFetchList failed with status %!STATUS!",
+			status
+		);
+	}
+
+	WdfWaitLockRelease(header->NameCache.FetchLock);
+
+	FuncExit(TRACE_BTH, "status=%!STATUS!", status);
+}
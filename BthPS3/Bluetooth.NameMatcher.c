@@ -0,0 +1,808 @@
+#include "Driver.h"
+#include "Bluetooth.NameMatcher.tmh"
+
+
+#define BTHPS3_NAME_MATCHER_MIN_BUCKETS	16
+#define BTHPS3_NAME_DFA_MAX_STATES		1024
+#define BTHPS3_NAME_DFA_MAX_POSITIONS	4096
+#define BTHPS3_NAME_DFA_DEAD_STATE		0
+#define BTHPS3_NAME_DFA_START_STATE		1
+
+//
+// Case-folded wildcard pattern, index in the pattern array is its priority
+// 
+typedef struct _BTHPS3_NAME_PATTERN
+{
+	PCWCH Pattern;
+
+	USHORT Length;
+
+	DS_DEVICE_TYPE DeviceType;
+
+} BTHPS3_NAME_PATTERN, * PBTHPS3_NAME_PATTERN;
+
+typedef const BTHPS3_NAME_PATTERN* PCBTHPS3_NAME_PATTERN;
+
+//
+// Upper-cases Length characters of Source into Destination and returns their FNV-1a hash
+// 
+static ULONG
+BthPS3_NameMatcherFold(
+	_Out_writes_(Length) PWCH Destination,
+	_In_reads_(Length) PCWCH Source,
+	_In_ USHORT Length
+)
+{
+	ULONG hash = 2166136261UL;
+
+	for (USHORT i = 0; i < Length; i++)
+	{
+		Destination[i] = RtlUpcaseUnicodeChar(Source[i]);
+
+		hash ^= Destination[i];
+		hash *= 16777619UL;
+	}
+
+	return hash;
+}
+
+static BOOLEAN
+BthPS3_NameMatcherIsPattern(
+	_In_reads_(Length) PCWCH Name,
+	_In_ USHORT Length
+)
+{
+	for (USHORT i = 0; i < Length; i++)
+	{
+		if (Name[i] == L'*' || Name[i] == L'?')
+		{
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+//
+// Maps a case-folded character to its input class
+// 
+static ULONG
+BthPS3_NameDfaClassOf(
+	_In_ const BTHPS3_NAME_DFA* Dfa,
+	_In_ WCHAR Character
+)
+{
+	LONG low = 0;
+	LONG high = (LONG)Dfa->ClassCount - 2;
+
+	while (low <= high)
+	{
+		const LONG mid = (low + high) / 2;
+
+		if (Dfa->ClassChars[mid] == Character)
+		{
+			return (ULONG)mid + 1;
+		}
+
+		if (Dfa->ClassChars[mid] < Character)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid - 1;
+		}
+	}
+
+	return 0;
+}
+
+static ULONG
+BthPS3_NameDfaHashSet(
+	_In_reads_(Words) const UINT32* Set,
+	_In_ ULONG Words
+)
+{
+	ULONG hash = 2166136261UL;
+
+	for (ULONG word = 0; word < Words; word++)
+	{
+		hash ^= Set[word];
+		hash *= 16777619UL;
+	}
+
+	return hash;
+}
+
+//
+// Marks Position of Rule active, plus every position reachable by '*' matching nothing
+// 
+static VOID
+BthPS3_NameDfaAddClosure(
+	_Inout_ PUINT32 Set,
+	_In_ const BTHPS3_NAME_PATTERN* Rule,
+	_In_ ULONG Base,
+	_In_ USHORT Position
+)
+{
+	for (;;)
+	{
+		const ULONG position = Base + Position;
+
+		SetBit(Set, position);
+
+		if (Position < Rule->Length && Rule->Pattern[Position] == L'*')
+		{
+			Position++;
+			continue;
+		}
+
+		break;
+	}
+}
+
+//
+// Builds a DFA from glob patterns by subset construction
+// 
+// Each NFA position is a (pattern, offset) pair, offset == Length accepts. If a
+// state accepts several patterns, the one with the lowest index wins.
+// 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+static NTSTATUS
+BthPS3_NameDfaCompile(
+	_In_ WDFOBJECT Parent,
+	_In_reads_(PatternCount) const BTHPS3_NAME_PATTERN* Patterns,
+	_In_ ULONG PatternCount,
+	_Out_ PBTHPS3_NAME_DFA Dfa
+)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	WDF_OBJECT_ATTRIBUTES attributes;
+	WDFMEMORY scratchMemory = NULL;
+	WDFMEMORY scratchTransitionsMemory = NULL;
+	WDFMEMORY classCharsMemory = NULL;
+	WDFMEMORY transitionsMemory = NULL;
+	WDFMEMORY acceptMemory = NULL;
+	PUCHAR pScratch;
+	PUSHORT transitions;
+	ULONG positions = 0, literals = 0, classes, words, states;
+
+	RtlZeroMemory(Dfa, sizeof(*Dfa));
+
+	for (ULONG rule = 0; rule < PatternCount; rule++)
+	{
+		positions += Patterns[rule].Length + 1;
+		literals += Patterns[rule].Length;
+	}
+
+	if (positions > BTHPS3_NAME_DFA_MAX_POSITIONS)
+	{
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	words = (positions + 31) / 32;
+
+	//
+	// Scratch layout: rule base positions, class characters, state sets (plus
+	// one to build successors in), state set hashes and accepted types
+	// 
+	const size_t basesSize = PatternCount * sizeof(ULONG);
+	const size_t classCharsSize = (literals + 1) * sizeof(WCHAR);
+	const size_t setsSize = (size_t)(BTHPS3_NAME_DFA_MAX_STATES + 1) * words * sizeof(UINT32);
+	const size_t hashesSize = BTHPS3_NAME_DFA_MAX_STATES * sizeof(ULONG);
+	const size_t acceptSize = BTHPS3_NAME_DFA_MAX_STATES * sizeof(UCHAR);
+
+	do
+	{
+		if (!NT_SUCCESS(status = WdfMemoryCreate(
+			WDF_NO_OBJECT_ATTRIBUTES,
+			PagedPool,
+			POOLTAG_BTHPS3,
+			ALIGN_UP_BY(basesSize, sizeof(UINT32))
+			+ ALIGN_UP_BY(classCharsSize, sizeof(UINT32))
+			+ setsSize + hashesSize + acceptSize,
+			&scratchMemory,
+			(PVOID*)&pScratch
+		)))
+		{
+			break;
+		}
+
+		const PULONG bases = (PULONG)pScratch;
+		const PWCH classChars = (PWCH)(pScratch + ALIGN_UP_BY(basesSize, sizeof(UINT32)));
+		const PUINT32 sets = (PUINT32)((PUCHAR)classChars + ALIGN_UP_BY(classCharsSize, sizeof(UINT32)));
+		const PULONG hashes = (PULONG)((PUCHAR)sets + setsSize);
+		const PUCHAR accept = (PUCHAR)hashes + hashesSize;
+
+		//
+		// Sorted, unique literal characters become input classes 1..n
+		// 
+		ULONG classChar = 0;
+
+		for (ULONG rule = 0, base = 0; rule < PatternCount; base += Patterns[rule].Length + 1, rule++)
+		{
+			bases[rule] = base;
+
+			for (USHORT offset = 0; offset < Patterns[rule].Length; offset++)
+			{
+				const WCHAR c = Patterns[rule].Pattern[offset];
+				ULONG at = classChar;
+
+				if (c == L'*' || c == L'?')
+				{
+					continue;
+				}
+
+				while (at > 0 && classChars[at - 1] > c)
+				{
+					at--;
+				}
+
+				if (at > 0 && classChars[at - 1] == c)
+				{
+					continue;
+				}
+
+				RtlMoveMemory(&classChars[at + 1], &classChars[at], (classChar - at) * sizeof(WCHAR));
+				classChars[at] = c;
+				classChar++;
+			}
+		}
+
+		classes = classChar + 1;
+
+		if (!NT_SUCCESS(status = WdfMemoryCreate(
+			WDF_NO_OBJECT_ATTRIBUTES,
+			PagedPool,
+			POOLTAG_BTHPS3,
+			(size_t)BTHPS3_NAME_DFA_MAX_STATES * classes * sizeof(USHORT),
+			&scratchTransitionsMemory,
+			(PVOID*)&transitions
+		)))
+		{
+			break;
+		}
+
+		RtlZeroMemory(sets, (size_t)2 * words * sizeof(UINT32));
+
+		//
+		// State 0 has no active positions, state 1 starts every pattern
+		// 
+		for (ULONG rule = 0; rule < PatternCount; rule++)
+		{
+			BthPS3_NameDfaAddClosure(&sets[BTHPS3_NAME_DFA_START_STATE * words], &Patterns[rule], bases[rule], 0);
+		}
+
+		hashes[BTHPS3_NAME_DFA_DEAD_STATE] = 0;
+		hashes[BTHPS3_NAME_DFA_START_STATE] = BthPS3_NameDfaHashSet(&sets[BTHPS3_NAME_DFA_START_STATE * words], words);
+		states = 2;
+
+		for (ULONG state = BTHPS3_NAME_DFA_START_STATE; state < states && NT_SUCCESS(status); state++)
+		{
+			for (ULONG inputClass = 0; inputClass < classes; inputClass++)
+			{
+				//
+				// Build successor in the next free slot, keep it only if new
+				// 
+				const PUINT32 next = &sets[states * words];
+				BOOLEAN isEmpty = TRUE;
+				ULONG rule = 0;
+
+				RtlZeroMemory(next, words * sizeof(UINT32));
+
+				for (ULONG word = 0; word < words; word++)
+				{
+					UINT32 bits = sets[state * words + word];
+					ULONG bit;
+
+					while (_BitScanForward(&bit, bits))
+					{
+						const ULONG position = word * 32 + bit;
+
+						bits &= bits - 1;
+
+						while (rule + 1 < PatternCount && bases[rule + 1] <= position)
+						{
+							rule++;
+						}
+
+						const PCBTHPS3_NAME_PATTERN pRule = &Patterns[rule];
+						const USHORT offset = (USHORT)(position - bases[rule]);
+
+						if (offset == pRule->Length)
+						{
+							continue;
+						}
+
+						const WCHAR c = pRule->Pattern[offset];
+
+						if (c == L'*')
+						{
+							BthPS3_NameDfaAddClosure(next, pRule, bases[rule], offset);
+						}
+						else if (c == L'?'
+							|| (inputClass != 0 && classChars[inputClass - 1] == c))
+						{
+							BthPS3_NameDfaAddClosure(next, pRule, bases[rule], offset + 1);
+						}
+					}
+				}
+
+				for (ULONG word = 0; word < words; word++)
+				{
+					if (next[word] != 0)
+					{
+						isEmpty = FALSE;
+						break;
+					}
+				}
+
+				const ULONG hash = BthPS3_NameDfaHashSet(next, words);
+
+				ULONG target = BTHPS3_NAME_DFA_DEAD_STATE;
+
+				if (!isEmpty)
+				{
+					for (target = BTHPS3_NAME_DFA_START_STATE; target < states; target++)
+					{
+						if (hashes[target] == hash
+							&& RtlEqualMemory(&sets[target * words], next, words * sizeof(UINT32)))
+						{
+							break;
+						}
+					}
+
+					if (target == states)
+					{
+						if (states == BTHPS3_NAME_DFA_MAX_STATES)
+						{
+							status = STATUS_INSUFFICIENT_RESOURCES;
+							break;
+						}
+
+						hashes[states++] = hash;
+					}
+				}
+
+				transitions[state * classes + inputClass] = (USHORT)target;
+			}
+		}
+
+		if (!NT_SUCCESS(status))
+		{
+			break;
+		}
+
+		RtlZeroMemory(transitions, classes * sizeof(USHORT));
+
+		for (ULONG state = 0; state < states; state++)
+		{
+			accept[state] = DS_DEVICE_TYPE_UNKNOWN;
+
+			for (ULONG rule = 0; rule < PatternCount; rule++)
+			{
+				const PUINT32 set = &sets[state * words];
+				const ULONG position = bases[rule] + Patterns[rule].Length;
+
+				if (TestBit(set, position))
+				{
+					accept[state] = (UCHAR)Patterns[rule].DeviceType;
+					break;
+				}
+			}
+		}
+
+		//
+		// Keep only what matching needs
+		// 
+		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+		attributes.ParentObject = Parent;
+
+		if (!NT_SUCCESS(status = WdfMemoryCreate(
+			&attributes,
+			PagedPool,
+			POOLTAG_BTHPS3,
+			classes * sizeof(WCHAR),
+			&classCharsMemory,
+			(PVOID*)&Dfa->ClassChars
+		)))
+		{
+			break;
+		}
+
+		if (!NT_SUCCESS(status = WdfMemoryCreate(
+			&attributes,
+			PagedPool,
+			POOLTAG_BTHPS3,
+			(size_t)states * classes * sizeof(USHORT),
+			&transitionsMemory,
+			(PVOID*)&Dfa->Transitions
+		)))
+		{
+			break;
+		}
+
+		if (!NT_SUCCESS(status = WdfMemoryCreate(
+			&attributes,
+			PagedPool,
+			POOLTAG_BTHPS3,
+			states * sizeof(UCHAR),
+			&acceptMemory,
+			(PVOID*)&Dfa->Accept
+		)))
+		{
+			break;
+		}
+
+		RtlCopyMemory(Dfa->ClassChars, classChars, classChar * sizeof(WCHAR));
+		RtlCopyMemory(Dfa->Transitions, transitions, (size_t)states * classes * sizeof(USHORT));
+		RtlCopyMemory(Dfa->Accept, accept, states * sizeof(UCHAR));
+
+		Dfa->ClassCount = classes;
+		Dfa->StateCount = states;
+
+	} while (FALSE);
+
+	if (!NT_SUCCESS(status))
+	{
+		RtlZeroMemory(Dfa, sizeof(*Dfa));
+
+		if (classCharsMemory)
+		{
+			WdfObjectDelete(classCharsMemory);
+		}
+
+		if (transitionsMemory)
+		{
+			WdfObjectDelete(transitionsMemory);
+		}
+
+		if (acceptMemory)
+		{
+			WdfObjectDelete(acceptMemory);
+		}
+	}
+
+	if (scratchTransitionsMemory)
+	{
+		WdfObjectDelete(scratchTransitionsMemory);
+	}
+
+	if (scratchMemory)
+	{
+		WdfObjectDelete(scratchMemory);
+	}
+
+	return status;
+}
+
+//
+// Builds a single hash set from the supported names of all enabled device types
+// 
+// Names containing '*' (any run of characters) or '?' (any single character)
+// are compiled into a DFA instead. Exact names take precedence over patterns.
+// Entries listed for more than one type resolve to the first one in
+// SIXAXIS, NAVIGATION, MOTION, WIRELESS order, like the former sequential checks;
+// within a list, earlier patterns win.
+// 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+BthPS3_NameMatcherCompile(
+	PBTHPS3_SETTINGS Settings
+)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	WDF_OBJECT_ATTRIBUTES attributes;
+	WDFMEMORY bucketsMemory = NULL;
+	WDFMEMORY namesMemory = NULL;
+	WDFMEMORY patternsMemory = NULL;
+	PWCH pNames = NULL;
+	PBTHPS3_NAME_PATTERN pPatterns = NULL;
+	ULONG count = 0, characters = 0, patterns = 0, buckets = BTHPS3_NAME_MATCHER_MIN_BUCKETS;
+	const PBTHPS3_NAME_MATCHER matcher = &Settings->NameMatcher;
+
+	const struct
+	{
+		ULONG IsSupported;
+
+		WDFCOLLECTION Names;
+
+		DS_DEVICE_TYPE DeviceType;
+
+	} sources[] =
+	{
+		{ Settings->IsSIXAXISSupported, Settings->SIXAXISSupportedNames, DS_DEVICE_TYPE_SIXAXIS },
+		{ Settings->IsNAVIGATIONSupported, Settings->NAVIGATIONSupportedNames, DS_DEVICE_TYPE_NAVIGATION },
+		{ Settings->IsMOTIONSupported, Settings->MOTIONSupportedNames, DS_DEVICE_TYPE_MOTION },
+		{ Settings->IsWIRELESSSupported, Settings->WIRELESSSupportedNames, DS_DEVICE_TYPE_WIRELESS },
+	};
+
+	FuncEntry(TRACE_BTH);
+
+	RtlZeroMemory(matcher, sizeof(*matcher));
+
+	for (ULONG source = 0; source < ARRAYSIZE(sources); source++)
+	{
+		if (!sources[source].IsSupported)
+		{
+			continue;
+		}
+
+		for (ULONG index = 0; index < WdfCollectionGetCount(sources[source].Names); index++)
+		{
+			UNICODE_STRING name;
+
+			WdfStringGetUnicodeString(WdfCollectionGetItem(sources[source].Names, index), &name);
+
+			if (BthPS3_NameMatcherIsPattern(name.Buffer, name.Length / sizeof(WCHAR)))
+			{
+				patterns++;
+			}
+			else
+			{
+				count++;
+			}
+
+			characters += name.Length / sizeof(WCHAR);
+		}
+	}
+
+	do
+	{
+		if (count + patterns == 0)
+		{
+			break;
+		}
+
+		//
+		// Keeps load below 50%
+		// 
+		while (buckets < count * 2)
+		{
+			buckets <<= 1;
+		}
+
+		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+		attributes.ParentObject = WdfObjectContextGetObject(Settings);
+
+		if (!NT_SUCCESS(status = WdfMemoryCreate(
+			&attributes,
+			PagedPool,
+			POOLTAG_BTHPS3,
+			buckets * sizeof(BTHPS3_NAME_MATCHER_ENTRY),
+			&bucketsMemory,
+			(PVOID*)&matcher->Buckets
+		)))
+		{
+			TraceError(
+				TRACE_BTH,
+				"WdfMemoryCreate failed with status %!STATUS!",
+				status
+			);
+			break;
+		}
+
+		RtlZeroMemory(matcher->Buckets, buckets * sizeof(BTHPS3_NAME_MATCHER_ENTRY));
+		matcher->BucketMask = buckets - 1;
+
+		if (characters > 0 && !NT_SUCCESS(status = WdfMemoryCreate(
+			&attributes,
+			PagedPool,
+			POOLTAG_BTHPS3,
+			characters * sizeof(WCHAR),
+			&namesMemory,
+			(PVOID*)&pNames
+		)))
+		{
+			TraceError(
+				TRACE_BTH,
+				"WdfMemoryCreate failed with status %!STATUS!",
+				status
+			);
+			break;
+		}
+
+		if (patterns > 0 && !NT_SUCCESS(status = WdfMemoryCreate(
+			WDF_NO_OBJECT_ATTRIBUTES,
+			PagedPool,
+			POOLTAG_BTHPS3,
+			patterns * sizeof(BTHPS3_NAME_PATTERN),
+			&patternsMemory,
+			(PVOID*)&pPatterns
+		)))
+		{
+			TraceError(
+				TRACE_BTH,
+				"WdfMemoryCreate failed with status %!STATUS!",
+				status
+			);
+			break;
+		}
+
+		patterns = 0;
+
+		for (ULONG source = 0; source < ARRAYSIZE(sources); source++)
+		{
+			if (!sources[source].IsSupported)
+			{
+				continue;
+			}
+
+			for (ULONG index = 0; index < WdfCollectionGetCount(sources[source].Names); index++)
+			{
+				UNICODE_STRING name;
+
+				WdfStringGetUnicodeString(WdfCollectionGetItem(sources[source].Names, index), &name);
+
+				const USHORT length = name.Length / sizeof(WCHAR);
+
+				if (length == 0)
+				{
+					continue;
+				}
+
+				const ULONG hash = BthPS3_NameMatcherFold(pNames, name.Buffer, length);
+
+				if (BthPS3_NameMatcherIsPattern(pNames, length))
+				{
+					pPatterns[patterns].Pattern = pNames;
+					pPatterns[patterns].Length = length;
+					pPatterns[patterns].DeviceType = sources[source].DeviceType;
+					patterns++;
+
+					pNames += length;
+					continue;
+				}
+
+				ULONG bucket = hash & matcher->BucketMask;
+				BOOLEAN isDuplicate = FALSE;
+
+				for (; matcher->Buckets[bucket].Length != 0; bucket = (bucket + 1) & matcher->BucketMask)
+				{
+					const PBTHPS3_NAME_MATCHER_ENTRY pEntry = &matcher->Buckets[bucket];
+
+					if (pEntry->Hash == hash && pEntry->Length == length
+						&& RtlEqualMemory(pEntry->Name, pNames, length * sizeof(WCHAR)))
+					{
+						isDuplicate = TRUE;
+						break;
+					}
+				}
+
+				if (isDuplicate)
+				{
+					continue;
+				}
+
+				matcher->Buckets[bucket].Hash = hash;
+				matcher->Buckets[bucket].Length = length;
+				matcher->Buckets[bucket].DeviceType = sources[source].DeviceType;
+				matcher->Buckets[bucket].Name = pNames;
+				matcher->Count++;
+
+				pNames += length;
+			}
+		}
+
+		//
+		// Broken patterns must not prevent exact names from working
+		// 
+		if (patterns > 0)
+		{
+			const NTSTATUS dfaStatus = BthPS3_NameDfaCompile(
+				attributes.ParentObject,
+				pPatterns,
+				patterns,
+				&matcher->Patterns
+			);
+
+			if (!NT_SUCCESS(dfaStatus))
+			{
+				TraceError(
+					TRACE_BTH,
+					"BthPS3_NameDfaCompile failed with status %!STATUS!, ignoring %d pattern(s)",
+					dfaStatus,
+					patterns
+				);
+			}
+		}
+
+		TraceVerbose(
+			TRACE_BTH,
+			"Compiled %d supported name(s) into %d buckets, %d pattern(s) into %d states",
+			matcher->Count,
+			buckets,
+			patterns,
+			matcher->Patterns.StateCount
+		);
+
+	} while (FALSE);
+
+	if (patternsMemory)
+	{
+		WdfObjectDelete(patternsMemory);
+	}
+
+	if (!NT_SUCCESS(status))
+	{
+		RtlZeroMemory(matcher, sizeof(*matcher));
+
+		if (bucketsMemory)
+		{
+			WdfObjectDelete(bucketsMemory);
+		}
+
+		if (namesMemory)
+		{
+			WdfObjectDelete(namesMemory);
+		}
+	}
+
+	FuncExit(TRACE_BTH, "status=%!STATUS!", status);
+
+	return status;
+}
+
+//
+// Identifies the device type by its remote name, case-insensitive
+// 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+DS_DEVICE_TYPE
+BthPS3_NameMatcherLookup(
+	const BTHPS3_SETTINGS* Settings,
+	PCSTR RemoteName
+)
+{
+	const BTHPS3_NAME_MATCHER* matcher = &Settings->NameMatcher;
+	const BTHPS3_NAME_DFA* dfa = &matcher->Patterns;
+	DECLARE_UNICODE_STRING_SIZE(name, BTH_MAX_NAME_SIZE);
+
+	if (matcher->Count == 0 && dfa->StateCount == 0)
+	{
+		return DS_DEVICE_TYPE_UNKNOWN;
+	}
+
+	if (!NT_SUCCESS(RtlUnicodeStringPrintf(&name, L"%hs", RemoteName)))
+	{
+		return DS_DEVICE_TYPE_UNKNOWN;
+	}
+
+	const USHORT length = name.Length / sizeof(WCHAR);
+
+	if (length == 0)
+	{
+		return DS_DEVICE_TYPE_UNKNOWN;
+	}
+
+	const ULONG hash = BthPS3_NameMatcherFold(name.Buffer, name.Buffer, length);
+
+	for (ULONG bucket = hash & matcher->BucketMask;
+		matcher->Count > 0 && matcher->Buckets[bucket].Length != 0;
+		bucket = (bucket + 1) & matcher->BucketMask)
+	{
+		const BTHPS3_NAME_MATCHER_ENTRY* pEntry = &matcher->Buckets[bucket];
+
+		if (pEntry->Hash == hash && pEntry->Length == length
+			&& RtlEqualMemory(pEntry->Name, name.Buffer, length * sizeof(WCHAR)))
+		{
+			return pEntry->DeviceType;
+		}
+	}
+
+	if (dfa->StateCount == 0)
+	{
+		return DS_DEVICE_TYPE_UNKNOWN;
+	}
+
+	//
+	// One transition per character, independent of the number of patterns
+	// 
+	ULONG state = BTHPS3_NAME_DFA_START_STATE;
+
+	for (USHORT i = 0; i < length && state != BTHPS3_NAME_DFA_DEAD_STATE; i++)
+	{
+		state = dfa->Transitions[state * dfa->ClassCount + BthPS3_NameDfaClassOf(dfa, name.Buffer[i])];
+	}
+
+	return (DS_DEVICE_TYPE)dfa->Accept[state];
+}
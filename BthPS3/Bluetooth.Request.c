@@ -97,6 +97,32 @@ BthPS3_SendBrbAsync(
 	_In_ PFN_WDF_REQUEST_COMPLETION_ROUTINE ComplRoutine,
 	_In_opt_ WDFCONTEXT Context
 )
+{
+	return BthPS3_SendBrbAsyncEx(
+		IoTarget,
+		Request,
+		Brb,
+		BrbSize,
+		ComplRoutine,
+		Context,
+		NULL
+	);
+}
+
+//
+// Same as BthPS3_SendBrbAsync with optional send options (e.g. a timeout)
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS
+BthPS3_SendBrbAsyncEx(
+	_In_ WDFIOTARGET IoTarget,
+	_In_ WDFREQUEST Request,
+	_In_ PBRB Brb,
+	_In_ size_t BrbSize,
+	_In_ PFN_WDF_REQUEST_COMPLETION_ROUTINE ComplRoutine,
+	_In_opt_ WDFCONTEXT Context,
+	_In_opt_ PWDF_REQUEST_SEND_OPTIONS Options
+)
 {
 	NTSTATUS status = BTH_ERROR_SUCCESS;
 	WDF_OBJECT_ATTRIBUTES attributes;
@@ -171,7 +197,7 @@ BthPS3_SendBrbAsync(
 	if (FALSE == WdfRequestSend(
 		Request,
 		IoTarget,
-		NULL
+		Options
 	))
 	{
 		status = WdfRequestGetStatus(Request);
@@ -0,0 +1,659 @@
+#include "Driver.h"
+#include "Bluetooth.Settings.tmh"
+
+
+static WORKER_THREAD_ROUTINE BthPS3_SettingsEvtRegistryChanged;
+static EVT_WDF_WORKITEM BthPS3_SettingsEvtRelease;
+
+//
+// Registry values of the channel profile of each device type
+// 
+static const struct
+{
+	DS_DEVICE_TYPE DeviceType;
+
+	PCWSTR Mtu;
+
+	PCWSTR FlushTimeout;
+
+	PCWSTR LinkTimeout;
+
+	PCWSTR IncomingQueueDepth;
+
+} G_ChannelProfileValues[] =
+{
+	{
+		DS_DEVICE_TYPE_SIXAXIS,
+		BTHPS3_REG_VALUE_SIXAXIS_CHANNEL_MTU,
+		BTHPS3_REG_VALUE_SIXAXIS_FLUSH_TIMEOUT,
+		BTHPS3_REG_VALUE_SIXAXIS_LINK_TIMEOUT,
+		BTHPS3_REG_VALUE_SIXAXIS_INCOMING_QUEUE_DEPTH
+	},
+	{
+		DS_DEVICE_TYPE_NAVIGATION,
+		BTHPS3_REG_VALUE_NAVIGATION_CHANNEL_MTU,
+		BTHPS3_REG_VALUE_NAVIGATION_FLUSH_TIMEOUT,
+		BTHPS3_REG_VALUE_NAVIGATION_LINK_TIMEOUT,
+		BTHPS3_REG_VALUE_NAVIGATION_INCOMING_QUEUE_DEPTH
+	},
+	{
+		DS_DEVICE_TYPE_MOTION,
+		BTHPS3_REG_VALUE_MOTION_CHANNEL_MTU,
+		BTHPS3_REG_VALUE_MOTION_FLUSH_TIMEOUT,
+		BTHPS3_REG_VALUE_MOTION_LINK_TIMEOUT,
+		BTHPS3_REG_VALUE_MOTION_INCOMING_QUEUE_DEPTH
+	},
+	{
+		DS_DEVICE_TYPE_WIRELESS,
+		BTHPS3_REG_VALUE_WIRELESS_CHANNEL_MTU,
+		BTHPS3_REG_VALUE_WIRELESS_FLUSH_TIMEOUT,
+		BTHPS3_REG_VALUE_WIRELESS_LINK_TIMEOUT,
+		BTHPS3_REG_VALUE_WIRELESS_INCOMING_QUEUE_DEPTH
+	},
+};
+
+//
+// Reads the channel profile values of all device types, keeping defaults for missing ones
+// 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+static VOID
+BthPS3_SettingsReadChannelProfiles(
+	WDFKEY Key,
+	PBTHPS3_SETTINGS Settings
+)
+{
+	UNICODE_STRING valueName;
+	ULONG value;
+
+	for (ULONG index = 0; index < ARRAYSIZE(G_ChannelProfileValues); index++)
+	{
+		const PBTHPS3_CHANNEL_PROFILE profile = &Settings->ChannelProfiles[G_ChannelProfileValues[index].DeviceType];
+
+		RtlInitUnicodeString(&valueName, G_ChannelProfileValues[index].Mtu);
+		if (NT_SUCCESS(WdfRegistryQueryULong(Key, &valueName, &value)))
+		{
+			profile->Mtu = (USHORT)max(min(value, L2CAP_MAX_MTU), L2CAP_MIN_MTU);
+		}
+
+		RtlInitUnicodeString(&valueName, G_ChannelProfileValues[index].FlushTimeout);
+		if (NT_SUCCESS(WdfRegistryQueryULong(Key, &valueName, &value)))
+		{
+			profile->FlushTimeout = (USHORT)max(min(value, L2CAP_DEFAULT_FLUSHTO), L2CAP_MIN_FLUSHTO);
+		}
+
+		RtlInitUnicodeString(&valueName, G_ChannelProfileValues[index].LinkTimeout);
+		if (NT_SUCCESS(WdfRegistryQueryULong(Key, &valueName, &value)))
+		{
+			profile->LinkTimeout = (USHORT)min(value, MAXUSHORT);
+		}
+
+		RtlInitUnicodeString(&valueName, G_ChannelProfileValues[index].IncomingQueueDepth);
+		if (NT_SUCCESS(WdfRegistryQueryULong(Key, &valueName, &value)))
+		{
+			//
+			// At least one packet must fit or nothing gets delivered
+			// 
+			profile->IncomingQueueDepth = max(value, 1);
+		}
+
+		TraceVerbose(
+			TRACE_BTH,
+			"Channel profile for device type %d: MTU %d, flush timeout %d, link timeout %d, queue depth %d",
+			G_ChannelProfileValues[index].DeviceType,
+			profile->Mtu,
+			profile->FlushTimeout,
+			profile->LinkTimeout,
+			profile->IncomingQueueDepth
+		);
+	}
+}
+
+//
+// Reads runtime properties from registry into a new snapshot and makes it current
+// 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+BthPS3_SettingsContextInit(
+	PBTHPS3_SERVER_CONTEXT Context
+)
+{
+	NTSTATUS status;
+	WDFKEY hKey = NULL;
+	WDF_OBJECT_ATTRIBUTES attributes;
+	WDFOBJECT snapshot = NULL;
+	PBTHPS3_SETTINGS pSettings = NULL;
+	PBTHPS3_SETTINGS pPrevious = NULL;
+
+	FuncEntry(TRACE_BTH);
+
+	DECLARE_CONST_UNICODE_STRING(autoEnableFilter, BTHPS3_REG_VALUE_AUTO_ENABLE_FILTER);
+	DECLARE_CONST_UNICODE_STRING(autoDisableFilter, BTHPS3_REG_VALUE_AUTO_DISABLE_FILTER);
+	DECLARE_CONST_UNICODE_STRING(autoEnableFilterDelay, BTHPS3_REG_VALUE_AUTO_ENABLE_FILTER_DELAY);
+
+	DECLARE_CONST_UNICODE_STRING(isSIXAXISSupported, BTHPS3_REG_VALUE_IS_SIXAXIS_SUPPORTED);
+	DECLARE_CONST_UNICODE_STRING(isNAVIGATIONSupported, BTHPS3_REG_VALUE_IS_NAVIGATION_SUPPORTED);
+	DECLARE_CONST_UNICODE_STRING(isMOTIONSupported, BTHPS3_REG_VALUE_IS_MOTION_SUPPORTED);
+	DECLARE_CONST_UNICODE_STRING(isWIRELESSSupported, BTHPS3_REG_VALUE_IS_WIRELESS_SUPPORTED);
+
+	DECLARE_CONST_UNICODE_STRING(SIXAXISSupportedNames, BTHPS3_REG_VALUE_SIXAXIS_SUPPORTED_NAMES);
+	DECLARE_CONST_UNICODE_STRING(NAVIGATIONSupportedNames, BTHPS3_REG_VALUE_NAVIGATION_SUPPORTED_NAMES);
+	DECLARE_CONST_UNICODE_STRING(MOTIONSupportedNames, BTHPS3_REG_VALUE_MOTION_SUPPORTED_NAMES);
+	DECLARE_CONST_UNICODE_STRING(WIRELESSSupportedNames, BTHPS3_REG_VALUE_WIRELESS_SUPPORTED_NAMES);
+
+	DECLARE_CONST_UNICODE_STRING(rawPdo, BTHPS3_REG_VALUE_RAW_PDO);
+	DECLARE_CONST_UNICODE_STRING(hidePdo, BTHPS3_REG_VALUE_HIDE_PDO);
+	DECLARE_CONST_UNICODE_STRING(adminOnlyPdo, BTHPS3_REG_VALUE_ADMIN_ONLY_PDO);
+	DECLARE_CONST_UNICODE_STRING(exclusivePdo, BTHPS3_REG_VALUE_EXCLUSIVE_PDO);
+	DECLARE_CONST_UNICODE_STRING(childIdleTimeout, BTHPS3_REG_VALUE_CHILD_IDLE_TIMEOUT);
+	DECLARE_CONST_UNICODE_STRING(suppressDuplicateReports, BTHPS3_REG_VALUE_SUPPRESS_DUPLICATE_REPORTS);
+	DECLARE_CONST_UNICODE_STRING(duplicateReportHoldTime, BTHPS3_REG_VALUE_DUPLICATE_REPORT_HOLD_TIME);
+	DECLARE_CONST_UNICODE_STRING(childLingerTimeout, BTHPS3_REG_VALUE_CHILD_LINGER_TIMEOUT);
+	DECLARE_CONST_UNICODE_STRING(requestLowLatencyQos, BTHPS3_REG_VALUE_REQUEST_LOW_LATENCY_QOS);
+	DECLARE_CONST_UNICODE_STRING(denyCacheTimeout, BTHPS3_REG_VALUE_DENY_CACHE_TIMEOUT);
+
+	do
+	{
+		//
+		// Created with the first snapshot, lives as long as the device
+		// 
+		if (Context->Settings.ReleaseWorkItem == NULL)
+		{
+			WDF_WORKITEM_CONFIG workItemCfg;
+
+			WDF_WORKITEM_CONFIG_INIT(&workItemCfg, BthPS3_SettingsEvtRelease);
+			WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+			attributes.ParentObject = Context->Header.Device;
+
+			if (!NT_SUCCESS(status = WdfWorkItemCreate(
+				&workItemCfg,
+				&attributes,
+				&Context->Settings.ReleaseWorkItem
+			)))
+			{
+				TraceError(
+					TRACE_BTH,
+					"WdfWorkItemCreate failed with status %!STATUS!",
+					status
+				);
+				break;
+			}
+		}
+
+		WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, BTHPS3_SETTINGS);
+		attributes.ParentObject = Context->Header.Device;
+
+		if (!NT_SUCCESS(status = WdfObjectCreate(
+			&attributes,
+			&snapshot
+		)))
+		{
+			TraceError(
+				TRACE_BTH,
+				"WdfObjectCreate failed with status %!STATUS!",
+				status
+			);
+			break;
+		}
+
+		pSettings = GetSettings(snapshot);
+
+		//
+		// Reference owned by Context->Settings.Current
+		// 
+		pSettings->RefCount = 1;
+		pSettings->Owner = Context;
+
+		//
+		// Set default values
+		// 
+		pSettings->AutoEnableFilter = TRUE;
+		pSettings->AutoDisableFilter = TRUE;
+		pSettings->AutoEnableFilterDelay = 10; // Seconds
+
+		pSettings->IsSIXAXISSupported = TRUE;
+		pSettings->IsNAVIGATIONSupported = TRUE;
+		pSettings->IsMOTIONSupported = TRUE;
+		pSettings->IsWIRELESSSupported = TRUE;
+
+		pSettings->ExclusivePDO = TRUE;
+		pSettings->ChildIdleTimeout = 10000; // 10 secs idle timeout
+		pSettings->DuplicateReportHoldTime = 100;
+		pSettings->DenyCacheTimeout = 300; // Seconds
+
+		for (ULONG type = 0; type < ARRAYSIZE(pSettings->ChannelProfiles); type++)
+		{
+			pSettings->ChannelProfiles[type].Mtu = L2CAP_MAX_MTU;
+			pSettings->ChannelProfiles[type].FlushTimeout = L2CAP_DEFAULT_FLUSHTO;
+			pSettings->ChannelProfiles[type].LinkTimeout = 0;
+			pSettings->ChannelProfiles[type].IncomingQueueDepth = 10;
+		}
+
+		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+		attributes.ParentObject = snapshot;
+
+		if (!NT_SUCCESS(status = WdfCollectionCreate(
+			&attributes,
+			&pSettings->SIXAXISSupportedNames
+		)))
+		{
+			break;
+		}
+
+		if (!NT_SUCCESS(status = WdfCollectionCreate(
+			&attributes,
+			&pSettings->NAVIGATIONSupportedNames
+		)))
+		{
+			break;
+		}
+
+		if (!NT_SUCCESS(status = WdfCollectionCreate(
+			&attributes,
+			&pSettings->MOTIONSupportedNames
+		)))
+		{
+			break;
+		}
+
+		if (!NT_SUCCESS(status = WdfCollectionCreate(
+			&attributes,
+			&pSettings->WIRELESSSupportedNames
+		)))
+		{
+			break;
+		}
+
+		//
+		// Open
+		//   HKEY_LOCAL_MACHINE\SYSTEM\CurrentControlSet\Services\BthPS3\Parameters
+		// key
+		// 
+		if (!NT_SUCCESS(status = WdfDriverOpenParametersRegistryKey(
+			WdfGetDriver(),
+			STANDARD_RIGHTS_READ,
+			WDF_NO_OBJECT_ATTRIBUTES,
+			&hKey
+		)))
+		{
+			TraceError(
+				TRACE_BTH,
+				"WdfDriverOpenParametersRegistryKey failed with status %!STATUS!, using defaults",
+				status
+			);
+
+			status = STATUS_SUCCESS;
+		}
+		else
+		{
+			//
+			// Don't care, if it fails, keep default value
+			// 
+			(void)WdfRegistryQueryULong(hKey, &autoEnableFilter, &pSettings->AutoEnableFilter);
+			(void)WdfRegistryQueryULong(hKey, &autoDisableFilter, &pSettings->AutoDisableFilter);
+			(void)WdfRegistryQueryULong(hKey, &autoEnableFilterDelay, &pSettings->AutoEnableFilterDelay);
+
+			(void)WdfRegistryQueryULong(hKey, &isSIXAXISSupported, &pSettings->IsSIXAXISSupported);
+			(void)WdfRegistryQueryULong(hKey, &isNAVIGATIONSupported, &pSettings->IsNAVIGATIONSupported);
+			(void)WdfRegistryQueryULong(hKey, &isMOTIONSupported, &pSettings->IsMOTIONSupported);
+			(void)WdfRegistryQueryULong(hKey, &isWIRELESSSupported, &pSettings->IsWIRELESSSupported);
+
+			(void)WdfRegistryQueryULong(hKey, &rawPdo, &pSettings->RawPDO);
+			(void)WdfRegistryQueryULong(hKey, &hidePdo, &pSettings->HidePDO);
+			(void)WdfRegistryQueryULong(hKey, &adminOnlyPdo, &pSettings->AdminOnlyPDO);
+			(void)WdfRegistryQueryULong(hKey, &exclusivePdo, &pSettings->ExclusivePDO);
+			(void)WdfRegistryQueryULong(hKey, &childIdleTimeout, &pSettings->ChildIdleTimeout);
+			(void)WdfRegistryQueryULong(hKey, &suppressDuplicateReports, &pSettings->SuppressDuplicateReports);
+			(void)WdfRegistryQueryULong(hKey, &duplicateReportHoldTime, &pSettings->DuplicateReportHoldTime);
+			(void)WdfRegistryQueryULong(hKey, &childLingerTimeout, &pSettings->ChildLingerTimeout);
+			(void)WdfRegistryQueryULong(hKey, &requestLowLatencyQos, &pSettings->RequestLowLatencyQos);
+			(void)WdfRegistryQueryULong(hKey, &denyCacheTimeout, &pSettings->DenyCacheTimeout);
+
+			BthPS3_SettingsReadChannelProfiles(hKey, pSettings);
+
+			WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+			attributes.ParentObject = pSettings->SIXAXISSupportedNames;
+			(void)WdfRegistryQueryMultiString(
+				hKey,
+				&SIXAXISSupportedNames,
+				&attributes,
+				pSettings->SIXAXISSupportedNames
+			);
+
+			WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+			attributes.ParentObject = pSettings->NAVIGATIONSupportedNames;
+			(void)WdfRegistryQueryMultiString(
+				hKey,
+				&NAVIGATIONSupportedNames,
+				&attributes,
+				pSettings->NAVIGATIONSupportedNames
+			);
+
+			WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+			attributes.ParentObject = pSettings->MOTIONSupportedNames;
+			(void)WdfRegistryQueryMultiString(
+				hKey,
+				&MOTIONSupportedNames,
+				&attributes,
+				pSettings->MOTIONSupportedNames
+			);
+
+			WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+			attributes.ParentObject = pSettings->WIRELESSSupportedNames;
+			(void)WdfRegistryQueryMultiString(
+				hKey,
+				&WIRELESSSupportedNames,
+				&attributes,
+				pSettings->WIRELESSSupportedNames
+			);
+		}
+
+		if (!NT_SUCCESS(status = BthPS3_NameMatcherCompile(pSettings)))
+		{
+			break;
+		}
+
+		pSettings->Version = (ULONG)InterlockedIncrement(&Context->Settings.Version);
+
+		//
+		// Swap, readers holding the previous snapshot keep it alive
+		// 
+		const KIRQL irql = ExAcquireSpinLockExclusive(&Context->Settings.Lock);
+		pPrevious = Context->Settings.Current;
+		Context->Settings.Current = pSettings;
+		ExReleaseSpinLockExclusive(&Context->Settings.Lock, irql);
+
+		snapshot = NULL;
+
+		if (pPrevious)
+		{
+			BthPS3_SettingsRelease(pPrevious);
+		}
+
+		//
+		// Supported devices may have changed, identify denied ones again
+		// 
+		BthPS3_DenyCacheClear(&Context->Header);
+
+		TraceVerbose(
+			TRACE_BTH,
+			"Settings snapshot version %d active",
+			pSettings->Version
+		);
+
+	} while (FALSE);
+
+	if (hKey)
+	{
+		WdfRegistryClose(hKey);
+	}
+
+	if (snapshot)
+	{
+		WdfObjectDelete(snapshot);
+	}
+
+	FuncExit(TRACE_BTH, "status=%!STATUS!", status);
+
+	return status;
+}
+
+//
+// Returns a reference to the current settings snapshot
+// 
+// The snapshot must be treated as read-only and released with BthPS3_SettingsRelease
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+PBTHPS3_SETTINGS
+BthPS3_SettingsAcquire(
+	PBTHPS3_SERVER_CONTEXT Context
+)
+{
+	const KIRQL irql = ExAcquireSpinLockShared(&Context->Settings.Lock);
+
+	const PBTHPS3_SETTINGS pSettings = Context->Settings.Current;
+
+	InterlockedIncrement(&pSettings->RefCount);
+
+	ExReleaseSpinLockShared(&Context->Settings.Lock, irql);
+
+	return pSettings;
+}
+
+//
+// Drops a reference obtained by BthPS3_SettingsAcquire
+// 
+// The snapshot owns pageable memory (names, compiled matcher), if the last
+// reference goes away above PASSIVE_LEVEL the deletion is left to a work item.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthPS3_SettingsRelease(
+	PBTHPS3_SETTINGS Settings
+)
+{
+	if (InterlockedDecrement(&Settings->RefCount) != 0)
+	{
+		return;
+	}
+
+	if (KeGetCurrentIrql() == PASSIVE_LEVEL)
+	{
+		WdfObjectDelete(WdfObjectContextGetObject(Settings));
+		return;
+	}
+
+	const PBTHPS3_SERVER_CONTEXT pOwner = Settings->Owner;
+	PBTHPS3_SETTINGS head;
+
+	do
+	{
+		head = pOwner->Settings.ReleaseList;
+		Settings->NextRelease = head;
+	} while (InterlockedCompareExchangePointer(
+		(PVOID*)&pOwner->Settings.ReleaseList,
+		Settings,
+		head
+	) != head);
+
+	WdfWorkItemEnqueue(pOwner->Settings.ReleaseWorkItem);
+}
+
+//
+// Deletes snapshots released above PASSIVE_LEVEL
+// 
+_Use_decl_annotations_
+static VOID
+BthPS3_SettingsEvtRelease(
+	WDFWORKITEM WorkItem
+)
+{
+	const PBTHPS3_SERVER_CONTEXT pCtx = GetServerDeviceContext(WdfWorkItemGetParentObject(WorkItem));
+
+	PBTHPS3_SETTINGS pSettings = InterlockedExchangePointer(
+		(PVOID*)&pCtx->Settings.ReleaseList,
+		NULL
+	);
+
+	while (pSettings != NULL)
+	{
+		const PBTHPS3_SETTINGS pNext = pSettings->NextRelease;
+
+		TraceVerbose(
+			TRACE_BTH,
+			"Deleting settings snapshot version %d",
+			pSettings->Version
+		);
+
+		WdfObjectDelete(WdfObjectContextGetObject(pSettings));
+
+		pSettings = pNext;
+	}
+}
+
+//
+// Requests a one-shot change notification for the Parameters key
+// 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+static NTSTATUS
+BthPS3_SettingsArmNotification(
+	PBTHPS3_SERVER_CONTEXT Context
+)
+{
+	//
+	// Kernel-mode callers pass a work item instead of an APC routine
+	// 
+	return ZwNotifyChangeKey(
+		WdfRegistryWdmGetHandle(Context->Settings.NotifyKey),
+		NULL,
+		(PIO_APC_ROUTINE)&Context->Settings.NotifyWorkItem,
+		(PVOID)(UINT_PTR)DelayedWorkQueue,
+		&Context->Settings.NotifyIoStatus,
+		REG_NOTIFY_CHANGE_LAST_SET,
+		FALSE,
+		NULL,
+		0,
+		TRUE
+	);
+}
+
+//
+// Parameters key changed (or got closed), refresh snapshot and re-arm
+// 
+_Use_decl_annotations_
+static VOID
+BthPS3_SettingsEvtRegistryChanged(
+	PVOID Parameter
+)
+{
+	const PBTHPS3_SERVER_CONTEXT pCtx = Parameter;
+	NTSTATUS status = pCtx->Settings.NotifyIoStatus.Status;
+
+	FuncEntryArguments(TRACE_BTH, "status=%!STATUS!", status);
+
+	if (status != STATUS_NOTIFY_CLEANUP && !pCtx->Settings.NotifyStopping)
+	{
+		(void)BthPS3_SettingsContextInit(pCtx);
+	}
+
+	WdfWaitLockAcquire(pCtx->Settings.NotifyLock, NULL);
+
+	if (pCtx->Settings.NotifyStopping || status == STATUS_NOTIFY_CLEANUP)
+	{
+		status = STATUS_CANCELLED;
+	}
+	else if (!NT_SUCCESS(status = BthPS3_SettingsArmNotification(pCtx)))
+	{
+		TraceError(
+			TRACE_BTH,
+			"ZwNotifyChangeKey failed with status %!STATUS!",
+			status
+		);
+	}
+
+	WdfWaitLockRelease(pCtx->Settings.NotifyLock);
+
+	if (!NT_SUCCESS(status))
+	{
+		KeSetEvent(&pCtx->Settings.NotifyStopped, IO_NO_INCREMENT, FALSE);
+	}
+
+	FuncExitNoReturn(TRACE_BTH);
+}
+
+//
+// Starts refreshing the settings snapshot on registry changes
+// 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+BthPS3_SettingsStartNotification(
+	PBTHPS3_SERVER_CONTEXT Context
+)
+{
+	NTSTATUS status;
+
+	FuncEntry(TRACE_BTH);
+
+	do
+	{
+		if (!NT_SUCCESS(status = WdfDriverOpenParametersRegistryKey(
+			WdfGetDriver(),
+			KEY_NOTIFY,
+			WDF_NO_OBJECT_ATTRIBUTES,
+			&Context->Settings.NotifyKey
+		)))
+		{
+			TraceError(
+				TRACE_BTH,
+				"WdfDriverOpenParametersRegistryKey failed with status %!STATUS!",
+				status
+			);
+			break;
+		}
+
+#pragma warning(suppress: 4996) // required by ZwNotifyChangeKey
+		ExInitializeWorkItem(
+			&Context->Settings.NotifyWorkItem,
+			BthPS3_SettingsEvtRegistryChanged,
+			Context
+		);
+
+		Context->Settings.NotifyStopping = FALSE;
+		KeClearEvent(&Context->Settings.NotifyStopped);
+
+		if (!NT_SUCCESS(status = BthPS3_SettingsArmNotification(Context)))
+		{
+			TraceError(
+				TRACE_BTH,
+				"ZwNotifyChangeKey failed with status %!STATUS!",
+				status
+			);
+
+			KeSetEvent(&Context->Settings.NotifyStopped, IO_NO_INCREMENT, FALSE);
+			WdfRegistryClose(Context->Settings.NotifyKey);
+			Context->Settings.NotifyKey = NULL;
+			break;
+		}
+
+	} while (FALSE);
+
+	FuncExit(TRACE_BTH, "status=%!STATUS!", status);
+
+	return status;
+}
+
+//
+// Stops watching the registry, waits for a running refresh to finish
+// 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+BthPS3_SettingsStopNotification(
+	PBTHPS3_SERVER_CONTEXT Context
+)
+{
+	FuncEntry(TRACE_BTH);
+
+	if (Context->Settings.NotifyKey != NULL)
+	{
+		WdfWaitLockAcquire(Context->Settings.NotifyLock, NULL);
+
+		Context->Settings.NotifyStopping = TRUE;
+
+		//
+		// Completes a pending notification with STATUS_NOTIFY_CLEANUP
+		// 
+		WdfRegistryClose(Context->Settings.NotifyKey);
+		Context->Settings.NotifyKey = NULL;
+
+		WdfWaitLockRelease(Context->Settings.NotifyLock);
+
+		(void)KeWaitForSingleObject(
+			&Context->Settings.NotifyStopped,
+			Executive,
+			KernelMode,
+			FALSE,
+			NULL
+		);
+	}
+
+	FuncExitNoReturn(TRACE_BTH);
+}
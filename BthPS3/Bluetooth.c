@@ -200,97 +200,6 @@ BthPS3_Initialize(
 }
 #pragma code_seg()
 
-_IRQL_requires_max_(PASSIVE_LEVEL)
-
-NTSTATUS
-BthPS3_GetDeviceName(
-    WDFIOTARGET IoTarget,
-    BTH_ADDR RemoteAddress,
-    PCHAR Name
-)
-{
-    FuncEntry(TRACE_BTH);
-
-    NTSTATUS status = STATUS_INVALID_BUFFER_SIZE;
-    ULONG index = 0;
-    WDF_MEMORY_DESCRIPTOR memoryDescriptor;
-    WDFMEMORY memoryHandle = NULL;
-    PBTH_DEVICE_INFO_LIST pDeviceInfoList = NULL;
-    ULONG maxDevices = BTH_DEVICE_INFO_MAX_COUNT;
-    ULONG retryCount = 0;
-
-    //
-    // Retry increasing the buffer a few times if _a lot_ of devices
-    // are cached and the allocated memory can't store them all.
-    // 
-    for (retryCount = 0; (retryCount <= BTH_DEVICE_INFO_MAX_RETRIES
-             && status == STATUS_INVALID_BUFFER_SIZE); retryCount++)
-    {
-        if (memoryHandle != NULL)
-        {
-            WdfObjectDelete(memoryHandle);
-        }
-
-        if (!NT_SUCCESS(status = WdfMemoryCreate(NULL,
-            NonPagedPoolNx,
-            POOLTAG_BTHPS3,
-            sizeof(BTH_DEVICE_INFO_LIST) + (sizeof(BTH_DEVICE_INFO) * maxDevices),
-            &memoryHandle,
-            NULL)))
-        {
-            return status;
-        }
-
-        WDF_MEMORY_DESCRIPTOR_INIT_HANDLE(
-            &memoryDescriptor,
-            memoryHandle,
-            NULL
-        );
-
-        status = WdfIoTargetSendIoctlSynchronously(
-            IoTarget,
-            NULL,
-            IOCTL_BTH_GET_DEVICE_INFO,
-            &memoryDescriptor,
-            &memoryDescriptor,
-            NULL,
-            NULL
-        );
-
-        //
-        // Increase memory to allocate
-        // 
-        maxDevices += BTH_DEVICE_INFO_MAX_COUNT;
-    }
-
-    if (!NT_SUCCESS(status))
-    {
-        WdfObjectDelete(memoryHandle);
-        return status;
-    }
-
-    pDeviceInfoList = WdfMemoryGetBuffer(memoryHandle, NULL);
-    status = STATUS_NOT_FOUND;
-
-    for (index = 0; index < pDeviceInfoList->numOfDevices; index++)
-    {
-        const PBTH_DEVICE_INFO pDeviceInfo = &pDeviceInfoList->deviceList[index];
-
-        if (pDeviceInfo->address == RemoteAddress)
-        {
-            strcpy_s(Name, BTH_MAX_NAME_SIZE, pDeviceInfo->name);
-            status = STATUS_SUCCESS;
-            break;
-        }
-    }
-
-    WdfObjectDelete(memoryHandle);
-
-    FuncExit(TRACE_BTH, "status=%!STATUS!", status);
-
-    return status;
-}
-
 _IRQL_requires_max_(PASSIVE_LEVEL)
 NTSTATUS
 BthPS3_GetHciVersion(
@@ -357,6 +266,122 @@ BthPS3_GetHciVersion(
 	return status;
 }
 
+//
+// Request the address of the radio behind an I/O target
+// 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+BthPS3_GetRadioAddress(
+	_In_ WDFIOTARGET IoTarget,
+	_Out_ PBTH_ADDR RadioAddress
+)
+{
+	FuncEntry(TRACE_BTH);
+
+	NTSTATUS status;
+	WDF_MEMORY_DESCRIPTOR MemoryDescriptor;
+	WDFMEMORY MemoryHandle = NULL;
+	PBTH_LOCAL_RADIO_INFO pLocalInfo = NULL;
+#ifdef _M_IX86
+	ULONG bytesReturned;
+#else
+	ULONGLONG bytesReturned;
+#endif
+
+	*RadioAddress = 0;
+
+	if (!NT_SUCCESS(status = WdfMemoryCreate(NULL,
+		NonPagedPoolNx,
+		POOLTAG_BTHPS3,
+		sizeof(BTH_LOCAL_RADIO_INFO),
+		&MemoryHandle,
+		NULL)))
+	{
+		return status;
+	}
+
+	WDF_MEMORY_DESCRIPTOR_INIT_HANDLE(
+		&MemoryDescriptor,
+		MemoryHandle,
+		NULL
+	);
+
+	status = WdfIoTargetSendIoctlSynchronously(
+		IoTarget,
+		NULL,
+		IOCTL_BTH_GET_LOCAL_INFO,
+		&MemoryDescriptor,
+		&MemoryDescriptor,
+		NULL,
+		&bytesReturned
+	);
+
+	if (NT_SUCCESS(status))
+	{
+		if (bytesReturned < sizeof(BTH_LOCAL_RADIO_INFO))
+		{
+			status = STATUS_INVALID_BUFFER_SIZE;
+		}
+		else
+		{
+			pLocalInfo = WdfMemoryGetBuffer(MemoryHandle, NULL);
+
+			*RadioAddress = pLocalInfo->localInfo.address;
+		}
+	}
+
+	WdfObjectDelete(MemoryHandle);
+
+	FuncExit(TRACE_BTH, "status=%!STATUS!", status);
+
+	return status;
+}
+
+//
+// Hands an indication to the PASSIVE_LEVEL lane of its remote device
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS
+BthPS3_QueuedWorkItemEnqueue(
+	_In_ PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	_Inout_ PBTHPS3_QWI_CONTEXT WorkItem
+)
+{
+	NTSTATUS status;
+	const BTH_ADDR address = WorkItem->IndicationParameters.BtAddress;
+
+	WorkItem->Lane = (ULONG)((address ^ (address >> 16) ^ (address >> 32)) % BTHPS3_QWI_LANE_COUNT);
+	WorkItem->EnqueuedAt = KeQueryInterruptTime();
+
+	const PBTHPS3_QWI_LANE_STATS stats = &Header->QueuedWorkItemStats[WorkItem->Lane];
+
+	InterlockedIncrement(&stats->Pending);
+
+	//
+	// PDO may get destroyed before the item runs, dropped by the handler
+	// 
+	if (WorkItem->IndicationCode != IndicationRemoteConnect)
+	{
+		WdfObjectReference(WdfObjectContextGetObject(WorkItem->Context.Pdo));
+	}
+
+	if (!NT_SUCCESS(status = DMF_QueuedWorkItem_Enqueue(
+		Header->QueuedWorkItemModules[WorkItem->Lane],
+		WorkItem,
+		sizeof(BTHPS3_QWI_CONTEXT)
+	)))
+	{
+		InterlockedDecrement(&stats->Pending);
+
+		if (WorkItem->IndicationCode != IndicationRemoteConnect)
+		{
+			WdfObjectDereference(WdfObjectContextGetObject(WorkItem->Context.Pdo));
+		}
+	}
+
+	return status;
+}
+
 ScheduledTask_Result_Type
 BthPS3_EvtQueuedWorkItemHandler(
 	_In_ DMFMODULE DmfModule,
@@ -370,6 +395,41 @@ BthPS3_EvtQueuedWorkItemHandler(
 	FuncEntry(TRACE_BTH);
 
 	const PBTHPS3_QWI_CONTEXT pCtx = ClientBuffer;
+	const PBTHPS3_DEVICE_CONTEXT_HEADER header = (pCtx->IndicationCode == IndicationRemoteConnect)
+		? &pCtx->Context.Server->Header
+		: pCtx->Context.Pdo->DevCtxHdr;
+	const PBTHPS3_QWI_LANE_STATS stats = &header->QueuedWorkItemStats[pCtx->Lane];
+
+	//
+	// Interrupt time is in 100ns units
+	// 
+	const LONG64 delayUs = (LONG64)((KeQueryInterruptTime() - pCtx->EnqueuedAt) / 10);
+
+	InterlockedDecrement(&stats->Pending);
+	InterlockedIncrement(&stats->Count);
+	InterlockedAdd64(&stats->TotalDelayUs, delayUs);
+
+	LONG64 max = stats->MaxDelayUs;
+
+	while (delayUs > max)
+	{
+		const LONG64 prev = InterlockedCompareExchange64(&stats->MaxDelayUs, delayUs, max);
+
+		if (prev == max)
+		{
+			break;
+		}
+
+		max = prev;
+	}
+
+	TraceVerbose(
+		TRACE_BTH,
+		"Lane %d picked up work for %012llX after %lld us",
+		pCtx->Lane,
+		pCtx->IndicationParameters.BtAddress,
+		delayUs
+	);
 
 	switch (pCtx->IndicationCode)
 	{
@@ -377,7 +437,8 @@ BthPS3_EvtQueuedWorkItemHandler(
 
 		(void)L2CAP_PS3_HandleRemoteConnect(
 			pCtx->Context.Server,
-			&pCtx->IndicationParameters
+			&pCtx->IndicationParameters,
+			pCtx->EnqueuedAt
 		);
 
 		break;
@@ -388,6 +449,11 @@ BthPS3_EvtQueuedWorkItemHandler(
 			&pCtx->IndicationParameters
 		);
 
+		//
+		// Taken on enqueue
+		// 
+		WdfObjectDereference(WdfObjectContextGetObject(pCtx->Context.Pdo));
+
 		break;
 	}
 
@@ -52,6 +52,104 @@
 #define BTH_DEVICE_INFO_MAX_RETRIES     UCHAR_MAX
 #define BTHPS3_MAX_NUM_DEVICES			UCHAR_MAX
 #define BTHPS3_BTH_ADDR_MAX_CHARS		13 /* 12 characters + NULL terminator */
+#define BTHPS3_CLIENTS_TABLE_BITS		9
+#define BTHPS3_CLIENTS_TABLE_SIZE		(1 << BTHPS3_CLIENTS_TABLE_BITS) /* keeps load below 50% */
+#define BTHPS3_NAME_CACHE_SIZE			32
+#define BTHPS3_NAME_CACHE_REFRESH_MS	60000
+#define BTHPS3_QWI_LANE_COUNT			4
+#define BTHPS3_DENY_CACHE_SIZE			32
+
+typedef struct _BTHPS3_PDO_CONTEXT* PBTHPS3_PDO_CONTEXT;
+
+//
+// Slot of the remote address to PDO context index
+// 
+typedef struct _BTHPS3_CLIENTS_TABLE_ENTRY
+{
+	BTH_ADDR RemoteAddress;
+
+	//
+	// NULL if slot is unoccupied
+	// 
+	PBTHPS3_PDO_CONTEXT PdoContext;
+
+} BTHPS3_CLIENTS_TABLE_ENTRY, * PBTHPS3_CLIENTS_TABLE_ENTRY;
+
+//
+// Work item lane usage, delays are from enqueue to handler invocation
+// 
+typedef struct _BTHPS3_QWI_LANE_STATS
+{
+	LONG Count;
+
+	LONG Pending;
+
+	LONG64 TotalDelayUs;
+
+	LONG64 MaxDelayUs;
+
+} BTHPS3_QWI_LANE_STATS, * PBTHPS3_QWI_LANE_STATS;
+
+//
+// Remote name last reported by the radio for an address
+// 
+typedef struct _BTHPS3_NAME_CACHE_ENTRY
+{
+	//
+	// Zero if entry is unused
+	// 
+	BTH_ADDR RemoteAddress;
+
+	//
+	// Interrupt time Name was fetched at
+	// 
+	ULONGLONG UpdatedAt;
+
+	CHAR Name[BTH_MAX_NAME_SIZE];
+
+} BTHPS3_NAME_CACHE_ENTRY, * PBTHPS3_NAME_CACHE_ENTRY;
+
+//
+// Commands the profile driver sends to the PSM filter
+// 
+typedef enum _BTHPS3PSM_FILTER_COMMAND
+{
+	BthPS3PSMFilterCommandNone = 0,
+	BthPS3PSMFilterCommandEnablePatch,
+	BthPS3PSMFilterCommandDisablePatch,
+	BthPS3PSMFilterCommandCount
+
+} BTHPS3PSM_FILTER_COMMAND;
+
+//
+// Remote address connections get denied from until it expires
+// 
+typedef struct _BTHPS3_DENY_CACHE_ENTRY
+{
+	//
+	// Zero if entry is unused
+	// 
+	BTH_ADDR RemoteAddress;
+
+	//
+	// Interrupt time the entry stops matching at
+	// 
+	ULONGLONG ExpiresAt;
+
+} BTHPS3_DENY_CACHE_ENTRY, * PBTHPS3_DENY_CACHE_ENTRY;
+
+//
+// Time from HID Control connect request to both channels being established
+// 
+typedef struct _BTHPS3_CONNECT_LATENCY_STATS
+{
+	LONG Count;
+
+	LONG64 TotalUs;
+
+	LONG64 MaxUs;
+
+} BTHPS3_CONNECT_LATENCY_STATS, * PBTHPS3_CONNECT_LATENCY_STATS;
 
 
 typedef struct _BTHPS3_DEVICE_CONTEXT_HEADER
@@ -93,6 +191,51 @@ typedef struct _BTHPS3_DEVICE_CONTEXT_HEADER
 	// 
 	WDFWAITLOCK ClientsLock;
 
+	//
+	// Open-addressed (linear probing) index of Clients by remote address
+	// 
+	BTHPS3_CLIENTS_TABLE_ENTRY ClientsTable[BTHPS3_CLIENTS_TABLE_SIZE];
+
+	//
+	// Reader/writer lock for ClientsTable
+	// 
+	EX_SPIN_LOCK ClientsTableLock;
+
+	//
+	// Connect latency of devices reusing a lingering PDO (Warm) or getting a new one (Cold)
+	// 
+	struct
+	{
+		BTHPS3_CONNECT_LATENCY_STATS Warm;
+
+		BTHPS3_CONNECT_LATENCY_STATS Cold;
+
+	} ConnectLatency;
+
+	//
+	// Setup timelines of the most recently completed connections
+	// 
+	struct
+	{
+		BTHPS3_CONNECT_TIMELINE Entries[BTHPS3_CONNECT_TIMELINES_MAX];
+
+		//
+		// Index the next timeline gets stored at
+		// 
+		ULONG Next;
+
+		//
+		// Valid entries, up to BTHPS3_CONNECT_TIMELINES_MAX
+		// 
+		ULONG Count;
+
+		//
+		// Protects Entries, Next and Count
+		// 
+		EX_SPIN_LOCK Lock;
+
+	} ConnectTimelines;
+
 	//
 	// DMF module to handle PDO creation
 	// 
@@ -104,17 +247,265 @@ typedef struct _BTHPS3_DEVICE_CONTEXT_HEADER
 	UINT32 Slots[8]; // 256 usable bits
 
 	//
-	// Lock protecting Slots access
+	// Slots handed out by BthPS3_PDO_QuerySlot whose PDO creation is still in progress
+	// 
+	UINT32 SlotsReserved[8];
+
+	//
+	// Lock protecting Slots and SlotsReserved access
 	// 
 	WDFWAITLOCK SlotsLock;
 
 	//
-	// DMF module to enqueue work items
+	// Remote address owning each slot, zero if unassigned (index 0 is unused)
 	// 
-	DMFMODULE QueuedWorkItemModule;
+	BTH_ADDR SlotAddresses[BTHPS3_MAX_NUM_DEVICES + 1];
+
+	//
+	// System time each slot's device last connected, used to reclaim the oldest slot
+	// 
+	LONGLONG SlotLastSeen[BTHPS3_MAX_NUM_DEVICES + 1];
+
+	//
+	// Set when SlotAddresses changed and haven't been written to the registry yet
+	// 
+	LONG SlotsDirty;
+
+	//
+	// Writes SlotAddresses to the registry off the connect path
+	// 
+	WDFWORKITEM SlotsPersistWorkItem;
+
+	//
+	// DMF modules to enqueue work items, each runs one item at a time
+	// 
+	// Work is sharded by remote address so a device's indications stay ordered
+	// while different devices don't wait on each other.
+	// 
+	DMFMODULE QueuedWorkItemModules[BTHPS3_QWI_LANE_COUNT];
+
+	//
+	// Per lane statistics of QueuedWorkItemModules
+	// 
+	BTHPS3_QWI_LANE_STATS QueuedWorkItemStats[BTHPS3_QWI_LANE_COUNT];
+
+	//
+	// Remote names of recently connected devices
+	// 
+	struct
+	{
+		BTHPS3_NAME_CACHE_ENTRY Entries[BTHPS3_NAME_CACHE_SIZE];
+
+		//
+		// Protects Entries
+		// 
+		WDFWAITLOCK Lock;
+
+		//
+		// Device info list buffer, kept across fetches
+		// 
+		WDFMEMORY DeviceInfoList;
+
+		//
+		// Number of BTH_DEVICE_INFO entries DeviceInfoList can hold
+		// 
+		ULONG MaxDevices;
+
+		//
+		// Serializes IOCTL_BTH_GET_DEVICE_INFO and DeviceInfoList access
+		// 
+		WDFWAITLOCK FetchLock;
+
+		//
+		// Updates stale Entries in the background
+		// 
+		WDFWORKITEM RefreshWorkItem;
+
+	} NameCache;
+
+	//
+	// Recently seen unsupported devices, denied without identifying them again
+	// 
+	struct
+	{
+		BTHPS3_DENY_CACHE_ENTRY Entries[BTHPS3_DENY_CACHE_SIZE];
+
+		//
+		// Protects Entries
+		// 
+		EX_SPIN_LOCK Lock;
+
+		LONG Lookups;
+
+		LONG Hits;
+
+	} DenyCache;
 
 } BTHPS3_DEVICE_CONTEXT_HEADER, * PBTHPS3_DEVICE_CONTEXT_HEADER;
 
+//
+// Case-folded supported remote name
+// 
+typedef struct _BTHPS3_NAME_MATCHER_ENTRY
+{
+	ULONG Hash;
+
+	//
+	// In characters, zero if bucket is unused
+	// 
+	USHORT Length;
+
+	DS_DEVICE_TYPE DeviceType;
+
+	PCWCH Name;
+
+} BTHPS3_NAME_MATCHER_ENTRY, * PBTHPS3_NAME_MATCHER_ENTRY;
+
+//
+// Deterministic automaton of all supported remote name patterns
+// 
+typedef struct _BTHPS3_NAME_DFA
+{
+	//
+	// Sorted characters having their own input class, all others map to class 0
+	// 
+	PWCH ClassChars;
+
+	//
+	// Number of input classes, including class 0
+	// 
+	ULONG ClassCount;
+
+	//
+	// StateCount * ClassCount next states, state 0 is the dead state
+	// 
+	PUSHORT Transitions;
+
+	//
+	// DS_DEVICE_TYPE accepted in each state
+	// 
+	PUCHAR Accept;
+
+	//
+	// Zero if no patterns are configured
+	// 
+	ULONG StateCount;
+
+} BTHPS3_NAME_DFA, * PBTHPS3_NAME_DFA;
+
+//
+// Open-addressed (linear probing) set of all supported remote names
+// 
+typedef struct _BTHPS3_NAME_MATCHER
+{
+	PBTHPS3_NAME_MATCHER_ENTRY Buckets;
+
+	ULONG BucketMask;
+
+	ULONG Count;
+
+	//
+	// Names containing '*' or '?' wildcards
+	// 
+	BTHPS3_NAME_DFA Patterns;
+
+} BTHPS3_NAME_MATCHER, * PBTHPS3_NAME_MATCHER;
+
+//
+// L2CAP parameters requested when accepting a channel of a device type
+// 
+typedef struct _BTHPS3_CHANNEL_PROFILE
+{
+	USHORT Mtu;
+
+	USHORT FlushTimeout;
+
+	USHORT LinkTimeout;
+
+	ULONG IncomingQueueDepth;
+
+} BTHPS3_CHANNEL_PROFILE, * PBTHPS3_CHANNEL_PROFILE;
+
+typedef const BTHPS3_CHANNEL_PROFILE* PCBTHPS3_CHANNEL_PROFILE;
+
+//
+// Immutable snapshot of the Parameters registry key
+// 
+typedef struct _BTHPS3_SETTINGS
+{
+	//
+	// Snapshot gets deleted once this drops to zero
+	// 
+	LONG RefCount;
+
+	//
+	// Device the snapshot belongs to, deletion is deferred through it above PASSIVE_LEVEL
+	// 
+	struct _BTHPS3_SERVER_CONTEXT* Owner;
+
+	//
+	// Link in Owner->Settings.ReleaseList
+	// 
+	struct _BTHPS3_SETTINGS* NextRelease;
+
+	ULONG Version;
+
+	ULONG AutoEnableFilter;
+
+	ULONG AutoDisableFilter;
+
+	ULONG AutoEnableFilterDelay;
+
+	ULONG IsSIXAXISSupported;
+
+	ULONG IsNAVIGATIONSupported;
+
+	ULONG IsMOTIONSupported;
+
+	ULONG IsWIRELESSSupported;
+
+	WDFCOLLECTION SIXAXISSupportedNames;
+
+	WDFCOLLECTION NAVIGATIONSupportedNames;
+
+	WDFCOLLECTION MOTIONSupportedNames;
+
+	WDFCOLLECTION WIRELESSSupportedNames;
+
+	ULONG RawPDO;
+
+	ULONG HidePDO;
+
+	ULONG AdminOnlyPDO;
+
+	ULONG ExclusivePDO;
+
+	ULONG ChildIdleTimeout;
+
+	ULONG SuppressDuplicateReports;
+
+	ULONG DuplicateReportHoldTime;
+
+	ULONG ChildLingerTimeout;
+
+	ULONG RequestLowLatencyQos;
+
+	ULONG DenyCacheTimeout;
+
+	//
+	// Indexed by DS_DEVICE_TYPE, DS_DEVICE_TYPE_UNKNOWN holds the defaults
+	// 
+	BTHPS3_CHANNEL_PROFILE ChannelProfiles[DS_DEVICE_TYPE_WIRELESS + 1];
+
+	//
+	// Supported names of all enabled device types, compiled on load
+	// 
+	BTHPS3_NAME_MATCHER NameMatcher;
+
+} BTHPS3_SETTINGS, * PBTHPS3_SETTINGS;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(BTHPS3_SETTINGS, GetSettings)
+
 typedef struct _BTHPS3_SERVER_CONTEXT
 {
 	//
@@ -146,6 +537,11 @@ typedef struct _BTHPS3_SERVER_CONTEXT
 	//
 	struct _BRB RegisterUnregisterBrb;
 
+	//
+	// Radio-wide diagnostics IOCTLs, available with or without children
+	// 
+	DMFMODULE DmfModuleIoctlHandler;
+
 	struct
 	{
 		//
@@ -159,35 +555,101 @@ typedef struct _BTHPS3_SERVER_CONTEXT
 		WDFTIMER AutoResetTimer;
 
 		//
-		// Request object used to asynchronously enable the patch
+		// Preallocated request and payload every filter command is sent with
 		// 
 		WDFREQUEST AsyncRequest;
 
+		WDFMEMORY AsyncPayload;
+
+		//
+		// Protects InFlight, Pending, Sent, Stopping and Idle
+		// 
+		WDFSPINLOCK Lock;
+
+		//
+		// Command currently sent with AsyncRequest
+		// 
+		BTHPS3PSM_FILTER_COMMAND InFlight;
+
+		//
+		// Latest command submitted while another one was in flight
+		// 
+		BTHPS3PSM_FILTER_COMMAND Pending;
+
+		//
+		// AsyncRequest is with the filter, only then it may be cancelled
+		// 
+		BOOLEAN Sent;
+
+		//
+		// Set on shutdown, no further commands get sent
+		// 
+		BOOLEAN Stopping;
+
+		//
+		// Signaled while no command is in flight
+		// 
+		KEVENT Idle;
+
+		//
+		// Commands dropped as identical to the pending (or in-flight) one
+		// 
+		LONG Coalesced;
+
+		//
+		// Symbolic link of our radio's filter instance is in AsyncPayload, commands may be sent
+		// 
+		BOOLEAN IsRadioResolved;
+
 	} PsmFilter;
 
 	struct
 	{
-		ULONG AutoEnableFilter;
+		//
+		// Current snapshot, use BthPS3_SettingsAcquire to access
+		// 
+		PBTHPS3_SETTINGS Current;
 
-		ULONG AutoDisableFilter;
+		//
+		// Protects swapping Current
+		// 
+		EX_SPIN_LOCK Lock;
 
-		ULONG AutoEnableFilterDelay;
+		//
+		// Incremented for every snapshot built
+		// 
+		LONG Version;
 
-		ULONG IsSIXAXISSupported;
+		//
+		// Parameters key watched for changes
+		// 
+		WDFKEY NotifyKey;
 
-		ULONG IsNAVIGATIONSupported;
+		//
+		// Serializes re-arming the notification against stopping it
+		// 
+		WDFWAITLOCK NotifyLock;
 
-		ULONG IsMOTIONSupported;
+		BOOLEAN NotifyStopping;
 
-		ULONG IsWIRELESSSupported;
+		IO_STATUS_BLOCK NotifyIoStatus;
 
-		WDFCOLLECTION SIXAXISSupportedNames;
+		WORK_QUEUE_ITEM NotifyWorkItem;
 
-		WDFCOLLECTION NAVIGATIONSupportedNames;
+		//
+		// Signaled while no notification is pending
+		// 
+		KEVENT NotifyStopped;
 
-		WDFCOLLECTION MOTIONSupportedNames;
+		//
+		// Snapshots released above PASSIVE_LEVEL, they own pageable memory
+		// 
+		PBTHPS3_SETTINGS ReleaseList;
 
-		WDFCOLLECTION WIRELESSSupportedNames;
+		//
+		// Deletes the snapshots in ReleaseList at PASSIVE_LEVEL
+		// 
+		WDFWORKITEM ReleaseWorkItem;
 
 	} Settings;
 
@@ -195,8 +657,6 @@ typedef struct _BTHPS3_SERVER_CONTEXT
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(BTHPS3_SERVER_CONTEXT, GetServerDeviceContext)
 
-typedef struct _BTHPS3_PDO_CONTEXT* PBTHPS3_PDO_CONTEXT;
-
 //
 // Context data for passing to queued work item handler
 //   Used to call PASSIVE_LEVEL code from DISPATCH_LEVEL
@@ -215,12 +675,29 @@ typedef struct _BTHPS3_QWI_CONTEXT
 
 	} Context;
 
+	//
+	// Index into QueuedWorkItemModules this item got enqueued to
+	// 
+	ULONG Lane;
+
+	//
+	// Interrupt time of enqueue
+	// 
+	ULONGLONG EnqueuedAt;
+
 } BTHPS3_QWI_CONTEXT, * PBTHPS3_QWI_CONTEXT;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(BTHPS3_QWI_CONTEXT, GetQWIContext)
 
 EVT_DMF_QueuedWorkItem_Callback BthPS3_EvtQueuedWorkItemHandler;
 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS
+BthPS3_QueuedWorkItemEnqueue(
+	_In_ PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	_Inout_ PBTHPS3_QWI_CONTEXT WorkItem
+);
+
 EVT_WDF_TIMER BthPS3_EnablePatchEvtWdfTimer;
 
 _IRQL_requires_max_(PASSIVE_LEVEL)
@@ -281,6 +758,43 @@ BthPS3_SettingsContextInit(
 	PBTHPS3_SERVER_CONTEXT Context
 );
 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+PBTHPS3_SETTINGS
+BthPS3_SettingsAcquire(
+	PBTHPS3_SERVER_CONTEXT Context
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthPS3_SettingsRelease(
+	PBTHPS3_SETTINGS Settings
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+BthPS3_SettingsStartNotification(
+	PBTHPS3_SERVER_CONTEXT Context
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+BthPS3_SettingsStopNotification(
+	PBTHPS3_SERVER_CONTEXT Context
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+BthPS3_NameMatcherCompile(
+	PBTHPS3_SETTINGS Settings
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+DS_DEVICE_TYPE
+BthPS3_NameMatcherLookup(
+	const BTHPS3_SETTINGS* Settings,
+	PCSTR RemoteName
+);
+
 _IRQL_requires_max_(PASSIVE_LEVEL)
 NTSTATUS
 BthPS3_QueryInterfaces(
@@ -323,6 +837,18 @@ BthPS3_SendBrbAsync(
 	_In_opt_ WDFCONTEXT Context
 );
 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS
+BthPS3_SendBrbAsyncEx(
+	_In_ WDFIOTARGET IoTarget,
+	_In_ WDFREQUEST Request,
+	_In_ PBRB Brb,
+	_In_ size_t BrbSize,
+	_In_ PFN_WDF_REQUEST_COMPLETION_ROUTINE ComplRoutine,
+	_In_opt_ WDFCONTEXT Context,
+	_In_opt_ PWDF_REQUEST_SEND_OPTIONS Options
+);
+
 #pragma endregion
 
 //
@@ -331,11 +857,53 @@ BthPS3_SendBrbAsync(
 _IRQL_requires_max_(PASSIVE_LEVEL)
 NTSTATUS
 BthPS3_GetDeviceName(
-	WDFIOTARGET IoTarget,
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
 	BTH_ADDR RemoteAddress,
 	PCHAR Name
 );
 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+BthPS3_NameCacheInit(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+BthPS3_NameCacheFlush(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+BthPS3_DenyCacheLookup(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	BTH_ADDR RemoteAddress
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthPS3_DenyCacheInsert(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	BTH_ADDR RemoteAddress,
+	ULONG TimeoutSeconds
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthPS3_DenyCacheClear(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthPS3_DenyCacheGetStats(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	PBTHPS3_DENY_CACHE_STATS Stats
+);
+
+EVT_DMF_IoctlHandler_Callback BthPS3_HandleGetDenyCacheStats;
+
 //
 // Request HCI version from radio
 // 
@@ -346,3 +914,13 @@ BthPS3_GetHciVersion(
 	_Out_ PUCHAR HciMajorVersion,
 	_Out_opt_ PUSHORT HciRevision
 );
+
+//
+// Request the address of the radio behind an I/O target
+// 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+BthPS3_GetRadioAddress(
+	_In_ WDFIOTARGET IoTarget,
+	_Out_ PBTH_ADDR RadioAddress
+);
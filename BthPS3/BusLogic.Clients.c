@@ -0,0 +1,197 @@
+#include "Driver.h"
+#include "BusLogic.Clients.tmh"
+
+
+//
+// Maps a remote address to its home slot
+// 
+static FORCEINLINE ULONG
+BthPS3_ClientsTable_Hash(
+	BTH_ADDR RemoteAddress
+)
+{
+	//
+	// Fibonacci hashing, vendor bits (OUI) are mostly identical so mix them all
+	// 
+	return (ULONG)((RemoteAddress * 0x9E3779B97F4A7C15ULL) >> (64 - BTHPS3_CLIENTS_TABLE_BITS));
+}
+
+//
+// Finds the slot occupied by RemoteAddress, caller must hold ClientsTableLock
+// 
+static LONG
+BthPS3_ClientsTable_FindSlot(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	BTH_ADDR RemoteAddress
+)
+{
+	ULONG slot = BthPS3_ClientsTable_Hash(RemoteAddress);
+
+	for (ULONG probe = 0; probe < BTHPS3_CLIENTS_TABLE_SIZE; probe++)
+	{
+		const PBTHPS3_CLIENTS_TABLE_ENTRY entry = &Header->ClientsTable[slot];
+
+		if (entry->PdoContext == NULL)
+		{
+			return -1;
+		}
+
+		if (entry->RemoteAddress == RemoteAddress)
+		{
+			return (LONG)slot;
+		}
+
+		slot = (slot + 1) & (BTHPS3_CLIENTS_TABLE_SIZE - 1);
+	}
+
+	return -1;
+}
+
+//
+// Adds or replaces the entry for a remote address
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS
+BthPS3_ClientsTable_Insert(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	BTH_ADDR RemoteAddress,
+	PBTHPS3_PDO_CONTEXT PdoContext
+)
+{
+	NTSTATUS status = STATUS_INSUFFICIENT_RESOURCES;
+	ULONG slot = BthPS3_ClientsTable_Hash(RemoteAddress);
+
+	const KIRQL irql = ExAcquireSpinLockExclusive(&Header->ClientsTableLock);
+
+	for (ULONG probe = 0; probe < BTHPS3_CLIENTS_TABLE_SIZE; probe++)
+	{
+		const PBTHPS3_CLIENTS_TABLE_ENTRY entry = &Header->ClientsTable[slot];
+
+		if (entry->PdoContext == NULL || entry->RemoteAddress == RemoteAddress)
+		{
+			entry->RemoteAddress = RemoteAddress;
+			entry->PdoContext = PdoContext;
+			status = STATUS_SUCCESS;
+			break;
+		}
+
+		slot = (slot + 1) & (BTHPS3_CLIENTS_TABLE_SIZE - 1);
+	}
+
+	ExReleaseSpinLockExclusive(&Header->ClientsTableLock, irql);
+
+	return status;
+}
+
+//
+// Removes the entry for a remote address if it still points to PdoContext
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+BthPS3_ClientsTable_Remove(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	BTH_ADDR RemoteAddress,
+	PBTHPS3_PDO_CONTEXT PdoContext
+)
+{
+	const KIRQL irql = ExAcquireSpinLockExclusive(&Header->ClientsTableLock);
+
+	const LONG found = BthPS3_ClientsTable_FindSlot(Header, RemoteAddress);
+
+	if (found < 0 || Header->ClientsTable[found].PdoContext != PdoContext)
+	{
+		ExReleaseSpinLockExclusive(&Header->ClientsTableLock, irql);
+		return FALSE;
+	}
+
+	//
+	// Backward-shift deletion: pull following entries of the same probe
+	// sequence into the gap so lookups never stop early at a hole
+	// 
+	ULONG hole = (ULONG)found;
+	ULONG next = (hole + 1) & (BTHPS3_CLIENTS_TABLE_SIZE - 1);
+
+	while (Header->ClientsTable[next].PdoContext != NULL)
+	{
+		const ULONG home = BthPS3_ClientsTable_Hash(Header->ClientsTable[next].RemoteAddress);
+
+		//
+		// Entry may move if its home slot isn't cyclically within (hole, next]
+		// 
+		if (((next - home) & (BTHPS3_CLIENTS_TABLE_SIZE - 1)) >=
+			((next - hole) & (BTHPS3_CLIENTS_TABLE_SIZE - 1)))
+		{
+			Header->ClientsTable[hole] = Header->ClientsTable[next];
+			hole = next;
+		}
+
+		next = (next + 1) & (BTHPS3_CLIENTS_TABLE_SIZE - 1);
+	}
+
+	Header->ClientsTable[hole].RemoteAddress = 0;
+	Header->ClientsTable[hole].PdoContext = NULL;
+
+	ExReleaseSpinLockExclusive(&Header->ClientsTableLock, irql);
+
+	return TRUE;
+}
+
+//
+// Looks up the PDO context for a remote address, concurrent lookups don't block each other
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+PBTHPS3_PDO_CONTEXT
+BthPS3_ClientsTable_Lookup(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	BTH_ADDR RemoteAddress
+)
+{
+	PBTHPS3_PDO_CONTEXT pPdoCtx = NULL;
+
+	const KIRQL irql = ExAcquireSpinLockShared(&Header->ClientsTableLock);
+
+	const LONG found = BthPS3_ClientsTable_FindSlot(Header, RemoteAddress);
+
+	if (found >= 0)
+	{
+		pPdoCtx = Header->ClientsTable[found].PdoContext;
+	}
+
+	ExReleaseSpinLockShared(&Header->ClientsTableLock, irql);
+
+	return pPdoCtx;
+}
+
+//
+// Looks up the PDO context for a remote address and takes a reference on its device
+// 
+// The reference keeps the context valid even if the PDO gets destroyed
+// concurrently, release it with WdfObjectDereference on the device.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+PBTHPS3_PDO_CONTEXT
+BthPS3_ClientsTable_LookupAndReference(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	BTH_ADDR RemoteAddress
+)
+{
+	PBTHPS3_PDO_CONTEXT pPdoCtx = NULL;
+
+	const KIRQL irql = ExAcquireSpinLockShared(&Header->ClientsTableLock);
+
+	const LONG found = BthPS3_ClientsTable_FindSlot(Header, RemoteAddress);
+
+	if (found >= 0)
+	{
+		pPdoCtx = Header->ClientsTable[found].PdoContext;
+
+		//
+		// Destroy removes the entry before unplugging, so the device is alive here
+		// 
+		WdfObjectReference(WdfObjectContextGetObject(pPdoCtx));
+	}
+
+	ExReleaseSpinLockShared(&Header->ClientsTableLock, irql);
+
+	return pPdoCtx;
+}
@@ -0,0 +1,227 @@
+#include "Driver.h"
+#include "BusLogic.Descriptors.tmh"
+
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (INIT, BthPS3_PDO_DescriptorsInit)
+#endif
+
+
+//
+// Indexed by DS_DEVICE_TYPE, DS_DEVICE_TYPE_UNKNOWN stays empty
+//
+static BTHPS3_PDO_DESCRIPTOR G_PdoDescriptors[DS_DEVICE_TYPE_WIRELESS + 1];
+
+static PCWSTR G_PdoManufacturer = L"Nefarius Software Solutions e.U.";
+
+//
+// Fills in everything not depending on the remote device
+//
+static NTSTATUS
+BthPS3_PDO_DescriptorInit(
+	_Out_ PBTHPS3_PDO_DESCRIPTOR Descriptor,
+	_In_ PCWSTR Description,
+	_In_ const GUID* BusEnumGuid,
+	_In_ const GUID* RawDeviceClassGuid,
+	_In_ USHORT VendorId,
+	_In_ USHORT ProductId
+)
+{
+	NTSTATUS status;
+	UNICODE_STRING guidString = { 0 };
+
+	Descriptor->Description = Description;
+	Descriptor->VendorId = VendorId;
+	Descriptor->ProductId = ProductId;
+	Descriptor->RawDeviceClassGuid = RawDeviceClassGuid;
+
+	if (!NT_SUCCESS(status = RtlStringFromGUID(BusEnumGuid, &guidString)))
+	{
+		TraceError(
+			TRACE_BUSLOGIC,
+			"RtlStringFromGUID failed with status %!STATUS!",
+			status
+		);
+		return status;
+	}
+
+	status = RtlStringCchPrintfW(
+		Descriptor->HardwareId,
+		ARRAYSIZE(Descriptor->HardwareId),
+		L"%ws\\%wZ&Dev&VID_%04X&PID_%04X",
+		BthPS3BusEnumeratorName,
+		&guidString,
+		VendorId,
+		ProductId
+	);
+
+	RtlFreeUnicodeString(&guidString);
+
+	if (!NT_SUCCESS(status))
+	{
+		TraceError(
+			TRACE_BUSLOGIC,
+			"RtlStringCchPrintfW failed for hardwareId with status %!STATUS!",
+			status
+		);
+		return status;
+	}
+
+	const Pdo_DevicePropertyEntry properties[PdoPropertyCount] =
+	{
+		{
+			{sizeof(WDF_DEVICE_PROPERTY_DATA), &DEVPKEY_Bluetooth_DeviceVID, LOCALE_NEUTRAL, PLUGPLAY_PROPERTY_PERSISTENT},
+			DEVPROP_TYPE_UINT16,
+			&Descriptor->VendorId,
+			sizeof(USHORT),
+			FALSE,
+			NULL
+		},
+		{
+			{sizeof(WDF_DEVICE_PROPERTY_DATA), &DEVPKEY_Bluetooth_DevicePID, LOCALE_NEUTRAL, PLUGPLAY_PROPERTY_PERSISTENT},
+			DEVPROP_TYPE_UINT16,
+			&Descriptor->ProductId,
+			sizeof(USHORT),
+			FALSE,
+			NULL
+		},
+		{
+			{sizeof(WDF_DEVICE_PROPERTY_DATA), &DEVPKEY_Bluetooth_DeviceAddress, LOCALE_NEUTRAL, PLUGPLAY_PROPERTY_PERSISTENT},
+			DEVPROP_TYPE_STRING,
+			NULL,
+			BTHPS3_BTH_ADDR_MAX_CHARS * sizeof(WCHAR),
+			FALSE,
+			NULL
+		},
+		{
+			{sizeof(WDF_DEVICE_PROPERTY_DATA), &DEVPKEY_BluetoothRadio_Address, LOCALE_NEUTRAL, PLUGPLAY_PROPERTY_PERSISTENT},
+			DEVPROP_TYPE_UINT64,
+			NULL,
+			sizeof(UINT64),
+			FALSE,
+			NULL
+		},
+		{
+			{sizeof(WDF_DEVICE_PROPERTY_DATA), &DEVPKEY_Device_FriendlyName, LOCALE_NEUTRAL, PLUGPLAY_PROPERTY_PERSISTENT},
+			DEVPROP_TYPE_STRING,
+			NULL,
+			0,
+			FALSE,
+			NULL
+		},
+		{
+			{sizeof(WDF_DEVICE_PROPERTY_DATA), &DEVPKEY_Bluetooth_DeviceManufacturer, LOCALE_NEUTRAL, PLUGPLAY_PROPERTY_PERSISTENT},
+			DEVPROP_TYPE_STRING,
+			(PVOID)G_PdoManufacturer,
+			(ULONG)(wcslen(G_PdoManufacturer) * sizeof(WCHAR)) + sizeof(L'\0'),
+			FALSE,
+			NULL
+		},
+		{
+			{sizeof(WDF_DEVICE_PROPERTY_DATA), &DEVPKEY_Bluetooth_LastConnectedTime, LOCALE_NEUTRAL, PLUGPLAY_PROPERTY_PERSISTENT},
+			DEVPROP_TYPE_FILETIME,
+			NULL,
+			sizeof(LARGE_INTEGER),
+			FALSE,
+			NULL
+		},
+	};
+
+	RtlCopyMemory(Descriptor->Properties, properties, sizeof(properties));
+
+	return STATUS_SUCCESS;
+}
+
+//
+// Builds the per device type descriptor table, called once from DriverEntry
+//
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+BthPS3_PDO_DescriptorsInit(
+	VOID
+)
+{
+	NTSTATUS status;
+
+	FuncEntry(TRACE_BUSLOGIC);
+
+	do
+	{
+		if (!NT_SUCCESS(status = BthPS3_PDO_DescriptorInit(
+			&G_PdoDescriptors[DS_DEVICE_TYPE_SIXAXIS],
+			L"PLAYSTATION(R)3 Controller",
+			&GUID_BUSENUM_BTHPS3_SIXAXIS,
+			&GUID_DEVCLASS_BTHPS3_SIXAXIS,
+			BTHPS3_SIXAXIS_VID,
+			BTHPS3_SIXAXIS_PID
+		)))
+		{
+			break;
+		}
+
+		if (!NT_SUCCESS(status = BthPS3_PDO_DescriptorInit(
+			&G_PdoDescriptors[DS_DEVICE_TYPE_NAVIGATION],
+			L"Navigation Controller",
+			&GUID_BUSENUM_BTHPS3_NAVIGATION,
+			&GUID_DEVCLASS_BTHPS3_NAVIGATION,
+			BTHPS3_NAVIGATION_VID,
+			BTHPS3_NAVIGATION_PID
+		)))
+		{
+			break;
+		}
+
+		if (!NT_SUCCESS(status = BthPS3_PDO_DescriptorInit(
+			&G_PdoDescriptors[DS_DEVICE_TYPE_MOTION],
+			L"Motion Controller",
+			&GUID_BUSENUM_BTHPS3_MOTION,
+			&GUID_DEVCLASS_BTHPS3_MOTION,
+			BTHPS3_MOTION_VID,
+			BTHPS3_MOTION_PID
+		)))
+		{
+			break;
+		}
+
+		if (!NT_SUCCESS(status = BthPS3_PDO_DescriptorInit(
+			&G_PdoDescriptors[DS_DEVICE_TYPE_WIRELESS],
+			L"Wireless Controller",
+			&GUID_BUSENUM_BTHPS3_WIRELESS,
+			&GUID_DEVCLASS_BTHPS3_WIRELESS,
+			BTHPS3_WIRELESS_VID,
+			BTHPS3_WIRELESS_PID
+		)))
+		{
+			break;
+		}
+
+	} while (FALSE);
+
+	FuncExit(TRACE_BUSLOGIC, "status=%!STATUS!", status);
+
+	return status;
+}
+
+//
+// Returns the descriptor for a device type, NULL if unsupported
+//
+// Entries not built by BthPS3_PDO_DescriptorsInit count as unsupported
+// instead of plugging a PDO without hardware ID
+//
+PCBTHPS3_PDO_DESCRIPTOR
+BthPS3_PDO_GetDescriptor(
+	_In_ DS_DEVICE_TYPE DeviceType
+)
+{
+	if (DeviceType <= DS_DEVICE_TYPE_UNKNOWN || DeviceType > DS_DEVICE_TYPE_WIRELESS)
+	{
+		return NULL;
+	}
+
+	if (G_PdoDescriptors[DeviceType].HardwareId[0] == L'\0')
+	{
+		return NULL;
+	}
+
+	return &G_PdoDescriptors[DeviceType];
+}
@@ -138,7 +138,7 @@ BthPS3_PDO_HandleHidControlWrite(
 }
 
 //
-// Handles IOCTL_BTHPS3_HID_INTERRUPT_READ
+// Handles IOCTL_BTHPS3_HID_INTERRUPT_READ and IOCTL_BTHPS3_HID_INTERRUPT_READ_TIMESTAMPED
 // 
 NTSTATUS
 BthPS3_PDO_HandleHidInterruptRead(
@@ -378,6 +378,215 @@ BthPS3_PDO_HandleBthDisconnect(
 }
 
 
+//
+// Handles IOCTL_BTHPS3_HID_CONTROL_TRANSACTION
+// 
+NTSTATUS
+BthPS3_PDO_HandleHidControlTransaction(
+	_In_ DMFMODULE DmfModule,
+	_In_ WDFQUEUE Queue,
+	_In_ WDFREQUEST Request,
+	_In_ ULONG IoctlCode,
+	_In_reads_(InputBufferSize) VOID* InputBuffer,
+	_In_ size_t InputBufferSize,
+	_Out_writes_(OutputBufferSize) VOID* OutputBuffer,
+	_In_ size_t OutputBufferSize,
+	_Out_ size_t* BytesReturned
+)
+{
+	UNREFERENCED_PARAMETER(Queue);
+	UNREFERENCED_PARAMETER(IoctlCode);
+	UNREFERENCED_PARAMETER(OutputBuffer);
+	UNREFERENCED_PARAMETER(OutputBufferSize);
+	UNREFERENCED_PARAMETER(InputBuffer);
+	UNREFERENCED_PARAMETER(InputBufferSize);
+
+	FuncEntry(TRACE_BUSLOGIC);
+
+	NTSTATUS status;
+	const WDFDEVICE device = DMF_ParentDeviceGet(DmfModule);
+	const PBTHPS3_PDO_CONTEXT pPdoCtx = GetPdoContext(device);
+
+	*BytesReturned = 0;
+
+	if (!NT_SUCCESS(status = WdfRequestForwardToIoQueue(
+		Request,
+		pPdoCtx->Queues.HidControlTransactionRequests
+	)))
+	{
+		TraceError(
+			TRACE_BUSLOGIC,
+			"WdfRequestForwardToIoQueue failed with status %!STATUS!",
+			status
+		);
+	}
+	else status = STATUS_PENDING;
+
+	FuncExit(TRACE_BUSLOGIC, "status=%!STATUS!", status);
+
+	return status;
+}
+
+//
+// Copies the parameters and counters of a channel
+// 
+static VOID
+BthPS3_PDO_GetChannelStats(
+	_In_ PBTHPS3_CLIENT_L2CAP_CHANNEL Channel,
+	_Out_ PBTHPS3_CHANNEL_STATS Stats
+)
+{
+	Stats->Mtu = Channel->Profile.Mtu;
+	Stats->FlushTimeout = Channel->Profile.FlushTimeout;
+	Stats->LinkTimeout = Channel->Profile.LinkTimeout;
+	Stats->IncomingQueueDepth = Channel->Profile.IncomingQueueDepth;
+	Stats->QueueDepthReached = (ULONG)InterlockedCompareExchange(&Channel->QueueDepthReached, 0, 0);
+
+	L2CAP_PS3_ChannelGetConfig(Channel, Stats);
+}
+
+//
+// Handles IOCTL_BTHPS3_GET_CHANNEL_INFO
+// 
+NTSTATUS
+BthPS3_PDO_HandleGetChannelInfo(
+	_In_ DMFMODULE DmfModule,
+	_In_ WDFQUEUE Queue,
+	_In_ WDFREQUEST Request,
+	_In_ ULONG IoctlCode,
+	_In_reads_(InputBufferSize) VOID* InputBuffer,
+	_In_ size_t InputBufferSize,
+	_Out_writes_(OutputBufferSize) VOID* OutputBuffer,
+	_In_ size_t OutputBufferSize,
+	_Out_ size_t* BytesReturned
+)
+{
+	UNREFERENCED_PARAMETER(Queue);
+	UNREFERENCED_PARAMETER(Request);
+	UNREFERENCED_PARAMETER(IoctlCode);
+	UNREFERENCED_PARAMETER(InputBuffer);
+	UNREFERENCED_PARAMETER(InputBufferSize);
+	UNREFERENCED_PARAMETER(OutputBufferSize);
+
+	FuncEntry(TRACE_BUSLOGIC);
+
+	const WDFDEVICE device = DMF_ParentDeviceGet(DmfModule);
+	const PBTHPS3_PDO_CONTEXT pPdoCtx = GetPdoContext(device);
+	const PBTHPS3_CHANNEL_INFO pInfo = OutputBuffer;
+
+	BthPS3_PDO_GetChannelStats(&pPdoCtx->HidControlChannel, &pInfo->HidControl);
+	BthPS3_PDO_GetChannelStats(&pPdoCtx->HidInterruptChannel, &pInfo->HidInterrupt);
+
+	*BytesReturned = sizeof(BTHPS3_CHANNEL_INFO);
+
+	FuncExitNoReturn(TRACE_BUSLOGIC);
+
+	return STATUS_SUCCESS;
+}
+
+//
+// Completes all queued HID requests and stops accepting new ones
+// 
+// Requests already sent to the radio are cancelled along with the channel
+// close, see L2CAP_PS3_CancelTransfers.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthPS3_PDO_PurgeQueues(
+	_In_ PBTHPS3_PDO_CONTEXT PdoContext
+)
+{
+	const WDFQUEUE queues[] =
+	{
+		PdoContext->Queues.HidControlReadRequests,
+		PdoContext->Queues.HidControlWriteRequests,
+		PdoContext->Queues.HidInterruptReadRequests,
+		PdoContext->Queues.HidInterruptWriteRequests,
+		PdoContext->Queues.HidControlTransactionRequests
+	};
+
+	for (ULONG index = 0; index < ARRAYSIZE(queues); index++)
+	{
+		if (queues[index] != NULL)
+		{
+			WdfIoQueuePurge(queues[index], NULL, NULL);
+		}
+	}
+
+	TraceVerbose(
+		TRACE_BUSLOGIC,
+		"Purged queues of device %012llX",
+		PdoContext->RemoteAddress
+	);
+}
+
+//
+// Checks if an interrupt read request expects BTHPS3_HID_INTERRUPT_READ_HEADER
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+BthPS3_PDO_IsTimestampedInterruptRead(
+	_In_ WDFREQUEST Request
+)
+{
+	WDF_REQUEST_PARAMETERS params;
+
+	WDF_REQUEST_PARAMETERS_INIT(&params);
+	WdfRequestGetParameters(Request, &params);
+
+	return (params.Type == WdfRequestTypeDeviceControl
+		&& params.Parameters.DeviceIoControl.IoControlCode == IOCTL_BTHPS3_HID_INTERRUPT_READ_TIMESTAMPED);
+}
+
+//
+// Checks if an input report equals the last delivered one within the hold time
+// 
+// Reports not considered duplicates become the new comparison reference
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+BthPS3_PDO_IsDuplicateInputReport(
+	_In_ PBTHPS3_PDO_CONTEXT PdoContext,
+	_In_reads_bytes_(Length) PUCHAR Report,
+	_In_ size_t Length
+)
+{
+	BOOLEAN isDuplicate = FALSE;
+
+	if (!PdoContext->InputReportFilter.Enabled
+		|| Length != BTHPS3_SIXAXIS_HID_INPUT_REPORT_SIZE)
+	{
+		return FALSE;
+	}
+
+	const ULONGLONG now = KeQueryInterruptTime();
+
+	WdfSpinLockAcquire(PdoContext->InputReportFilter.Lock);
+
+	if (PdoContext->InputReportFilter.IsLastReportValid
+		&& BthPS3_ReportFilterIsDuplicate(
+			Report,
+			PdoContext->InputReportFilter.LastReport,
+			PdoContext->InputReportFilter.Mask,
+			Length,
+			now - PdoContext->InputReportFilter.LastDelivered,
+			PdoContext->InputReportFilter.HoldTimeMs
+		))
+	{
+		isDuplicate = TRUE;
+	}
+	else
+	{
+		RtlCopyMemory(PdoContext->InputReportFilter.LastReport, Report, Length);
+		PdoContext->InputReportFilter.LastDelivered = now;
+		PdoContext->InputReportFilter.IsLastReportValid = TRUE;
+	}
+
+	WdfSpinLockRelease(PdoContext->InputReportFilter.Lock);
+
+	return isDuplicate;
+}
+
 //
 // Sends pending HID Control Read Requests through L2CAP channel to remote device
 // 
@@ -422,6 +631,15 @@ BthPS3_PDO_DispatchHidControlRead(
 			L2CAP_PS3_AsyncReadControlTransferCompleted
 		)))
 		{
+			//
+			// A transaction took the channel and stopped the queue meanwhile,
+			// hand the request back, retrieving only succeeds again once it ended
+			// 
+			if (status == STATUS_DEVICE_BUSY && NT_SUCCESS(WdfRequestRequeue(request)))
+			{
+				continue;
+			}
+
 			TraceError(
 				TRACE_BUSLOGIC,
 				"L2CAP_PS3_ReadControlTransferAsync failed with status %!STATUS!",
@@ -530,6 +748,21 @@ BthPS3_PDO_DispatchHidInterruptRead(
 			continue;
 		}
 
+		//
+		// Leave room for the header, it gets filled on completion
+		// 
+		if (BthPS3_PDO_IsTimestampedInterruptRead(request))
+		{
+			if (length <= sizeof(BTHPS3_HID_INTERRUPT_READ_HEADER))
+			{
+				WdfRequestComplete(request, STATUS_BUFFER_TOO_SMALL);
+				continue;
+			}
+
+			buffer = (PUCHAR)buffer + sizeof(BTHPS3_HID_INTERRUPT_READ_HEADER);
+			length -= sizeof(BTHPS3_HID_INTERRUPT_READ_HEADER);
+		}
+
 		if (!NT_SUCCESS(status = L2CAP_PS3_ReadInterruptTransferAsync(
 			pPdoCtx,
 			request,
@@ -609,3 +842,76 @@ BthPS3_PDO_DispatchHidInterruptWrite(
 
 	FuncExitNoReturn(TRACE_BUSLOGIC);
 }
+
+//
+// Sends pending HID Control Transaction Requests through L2CAP channel to remote device
+// 
+// The control channel allows a single outstanding transaction, so requests are
+// processed in arrival order and the next one is started from the completion
+// of the current one.
+// 
+VOID
+BthPS3_PDO_DispatchHidControlTransaction(
+	_In_ WDFQUEUE Queue,
+	_In_ WDFCONTEXT Context
+)
+{
+	FuncEntry(TRACE_BUSLOGIC);
+
+	const PBTHPS3_PDO_CONTEXT pPdoCtx = Context;
+	NTSTATUS status;
+	WDFREQUEST request = NULL;
+	ULONG queuedRequests = 0;
+
+	while (InterlockedCompareExchange(&pPdoCtx->ControlTransaction.InFlight, 1, 0) == 0)
+	{
+		//
+		// Keep requests queued while the channel is down, reconnect notifies us again
+		// 
+		if (L2CAP_PS3_ChannelGetState(&pPdoCtx->HidControlChannel) != ConnectionStateConnected)
+		{
+			InterlockedExchange(&pPdoCtx->ControlTransaction.InFlight, 0);
+			break;
+		}
+
+		if (!NT_SUCCESS(status = WdfIoQueueRetrieveNextRequest(Queue, &request)))
+		{
+			InterlockedExchange(&pPdoCtx->ControlTransaction.InFlight, 0);
+
+			if (status != STATUS_NO_MORE_ENTRIES)
+			{
+				break;
+			}
+
+			//
+			// A request queued before the flag got cleared would not notify us again
+			// 
+			(void)WdfIoQueueGetState(Queue, &queuedRequests, NULL);
+
+			if (queuedRequests == 0)
+			{
+				break;
+			}
+
+			continue;
+		}
+
+		if (!NT_SUCCESS(status = L2CAP_PS3_StartControlTransaction(
+			pPdoCtx,
+			request
+		)))
+		{
+			TraceError(
+				TRACE_BUSLOGIC,
+				"L2CAP_PS3_StartControlTransaction failed with status %!STATUS!",
+				status
+			);
+
+			WdfRequestComplete(request, status);
+			L2CAP_PS3_EndControlTransaction(pPdoCtx);
+			continue;
+		}
+	}
+
+	FuncExitNoReturn(TRACE_BUSLOGIC);
+}
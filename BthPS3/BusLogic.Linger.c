@@ -0,0 +1,187 @@
+#include "Driver.h"
+#include "BusLogic.Linger.tmh"
+#include "BthPS3ETW.h"
+
+
+//
+// Keeps the PDO of a disconnected device plugged in for Linger.TimeoutMs
+// 
+// Pending requests stay queued until the device reconnects or the timer
+// expires and destroys the PDO. Returns FALSE if lingering is disabled.
+// 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+BOOLEAN
+BthPS3_PDO_EnterLinger(
+	_In_ PBTHPS3_PDO_CONTEXT PdoContext
+)
+{
+	if (PdoContext->Linger.TimeoutMs == 0)
+	{
+		return FALSE;
+	}
+
+	if (InterlockedCompareExchange(
+		&PdoContext->Linger.State,
+		LingerStateLingering,
+		LingerStateActive
+	) != LingerStateActive)
+	{
+		//
+		// Already lingering or about to get destroyed
+		// 
+		return TRUE;
+	}
+
+	TraceInformation(
+		TRACE_BUSLOGIC,
+		"Device %012llX disconnected, keeping PDO for %d ms",
+		PdoContext->RemoteAddress,
+		PdoContext->Linger.TimeoutMs
+	);
+
+	//
+	// Stop dispatching, requests get held in the queues until reconnect
+	// 
+	(void)WdfIoQueueReadyNotify(PdoContext->Queues.HidControlReadRequests, NULL, NULL);
+	(void)WdfIoQueueReadyNotify(PdoContext->Queues.HidControlWriteRequests, NULL, NULL);
+	(void)WdfIoQueueReadyNotify(PdoContext->Queues.HidControlTransactionRequests, NULL, NULL);
+	(void)WdfIoQueueReadyNotify(PdoContext->Queues.HidInterruptReadRequests, NULL, NULL);
+	(void)WdfIoQueueReadyNotify(PdoContext->Queues.HidInterruptWriteRequests, NULL, NULL);
+
+	//
+	// First report after reconnect must not be suppressed
+	// 
+	WdfSpinLockAcquire(PdoContext->InputReportFilter.Lock);
+	PdoContext->InputReportFilter.IsLastReportValid = FALSE;
+	WdfSpinLockRelease(PdoContext->InputReportFilter.Lock);
+
+	(void)WdfTimerStart(
+		PdoContext->Linger.Timer,
+		WDF_REL_TIMEOUT_IN_MS(PdoContext->Linger.TimeoutMs)
+	);
+
+	return TRUE;
+}
+
+//
+// Claims a lingering PDO for a new connection of the same device
+// 
+// Returns the state before the call; only LingerStateLingering means the PDO
+// has been claimed, LingerStateExpired means it is being destroyed.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BTHPS3_LINGER_STATE
+BthPS3_PDO_LeaveLinger(
+	_In_ PBTHPS3_PDO_CONTEXT PdoContext
+)
+{
+	const BTHPS3_LINGER_STATE state = (BTHPS3_LINGER_STATE)InterlockedCompareExchange(
+		&PdoContext->Linger.State,
+		LingerStateActive,
+		LingerStateLingering
+	);
+
+	if (state == LingerStateLingering)
+	{
+		(void)WdfTimerStop(PdoContext->Linger.Timer, FALSE);
+
+		TraceInformation(
+			TRACE_BUSLOGIC,
+			"Device %012llX reconnected, reusing PDO (serial: %d)",
+			PdoContext->RemoteAddress,
+			PdoContext->SerialNumber
+		);
+	}
+
+	return state;
+}
+
+//
+// Updates connect latency statistics once both channels are established
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthPS3_PDO_RecordConnectLatency(
+	_In_ PBTHPS3_PDO_CONTEXT PdoContext
+)
+{
+	const ULONGLONG startedAt = PdoContext->Linger.ConnectStartedAt;
+
+	if (startedAt == 0)
+	{
+		return;
+	}
+
+	PdoContext->Linger.ConnectStartedAt = 0;
+
+	//
+	// Interrupt time is in 100ns units
+	// 
+	const LONG64 latencyUs = (LONG64)((KeQueryInterruptTime() - startedAt) / 10);
+	const PBTHPS3_CONNECT_LATENCY_STATS stats = PdoContext->Linger.IsWarmConnect
+		? &PdoContext->DevCtxHdr->ConnectLatency.Warm
+		: &PdoContext->DevCtxHdr->ConnectLatency.Cold;
+
+	InterlockedIncrement(&stats->Count);
+	InterlockedAdd64(&stats->TotalUs, latencyUs);
+
+	LONG64 max = stats->MaxUs;
+
+	while (latencyUs > max)
+	{
+		const LONG64 prev = InterlockedCompareExchange64(&stats->MaxUs, latencyUs, max);
+
+		if (prev == max)
+		{
+			break;
+		}
+
+		max = prev;
+	}
+
+	TraceInformation(
+		TRACE_BUSLOGIC,
+		"Device %012llX connected in %lld us (warm: %d)",
+		PdoContext->RemoteAddress,
+		latencyUs,
+		PdoContext->Linger.IsWarmConnect
+	);
+
+	EventWriteRemoteDeviceConnectLatency(
+		NULL,
+		PdoContext->RemoteAddress,
+		PdoContext->Linger.IsWarmConnect,
+		(UINT64)latencyUs
+	);
+}
+
+//
+// Device didn't come back in time, remove PDO
+// 
+_Use_decl_annotations_
+VOID
+BthPS3_PDO_EvtLingerTimerFunc(
+	WDFTIMER Timer
+)
+{
+	const PBTHPS3_PDO_CONTEXT pPdoCtx = GetPdoContext(WdfTimerGetParentObject(Timer));
+
+	FuncEntry(TRACE_BUSLOGIC);
+
+	if (InterlockedCompareExchange(
+		&pPdoCtx->Linger.State,
+		LingerStateExpired,
+		LingerStateLingering
+	) == LingerStateLingering)
+	{
+		TraceInformation(
+			TRACE_BUSLOGIC,
+			"Device %012llX didn't reconnect in time, destroying PDO",
+			pPdoCtx->RemoteAddress
+		);
+
+		BthPS3_PDO_Destroy(pPdoCtx->DevCtxHdr, pPdoCtx);
+	}
+
+	FuncExitNoReturn(TRACE_BUSLOGIC);
+}
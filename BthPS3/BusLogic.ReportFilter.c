@@ -0,0 +1,82 @@
+#include "Driver.h"
+
+
+//
+// Input report bytes relevant for duplicate detection (including 0xA1 header)
+// 
+// SIXAXIS and NAVIGATION share a layout, accelerometer and gyro values
+// at the end of the report are masked out as they're never stable
+// 
+static const UCHAR G_SixaxisInputReportMask[BTHPS3_SIXAXIS_HID_INPUT_REPORT_SIZE] =
+{
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+//
+// MOTION only keeps buttons and trigger, the lower nibble of byte 5 is a
+// sequence number and everything past the trigger is time and sensor data
+// 
+static const UCHAR G_MotionInputReportMask[BTHPS3_SIXAXIS_HID_INPUT_REPORT_SIZE] =
+{
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0, 0xFF, 0xFF, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+//
+// Gets the duplicate detection mask for a device type, NULL if unsupported
+// 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+const UCHAR*
+BthPS3_PDO_GetInputReportMask(
+	_In_ DS_DEVICE_TYPE DeviceType
+)
+{
+	switch (DeviceType)
+	{
+	case DS_DEVICE_TYPE_SIXAXIS:
+	case DS_DEVICE_TYPE_NAVIGATION:
+		return G_SixaxisInputReportMask;
+	case DS_DEVICE_TYPE_MOTION:
+		return G_MotionInputReportMask;
+	default:
+		//
+		// WIRELESS reports don't match the fixed report size
+		// 
+		return NULL;
+	}
+}
+
+//
+// Compares an input report against the last delivered one
+// 
+// Only depends on its arguments, the caller owns the reference report and
+// its delivery time. Elapsed is in 100ns units like KeQueryInterruptTime.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+BthPS3_ReportFilterIsDuplicate(
+	_In_reads_bytes_(Length) const UCHAR* Report,
+	_In_reads_bytes_(Length) const UCHAR* LastReport,
+	_In_reads_bytes_(Length) const UCHAR* Mask,
+	_In_ size_t Length,
+	_In_ ULONGLONG Elapsed,
+	_In_ ULONG HoldTimeMs
+)
+{
+	//
+	// Held long enough, deliver even if unchanged so consumers see the device is alive
+	// 
+	if (Elapsed >= (ULONGLONG)HoldTimeMs * 10000)
+	{
+		return FALSE;
+	}
+
+	return MemoryUtil_IsEqualMasked(Report, LastReport, Mask, Length);
+}
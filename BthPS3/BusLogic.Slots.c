@@ -2,31 +2,261 @@
 #include "BusLogic.Slots.tmh"
 
 
+static EVT_WDF_WORKITEM BthPS3_SlotsEvtPersist;
+
+
 //
-// Gets a stored slot/serial/index number for a given remote address or selects a free one
+// Converts a Devices\%012llX sub-key name back into a remote address
+// 
+static BOOLEAN
+BthPS3_SlotsParseAddress(
+	_In_reads_(Length) PCWCH Name,
+	_In_ ULONG Length,
+	_Out_ PBTH_ADDR Address
+)
+{
+	*Address = 0;
+
+	if (Length != BTH_ADDR_HEX_LEN)
+	{
+		return FALSE;
+	}
+
+	for (ULONG i = 0; i < Length; i++)
+	{
+		const WCHAR c = Name[i];
+		ULONG nibble;
+
+		if (c >= L'0' && c <= L'9')
+		{
+			nibble = c - L'0';
+		}
+		else if (c >= L'A' && c <= L'F')
+		{
+			nibble = c - L'A' + 10;
+		}
+		else if (c >= L'a' && c <= L'f')
+		{
+			nibble = c - L'a' + 10;
+		}
+		else
+		{
+			return FALSE;
+		}
+
+		*Address = (*Address << 4) | nibble;
+	}
+
+	return *Address != 0;
+}
+
+//
+// Imports slots stored by previous versions in Devices\%012llX\SlotNo
+// 
+#pragma code_seg("PAGE")
+static ULONG
+BthPS3_SlotsImportLegacy(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	WDFKEY ParametersKey
+)
+{
+	NTSTATUS status;
+	WDFKEY hDevicesKey = NULL;
+	ULONG imported = 0;
+	UCHAR buffer[sizeof(KEY_BASIC_INFORMATION) + (BTHPS3_BTH_ADDR_MAX_CHARS * sizeof(WCHAR))];
+	const PKEY_BASIC_INFORMATION info = (PKEY_BASIC_INFORMATION)buffer;
+	ULONG resultLength;
+	LARGE_INTEGER now;
+
+	PAGED_CODE();
+
+	KeQuerySystemTime(&now);
+
+	DECLARE_CONST_UNICODE_STRING(devices, BTHPS3_REG_KEY_DEVICES);
+	DECLARE_CONST_UNICODE_STRING(slotNo, BTHPS3_REG_VALUE_SLOT_NO);
+
+	if (!NT_SUCCESS(WdfRegistryOpenKey(
+		ParametersKey,
+		&devices,
+		KEY_READ,
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&hDevicesKey
+	)))
+	{
+		return 0;
+	}
+
+	for (ULONG index = 0; ; index++)
+	{
+		WDFKEY hDeviceKey = NULL;
+		UNICODE_STRING deviceKeyName;
+		BTH_ADDR address;
+		ULONG slot;
+
+		status = ZwEnumerateKey(
+			WdfRegistryWdmGetHandle(hDevicesKey),
+			index,
+			KeyBasicInformation,
+			info,
+			sizeof(buffer),
+			&resultLength
+		);
+
+		if (status == STATUS_NO_MORE_ENTRIES)
+		{
+			break;
+		}
+
+		//
+		// Not one of ours if the name doesn't fit
+		// 
+		if (!NT_SUCCESS(status)
+			|| !BthPS3_SlotsParseAddress(info->Name, info->NameLength / sizeof(WCHAR), &address))
+		{
+			continue;
+		}
+
+		deviceKeyName.Buffer = info->Name;
+		deviceKeyName.Length = deviceKeyName.MaximumLength = (USHORT)info->NameLength;
+
+		if (!NT_SUCCESS(WdfRegistryOpenKey(
+			hDevicesKey,
+			&deviceKeyName,
+			KEY_READ,
+			WDF_NO_OBJECT_ATTRIBUTES,
+			&hDeviceKey
+		)))
+		{
+			continue;
+		}
+
+		status = WdfRegistryQueryULong(hDeviceKey, &slotNo, &slot);
+
+		WdfRegistryClose(hDeviceKey);
+
+		if (!NT_SUCCESS(status)
+			|| slot == 0 /* invalid value */ || slot > BTHPS3_MAX_NUM_DEVICES
+			|| Header->SlotAddresses[slot] != 0)
+		{
+			continue;
+		}
+
+		Header->SlotAddresses[slot] = address;
+		Header->SlotLastSeen[slot] = now.QuadPart;
+		SetBit(Header->Slots, slot);
+		imported++;
+	}
+
+	WdfRegistryClose(hDevicesKey);
+
+	return imported;
+}
+#pragma code_seg()
+
+//
+// Opens (or creates) the Parameters\Devices key
+// 
+// Writing here doesn't trigger a settings reload, the Parameters watch isn't recursive.
+// 
+#pragma code_seg("PAGE")
+static NTSTATUS
+BthPS3_SlotsOpenDevicesKey(
+	_In_ ACCESS_MASK DesiredAccess,
+	_Out_ WDFKEY* Key
+)
+{
+	NTSTATUS status;
+	WDFKEY hParametersKey = NULL;
+
+	PAGED_CODE();
+
+	DECLARE_CONST_UNICODE_STRING(devices, BTHPS3_REG_KEY_DEVICES);
+
+	*Key = NULL;
+
+	if (!NT_SUCCESS(status = WdfDriverOpenParametersRegistryKey(
+		WdfGetDriver(),
+		KEY_READ | KEY_CREATE_SUB_KEY,
+		WDF_NO_OBJECT_ATTRIBUTES,
+		&hParametersKey
+	)))
+	{
+		TraceError(
+			TRACE_BUSLOGIC,
+			"WdfDriverOpenParametersRegistryKey failed with status %!STATUS!",
+			status
+		);
+		return status;
+	}
+
+	if (!NT_SUCCESS(status = WdfRegistryCreateKey(
+		hParametersKey,
+		&devices,
+		DesiredAccess,
+		REG_OPTION_NON_VOLATILE,
+		NULL,
+		WDF_NO_OBJECT_ATTRIBUTES,
+		Key
+	)))
+	{
+		TraceError(
+			TRACE_BUSLOGIC,
+			"WdfRegistryCreateKey failed with status %!STATUS!",
+			status
+		);
+	}
+
+	WdfRegistryClose(hParametersKey);
+
+	return status;
+}
+#pragma code_seg()
+
+//
+// Loads all cached slot assignments into memory, called once on device creation
 // 
 #pragma code_seg("PAGE")
 _IRQL_requires_max_(PASSIVE_LEVEL)
 NTSTATUS
-BthPS3_PDO_QuerySlot(
-	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
-	BTH_ADDR RemoteAddress,
-	PULONG Slot
+BthPS3_SlotsInit(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header
 )
 {
 	NTSTATUS status;
+	WDF_OBJECT_ATTRIBUTES attributes;
+	WDF_WORKITEM_CONFIG workItemCfg;
 	WDFKEY hKey = NULL;
-	WDFKEY hDeviceKey = NULL;
+	WDFKEY hDevicesKey = NULL;
+	WDFMEMORY slotMapMemory = NULL;
+	ULONG type = REG_NONE;
 
 	FuncEntry(TRACE_BUSLOGIC);
 
 	PAGED_CODE();
 
-	DECLARE_UNICODE_STRING_SIZE(deviceKeyName, REG_CACHED_DEVICE_KEY_FMT_LEN);
-	DECLARE_CONST_UNICODE_STRING(slotNo, BTHPS3_REG_VALUE_SLOT_NO);
+	DECLARE_CONST_UNICODE_STRING(slotMap, BTHPS3_REG_VALUE_SLOT_MAP);
+	DECLARE_CONST_UNICODE_STRING(devices, BTHPS3_REG_KEY_DEVICES);
 
 	do
 	{
+		WDF_WORKITEM_CONFIG_INIT(&workItemCfg, BthPS3_SlotsEvtPersist);
+		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+		attributes.ParentObject = Header->Device;
+
+		if (!NT_SUCCESS(status = WdfWorkItemCreate(
+			&workItemCfg,
+			&attributes,
+			&Header->SlotsPersistWorkItem
+		)))
+		{
+			TraceError(
+				TRACE_BUSLOGIC,
+				"WdfWorkItemCreate failed with status %!STATUS!",
+				status
+			);
+			break;
+		}
+
 		//
 		// Open
 		//   HKEY_LOCAL_MACHINE\SYSTEM\CurrentControlSet\Services\BthPS3\Parameters
@@ -34,7 +264,7 @@ BthPS3_PDO_QuerySlot(
 		// 
 		if (!NT_SUCCESS(status = WdfDriverOpenParametersRegistryKey(
 			WdfGetDriver(),
-			STANDARD_RIGHTS_READ,
+			KEY_READ,
 			WDF_NO_OBJECT_ATTRIBUTES,
 			&hKey
 		)))
@@ -47,110 +277,293 @@ BthPS3_PDO_QuerySlot(
 			break;
 		}
 
-		if (!NT_SUCCESS(status = RtlUnicodeStringPrintf(
-			&deviceKeyName,
-			REG_CACHED_DEVICE_KEY_FMT,
-			RemoteAddress
-		)))
-		{
-			TraceError(
-				TRACE_BUSLOGIC,
-				"RtlUnicodeStringPrintf failed with status %!STATUS!",
-				status
-			);
-			break;
-		}
-
 		//
-		// Try to get cached value
+		// Current location first, then the map earlier builds kept in Parameters itself
 		// 
 		if (NT_SUCCESS(WdfRegistryOpenKey(
 			hKey,
-			&deviceKeyName,
-			GENERIC_READ,
+			&devices,
+			KEY_READ,
 			WDF_NO_OBJECT_ATTRIBUTES,
-			&hDeviceKey
-		))
-			&& NT_SUCCESS(status = WdfRegistryQueryULong(
-				hDeviceKey,
-				&slotNo,
-				Slot
+			&hDevicesKey
+		)))
+		{
+			if (!NT_SUCCESS(WdfRegistryQueryMemory(
+				hDevicesKey,
+				&slotMap,
+				PagedPool,
+				WDF_NO_OBJECT_ATTRIBUTES,
+				&slotMapMemory,
+				&type
 			)))
+			{
+				slotMapMemory = NULL;
+			}
+		}
+
+		if (slotMapMemory == NULL && NT_SUCCESS(WdfRegistryQueryMemory(
+			hKey,
+			&slotMap,
+			PagedPool,
+			WDF_NO_OBJECT_ATTRIBUTES,
+			&slotMapMemory,
+			&type
+		)))
+		{
+			Header->SlotsDirty = TRUE;
+		}
+
+		if (slotMapMemory != NULL && type == REG_BINARY)
 		{
+			size_t size;
+			const PBTHPS3_SLOT_MAP_RECORD records = WdfMemoryGetBuffer(slotMapMemory, &size);
+
+			for (size_t index = 0; index < size / sizeof(BTHPS3_SLOT_MAP_RECORD); index++)
+			{
+				const ULONG slot = BTHPS3_SLOT_MAP_SLOT(records[index].SlotAndAddress);
+				const BTH_ADDR address = BTHPS3_SLOT_MAP_ADDR(records[index].SlotAndAddress);
+
+				if (slot == 0 /* invalid value */ || slot > BTHPS3_MAX_NUM_DEVICES || address == 0)
+				{
+					continue;
+				}
+
+				Header->SlotAddresses[slot] = address;
+				Header->SlotLastSeen[slot] = records[index].LastSeen;
+				SetBit(Header->Slots, slot);
+			}
+
 			TraceVerbose(
 				TRACE_BUSLOGIC,
-				"Found cached serial"
+				"Loaded %d cached slot(s)",
+				(ULONG)(size / sizeof(BTHPS3_SLOT_MAP_RECORD))
 			);
 
 			//
-			// Validate
+			// Move a map found in Parameters
 			// 
-			if (*Slot == 0 /* invalid value */ || *Slot > BTHPS3_MAX_NUM_DEVICES)
+			if (Header->SlotsDirty)
 			{
-				status = STATUS_INVALID_PARAMETER;
-				break;
+				WdfWorkItemEnqueue(Header->SlotsPersistWorkItem);
 			}
 
-			WdfWaitLockAcquire(Header->SlotsLock, NULL);
-
-			SetBit(Header->Slots, *Slot);
+			break;
+		}
 
-			WdfWaitLockRelease(Header->SlotsLock);
+		Header->SlotsDirty = FALSE;
 
-			status = STATUS_SUCCESS;
+		//
+		// No map yet, convert from previous layout once
+		// 
+		if (BthPS3_SlotsImportLegacy(Header, hKey) > 0)
+		{
+			Header->SlotsDirty = TRUE;
+			WdfWorkItemEnqueue(Header->SlotsPersistWorkItem);
 		}
+
+	} while (FALSE);
+
+	if (slotMapMemory)
+	{
+		WdfObjectDelete(slotMapMemory);
+	}
+
+	if (hDevicesKey)
+	{
+		WdfRegistryClose(hDevicesKey);
+	}
+
+	if (hKey)
+	{
+		WdfRegistryClose(hKey);
+	}
+
+	FuncExit(TRACE_BUSLOGIC, "status=%!STATUS!", status);
+
+	return status;
+}
+#pragma code_seg()
+
+//
+// Waits for pending slot map writes to hit the registry
+// 
+#pragma code_seg("PAGE")
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+BthPS3_SlotsFlush(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header
+)
+{
+	PAGED_CODE();
+
+	if (Header->SlotsPersistWorkItem)
+	{
+		WdfWorkItemFlush(Header->SlotsPersistWorkItem);
+	}
+}
+#pragma code_seg()
+
+//
+// Returns the lowest slot not marked in the bitmap, 0 if all are taken
+// 
+static ULONG
+BthPS3_SlotsFindFree(
+	_In_reads_(Words) const UINT32* Bitmap,
+	_In_ ULONG Words
+)
+{
+	for (ULONG word = 0; word < Words; word++)
+	{
+		ULONG bit;
+		ULONG free = ~Bitmap[word];
+
 		//
-		// Get next free one
+		// Slot 0 is invalid
 		// 
-		else
+		if (word == 0)
 		{
-			TraceVerbose(
-				TRACE_BUSLOGIC,
-				"Looking for free serial"
-			);
+			free &= ~1UL;
+		}
 
-			WdfWaitLockAcquire(Header->SlotsLock, NULL);
+		if (_BitScanForward(&bit, free))
+		{
+			const ULONG slot = word * 32 + bit;
 
-			//
-			// ...otherwise get next free serial number
-			// 
-			for (*Slot = 1; *Slot <= BTHPS3_MAX_NUM_DEVICES; (*Slot)++)
-			{
-				if (!TestBit(Header->Slots, *Slot))
-				{
-					TraceVerbose(
-						TRACE_BUSLOGIC,
-						"Assigned serial: %d",
-						*Slot
-					);
+			return slot <= BTHPS3_MAX_NUM_DEVICES ? slot : 0;
+		}
+	}
 
-					SetBit(Header->Slots, *Slot);
+	return 0;
+}
 
-					status = STATUS_SUCCESS;
-					break;
-				}
-			}
+//
+// Takes the slot of the least recently seen device not currently connected
+// 
+// Caller must hold SlotsLock. Returns 0 if every slot is in use or being assigned.
+// 
+static ULONG
+BthPS3_SlotsReclaimOldest(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header
+)
+{
+	ULONG oldest = 0;
 
-			if (*Slot > BTHPS3_MAX_NUM_DEVICES)
-			{
-				status = STATUS_NO_MORE_ENTRIES;
-			}
+	for (ULONG slot = 1; slot <= BTHPS3_MAX_NUM_DEVICES; slot++)
+	{
+		//
+		// Reserved by a PDO creation in progress, its PDO isn't in the clients table yet
+		// 
+		if (TestBit(Header->SlotsReserved, slot) || Header->SlotAddresses[slot] == 0)
+		{
+			continue;
+		}
 
-			WdfWaitLockRelease(Header->SlotsLock);
+		if (oldest != 0 && Header->SlotLastSeen[slot] >= Header->SlotLastSeen[oldest])
+		{
+			continue;
 		}
 
-	} while (FALSE);
+		const PBTHPS3_PDO_CONTEXT pPdoCtx = BthPS3_ClientsTable_LookupAndReference(
+			Header,
+			Header->SlotAddresses[slot]
+		);
 
-	if (hKey)
+		if (pPdoCtx != NULL)
+		{
+			WdfObjectDereference(WdfObjectContextGetObject(pPdoCtx));
+			continue;
+		}
+
+		oldest = slot;
+	}
+
+	if (oldest != 0)
 	{
-		WdfRegistryClose(hKey);
+		TraceInformation(
+			TRACE_BUSLOGIC,
+			"Reclaiming slot %d of device %012llX (last seen: %lld)",
+			oldest,
+			Header->SlotAddresses[oldest],
+			Header->SlotLastSeen[oldest]
+		);
+
+		Header->SlotAddresses[oldest] = 0;
+	}
+
+	return oldest;
+}
+
+//
+// Gets a stored slot/serial/index number for a given remote address or selects a free one
+// 
+// If all slots are taken, the one of the least recently seen disconnected device is reused.
+// The slot stays reserved until BthPS3_PDO_ReleaseSlot, so it can't get reclaimed meanwhile.
+// 
+#pragma code_seg("PAGE")
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+BthPS3_PDO_QuerySlot(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	BTH_ADDR RemoteAddress,
+	PULONG Slot
+)
+{
+	NTSTATUS status = STATUS_NO_MORE_ENTRIES;
+	ULONG slot;
+	LARGE_INTEGER now;
+
+	FuncEntry(TRACE_BUSLOGIC);
+
+	PAGED_CODE();
+
+	KeQuerySystemTime(&now);
+
+	WdfWaitLockAcquire(Header->SlotsLock, NULL);
+
+	for (slot = 1; slot <= BTHPS3_MAX_NUM_DEVICES; slot++)
+	{
+		if (Header->SlotAddresses[slot] == RemoteAddress)
+		{
+			TraceVerbose(
+				TRACE_BUSLOGIC,
+				"Found cached serial"
+			);
+
+			break;
+		}
 	}
 
-	if (hDeviceKey)
+	//
+	// ...otherwise get next free serial number
+	// 
+	if (slot > BTHPS3_MAX_NUM_DEVICES)
 	{
-		WdfRegistryClose(hDeviceKey);
+		slot = BthPS3_SlotsFindFree(Header->Slots, ARRAYSIZE(Header->Slots));
+
+		if (slot == 0)
+		{
+			slot = BthPS3_SlotsReclaimOldest(Header);
+		}
+
+		TraceVerbose(
+			TRACE_BUSLOGIC,
+			"Assigned serial: %d",
+			slot
+		);
+	}
+
+	if (slot != 0)
+	{
+		SetBit(Header->Slots, slot);
+		SetBit(Header->SlotsReserved, slot);
+		Header->SlotLastSeen[slot] = now.QuadPart;
+
+		*Slot = slot;
+		status = STATUS_SUCCESS;
 	}
 
+	WdfWaitLockRelease(Header->SlotsLock);
+
 	FuncExit(TRACE_BUSLOGIC, "status=%!STATUS!", status);
 
 	return status;
@@ -158,7 +571,7 @@ BthPS3_PDO_QuerySlot(
 #pragma code_seg()
 
 //
-// Caches an occupied slot in the registry
+// Caches an occupied slot, the registry gets updated in the background
 // 
 #pragma code_seg("PAGE")
 _IRQL_requires_max_(PASSIVE_LEVEL)
@@ -168,114 +581,168 @@ BthPS3_PDO_AssignSlot(
 	BTH_ADDR RemoteAddress,
 	ULONG Slot
 )
+{
+	FuncEntry(TRACE_BUSLOGIC);
+
+	PAGED_CODE();
+
+	if (Slot == 0 /* invalid value */ || Slot > BTHPS3_MAX_NUM_DEVICES)
+	{
+		FuncExit(TRACE_BUSLOGIC, "status=%!STATUS!", STATUS_INVALID_PARAMETER);
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	WdfWaitLockAcquire(Header->SlotsLock, NULL);
+
+	SetBit(Header->Slots, Slot);
+	Header->SlotAddresses[Slot] = RemoteAddress;
+
+	WdfWaitLockRelease(Header->SlotsLock);
+
+	//
+	// Also persists the updated last seen time
+	// 
+	InterlockedExchange(&Header->SlotsDirty, TRUE);
+	WdfWorkItemEnqueue(Header->SlotsPersistWorkItem);
+
+	FuncExit(TRACE_BUSLOGIC, "status=%!STATUS!", STATUS_SUCCESS);
+
+	return STATUS_SUCCESS;
+}
+#pragma code_seg()
+
+//
+// Ends the reservation taken by BthPS3_PDO_QuerySlot, on success or failure of the PDO creation
+// 
+// A slot that never got assigned to a device becomes free again. Releasing a
+// slot not reserved anymore is ignored, it may already be handed out again.
+// 
+#pragma code_seg("PAGE")
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+BthPS3_PDO_ReleaseSlot(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	ULONG Slot
+)
+{
+	PAGED_CODE();
+
+	if (Slot == 0 /* invalid value */ || Slot > BTHPS3_MAX_NUM_DEVICES)
+	{
+		return;
+	}
+
+	WdfWaitLockAcquire(Header->SlotsLock, NULL);
+
+	if (!TestBit(Header->SlotsReserved, Slot))
+	{
+		TraceEvents(TRACE_LEVEL_WARNING,
+			TRACE_BUSLOGIC,
+			"Slot %d released without reservation",
+			Slot
+		);
+
+		WdfWaitLockRelease(Header->SlotsLock);
+		return;
+	}
+
+	ClearBit(Header->SlotsReserved, Slot);
+
+	if (Header->SlotAddresses[Slot] == 0)
+	{
+		TraceVerbose(
+			TRACE_BUSLOGIC,
+			"Freeing unassigned slot %d",
+			Slot
+		);
+
+		ClearBit(Header->Slots, Slot);
+	}
+
+	WdfWaitLockRelease(Header->SlotsLock);
+}
+#pragma code_seg()
+
+//
+// Writes all slot assignments as one binary value into Parameters\Devices
+// 
+#pragma code_seg("PAGE")
+_Use_decl_annotations_
+VOID
+BthPS3_SlotsEvtPersist(
+	WDFWORKITEM WorkItem
+)
 {
 	NTSTATUS status;
+	const PBTHPS3_DEVICE_CONTEXT_HEADER header =
+		&GetServerDeviceContext(WdfWorkItemGetParentObject(WorkItem))->Header;
 	WDFKEY hKey = NULL;
-	WDFKEY hDeviceKey = NULL;
+	WDFMEMORY recordsMemory = NULL;
+	PBTHPS3_SLOT_MAP_RECORD records;
+	ULONG count = 0;
 
 	FuncEntry(TRACE_BUSLOGIC);
 
 	PAGED_CODE();
 
-	DECLARE_UNICODE_STRING_SIZE(deviceKeyName, REG_CACHED_DEVICE_KEY_FMT_LEN);
-	DECLARE_CONST_UNICODE_STRING(slotNo, BTHPS3_REG_VALUE_SLOT_NO);
-	DECLARE_CONST_UNICODE_STRING(slots, BTHPS3_REG_VALUE_SLOTS);
+	DECLARE_CONST_UNICODE_STRING(slotMap, BTHPS3_REG_VALUE_SLOT_MAP);
 
 	do
 	{
-		if (Slot == 0 /* invalid value */ || Slot > BTHPS3_MAX_NUM_DEVICES)
-		{
-			status = STATUS_INVALID_PARAMETER;
-			break;
-		}
-
 		//
-		// Open
-		//   HKEY_LOCAL_MACHINE\SYSTEM\CurrentControlSet\Services\BthPS3\Parameters
-		// key
+		// Changes after this point re-enqueue us
 		// 
-		if (!NT_SUCCESS(status = WdfDriverOpenParametersRegistryKey(
-			WdfGetDriver(),
-			STANDARD_RIGHTS_ALL,
-			WDF_NO_OBJECT_ATTRIBUTES,
-			&hKey
-		)))
+		if (!InterlockedExchange(&header->SlotsDirty, FALSE))
 		{
-			TraceError(
-				TRACE_BUSLOGIC,
-				"WdfDriverOpenParametersRegistryKey failed with status %!STATUS!",
-				status
-			);
+			status = STATUS_SUCCESS;
 			break;
 		}
 
-		if (!NT_SUCCESS(status = RtlUnicodeStringPrintf(
-			&deviceKeyName,
-			REG_CACHED_DEVICE_KEY_FMT,
-			RemoteAddress
+		if (!NT_SUCCESS(status = WdfMemoryCreate(
+			WDF_NO_OBJECT_ATTRIBUTES,
+			PagedPool,
+			POOLTAG_BTHPS3,
+			BTHPS3_MAX_NUM_DEVICES * sizeof(BTHPS3_SLOT_MAP_RECORD),
+			&recordsMemory,
+			(PVOID*)&records
 		)))
 		{
 			TraceError(
 				TRACE_BUSLOGIC,
-				"RtlUnicodeStringPrintf failed with status %!STATUS!",
+				"WdfMemoryCreate failed with status %!STATUS!",
 				status
 			);
 			break;
 		}
 
-		//
-		// Create key for device
-		// 
-		if (!NT_SUCCESS(status = WdfRegistryCreateKey(
-			hKey,
-			&deviceKeyName,
-			GENERIC_WRITE,
-			REG_OPTION_NON_VOLATILE,
-			NULL,
-			WDF_NO_OBJECT_ATTRIBUTES,
-			&hDeviceKey
-		)))
+		WdfWaitLockAcquire(header->SlotsLock, NULL);
+
+		for (ULONG slot = 1; slot <= BTHPS3_MAX_NUM_DEVICES; slot++)
 		{
-			TraceError(
-				TRACE_BUSLOGIC,
-				"WdfRegistryCreateKey failed with status %!STATUS!",
-				status
-			);
-			break;
+			if (header->SlotAddresses[slot] != 0)
+			{
+				records[count].SlotAndAddress = BTHPS3_SLOT_MAP_PACK(slot, header->SlotAddresses[slot]);
+				records[count].LastSeen = header->SlotLastSeen[slot];
+				count++;
+			}
 		}
 
+		WdfWaitLockRelease(header->SlotsLock);
+
 		//
-		// Store serial value
+		// Not in Parameters itself, every write there reloads the settings
 		// 
-		if (!NT_SUCCESS(status = WdfRegistryAssignULong(
-			hDeviceKey,
-			&slotNo,
-			Slot
-		)))
+		if (!NT_SUCCESS(status = BthPS3_SlotsOpenDevicesKey(KEY_WRITE, &hKey)))
 		{
-			TraceError(
-				TRACE_BUSLOGIC,
-				"WdfRegistryAssignULong failed with status %!STATUS!",
-				status
-			);
 			break;
 		}
 
-		WdfWaitLockAcquire(Header->SlotsLock, NULL);
-
-		SetBit(Header->Slots, Slot);
-
-		WdfWaitLockRelease(Header->SlotsLock);
-
-		//
-		// Store occupied slots in registry
-		// 
 		if (!NT_SUCCESS(status = WdfRegistryAssignValue(
 			hKey,
-			&slots,
+			&slotMap,
 			REG_BINARY,
-			sizeof(Header->Slots),
-			&Header->Slots
+			count * sizeof(BTHPS3_SLOT_MAP_RECORD),
+			records
 		)))
 		{
 			TraceError(
@@ -286,20 +753,32 @@ BthPS3_PDO_AssignSlot(
 			break;
 		}
 
+		TraceVerbose(
+			TRACE_BUSLOGIC,
+			"Persisted %d slot(s)",
+			count
+		);
+
 	} while (FALSE);
 
+	//
+	// Try again with the next change
+	// 
+	if (!NT_SUCCESS(status))
+	{
+		InterlockedExchange(&header->SlotsDirty, TRUE);
+	}
+
 	if (hKey)
 	{
 		WdfRegistryClose(hKey);
 	}
 
-	if (hDeviceKey)
+	if (recordsMemory)
 	{
-		WdfRegistryClose(hDeviceKey);
+		WdfObjectDelete(recordsMemory);
 	}
 
 	FuncExit(TRACE_BUSLOGIC, "status=%!STATUS!", status);
-
-	return status;
 }
 #pragma code_seg()
@@ -55,19 +55,11 @@ BthPS3_PDO_EvtPreCreate(
 
 	NTSTATUS status = STATUS_SUCCESS;
 	WDF_PNPPOWER_EVENT_CALLBACKS power;
-	WDFKEY hKey = NULL;
-	ULONG rawPdo = 0;
-	ULONG adminOnlyPdo = 0;
-	ULONG exclusivePdo = 1;
+	WDF_OBJECT_ATTRIBUTES requestAttributes;
 
-	UNREFERENCED_PARAMETER(DmfModule);
 	UNREFERENCED_PARAMETER(DmfDeviceInit);
 	UNREFERENCED_PARAMETER(PdoRecord);
 
-	DECLARE_CONST_UNICODE_STRING(rawPdoValue, BTHPS3_REG_VALUE_RAW_PDO);
-	DECLARE_CONST_UNICODE_STRING(adminOnlyPdoValue, BTHPS3_REG_VALUE_ADMIN_ONLY_PDO);
-	DECLARE_CONST_UNICODE_STRING(exclusivePdoValue, BTHPS3_REG_VALUE_EXCLUSIVE_PDO);
-
 	WdfDeviceInitSetDeviceType(DeviceInit, FILE_DEVICE_BUS_EXTENDER);
 
 	//
@@ -81,70 +73,32 @@ BthPS3_PDO_EvtPreCreate(
 
 	WdfDeviceInitSetPnpPowerEventCallbacks(DeviceInit, &power);
 
-	do
-	{
-		//
-		// Open
-		//   HKEY_LOCAL_MACHINE\SYSTEM\CurrentControlSet\Services\BthPS3\Parameters
-		// key
-		// 
-		if (!NT_SUCCESS(status = WdfDriverOpenParametersRegistryKey(
-			WdfGetDriver(),
-			STANDARD_RIGHTS_READ,
-			WDF_NO_OBJECT_ATTRIBUTES,
-			&hKey
-		)))
-		{
-			TraceError(
-				TRACE_BUSLOGIC,
-				"WdfDriverOpenParametersRegistryKey failed with status %!STATUS!",
-				status
-			);
-
-			status = STATUS_SUCCESS;
-			break;
-		}
-
-		//
-		// Don't care, if it fails, keep default value
-		// 
-		(void)WdfRegistryQueryULong(
-			hKey,
-			&rawPdoValue,
-			&rawPdo
-		);
+	//
+	// Used to track HID requests while they're sent to the radio
+	// 
+	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&requestAttributes, BTHPS3_TRANSFER_CONTEXT);
 
-		//
-		// Don't care, if it fails, keep default value
-		// 
-		(void)WdfRegistryQueryULong(
-			hKey,
-			&adminOnlyPdoValue,
-			&adminOnlyPdo
-		);
+	WdfDeviceInitSetRequestAttributes(DeviceInit, &requestAttributes);
 
-		//
-		// Don't care, if it fails, keep default value
-		// 
-		(void)WdfRegistryQueryULong(
-			hKey,
-			&exclusivePdoValue,
-			&exclusivePdo
-		);
+	const PBTHPS3_SETTINGS settings = BthPS3_SettingsAcquire(
+		GetServerDeviceContext(DMF_ParentDeviceGet(DmfModule))
+	);
 
-		if (rawPdo)
+	do
+	{
+		if (settings->RawPDO)
 		{
 			//
 			// Only one instance (either function driver or user-land application)
 			// may talk to this PDO at the same time to avoid splitting traffic.
 			// 
-			WdfDeviceInitSetExclusive(DeviceInit, (BOOLEAN)exclusivePdo);
+			WdfDeviceInitSetExclusive(DeviceInit, (BOOLEAN)settings->ExclusivePDO);
 
 			//
 			// Let the world talk to us
 			// 
 			status = WdfDeviceInitAssignSDDLString(DeviceInit,
-				(adminOnlyPdo) ? &SDDL_DEVOBJ_SYS_ALL_ADM_ALL : // only elevated allowed
+				(settings->AdminOnlyPDO) ? &SDDL_DEVOBJ_SYS_ALL_ADM_ALL : // only elevated allowed
 				&SDDL_DEVOBJ_SYS_ALL_ADM_RWX_WORLD_RWX_RES_RWX  // everyone is allowed
 			);
 
@@ -161,10 +115,7 @@ BthPS3_PDO_EvtPreCreate(
 
 	} while (FALSE);
 
-	if (hKey)
-	{
-		WdfRegistryClose(hKey);
-	}
+	BthPS3_SettingsRelease(settings);
 
 	FuncExit(TRACE_BUSLOGIC, "status=%!STATUS!", status);
 
@@ -188,12 +139,7 @@ BthPS3_PDO_EvtPostCreate(
 	WDF_OBJECT_ATTRIBUTES attributes;
 	WDF_IO_QUEUE_CONFIG queueCfg;
 	WDF_DEVICE_PNP_CAPABILITIES pnp;
-	WDFKEY hKey = NULL;
-	ULONG hidePdo = 0;
 
-	DECLARE_CONST_UNICODE_STRING(hidePdoValue, BTHPS3_REG_VALUE_HIDE_PDO);
-
-	UNREFERENCED_PARAMETER(DmfModule);
 	UNREFERENCED_PARAMETER(DmfDeviceInit);
 	UNREFERENCED_PARAMETER(PdoRecord);
 
@@ -269,36 +215,26 @@ BthPS3_PDO_EvtPostCreate(
 			break;
 		}
 
-		//
-		// Open
-		//   HKEY_LOCAL_MACHINE\SYSTEM\CurrentControlSet\Services\BthPS3\Parameters
-		// key
-		// 
-		if (!NT_SUCCESS(status = WdfDriverOpenParametersRegistryKey(
-			WdfGetDriver(),
-			STANDARD_RIGHTS_READ,
-			WDF_NO_OBJECT_ATTRIBUTES,
-			&hKey
+		if (!NT_SUCCESS(status = WdfIoQueueCreate(
+			ChildDevice,
+			&queueCfg,
+			&attributes,
+			&pPdoCtx->Queues.HidControlTransactionRequests
 		)))
 		{
 			TraceError(
 				TRACE_BUSLOGIC,
-				"WdfDriverOpenParametersRegistryKey failed with status %!STATUS!",
+				"WdfIoQueueCreate (HidControlTransactionRequests) failed with status %!STATUS!",
 				status
 			);
-
-			status = STATUS_SUCCESS;
 			break;
 		}
 
-		//
-		// Don't care, if it fails, keep default value
-		// 
-		(void)WdfRegistryQueryULong(
-			hKey,
-			&hidePdoValue,
-			&hidePdo
+		const PBTHPS3_SETTINGS settings = BthPS3_SettingsAcquire(
+			GetServerDeviceContext(DMF_ParentDeviceGet(DmfModule))
 		);
+		const ULONG hidePdo = settings->HidePDO;
+		BthPS3_SettingsRelease(settings);
 
 		if (hidePdo) 
 		{
@@ -312,11 +248,6 @@ BthPS3_PDO_EvtPostCreate(
 
 	} while (FALSE);
 
-	if (hKey)
-	{
-		WdfRegistryClose(hKey);
-	}
-
 	FuncExit(TRACE_BUSLOGIC, "status=%!STATUS!", status);
 
 	return status;
@@ -356,44 +287,15 @@ BthPS3_PDO_SelfManagedIoInit(
 
 	NTSTATUS status;
 	WDF_DEVICE_POWER_POLICY_IDLE_SETTINGS idleSettings;
-	WDFKEY hKey = NULL;
-	ULONG idleTimeout = 10000; // 10 secs idle timeout
 
-	DECLARE_CONST_UNICODE_STRING(idleTimeoutValue, BTHPS3_REG_VALUE_CHILD_IDLE_TIMEOUT);
+	const PBTHPS3_SETTINGS settings = BthPS3_SettingsAcquire(
+		GetServerDeviceContext(WdfPdoGetParent(Device))
+	);
+	const ULONG idleTimeout = settings->ChildIdleTimeout;
+	BthPS3_SettingsRelease(settings);
 
 	do
 	{
-		//
-		// Open
-		//   HKEY_LOCAL_MACHINE\SYSTEM\CurrentControlSet\Services\BthPS3\Parameters
-		// key
-		// 
-		if (!NT_SUCCESS(status = WdfDriverOpenParametersRegistryKey(
-			WdfGetDriver(),
-			STANDARD_RIGHTS_READ,
-			WDF_NO_OBJECT_ATTRIBUTES,
-			&hKey
-		)))
-		{
-			TraceError(
-				TRACE_BUSLOGIC,
-				"WdfDriverOpenParametersRegistryKey failed with status %!STATUS!",
-				status
-			);
-
-			status = STATUS_SUCCESS;
-			break;
-		}
-
-		//
-		// Don't care, if it fails, keep default value
-		// 
-		(void)WdfRegistryQueryULong(
-			hKey,
-			&idleTimeoutValue,
-			&idleTimeout
-		);
-
 		//
 		// Idle settings
 		// 
@@ -428,9 +330,9 @@ BthPS3_PDO_SelfManagedIoInit(
 
 	} while (FALSE);
 
-	if (hKey)
+	if (NT_SUCCESS(status))
 	{
-		WdfRegistryClose(hKey);
+		BthPS3_PDO_TimelineMark(GetPdoContext(Device), BTHPS3_CONNECT_PHASE_PDO_READY);
 	}
 
 	FuncExit(TRACE_BUSLOGIC, "status=%!STATUS!", status);
@@ -0,0 +1,273 @@
+#include "Driver.h"
+#include "BusLogic.Timeline.tmh"
+#include "BthPS3ETW.h"
+
+
+//
+// Converts phase timestamps to microseconds since the indication
+// 
+static VOID
+BthPS3_TimelineFill(
+	_Out_ PBTHPS3_CONNECT_TIMELINE Timeline,
+	_In_ UINT64 RemoteAddress,
+	_In_ BOOLEAN IsWarm,
+	_In_ NTSTATUS Status,
+	_In_reads_(BTHPS3_CONNECT_PHASE_COUNT) const ULONGLONG* At
+)
+{
+	Timeline->RemoteAddress = RemoteAddress;
+	Timeline->IsWarm = IsWarm;
+	Timeline->Status = Status;
+
+	for (ULONG phase = 0; phase < BTHPS3_CONNECT_PHASE_COUNT; phase++)
+	{
+		//
+		// Interrupt time is in 100ns units
+		// 
+		Timeline->PhaseUs[phase] = (At[phase] == 0)
+			? BTHPS3_CONNECT_PHASE_SKIPPED
+			: (ULONG)min((At[phase] - At[BTHPS3_CONNECT_PHASE_INDICATED]) / 10, MAXULONG - 1);
+	}
+}
+
+//
+// Stores a timeline, overwriting the oldest one once full
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+static VOID
+BthPS3_TimelineStore(
+	_In_ PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	_In_ const BTHPS3_CONNECT_TIMELINE* Timeline
+)
+{
+	const KIRQL irql = ExAcquireSpinLockExclusive(&Header->ConnectTimelines.Lock);
+
+	Header->ConnectTimelines.Entries[Header->ConnectTimelines.Next] = *Timeline;
+	Header->ConnectTimelines.Next = (Header->ConnectTimelines.Next + 1) % BTHPS3_CONNECT_TIMELINES_MAX;
+
+	if (Header->ConnectTimelines.Count < BTHPS3_CONNECT_TIMELINES_MAX)
+	{
+		Header->ConnectTimelines.Count++;
+	}
+
+	ExReleaseSpinLockExclusive(&Header->ConnectTimelines.Lock, irql);
+}
+
+//
+// Reports the timeline once the device is ready to operate
+// 
+// Cold connects are ready when both the interrupt channel and the PDO are up,
+// warm ones only wait for the interrupt channel.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+static VOID
+BthPS3_PDO_TimelineComplete(
+	_In_ PBTHPS3_PDO_CONTEXT PdoContext
+)
+{
+	const PBTHPS3_DEVICE_CONTEXT_HEADER header = PdoContext->DevCtxHdr;
+	BTHPS3_CONNECT_TIMELINE timeline;
+	ULONGLONG at[BTHPS3_CONNECT_PHASE_COUNT];
+
+	for (ULONG phase = 0; phase < BTHPS3_CONNECT_PHASE_COUNT; phase++)
+	{
+		at[phase] = (ULONGLONG)InterlockedCompareExchange64(&PdoContext->Timeline.At[phase], 0, 0);
+	}
+
+	if (at[BTHPS3_CONNECT_PHASE_INDICATED] == 0 || at[BTHPS3_CONNECT_PHASE_INTERRUPT_CONNECTED] == 0)
+	{
+		return;
+	}
+
+	if (!PdoContext->Timeline.IsWarm && at[BTHPS3_CONNECT_PHASE_PDO_READY] == 0)
+	{
+		return;
+	}
+
+	if (InterlockedCompareExchange(&PdoContext->Timeline.Completed, TRUE, FALSE) != FALSE)
+	{
+		return;
+	}
+
+	BthPS3_TimelineFill(
+		&timeline,
+		PdoContext->RemoteAddress,
+		PdoContext->Timeline.IsWarm,
+		STATUS_SUCCESS,
+		at
+	);
+
+	BthPS3_TimelineStore(header, &timeline);
+
+	const ULONG readyUs = timeline.IsWarm
+		? timeline.PhaseUs[BTHPS3_CONNECT_PHASE_INTERRUPT_CONNECTED]
+		: max(timeline.PhaseUs[BTHPS3_CONNECT_PHASE_INTERRUPT_CONNECTED], timeline.PhaseUs[BTHPS3_CONNECT_PHASE_PDO_READY]);
+
+	TraceInformation(
+		TRACE_BUSLOGIC,
+		"Device %012llX ready after %d us (warm: %d, name: %d, identified: %d, slot: %d, plugged: %d, control: %d, interrupt: %d, PDO: %d)",
+		timeline.RemoteAddress,
+		readyUs,
+		timeline.IsWarm,
+		timeline.PhaseUs[BTHPS3_CONNECT_PHASE_NAME_RESOLVED],
+		timeline.PhaseUs[BTHPS3_CONNECT_PHASE_DEVICE_IDENTIFIED],
+		timeline.PhaseUs[BTHPS3_CONNECT_PHASE_SLOT_ASSIGNED],
+		timeline.PhaseUs[BTHPS3_CONNECT_PHASE_PDO_PLUGGED],
+		timeline.PhaseUs[BTHPS3_CONNECT_PHASE_CONTROL_CONNECTED],
+		timeline.PhaseUs[BTHPS3_CONNECT_PHASE_INTERRUPT_CONNECTED],
+		timeline.PhaseUs[BTHPS3_CONNECT_PHASE_PDO_READY]
+	);
+
+	EventWriteRemoteDeviceConnectTimeline(
+		NULL,
+		timeline.RemoteAddress,
+		timeline.IsWarm,
+		timeline.PhaseUs[BTHPS3_CONNECT_PHASE_NAME_RESOLVED],
+		timeline.PhaseUs[BTHPS3_CONNECT_PHASE_DEVICE_IDENTIFIED],
+		timeline.PhaseUs[BTHPS3_CONNECT_PHASE_SLOT_ASSIGNED],
+		timeline.PhaseUs[BTHPS3_CONNECT_PHASE_PDO_PLUGGED],
+		timeline.PhaseUs[BTHPS3_CONNECT_PHASE_CONTROL_CONNECTED],
+		timeline.PhaseUs[BTHPS3_CONNECT_PHASE_INTERRUPT_CONNECTED],
+		timeline.PhaseUs[BTHPS3_CONNECT_PHASE_PDO_READY]
+	);
+}
+
+//
+// Begins a new timeline with the phases passed before the PDO context was available
+// 
+// Phases not passed yet must be zero. On cold connects PDO_READY is kept as
+// it may have been reached already between plugging the PDO and this call.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthPS3_PDO_TimelineStart(
+	_In_ PBTHPS3_PDO_CONTEXT PdoContext,
+	_In_ BOOLEAN IsWarm,
+	_In_reads_(BTHPS3_CONNECT_PHASE_COUNT) const ULONGLONG* Phases
+)
+{
+	PdoContext->Timeline.IsWarm = IsWarm;
+
+	for (ULONG phase = 0; phase < BTHPS3_CONNECT_PHASE_COUNT; phase++)
+	{
+		if (phase == BTHPS3_CONNECT_PHASE_PDO_READY && !IsWarm)
+		{
+			continue;
+		}
+
+		InterlockedExchange64(&PdoContext->Timeline.At[phase], (LONG64)Phases[phase]);
+	}
+
+	InterlockedExchange(&PdoContext->Timeline.Completed, FALSE);
+}
+
+//
+// Records the current time for a phase of the running timeline
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthPS3_PDO_TimelineMark(
+	_In_ PBTHPS3_PDO_CONTEXT PdoContext,
+	_In_ BTHPS3_CONNECT_PHASE Phase
+)
+{
+	if (PdoContext->Timeline.Completed)
+	{
+		return;
+	}
+
+	InterlockedExchange64(&PdoContext->Timeline.At[Phase], (LONG64)KeQueryInterruptTime());
+
+	if (Phase == BTHPS3_CONNECT_PHASE_INTERRUPT_CONNECTED || Phase == BTHPS3_CONNECT_PHASE_PDO_READY)
+	{
+		BthPS3_PDO_TimelineComplete(PdoContext);
+	}
+}
+
+//
+// Stores the timeline of a connect dropped before its device got ready
+// 
+// Covers connects which never got a PDO, e.g. denied or failed identification.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthPS3_TimelineRecordFailed(
+	_In_ PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	_In_ UINT64 RemoteAddress,
+	_In_ BOOLEAN IsWarm,
+	_In_ NTSTATUS Status,
+	_In_reads_(BTHPS3_CONNECT_PHASE_COUNT) const ULONGLONG* Phases
+)
+{
+	BTHPS3_CONNECT_TIMELINE timeline;
+
+	BthPS3_TimelineFill(&timeline, RemoteAddress, IsWarm, Status, Phases);
+
+	BthPS3_TimelineStore(Header, &timeline);
+
+	TraceInformation(
+		TRACE_BUSLOGIC,
+		"Device %012llX dropped after %d us with status %!STATUS! (warm: %d, name: %d, identified: %d)",
+		timeline.RemoteAddress,
+		(ULONG)min((KeQueryInterruptTime() - Phases[BTHPS3_CONNECT_PHASE_INDICATED]) / 10, MAXULONG - 1),
+		Status,
+		timeline.IsWarm,
+		timeline.PhaseUs[BTHPS3_CONNECT_PHASE_NAME_RESOLVED],
+		timeline.PhaseUs[BTHPS3_CONNECT_PHASE_DEVICE_IDENTIFIED]
+	);
+}
+
+//
+// Handles IOCTL_BTHPS3_GET_CONNECT_TIMELINES on the bus interface
+// 
+NTSTATUS
+BthPS3_HandleGetConnectTimelines(
+	_In_ DMFMODULE DmfModule,
+	_In_ WDFQUEUE Queue,
+	_In_ WDFREQUEST Request,
+	_In_ ULONG IoctlCode,
+	_In_reads_(InputBufferSize) VOID* InputBuffer,
+	_In_ size_t InputBufferSize,
+	_Out_writes_(OutputBufferSize) VOID* OutputBuffer,
+	_In_ size_t OutputBufferSize,
+	_Out_ size_t* BytesReturned
+)
+{
+	UNREFERENCED_PARAMETER(Queue);
+	UNREFERENCED_PARAMETER(Request);
+	UNREFERENCED_PARAMETER(IoctlCode);
+	UNREFERENCED_PARAMETER(InputBuffer);
+	UNREFERENCED_PARAMETER(InputBufferSize);
+	UNREFERENCED_PARAMETER(OutputBufferSize);
+
+	FuncEntry(TRACE_BUSLOGIC);
+
+	const WDFDEVICE device = DMF_ParentDeviceGet(DmfModule);
+	const PBTHPS3_DEVICE_CONTEXT_HEADER header = &GetServerDeviceContext(device)->Header;
+	const PBTHPS3_CONNECT_TIMELINES pTimelines = OutputBuffer;
+
+	RtlZeroMemory(pTimelines, sizeof(BTHPS3_CONNECT_TIMELINES));
+
+	const KIRQL irql = ExAcquireSpinLockShared(&header->ConnectTimelines.Lock);
+
+	pTimelines->Count = header->ConnectTimelines.Count;
+
+	for (ULONG index = 0; index < pTimelines->Count; index++)
+	{
+		//
+		// Walk backwards from the most recently stored entry
+		// 
+		const ULONG entry = (header->ConnectTimelines.Next + BTHPS3_CONNECT_TIMELINES_MAX - 1 - index)
+			% BTHPS3_CONNECT_TIMELINES_MAX;
+
+		pTimelines->Timelines[index] = header->ConnectTimelines.Entries[entry];
+	}
+
+	ExReleaseSpinLockShared(&header->ConnectTimelines.Lock, irql);
+
+	*BytesReturned = sizeof(BTHPS3_CONNECT_TIMELINES);
+
+	FuncExitNoReturn(TRACE_BUSLOGIC);
+
+	return STATUS_SUCCESS;
+}
@@ -50,6 +50,10 @@ IoctlHandler_IoctlRecord G_PDO_IoctlSpecification[] =
 	{IOCTL_BTHPS3_HID_CONTROL_WRITE, 1, 0, BthPS3_PDO_HandleHidControlWrite},
 	{IOCTL_BTHPS3_HID_INTERRUPT_READ, 0, 1, BthPS3_PDO_HandleHidInterruptRead},
 	{IOCTL_BTHPS3_HID_INTERRUPT_WRITE, 1, 0, BthPS3_PDO_HandleHidInterruptWrite},
+	{IOCTL_BTHPS3_HID_INTERRUPT_READ_TIMESTAMPED, 0, sizeof(BTHPS3_HID_INTERRUPT_READ_HEADER) + 1, BthPS3_PDO_HandleHidInterruptRead},
+	{IOCTL_BTHPS3_HID_CONTROL_TRANSACTION, sizeof(BTHPS3_HID_CONTROL_TRANSACTION) + 1, 1, BthPS3_PDO_HandleHidControlTransaction},
+	/* Diagnostics */
+	{IOCTL_BTHPS3_GET_CHANNEL_INFO, 0, sizeof(BTHPS3_CHANNEL_INFO), BthPS3_PDO_HandleGetChannelInfo},
 	/* Disconnect instruction (e.g. from DsHidMini) */
 	{IOCTL_BTH_DISCONNECT_DEVICE, sizeof(BTH_ADDR), 0, BthPS3_PDO_HandleBthDisconnect},
 };
@@ -111,6 +115,7 @@ BthPS3_PDO_Create(
 	_In_ BTH_ADDR RemoteAddress,
 	_In_ DS_DEVICE_TYPE DeviceType,
 	_In_ PSTR RemoteName,
+	_Inout_updates_(BTHPS3_CONNECT_PHASE_COUNT) PULONGLONG Phases,
 	_Outptr_result_maybenull_ BTHPS3_PDO_CONTEXT** PdoContext
 )
 {
@@ -119,19 +124,16 @@ BthPS3_PDO_Create(
 	NTSTATUS status = STATUS_SUCCESS;
 	WDF_OBJECT_ATTRIBUTES attributes;
 	PDO_RECORD record;
-	WDFDEVICE device;
-	UNICODE_STRING guidString = { 0 };
+	WDFDEVICE device = NULL;
+	BOOLEAN isInCollection = FALSE;
 	WCHAR devAddr[BTHPS3_BTH_ADDR_MAX_CHARS]; // MAC address in hex format including NULL terminator
-	PWSTR manufacturer = L"Nefarius Software Solutions e.U.";
+	const PCBTHPS3_PDO_DESCRIPTOR descriptor = BthPS3_PDO_GetDescriptor(DeviceType);
 	LARGE_INTEGER lastConnectionTime;
-	WDFKEY hKey = NULL;
-	ULONG rawPdo = 0;
+	WDF_TIMER_CONFIG timerCfg;
 
     *PdoContext = NULL;
 
-	DECLARE_UNICODE_STRING_SIZE(hardwareId, MAX_DEVICE_ID_LEN);
 	DECLARE_UNICODE_STRING_SIZE(remotenameWide, BTH_MAX_NAME_SIZE);
-	DECLARE_CONST_UNICODE_STRING(rawPdoValue, BTHPS3_REG_VALUE_RAW_PDO);
 
 	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, BTHPS3_PDO_CONTEXT);
 
@@ -149,35 +151,21 @@ BthPS3_PDO_Create(
 	record.EvtDmfDeviceModulesAdd = BthPS3_PDO_EvtDmfModulesAdd;
 
 
-	//
-	// Open
-	//   HKEY_LOCAL_MACHINE\SYSTEM\CurrentControlSet\Services\BthPS3\Parameters
-	// key
-	// 
-	status = WdfDriverOpenParametersRegistryKey(
-		WdfGetDriver(),
-		STANDARD_RIGHTS_READ,
-		WDF_NO_OBJECT_ATTRIBUTES,
-		&hKey
-	);
-
-	//
-	// On success, read configuration values
-	// 
-	if (NT_SUCCESS(status))
-	{
-		//
-		// Don't care, if it fails, keep default value
-		// 
-		(void)WdfRegistryQueryULong(
-			hKey,
-			&rawPdoValue,
-			&rawPdo
-		);
-	}
+	const PBTHPS3_SETTINGS settings = BthPS3_SettingsAcquire(Context);
 
 	do
 	{
+		if (descriptor == NULL)
+		{
+			status = STATUS_INVALID_PARAMETER;
+			TraceError(
+				TRACE_BUSLOGIC,
+				"Unsupported device type %d",
+				DeviceType
+			);
+			break;
+		}
+
 		//
 		// Get unique serial
 		// 
@@ -195,6 +183,8 @@ BthPS3_PDO_Create(
 			break;
 		}
 
+		Phases[BTHPS3_CONNECT_PHASE_SLOT_ASSIGNED] = KeQueryInterruptTime();
+
 		//
 		// Convert remote name from narrow to wide
 		// 
@@ -232,95 +222,17 @@ BthPS3_PDO_Create(
 		}
 
 		//
-		// Set these device properties for the new PDO
-		// TODO: convert from stack to heap allocated!
+		// Start from device type template, set per-device properties
 		// 
-		Pdo_DevicePropertyEntry entries[] =
-		{
-			{
-				{sizeof(WDF_DEVICE_PROPERTY_DATA), &DEVPKEY_Bluetooth_DeviceVID, LOCALE_NEUTRAL, PLUGPLAY_PROPERTY_PERSISTENT},
-				DEVPROP_TYPE_UINT16,
-				NULL,
-				sizeof(USHORT),
-				FALSE,
-				NULL
-			},
-			{
-				{sizeof(WDF_DEVICE_PROPERTY_DATA), &DEVPKEY_Bluetooth_DevicePID, LOCALE_NEUTRAL, PLUGPLAY_PROPERTY_PERSISTENT},
-				DEVPROP_TYPE_UINT16,
-				NULL,
-				sizeof(USHORT),
-				FALSE,
-				NULL
-			},
-			{
-				{sizeof(WDF_DEVICE_PROPERTY_DATA), &DEVPKEY_Bluetooth_DeviceAddress, LOCALE_NEUTRAL, PLUGPLAY_PROPERTY_PERSISTENT},
-				DEVPROP_TYPE_STRING,
-				devAddr,
-				ARRAYSIZE(devAddr) * sizeof(WCHAR),
-				FALSE,
-				NULL
-			},
-			{
-				{sizeof(WDF_DEVICE_PROPERTY_DATA), &DEVPKEY_BluetoothRadio_Address, LOCALE_NEUTRAL, PLUGPLAY_PROPERTY_PERSISTENT},
-				DEVPROP_TYPE_UINT64,
-				&Context->Header.LocalBthAddr,
-				sizeof(UINT64),
-				FALSE,
-				NULL
-			},
-			{
-				{sizeof(WDF_DEVICE_PROPERTY_DATA), &DEVPKEY_Device_FriendlyName, LOCALE_NEUTRAL, PLUGPLAY_PROPERTY_PERSISTENT},
-				DEVPROP_TYPE_STRING,
-				remotenameWide.Buffer,
-				remotenameWide.Length + sizeof(L'\0'),
-				FALSE,
-				NULL
-			},
-			{
-				{sizeof(WDF_DEVICE_PROPERTY_DATA), &DEVPKEY_Bluetooth_DeviceManufacturer, LOCALE_NEUTRAL, PLUGPLAY_PROPERTY_PERSISTENT},
-				DEVPROP_TYPE_STRING,
-				manufacturer,
-				(ULONG)(wcslen(manufacturer) * sizeof(WCHAR)) + sizeof(L'\0'),
-				FALSE,
-				NULL
-			},
-			{
-				{sizeof(WDF_DEVICE_PROPERTY_DATA), &DEVPKEY_Bluetooth_LastConnectedTime, LOCALE_NEUTRAL, PLUGPLAY_PROPERTY_PERSISTENT},
-				DEVPROP_TYPE_FILETIME,
-				&lastConnectionTime,
-				sizeof(LARGE_INTEGER),
-				FALSE,
-				NULL
-			},
-		};
+		Pdo_DevicePropertyEntry entries[PdoPropertyCount];
 
-		//
-		// Set VID/PID according to device type
-		// 
-		switch (DeviceType)
-		{
-		case DS_DEVICE_TYPE_SIXAXIS:
-			entries[0].ValueData = &BTHPS3_SIXAXIS_VID;
-			entries[1].ValueData = &BTHPS3_SIXAXIS_PID;
-			break;
-		case DS_DEVICE_TYPE_NAVIGATION:
-			entries[0].ValueData = &BTHPS3_NAVIGATION_VID;
-			entries[1].ValueData = &BTHPS3_NAVIGATION_PID;
-			break;
-		case DS_DEVICE_TYPE_MOTION:
-			entries[0].ValueData = &BTHPS3_MOTION_VID;
-			entries[1].ValueData = &BTHPS3_MOTION_PID;
-			break;
-		case DS_DEVICE_TYPE_WIRELESS:
-			entries[0].ValueData = &BTHPS3_WIRELESS_VID;
-			entries[1].ValueData = &BTHPS3_WIRELESS_PID;
-			break;
-		case DS_DEVICE_TYPE_UNKNOWN:
-		default:
-			status = STATUS_INVALID_PARAMETER;
-			break;
-		}
+		RtlCopyMemory(entries, descriptor->Properties, sizeof(entries));
+
+		entries[PdoPropertyDeviceAddress].ValueData = devAddr;
+		entries[PdoPropertyRadioAddress].ValueData = &Context->Header.LocalBthAddr;
+		entries[PdoPropertyFriendlyName].ValueData = remotenameWide.Buffer;
+		entries[PdoPropertyFriendlyName].ValueSize = remotenameWide.Length + sizeof(L'\0');
+		entries[PdoPropertyLastConnectedTime].ValueData = &lastConnectionTime;
 
 		Pdo_DeviceProperty_Table properties;
 
@@ -329,143 +241,17 @@ BthPS3_PDO_Create(
 
 		record.DeviceProperties = &properties;
 
-		//
-		// Prepare Hardware ID GUID segment and description based on device type
-		// 
-		switch (DeviceType)
-		{
-		case DS_DEVICE_TYPE_SIXAXIS:
-			record.Description = L"PLAYSTATION(R)3 Controller";
-			status = RtlStringFromGUID(&GUID_BUSENUM_BTHPS3_SIXAXIS,
-				&guidString
-			);
-			break;
-		case DS_DEVICE_TYPE_NAVIGATION:
-			record.Description = L"Navigation Controller";
-			status = RtlStringFromGUID(&GUID_BUSENUM_BTHPS3_NAVIGATION,
-				&guidString
-			);
-			break;
-		case DS_DEVICE_TYPE_MOTION:
-			record.Description = L"Motion Controller";
-			status = RtlStringFromGUID(&GUID_BUSENUM_BTHPS3_MOTION,
-				&guidString
-			);
-			break;
-		case DS_DEVICE_TYPE_WIRELESS:
-			record.Description = L"Wireless Controller";
-			status = RtlStringFromGUID(&GUID_BUSENUM_BTHPS3_WIRELESS,
-				&guidString
-			);
-			break;
-		case DS_DEVICE_TYPE_UNKNOWN:
-		default:
-			status = STATUS_INVALID_PARAMETER;
-			break;
-		}
-
-		if (!NT_SUCCESS(status))
-		{
-			TraceError(
-				TRACE_BUSLOGIC,
-				"RtlStringFromGUID failed with status %!STATUS!",
-				status
-			);
-			break;
-		}
-
-		//
-		// Build Hardware ID depending on device type
-		// 
-		switch (DeviceType)
-		{
-		case DS_DEVICE_TYPE_SIXAXIS:
-			status = RtlUnicodeStringPrintf(
-				&hardwareId,
-				L"%ws\\%wZ&Dev&VID_%04X&PID_%04X",
-				BthPS3BusEnumeratorName,
-				guidString,
-				BTHPS3_SIXAXIS_VID,
-				BTHPS3_SIXAXIS_PID
-			);
-			break;
-		case DS_DEVICE_TYPE_NAVIGATION:
-			status = RtlUnicodeStringPrintf(
-				&hardwareId,
-				L"%ws\\%wZ&Dev&VID_%04X&PID_%04X",
-				BthPS3BusEnumeratorName,
-				guidString,
-				BTHPS3_NAVIGATION_VID,
-				BTHPS3_NAVIGATION_PID
-			);
-			break;
-		case DS_DEVICE_TYPE_MOTION:
-			status = RtlUnicodeStringPrintf(
-				&hardwareId,
-				L"%ws\\%wZ&Dev&VID_%04X&PID_%04X",
-				BthPS3BusEnumeratorName,
-				guidString,
-				BTHPS3_MOTION_VID,
-				BTHPS3_MOTION_PID
-			);
-			break;
-		case DS_DEVICE_TYPE_WIRELESS:
-			status = RtlUnicodeStringPrintf(
-				&hardwareId,
-				L"%ws\\%wZ&Dev&VID_%04X&PID_%04X",
-				BthPS3BusEnumeratorName,
-				guidString,
-				BTHPS3_WIRELESS_VID,
-				BTHPS3_WIRELESS_PID
-			);
-			break;
-		case DS_DEVICE_TYPE_UNKNOWN:
-		default:
-			status = STATUS_INVALID_PARAMETER;
-			break;
-		}
-
-		if (!NT_SUCCESS(status)) {
-			TraceError(
-				TRACE_BUSLOGIC,
-				"RtlUnicodeStringPrintf failed for hardwareId with status %!STATUS!",
-				status
-			);
-			break;
-		}
-
-		//
-		// Set Hardware ID previously built
-		// 
-		record.HardwareIds[0] = hardwareId.Buffer;
+		record.Description = (PWSTR)descriptor->Description;
+		record.HardwareIds[0] = (PWSTR)descriptor->HardwareId;
 		record.HardwareIdsCount = 1;
 
 		//
 		// Expose as RAW device if told
 		// 
-		if (rawPdo)
+		if (settings->RawPDO)
 		{
 			record.RawDevice = TRUE;
-
-			switch (DeviceType)
-			{
-			case DS_DEVICE_TYPE_SIXAXIS:
-				record.RawDeviceClassGuid = &GUID_DEVCLASS_BTHPS3_SIXAXIS;
-				break;
-			case DS_DEVICE_TYPE_NAVIGATION:
-				record.RawDeviceClassGuid = &GUID_DEVCLASS_BTHPS3_NAVIGATION;
-				break;
-			case DS_DEVICE_TYPE_MOTION:
-				record.RawDeviceClassGuid = &GUID_DEVCLASS_BTHPS3_MOTION;
-				break;
-			case DS_DEVICE_TYPE_WIRELESS:
-				record.RawDeviceClassGuid = &GUID_DEVCLASS_BTHPS3_WIRELESS;
-				break;
-			case DS_DEVICE_TYPE_UNKNOWN:
-			default:
-				status = STATUS_INVALID_PARAMETER;
-				break;
-			}
+			record.RawDeviceClassGuid = descriptor->RawDeviceClassGuid;
 		}
 
 		//
@@ -485,13 +271,34 @@ BthPS3_PDO_Create(
 			break;
 		}
 
+		Phases[BTHPS3_CONNECT_PHASE_PDO_PLUGGED] = KeQueryInterruptTime();
+
+		const PBTHPS3_PDO_CONTEXT pPdoCtx = GetPdoContext(device);
+
+		//
+		// Initialize signaled, will be cleared once a connection is established.
+		// Done first so an unplug on failure below doesn't wait on them.
+		// 
+		KeInitializeEvent(&pPdoCtx->HidControlChannel.DisconnectEvent,
+			NotificationEvent,
+			TRUE
+		);
+		KeInitializeEvent(&pPdoCtx->HidInterruptChannel.DisconnectEvent,
+			NotificationEvent,
+			TRUE
+		);
+
 		//
 		// Insert PDO in connection collection
 		// 
-		if (!NT_SUCCESS(status = WdfCollectionAdd(
+		WdfWaitLockAcquire(Context->Header.ClientsLock, NULL);
+		status = WdfCollectionAdd(
 			Context->Header.Clients,
 			device
-		)))
+		);
+		WdfWaitLockRelease(Context->Header.ClientsLock);
+
+		if (!NT_SUCCESS(status))
 		{
 			TraceError(
 				TRACE_BUSLOGIC,
@@ -501,6 +308,8 @@ BthPS3_PDO_Create(
 			break;
 		}
 
+		isInCollection = TRUE;
+
 		//
 		// Persist slot information to avoid duplicates
 		// 
@@ -518,18 +327,18 @@ BthPS3_PDO_Create(
 			break;
 		}
 
-		const PBTHPS3_PDO_CONTEXT pPdoCtx = *PdoContext = GetPdoContext(device);
-
 		pPdoCtx->RemoteAddress = RemoteAddress;
 		pPdoCtx->DevCtxHdr = &Context->Header;
 		pPdoCtx->DeviceType = DeviceType;
 		pPdoCtx->SerialNumber = record.SerialNumber;
 
+		BthPS3_PDO_TimelineStart(pPdoCtx, FALSE, Phases);
+
 		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
 		attributes.ParentObject = device;
 
 		PUCHAR pBuffer = NULL;
-		const size_t hwIdByteCount = (wcslen(hardwareId.Buffer) * sizeof(WCHAR)) + sizeof(L'\0');
+		const size_t hwIdByteCount = (wcslen(descriptor->HardwareId) * sizeof(WCHAR)) + sizeof(L'\0');
 
 		//
 		// Save Hardware ID for later unplug
@@ -551,7 +360,7 @@ BthPS3_PDO_Create(
 			break;
 		}
 
-		RtlCopyMemory(pBuffer, hardwareId.Buffer, hwIdByteCount);
+		RtlCopyMemory(pBuffer, descriptor->HardwareId, hwIdByteCount);
 
 		//
 		// Initialize HidControlChannel properties
@@ -571,75 +380,130 @@ BthPS3_PDO_Create(
 			break;
 		}
 
+		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+		attributes.ParentObject = device;
+
+		pPdoCtx->HidControlChannel.Owner = pPdoCtx;
+		(void)L2CAP_PS3_ChannelTransition(&pPdoCtx->HidControlChannel, ChannelEventInitialize, NULL);
+
 		//
-		// Initialize signaled, will be cleared once a connection is established
+		// Initialize HidInterruptChannel properties
 		// 
-		KeInitializeEvent(&pPdoCtx->HidControlChannel.DisconnectEvent,
-			NotificationEvent,
-			TRUE
-		);
+
+		if (!NT_SUCCESS(status = WdfRequestCreate(
+			&attributes,
+			pPdoCtx->DevCtxHdr->IoTarget,
+			&pPdoCtx->HidInterruptChannel.ConnectDisconnectRequest
+		)))
+		{
+			TraceError(
+				TRACE_BUSLOGIC,
+				"WdfRequestCreate for HidInterruptChannel failed with status %!STATUS!",
+				status
+			);
+			break;
+		}
 
 		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
 		attributes.ParentObject = device;
 
+		pPdoCtx->HidInterruptChannel.Owner = pPdoCtx;
+		(void)L2CAP_PS3_ChannelTransition(&pPdoCtx->HidInterruptChannel, ChannelEventInitialize, NULL);
+
+		//
+		// Initialize in-flight transfer tracking
+		// 
+		// Must be ready before the clients table insert, transfers and channel
+		// closes of a PDO found there take this lock.
+		// 
+
 		if (!NT_SUCCESS(status = WdfSpinLockCreate(
 			&attributes,
-			&pPdoCtx->HidControlChannel.ConnectionStateLock
+			&pPdoCtx->TransfersInFlight.Lock
 		)))
 		{
 			TraceError(
 				TRACE_BUSLOGIC,
-				"WdfSpinLockCreate for HidControlChannel failed with status %!STATUS!",
+				"WdfSpinLockCreate for TransfersInFlight failed with status %!STATUS!",
 				status
 			);
 			break;
 		}
 
-		pPdoCtx->HidControlChannel.ConnectionState = ConnectionStateInitialized;
+		InitializeListHead(&pPdoCtx->TransfersInFlight.List);
 
 		//
-		// Initialize HidInterruptChannel properties
+		// Initialize duplicate input report suppression
 		// 
 
-		if (!NT_SUCCESS(status = WdfRequestCreate(
+		if (!NT_SUCCESS(status = WdfSpinLockCreate(
 			&attributes,
-			pPdoCtx->DevCtxHdr->IoTarget,
-			&pPdoCtx->HidInterruptChannel.ConnectDisconnectRequest
+			&pPdoCtx->InputReportFilter.Lock
 		)))
 		{
 			TraceError(
 				TRACE_BUSLOGIC,
-				"WdfRequestCreate for HidInterruptChannel failed with status %!STATUS!",
+				"WdfSpinLockCreate for InputReportFilter failed with status %!STATUS!",
 				status
 			);
 			break;
 		}
 
+		pPdoCtx->InputReportFilter.Mask = BthPS3_PDO_GetInputReportMask(DeviceType);
+		pPdoCtx->InputReportFilter.Enabled = (settings->SuppressDuplicateReports && pPdoCtx->InputReportFilter.Mask);
+		pPdoCtx->InputReportFilter.HoldTimeMs = settings->DuplicateReportHoldTime;
+
 		//
-		// Initialize signaled, will be cleared once a connection is established
+		// Initialize linger timer, expiration unplugs so it needs PASSIVE_LEVEL
+		// 
+		// Must exist before the clients table insert, a reconnect finding the
+		// PDO there calls BthPS3_PDO_LeaveLinger right away. Parented to the
+		// device so the unplug on failure takes it along.
 		// 
-		KeInitializeEvent(&pPdoCtx->HidInterruptChannel.DisconnectEvent,
-			NotificationEvent,
-			TRUE
-		);
+
+		WDF_TIMER_CONFIG_INIT(&timerCfg, BthPS3_PDO_EvtLingerTimerFunc);
+		timerCfg.AutomaticSerialization = FALSE;
 
 		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
 		attributes.ParentObject = device;
+		attributes.ExecutionLevel = WdfExecutionLevelPassive;
 
-		if (!NT_SUCCESS(status = WdfSpinLockCreate(
+		if (!NT_SUCCESS(status = WdfTimerCreate(
+			&timerCfg,
 			&attributes,
-			&pPdoCtx->HidInterruptChannel.ConnectionStateLock
+			&pPdoCtx->Linger.Timer
 		)))
 		{
 			TraceError(
 				TRACE_BUSLOGIC,
-				"WdfSpinLockCreate for HidInterruptChannel failed with status %!STATUS!",
+				"WdfTimerCreate for Linger failed with status %!STATUS!",
 				status
 			);
 			break;
 		}
 
-		pPdoCtx->HidInterruptChannel.ConnectionState = ConnectionStateInitialized;
+		pPdoCtx->Linger.TimeoutMs = settings->ChildLingerTimeout;
+		pPdoCtx->Linger.State = LingerStateActive;
+
+		//
+		// Index for lookup by remote address, comes last since lookups at
+		// DISPATCH_LEVEL use the locks and timer created above right away
+		// 
+		if (!NT_SUCCESS(status = BthPS3_ClientsTable_Insert(
+			&Context->Header,
+			RemoteAddress,
+			pPdoCtx
+		)))
+		{
+			TraceError(
+				TRACE_BUSLOGIC,
+				"BthPS3_ClientsTable_Insert failed with status %!STATUS!",
+				status
+			);
+			break;
+		}
+
+		*PdoContext = pPdoCtx;
 
 		//
 		// We're ready, expose interface
@@ -648,9 +512,42 @@ BthPS3_PDO_Create(
 
 	} while (FALSE);
 
-	if (hKey)
+	BthPS3_SettingsRelease(settings);
+
+	//
+	// Never made it into the clients table so BthPS3_PDO_Destroy won't find
+	// it, undo the plug-in here
+	// 
+	if (!NT_SUCCESS(status) && device != NULL)
+	{
+		WdfWaitLockAcquire(Context->Header.ClientsLock, NULL);
+
+		if (!NT_SUCCESS(DMF_Pdo_DeviceUnPlugEx(
+			Context->Header.PdoModule,
+			(PWSTR)descriptor->HardwareId,
+			record.SerialNumber
+		)))
+		{
+			TraceError(
+				TRACE_BUSLOGIC,
+				"DMF_Pdo_DeviceUnPlugEx for failed PDO creation failed"
+			);
+		}
+
+		if (isInCollection)
+		{
+			WdfCollectionRemove(Context->Header.Clients, device);
+		}
+
+		WdfWaitLockRelease(Context->Header.ClientsLock);
+	}
+
+	//
+	// PDO is in the clients table now (or creation failed), reclaiming can see it
+	// 
+	if (record.SerialNumber != 0)
 	{
-		WdfRegistryClose(hKey);
+		BthPS3_PDO_ReleaseSlot(&Context->Header, record.SerialNumber);
 	}
 
 	if (NT_SUCCESS(status))
@@ -702,30 +599,22 @@ BthPS3_PDO_RetrieveByBthAddr(
 
     *PdoContext = NULL;
 
-	WdfWaitLockAcquire(Context->Header.ClientsLock, NULL);
-
-	const ULONG itemCount = WdfCollectionGetCount(Context->Header.Clients);
+	const PBTHPS3_PDO_CONTEXT pPdoCtx = BthPS3_ClientsTable_Lookup(
+		&Context->Header,
+		RemoteAddress
+	);
 
-	for (ULONG index = 0; index < itemCount; index++)
+	if (pPdoCtx != NULL)
 	{
-		const WDFDEVICE currentPdo = WdfCollectionGetItem(Context->Header.Clients, index);
-		const PBTHPS3_PDO_CONTEXT pPdoCtx = GetPdoContext(currentPdo);
-
-		if (pPdoCtx->RemoteAddress == RemoteAddress)
-		{
-			TraceVerbose(
-				TRACE_BUSLOGIC,
-				"Found desired connection item in connection list"
-			);
+		TraceVerbose(
+			TRACE_BUSLOGIC,
+			"Found desired connection item in connection list"
+		);
 
-			status = STATUS_SUCCESS;
-			*PdoContext = pPdoCtx;
-			break;
-		}
+		status = STATUS_SUCCESS;
+		*PdoContext = pPdoCtx;
 	}
 
-	WdfWaitLockRelease(Context->Header.ClientsLock);
-
 	FuncExit(TRACE_BUSLOGIC, "status=%!STATUS!", status);
 
 	return status;
@@ -749,74 +638,81 @@ BthPS3_PDO_Destroy(
 
 	WdfWaitLockAcquire(Context->ClientsLock, NULL);
 
-	const WDFDEVICE device = WdfObjectContextGetObject(PdoContext);
-	const ULONG itemCount = WdfCollectionGetCount(Context->Clients);
-
-	for (ULONG index = 0; index < itemCount; index++)
+	do
 	{
-		const WDFDEVICE currentPdo = WdfCollectionGetItem(Context->Clients, index);
-
-		if (currentPdo == device)
+		//
+		// Unknown or already destroyed, also stops further lookups from finding it
+		// 
+		if (!BthPS3_ClientsTable_Remove(Context, PdoContext->RemoteAddress, PdoContext))
 		{
-			const PBTHPS3_PDO_CONTEXT pPdoCtx = GetPdoContext(currentPdo);
-			const ULONG serial = pPdoCtx->SerialNumber;
-			WCHAR hardwareId[BTHPS3_MAX_DEVICE_ID_LEN];
-
-			//
-			// Make a copy for logging since the context memory gets destroyed on unplug
-			// 
-			wcscpy_s(
-				hardwareId,
-				sizeof(hardwareId) / sizeof(WCHAR),
-				(PWSTR)WdfMemoryGetBuffer(pPdoCtx->HardwareId, NULL)
-			);
+			break;
+		}
+
+		//
+		// Fail everything still queued in one go instead of on removal
+		// 
+		BthPS3_PDO_PurgeQueues(PdoContext);
 
-			TraceVerbose(
+		const WDFDEVICE device = WdfObjectContextGetObject(PdoContext);
+		const ULONG serial = PdoContext->SerialNumber;
+		WCHAR hardwareId[BTHPS3_MAX_DEVICE_ID_LEN];
+
+		//
+		// Make a copy for logging since the context memory gets destroyed on unplug
+		// 
+		wcscpy_s(
+			hardwareId,
+			sizeof(hardwareId) / sizeof(WCHAR),
+			(PWSTR)WdfMemoryGetBuffer(PdoContext->HardwareId, NULL)
+		);
+
+		TraceVerbose(
+			TRACE_BUSLOGIC,
+			"Found desired connection item in connection list (serial: %d)",
+			serial
+		);
+
+		//
+		// Do NOT use PBTHPS3_PDO_CONTEXT after this call as it gets destroyed!
+		// 
+
+		NTSTATUS status = DMF_Pdo_DeviceUnPlugEx(
+			Context->PdoModule,
+			hardwareId,
+			serial
+		);
+
+		if (!NT_SUCCESS(status))
+		{
+			TraceError(
 				TRACE_BUSLOGIC,
-				"Found desired connection item in connection list (serial: %d)",
-				serial
+				"DMF_Pdo_DeviceUnPlugEx failed with status %!STATUS!",
+				status
 			);
 
-			//
-			// Do NOT use PBTHPS3_PDO_CONTEXT after this call as it gets destroyed!
-			// 
-
-			NTSTATUS status = DMF_Pdo_DeviceUnPlugEx(
-				Context->PdoModule,
+			EventWriteChildDeviceDestructionFailed(
+				NULL,
+				serial,
+				hardwareId,
+				status
+			);
+		}
+		else
+		{
+			EventWriteChildDeviceDestructionSuccessful(
+				NULL,
+				serial,
 				hardwareId,
-				serial
+				status
 			);
+		}
 
-			if (!NT_SUCCESS(status))
-			{
-				TraceError(
-					TRACE_BUSLOGIC,
-					"DMF_Pdo_DeviceUnPlugEx failed with status %!STATUS!",
-					status
-				);
-
-				EventWriteChildDeviceDestructionFailed(
-					NULL,
-					serial,
-					hardwareId,
-					status
-				);
-			}
-			else
-			{
-				EventWriteChildDeviceDestructionSuccessful(
-					NULL,
-					serial,
-					hardwareId,
-					status
-				);
-			}
-
-			WdfCollectionRemoveItem(Context->Clients, index);
+		//
+		// Collection holds a reference, handle is still valid
+		// 
+		WdfCollectionRemove(Context->Clients, device);
 
-			break;
-		}
-	}
+	} while (FALSE);
 
 	WdfWaitLockRelease(Context->ClientsLock);
 
@@ -838,48 +734,44 @@ BthPS3_PDO_EvtContextCleanup(
 	PBTHPS3_PDO_CONTEXT pPdoCtx = GetPdoContext(Object);
 	LARGE_INTEGER timeout;
 	timeout.QuadPart = WDF_REL_TIMEOUT_IN_SEC(5);
-
-	if (!NT_SUCCESS(status = KeWaitForSingleObject(
-		&pPdoCtx->HidControlChannel.DisconnectEvent,
-		Executive,
-		KernelMode,
-		FALSE,
-		&timeout
-	)))
+	PVOID disconnectEvents[] =
 	{
-		TraceError(
-			TRACE_BUSLOGIC,
-			"HID Control - KeWaitForSingleObject failed with status %!STATUS!",
-			status
-		);
-	}
-	else
-	{
-		TraceVerbose(
-			TRACE_BUSLOGIC,
-			"HID Control channel event signalled"
-		);
-	}
+		&pPdoCtx->HidControlChannel.DisconnectEvent,
+		&pPdoCtx->HidInterruptChannel.DisconnectEvent
+	};
+	const ULONGLONG waitStartedAt = KeQueryInterruptTime();
 
-	if (!NT_SUCCESS(status = KeWaitForSingleObject(
-		&pPdoCtx->HidInterruptChannel.DisconnectEvent,
+	//
+	// Both channels close concurrently, wait for them at once
+	// 
+	status = KeWaitForMultipleObjects(
+		ARRAYSIZE(disconnectEvents),
+		disconnectEvents,
+		WaitAll,
 		Executive,
 		KernelMode,
 		FALSE,
-		&timeout
-	)))
+		&timeout,
+		NULL
+	);
+
+	if (!NT_SUCCESS(status) || status == STATUS_TIMEOUT)
 	{
 		TraceError(
 			TRACE_BUSLOGIC,
-			"HID Interrupt - KeWaitForSingleObject failed with status %!STATUS!",
+			"KeWaitForMultipleObjects failed with status %!STATUS!",
 			status
 		);
 	}
 	else
 	{
+		//
+		// Interrupt time is in 100ns units
+		// 
 		TraceVerbose(
 			TRACE_BUSLOGIC,
-			"HID Interrupt channel event signalled"
+			"HID channel events signalled after %lld us",
+			(LONG64)((KeQueryInterruptTime() - waitStartedAt) / 10)
 		);
 	}
 
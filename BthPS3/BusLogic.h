@@ -43,6 +43,27 @@
 #define REG_CACHED_DEVICE_KEY_FMT		L"Devices\\%012llX"
 #define REG_CACHED_DEVICE_KEY_FMT_LEN	(8 + BTHPS3_BTH_ADDR_MAX_CHARS)
 
+//
+// Slot and remote address packed into BTHPS3_SLOT_MAP_RECORD.SlotAndAddress
+// 
+#define BTHPS3_SLOT_MAP_PACK(_slot_, _addr_)	(((UINT64)(_slot_) << 48) | ((UINT64)(_addr_) & 0xFFFFFFFFFFFFULL))
+#define BTHPS3_SLOT_MAP_SLOT(_packed_)			((ULONG)((_packed_) >> 48))
+#define BTHPS3_SLOT_MAP_ADDR(_packed_)			((BTH_ADDR)((_packed_) & 0xFFFFFFFFFFFFULL))
+
+
+//
+// Entry of the SlotMap registry value
+// 
+typedef struct _BTHPS3_SLOT_MAP_RECORD
+{
+	UINT64 SlotAndAddress;
+
+	//
+	// System time the device last connected
+	// 
+	LONGLONG LastSeen;
+
+} BTHPS3_SLOT_MAP_RECORD, * PBTHPS3_SLOT_MAP_RECORD;
 
 //
 // Connection state
@@ -58,14 +79,64 @@ typedef enum _BTHPS3_CONNECTION_STATE {
 
 } BTHPS3_CONNECTION_STATE, *PBTHPS3_CONNECTION_STATE;
 
+//
+// Life cycle of a PDO after its device disconnected
+//
+typedef enum _BTHPS3_LINGER_STATE {
+    LingerStateActive = 0,
+    LingerStateLingering,
+    LingerStateExpired
+
+} BTHPS3_LINGER_STATE, *PBTHPS3_LINGER_STATE;
+
+//
+// Indexes of properties in BTHPS3_PDO_DESCRIPTOR.Properties
+//
+typedef enum _BTHPS3_PDO_PROPERTY {
+    PdoPropertyVendorId = 0,
+    PdoPropertyProductId,
+    PdoPropertyDeviceAddress,
+    PdoPropertyRadioAddress,
+    PdoPropertyFriendlyName,
+    PdoPropertyManufacturer,
+    PdoPropertyLastConnectedTime,
+    PdoPropertyCount
+
+} BTHPS3_PDO_PROPERTY;
+
+//
+// Device type specific PDO properties, built once on driver load
+// 
+typedef struct _BTHPS3_PDO_DESCRIPTOR
+{
+	PCWSTR Description;
+
+	USHORT VendorId;
+
+	USHORT ProductId;
+
+	const GUID* RawDeviceClassGuid;
+
+	WCHAR HardwareId[BTHPS3_MAX_DEVICE_ID_LEN];
+
+	//
+	// Per-device values (address, name etc.) are left NULL
+	// 
+	Pdo_DevicePropertyEntry Properties[PdoPropertyCount];
+
+} BTHPS3_PDO_DESCRIPTOR, * PBTHPS3_PDO_DESCRIPTOR;
+
+typedef const BTHPS3_PDO_DESCRIPTOR* PCBTHPS3_PDO_DESCRIPTOR;
+
 //
 // State information for a single L2CAP channel
 // 
 typedef struct _BTHPS3_CLIENT_L2CAP_CHANNEL
 {
-    BTHPS3_CONNECTION_STATE ConnectionState;
-
-    WDFSPINLOCK ConnectionStateLock;
+    //
+    // BTHPS3_CONNECTION_STATE, only changed via L2CAP_PS3_ChannelTransition
+    // 
+    volatile LONG ConnectionState;
 
     L2CAP_CHANNEL_HANDLE ChannelHandle;
 
@@ -75,8 +146,148 @@ typedef struct _BTHPS3_CLIENT_L2CAP_CHANNEL
 
     KEVENT DisconnectEvent;
 
+    //
+    // PDO context this channel belongs to
+    // 
+    struct _BTHPS3_PDO_CONTEXT* Owner;
+
+    //
+    // Parameters requested in the last connect response
+    // 
+    BTHPS3_CHANNEL_PROFILE Profile;
+
+    //
+    // Packets received while the incoming queue was full
+    // 
+    LONG QueueDepthReached;
+
+    struct
+    {
+        //
+        // Last configuration requested by the remote device
+        // 
+        BTHPS3_CHANNEL_QOS Remote;
+
+        //
+        // Last configuration of ours the remote device accepted
+        // 
+        BTHPS3_CHANNEL_QOS Local;
+
+        LONG Rejects;
+
+        EX_SPIN_LOCK Lock;
+
+    } Config;
+
 } BTHPS3_CLIENT_L2CAP_CHANNEL, *PBTHPS3_CLIENT_L2CAP_CHANNEL;
 
+//
+// Events driving BTHPS3_CLIENT_L2CAP_CHANNEL.ConnectionState
+// 
+typedef enum _BTHPS3_CHANNEL_EVENT {
+    ChannelEventInitialize = 0,
+    ChannelEventConnect,
+    ChannelEventConnected,
+    ChannelEventConnectFailed,
+    ChannelEventDisconnect,
+    ChannelEventDisconnected,
+    ChannelEventCount
+
+} BTHPS3_CHANNEL_EVENT;
+
+//
+// Runs once after a channel state transition succeeded
+// 
+typedef
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+EVT_BTHPS3_CHANNEL_TRANSITION(
+    _In_ PBTHPS3_CLIENT_L2CAP_CHANNEL Channel
+);
+
+typedef EVT_BTHPS3_CHANNEL_TRANSITION *PFN_BTHPS3_CHANNEL_TRANSITION;
+
+//
+// Entry of the channel state transition table
+// 
+typedef struct _BTHPS3_CHANNEL_TRANSITION
+{
+    BTHPS3_CONNECTION_STATE From;
+
+    BTHPS3_CHANNEL_EVENT Event;
+
+    BTHPS3_CONNECTION_STATE To;
+
+    PFN_BTHPS3_CHANNEL_TRANSITION Hook;
+
+} BTHPS3_CHANNEL_TRANSITION, *PBTHPS3_CHANNEL_TRANSITION;
+
+typedef const BTHPS3_CHANNEL_TRANSITION* PCBTHPS3_CHANNEL_TRANSITION;
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BTHPS3_CONNECTION_STATE
+L2CAP_PS3_ChannelGetState(
+	_In_ PBTHPS3_CLIENT_L2CAP_CHANNEL Channel
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+L2CAP_PS3_ChannelConfigRequested(
+	_In_ PBTHPS3_CLIENT_L2CAP_CHANNEL Channel,
+	_In_ PINDICATION_PARAMETERS Parameters
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+L2CAP_PS3_ChannelConfigResponded(
+	_In_ PBTHPS3_CLIENT_L2CAP_CHANNEL Channel,
+	_In_ PINDICATION_PARAMETERS Parameters
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+L2CAP_PS3_ChannelGetConfig(
+	_In_ PBTHPS3_CLIENT_L2CAP_CHANNEL Channel,
+	_Out_ PBTHPS3_CHANNEL_STATS Stats
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+L2CAP_PS3_ChannelTransition(
+	_In_ PBTHPS3_CLIENT_L2CAP_CHANNEL Channel,
+	_In_ BTHPS3_CHANNEL_EVENT Event,
+	_Out_opt_ BTHPS3_CONNECTION_STATE* PreviousState
+);
+
+//
+// Per request state of HID transfers forwarded to the radio as BRBs
+// 
+typedef struct _BTHPS3_TRANSFER_CONTEXT
+{
+    //
+    // Entry in TransfersInFlight.List while owned by the radio
+    // 
+    LIST_ENTRY Link;
+
+    //
+    // Channel the transfer got sent on
+    // 
+    PBTHPS3_CLIENT_L2CAP_CHANNEL Channel;
+
+    //
+    // WdfRequestCancelSentRequest got called for the current send
+    // 
+    BOOLEAN CancelIssued;
+
+    //
+    // Consumer control read, gets cancelled when a transaction takes the channel
+    // 
+    BOOLEAN IsConsumerRead;
+
+} BTHPS3_TRANSFER_CONTEXT, *PBTHPS3_TRANSFER_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(BTHPS3_TRANSFER_CONTEXT, GetTransferContext)
+
 //
 // PDO context object holding all state information per child device
 // 
@@ -92,12 +303,170 @@ typedef struct _BTHPS3_PDO_CONTEXT
 
 	BTHPS3_CLIENT_L2CAP_CHANNEL HidInterruptChannel;
 
+	//
+	// Set while remote disconnect waits for channel closes to complete
+	// 
+	// Whoever clears it (the disconnect handler or the last close completion)
+	// continues with lingering or destroying the PDO.
+	// 
+	LONG TeardownPending;
+
+	struct
+	{
+		//
+		// BTHPS3_TRANSFER_CONTEXT of requests currently sent to the radio
+		// 
+		LIST_ENTRY List;
+
+		WDFSPINLOCK Lock;
+
+	} TransfersInFlight;
+
 	DMFMODULE DmfModuleIoctlHandler;
 
 	ULONG SerialNumber;
 
 	WDFMEMORY HardwareId;
 
+	struct
+	{
+		//
+		// Incremented for every successfully delivered input report
+		// 
+		LONG SequenceNumber;
+
+		//
+		// Failed transfers since the last delivered input report
+		// 
+		LONG DroppedCount;
+
+		//
+		// Duplicate reports held back since the last delivered input report
+		// 
+		LONG SuppressedCount;
+
+	} InterruptReadStats;
+
+	struct
+	{
+		//
+		// Duplicate suppression enabled for this device
+		// 
+		BOOLEAN Enabled;
+
+		//
+		// Duplicates older than this get delivered anyway
+		// 
+		ULONG HoldTimeMs;
+
+		//
+		// Bytes to compare, NULL if not supported by device type
+		// 
+		const UCHAR* Mask;
+
+		//
+		// Protects LastReport and LastDelivered
+		// 
+		WDFSPINLOCK Lock;
+
+		BOOLEAN IsLastReportValid;
+
+		UCHAR LastReport[BTHPS3_SIXAXIS_HID_INPUT_REPORT_SIZE];
+
+		//
+		// Interrupt time of last delivered input report
+		// 
+		ULONGLONG LastDelivered;
+
+	} InputReportFilter;
+
+	struct
+	{
+		//
+		// Non-zero while a transaction occupies the control channel
+		// 
+		LONG InFlight;
+
+		//
+		// Request awaits a DATA reply (GET_REPORT/GET_PROTOCOL)
+		// 
+		BOOLEAN ExpectData;
+
+		//
+		// Interrupt time at which the current transaction times out
+		// 
+		ULONGLONG Deadline;
+
+		//
+		// Set while a transaction holds consumer control reads back
+		// 
+		// Protected by TransfersInFlight.Lock like the two fields below.
+		// 
+		BOOLEAN OwnsChannel;
+
+		//
+		// Consumer control reads currently sent to the radio
+		// 
+		// A transaction is only sent once this dropped to zero so no consumer
+		// read can take its reply.
+		// 
+		LONG ConsumerReads;
+
+		//
+		// Transaction waiting for ConsumerReads to drop to zero
+		// 
+		WDFREQUEST Deferred;
+
+	} ControlTransaction;
+
+	struct
+	{
+		//
+		// Time to keep PDO after disconnect, zero destroys it immediately
+		// 
+		ULONG TimeoutMs;
+
+		//
+		// BTHPS3_LINGER_STATE
+		// 
+		LONG State;
+
+		//
+		// Destroys the PDO once TimeoutMs elapsed without reconnect
+		// 
+		WDFTIMER Timer;
+
+		//
+		// Interrupt time the current HID Control connect request arrived at
+		// 
+		ULONGLONG ConnectStartedAt;
+
+		//
+		// Current connection reuses this PDO after linger
+		// 
+		BOOLEAN IsWarmConnect;
+
+	} Linger;
+
+	struct
+	{
+		//
+		// Interrupt time each BTHPS3_CONNECT_PHASE was reached at, zero if not (yet)
+		// 
+		LONG64 At[BTHPS3_CONNECT_PHASE_COUNT];
+
+		//
+		// Connection reuses this PDO after linger, PDO phases are skipped
+		// 
+		BOOLEAN IsWarm;
+
+		//
+		// Set once the timeline got reported
+		// 
+		LONG Completed;
+
+	} Timeline;
+
 	struct
 	{
 		WDFQUEUE HidControlReadRequests;
@@ -108,6 +477,8 @@ typedef struct _BTHPS3_PDO_CONTEXT
 
 		WDFQUEUE HidInterruptWriteRequests;
 
+		WDFQUEUE HidControlTransactionRequests;
+
 	} Queues;
 
 } BTHPS3_PDO_CONTEXT, * PBTHPS3_PDO_CONTEXT;
@@ -134,6 +505,17 @@ CLIENT_CONNECTION_REQUEST_REUSE(
 // PDO lifecycle
 // 
 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+BthPS3_PDO_DescriptorsInit(
+	VOID
+);
+
+PCBTHPS3_PDO_DESCRIPTOR
+BthPS3_PDO_GetDescriptor(
+	_In_ DS_DEVICE_TYPE DeviceType
+);
+
 _IRQL_requires_max_(PASSIVE_LEVEL)
 _Must_inspect_result_
 _Success_(return == STATUS_SUCCESS)
@@ -143,6 +525,7 @@ BthPS3_PDO_Create(
 	_In_ BTH_ADDR RemoteAddress,
 	_In_ DS_DEVICE_TYPE DeviceType,
 	_In_ PSTR RemoteName,
+	_Inout_updates_(BTHPS3_CONNECT_PHASE_COUNT) PULONGLONG Phases,
 	_Outptr_result_maybenull_ BTHPS3_PDO_CONTEXT** PdoContext
 );
 
@@ -197,6 +580,10 @@ EVT_DMF_IoctlHandler_Callback BthPS3_PDO_HandleHidInterruptWrite;
 
 EVT_DMF_IoctlHandler_Callback BthPS3_PDO_HandleBthDisconnect;
 
+EVT_DMF_IoctlHandler_Callback BthPS3_PDO_HandleHidControlTransaction;
+
+EVT_DMF_IoctlHandler_Callback BthPS3_PDO_HandleGetChannelInfo;
+
 //
 // Process requests once queued
 // 
@@ -209,6 +596,39 @@ EVT_WDF_IO_QUEUE_STATE BthPS3_PDO_DispatchHidInterruptRead;
 
 EVT_WDF_IO_QUEUE_STATE BthPS3_PDO_DispatchHidInterruptWrite;
 
+EVT_WDF_IO_QUEUE_STATE BthPS3_PDO_DispatchHidControlTransaction;
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+BthPS3_PDO_IsTimestampedInterruptRead(
+	_In_ WDFREQUEST Request
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+BthPS3_PDO_IsDuplicateInputReport(
+	_In_ PBTHPS3_PDO_CONTEXT PdoContext,
+	_In_reads_bytes_(Length) PUCHAR Report,
+	_In_ size_t Length
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+const UCHAR*
+BthPS3_PDO_GetInputReportMask(
+	_In_ DS_DEVICE_TYPE DeviceType
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+BthPS3_ReportFilterIsDuplicate(
+	_In_reads_bytes_(Length) const UCHAR* Report,
+	_In_reads_bytes_(Length) const UCHAR* LastReport,
+	_In_reads_bytes_(Length) const UCHAR* Mask,
+	_In_ size_t Length,
+	_In_ ULONGLONG Elapsed,
+	_In_ ULONG HoldTimeMs
+);
+
 //
 // PNP/Power
 // 
@@ -221,10 +641,117 @@ EVT_WDF_DEVICE_SELF_MANAGED_IO_INIT BthPS3_PDO_SelfManagedIoInit;
 
 EVT_WDF_REQUEST_COMPLETION_ROUTINE BthPS3_PDO_DisconnectRequestCompleted;
 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthPS3_PDO_PurgeQueues(
+	_In_ PBTHPS3_PDO_CONTEXT PdoContext
+);
+
+//
+// Keeping PDOs of disconnected devices
+// 
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+BOOLEAN
+BthPS3_PDO_EnterLinger(
+	_In_ PBTHPS3_PDO_CONTEXT PdoContext
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BTHPS3_LINGER_STATE
+BthPS3_PDO_LeaveLinger(
+	_In_ PBTHPS3_PDO_CONTEXT PdoContext
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthPS3_PDO_RecordConnectLatency(
+	_In_ PBTHPS3_PDO_CONTEXT PdoContext
+);
+
+EVT_WDF_TIMER BthPS3_PDO_EvtLingerTimerFunc;
+
+//
+// Connection setup timeline
+// 
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthPS3_PDO_TimelineStart(
+	_In_ PBTHPS3_PDO_CONTEXT PdoContext,
+	_In_ BOOLEAN IsWarm,
+	_In_reads_(BTHPS3_CONNECT_PHASE_COUNT) const ULONGLONG* Phases
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthPS3_PDO_TimelineMark(
+	_In_ PBTHPS3_PDO_CONTEXT PdoContext,
+	_In_ BTHPS3_CONNECT_PHASE Phase
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthPS3_TimelineRecordFailed(
+	_In_ PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	_In_ UINT64 RemoteAddress,
+	_In_ BOOLEAN IsWarm,
+	_In_ NTSTATUS Status,
+	_In_reads_(BTHPS3_CONNECT_PHASE_COUNT) const ULONGLONG* Phases
+);
+
+EVT_DMF_IoctlHandler_Callback BthPS3_HandleGetConnectTimelines;
+
+//
+// Client lookup by remote address
+// 
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS
+BthPS3_ClientsTable_Insert(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	BTH_ADDR RemoteAddress,
+	PBTHPS3_PDO_CONTEXT PdoContext
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+BthPS3_ClientsTable_Remove(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	BTH_ADDR RemoteAddress,
+	PBTHPS3_PDO_CONTEXT PdoContext
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+PBTHPS3_PDO_CONTEXT
+BthPS3_ClientsTable_Lookup(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	BTH_ADDR RemoteAddress
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+PBTHPS3_PDO_CONTEXT
+BthPS3_ClientsTable_LookupAndReference(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	BTH_ADDR RemoteAddress
+);
+
 //
 // Registry operations
 // 
 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+BthPS3_SlotsInit(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+BthPS3_SlotsFlush(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header
+);
+
 _IRQL_requires_max_(PASSIVE_LEVEL)
 NTSTATUS
 BthPS3_PDO_QuerySlot(
@@ -240,3 +767,10 @@ BthPS3_PDO_AssignSlot(
 	BTH_ADDR RemoteAddress,
 	ULONG Slot
 );
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+BthPS3_PDO_ReleaseSlot(
+	PBTHPS3_DEVICE_CONTEXT_HEADER Header,
+	ULONG Slot
+);
@@ -40,6 +40,17 @@
 #include "BthPS3ETW.h"
 
 
+//
+// IOCTLs handled by the bus device, independent of any child being present
+// 
+IoctlHandler_IoctlRecord G_Bus_IoctlSpecification[] =
+{
+    /* Diagnostics */
+    {IOCTL_BTHPS3_GET_DENY_CACHE_STATS, 0, sizeof(BTHPS3_DENY_CACHE_STATS), BthPS3_HandleGetDenyCacheStats},
+    {IOCTL_BTHPS3_GET_CONNECT_TIMELINES, 0, sizeof(BTHPS3_CONNECT_TIMELINES), BthPS3_HandleGetConnectTimelines},
+};
+
+
  //
  // Framework device creation entry point
  // 
@@ -150,21 +161,9 @@ BthPS3_CreateDevice(
         // Allocate request object for async filter communication
         // 
 
-        WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
-        attributes.ParentObject = pSrvCtx->PsmFilter.IoTarget;
-
-        if (!NT_SUCCESS(status = WdfRequestCreate(
-            &attributes,
-            pSrvCtx->PsmFilter.IoTarget,
-            &pSrvCtx->PsmFilter.AsyncRequest
-        )))
+        if (!NT_SUCCESS(status = BthPS3PSM_FilterPipelineInit(pSrvCtx)))
         {
-            TraceError(
-                TRACE_DEVICE,
-                "WdfRequestCreate failed with status %!STATUS!",
-                status
-            );
-            EventWriteFailedWithNTStatus(NULL, __FUNCTION__, L"WdfRequestCreate", status);
+            EventWriteFailedWithNTStatus(NULL, __FUNCTION__, L"BthPS3PSM_FilterPipelineInit", status);
             break;
         }
 
@@ -288,29 +287,13 @@ void BthPS3_EnablePatchEvtWdfTimer(
     WDFTIMER Timer
 )
 {
-    NTSTATUS status;
     PBTHPS3_SERVER_CONTEXT devCtx = GetServerDeviceContext(WdfTimerGetParentObject(Timer));
 
     TraceVerbose(TRACE_DEVICE,
         "Requesting filter to enable patch"
     );
 
-    if (!NT_SUCCESS(status = BthPS3PSM_EnablePatchAsync(
-        devCtx->PsmFilter.IoTarget,
-        0 // TODO: read from registry?
-    )))
-    {
-        TraceVerbose(TRACE_DEVICE,
-            "BthPS3PSM_EnablePatchAsync failed with status %!STATUS!",
-            status
-        );
-
-        EventWriteFilterAutoEnabledFailed(NULL, status);
-    }
-    else
-    {
-        EventWriteFilterAutoEnabledSuccessfully(NULL);
-    }
+    BthPS3PSM_FilterCommandSubmit(devCtx, BthPS3PSMFilterCommandEnablePatch);
 }
 
 //
@@ -324,17 +307,28 @@ BthPS3_EvtWdfDeviceSelfManagedIoInit(
 {
     NTSTATUS status;
     PBTHPS3_SERVER_CONTEXT devCtx = GetServerDeviceContext(Device);
+    PBTHPS3_SETTINGS settings = NULL;
 
     FuncEntry(TRACE_DEVICE);
 
     do
     {
+        //
+        // Failure only means settings changes require a restart
+        //
+        (void)BthPS3_SettingsStartNotification(devCtx);
+
         if (!NT_SUCCESS(status = BthPS3_RetrieveLocalInfo(&devCtx->Header)))
         {
             EventWriteFailedWithNTStatus(NULL, __FUNCTION__, L"BthPS3_RetrieveLocalInfo", status);
             break;
         }
 
+        //
+        // Failure only means the filter isn't commanded, other radios stay untouched
+        //
+        (void)BthPS3PSM_FilterResolveRadio(devCtx);
+
         if (!NT_SUCCESS(status = BthPS3_RegisterPSM(devCtx)))
         {
             EventWriteFailedWithNTStatus(NULL, __FUNCTION__, L"BthPS3_RegisterPSM", status);
@@ -347,17 +341,18 @@ BthPS3_EvtWdfDeviceSelfManagedIoInit(
             break;
         }
 
+        settings = BthPS3_SettingsAcquire(devCtx);
+
         //
         // Attempt to enable, but ignore failure
         //
-        if (devCtx->Settings.AutoEnableFilter)
+        if (settings->AutoEnableFilter)
         {
-            (void)BthPS3PSM_EnablePatchSync(
-                devCtx->PsmFilter.IoTarget,
-                0
-            );
+            BthPS3PSM_FilterCommandSubmit(devCtx, BthPS3PSMFilterCommandEnablePatch);
         }
 
+        BthPS3_SettingsRelease(settings);
+
     } while (FALSE);
 
     FuncExit(TRACE_DEVICE, "status=%!STATUS!", status);
@@ -381,8 +376,18 @@ BthPS3_EvtWdfDeviceSelfManagedIoCleanup(
 
     FuncEntry(TRACE_DEVICE);
 
+    BthPS3_SettingsStopNotification(devCtx);
+
+    L2CAP_PS3_DisconnectAll(&devCtx->Header);
+
+    BthPS3_SlotsFlush(&devCtx->Header);
+
+    BthPS3_NameCacheFlush(&devCtx->Header);
+
     if (devCtx->PsmFilter.IoTarget != NULL)
     {
+        BthPS3PSM_FilterPipelineStop(devCtx);
+
         WdfIoTargetClose(devCtx->PsmFilter.IoTarget);
         WdfObjectDelete(devCtx->PsmFilter.IoTarget);
     }
@@ -416,6 +421,7 @@ DmfDeviceModulesAdd(
     DMF_MODULE_ATTRIBUTES moduleAttributes;
     DMF_CONFIG_Pdo moduleConfigPdo;
     DMF_CONFIG_QueuedWorkItem moduleConfigQwi;
+    DMF_CONFIG_IoctlHandler moduleConfigIoctlHandler;
 
     const PBTHPS3_SERVER_CONTEXT pSrvCtx = GetServerDeviceContext(Device);
 
@@ -448,24 +454,50 @@ DmfDeviceModulesAdd(
     );
 
     //
-    // Queued Work Item Module
+    // Queued Work Item Modules, one per lane
+    // 
+
+    for (ULONG lane = 0; lane < BTHPS3_QWI_LANE_COUNT; lane++)
+    {
+        DMF_CONFIG_QueuedWorkItem_AND_ATTRIBUTES_INIT(
+            &moduleConfigQwi,
+            &moduleAttributes
+        );
+
+        moduleConfigQwi.BufferQueueConfig.SourceSettings.BufferCount = 4;
+        moduleConfigQwi.BufferQueueConfig.SourceSettings.BufferSize = sizeof(BTHPS3_QWI_CONTEXT);
+        moduleConfigQwi.BufferQueueConfig.SourceSettings.PoolType = NonPagedPoolNx;
+        moduleConfigQwi.EvtQueuedWorkitemFunction = BthPS3_EvtQueuedWorkItemHandler;
+
+        DMF_DmfModuleAdd(
+            DmfModuleInit,
+            &moduleAttributes,
+            WDF_NO_OBJECT_ATTRIBUTES,
+            &pSrvCtx->Header.QueuedWorkItemModules[lane]
+        );
+    }
+
+    //
+    // IOCTL Handler Module
     // 
 
-    DMF_CONFIG_QueuedWorkItem_AND_ATTRIBUTES_INIT(
-        &moduleConfigQwi,
+    DMF_CONFIG_IoctlHandler_AND_ATTRIBUTES_INIT(
+        &moduleConfigIoctlHandler,
         &moduleAttributes
     );
 
-    moduleConfigQwi.BufferQueueConfig.SourceSettings.BufferCount = 4;
-    moduleConfigQwi.BufferQueueConfig.SourceSettings.BufferSize = sizeof(BTHPS3_QWI_CONTEXT);
-    moduleConfigQwi.BufferQueueConfig.SourceSettings.PoolType = NonPagedPoolNx;
-    moduleConfigQwi.EvtQueuedWorkitemFunction = BthPS3_EvtQueuedWorkItemHandler;
+    moduleConfigIoctlHandler.DeviceInterfaceGuid = GUID_DEVINTERFACE_BTHPS3_BUS;
+    moduleConfigIoctlHandler.AccessModeFilter = IoctlHandler_AccessModeDefault;
+    moduleConfigIoctlHandler.EvtIoctlHandlerAccessModeFilter = NULL;
+    moduleConfigIoctlHandler.IoctlRecordCount = ARRAYSIZE(G_Bus_IoctlSpecification);
+    moduleConfigIoctlHandler.IoctlRecords = G_Bus_IoctlSpecification;
+    moduleConfigIoctlHandler.ForwardUnhandledRequests = TRUE;
 
     DMF_DmfModuleAdd(
         DmfModuleInit,
         &moduleAttributes,
         WDF_NO_OBJECT_ATTRIBUTES,
-        &pSrvCtx->Header.QueuedWorkItemModule
+        &pSrvCtx->DmfModuleIoctlHandler
     );
 
     FuncExitNoReturn(TRACE_DEVICE);
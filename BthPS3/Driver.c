@@ -109,6 +109,17 @@ DriverEntry(
         return status;
     }
 
+    if (!NT_SUCCESS(status = BthPS3_PDO_DescriptorsInit()))
+    {
+        TraceError(
+            TRACE_DRIVER,
+            "BthPS3_PDO_DescriptorsInit failed %!STATUS!",
+            status
+        );
+        WPP_CLEANUP(DriverObject);
+        return status;
+    }
+
     if (!NT_SUCCESS(status = DomitoInit()))
     {
         TraceError(
@@ -0,0 +1,371 @@
+#include "Driver.h"
+#include "L2CAP.Channel.tmh"
+
+
+static EVT_BTHPS3_CHANNEL_TRANSITION L2CAP_PS3_ChannelEvtArmDisconnectEvent;
+static EVT_BTHPS3_CHANNEL_TRANSITION L2CAP_PS3_ChannelEvtSignalDisconnectEvent;
+static EVT_BTHPS3_CHANNEL_TRANSITION L2CAP_PS3_ChannelEvtSendDeferredClose;
+
+//
+// Every legal channel state change, anything not listed here is rejected
+// 
+static const BTHPS3_CHANNEL_TRANSITION G_ChannelTransitions[] =
+{
+	/* Channel objects got created with the PDO */
+	{ ConnectionStateUninitialized, ChannelEventInitialize, ConnectionStateInitialized, NULL },
+	/* Connect response about to be sent, also on reconnect of a lingering PDO */
+	{ ConnectionStateInitialized, ChannelEventConnect, ConnectionStateConnecting, NULL },
+	{ ConnectionStateConnectFailed, ChannelEventConnect, ConnectionStateConnecting, NULL },
+	{ ConnectionStateDisconnected, ChannelEventConnect, ConnectionStateConnecting, NULL },
+	/* Connect response completed */
+	{ ConnectionStateConnecting, ChannelEventConnected, ConnectionStateConnected, L2CAP_PS3_ChannelEvtArmDisconnectEvent },
+	{ ConnectionStateConnecting, ChannelEventConnectFailed, ConnectionStateConnectFailed, NULL },
+	/* Close requested, while connecting the close is sent once the connect completes */
+	{ ConnectionStateConnected, ChannelEventDisconnect, ConnectionStateDisconnecting, L2CAP_PS3_ChannelEvtArmDisconnectEvent },
+	{ ConnectionStateConnecting, ChannelEventDisconnect, ConnectionStateDisconnecting, L2CAP_PS3_ChannelEvtArmDisconnectEvent },
+	{ ConnectionStateDisconnecting, ChannelEventConnected, ConnectionStateDisconnecting, L2CAP_PS3_ChannelEvtSendDeferredClose },
+	{ ConnectionStateDisconnecting, ChannelEventConnectFailed, ConnectionStateDisconnected, L2CAP_PS3_ChannelEvtSignalDisconnectEvent },
+	/* Close completed */
+	{ ConnectionStateDisconnecting, ChannelEventDisconnected, ConnectionStateDisconnected, L2CAP_PS3_ChannelEvtSignalDisconnectEvent },
+};
+
+//
+// Channel is (about to be) in use, DisconnectEvent gets signalled once it's closed
+// 
+// Hooks run after the new state got published, a close may have completed
+// and signalled in the meantime. Signal again so the clear isn't the last word.
+// 
+_Use_decl_annotations_
+static VOID
+L2CAP_PS3_ChannelEvtArmDisconnectEvent(
+	PBTHPS3_CLIENT_L2CAP_CHANNEL Channel
+)
+{
+	KeClearEvent(&Channel->DisconnectEvent);
+
+	if (L2CAP_PS3_ChannelGetState(Channel) == ConnectionStateDisconnected)
+	{
+		KeSetEvent(&Channel->DisconnectEvent, 0, FALSE);
+	}
+}
+
+//
+// Channel is closed
+// 
+_Use_decl_annotations_
+static VOID
+L2CAP_PS3_ChannelEvtSignalDisconnectEvent(
+	PBTHPS3_CLIENT_L2CAP_CHANNEL Channel
+)
+{
+	KeSetEvent(&Channel->DisconnectEvent, 0, FALSE);
+}
+
+//
+// Close got requested while the connect response was pending, send it now
+// 
+_Use_decl_annotations_
+static VOID
+L2CAP_PS3_ChannelEvtSendDeferredClose(
+	PBTHPS3_CLIENT_L2CAP_CHANNEL Channel
+)
+{
+	L2CAP_PS3_SendChannelClose(
+		Channel->Owner->DevCtxHdr,
+		Channel->Owner->RemoteAddress,
+		Channel
+	);
+}
+
+//
+// Current state of a channel
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BTHPS3_CONNECTION_STATE
+L2CAP_PS3_ChannelGetState(
+	_In_ PBTHPS3_CLIENT_L2CAP_CHANNEL Channel
+)
+{
+	return (BTHPS3_CONNECTION_STATE)InterlockedCompareExchange(&Channel->ConnectionState, 0, 0);
+}
+
+//
+// Applies an event to a channel if the transition table allows it in the current state
+//
+// The state is swapped with compare-and-swap, on contention the transition is
+// looked up again for the state that won. The hook of the transition runs after
+// the swap, exactly once, on the thread that performed it.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+BOOLEAN
+L2CAP_PS3_ChannelTransition(
+	_In_ PBTHPS3_CLIENT_L2CAP_CHANNEL Channel,
+	_In_ BTHPS3_CHANNEL_EVENT Event,
+	_Out_opt_ BTHPS3_CONNECTION_STATE* PreviousState
+)
+{
+	LONG current = (LONG)L2CAP_PS3_ChannelGetState(Channel);
+
+	for (;;)
+	{
+		PCBTHPS3_CHANNEL_TRANSITION transition = NULL;
+
+		for (ULONG index = 0; index < ARRAYSIZE(G_ChannelTransitions); index++)
+		{
+			if (G_ChannelTransitions[index].From == (BTHPS3_CONNECTION_STATE)current
+				&& G_ChannelTransitions[index].Event == Event)
+			{
+				transition = &G_ChannelTransitions[index];
+				break;
+			}
+		}
+
+		if (PreviousState != NULL)
+		{
+			*PreviousState = (BTHPS3_CONNECTION_STATE)current;
+		}
+
+		if (transition == NULL)
+		{
+			TraceVerbose(
+				TRACE_L2CAP,
+				"Channel 0x%p ignored event %d in state %d",
+				Channel,
+				Event,
+				current
+			);
+
+			return FALSE;
+		}
+
+		const LONG previous = InterlockedCompareExchange(
+			&Channel->ConnectionState,
+			(LONG)transition->To,
+			current
+		);
+
+		if (previous != current)
+		{
+			current = previous;
+			continue;
+		}
+
+		TraceVerbose(
+			TRACE_L2CAP,
+			"Channel 0x%p state %d -> %d (event %d)",
+			Channel,
+			current,
+			transition->To,
+			Event
+		);
+
+		if (transition->Hook != NULL)
+		{
+			transition->Hook(Channel);
+		}
+
+		return TRUE;
+	}
+}
+
+//
+// Copies the options present in a configuration into its exposed form
+// 
+static VOID
+L2CAP_PS3_ChannelCopyConfig(
+	_In_ const CHANNEL_CONFIG_PARAMETERS* Params,
+	_Out_ PBTHPS3_CHANNEL_QOS Qos
+)
+{
+	RtlZeroMemory(Qos, sizeof(BTHPS3_CHANNEL_QOS));
+
+	Qos->Flags = Params->Flags;
+
+	if (Params->Flags & CFG_MTU)
+	{
+		Qos->Mtu = Params->Mtu;
+	}
+
+	if (Params->Flags & CFG_FLUSHTO)
+	{
+		Qos->FlushTimeout = Params->FlushTO;
+	}
+
+	if (Params->Flags & CFG_QOS)
+	{
+		Qos->ServiceType = Params->Flow.ServiceType;
+		Qos->Latency = Params->Flow.Latency;
+		Qos->PeakBandwidth = Params->Flow.PeakBandwidth;
+	}
+}
+
+//
+// Builds our next configuration request after the remote device rejected one
+// 
+// Options the remote device rejected come back with the values it is willing
+// to accept, these are adopted as they're the closest to what we asked for.
+// A rejected flow specification falls back to best effort. If nothing could
+// be adopted the optional flow and flush timeout options are dropped, asking
+// for the same values again would only get rejected again.
+// 
+static VOID
+L2CAP_PS3_ChannelCounterProposal(
+	_In_ const CHANNEL_CONFIG_PARAMETERS* Requested,
+	_In_ const CHANNEL_CONFIG_PARAMETERS* Rejected,
+	_Out_ CHANNEL_CONFIG_PARAMETERS* Proposal
+)
+{
+	BOOLEAN adopted = FALSE;
+
+	*Proposal = *Requested;
+
+	if ((Rejected->Flags & CFG_MTU)
+		&& (!(Requested->Flags & CFG_MTU) || Rejected->Mtu != Requested->Mtu))
+	{
+		Proposal->Flags |= CFG_MTU;
+		Proposal->Mtu = Rejected->Mtu;
+		adopted = TRUE;
+	}
+
+	if ((Rejected->Flags & CFG_FLUSHTO)
+		&& (!(Requested->Flags & CFG_FLUSHTO) || Rejected->FlushTO != Requested->FlushTO))
+	{
+		Proposal->Flags |= CFG_FLUSHTO;
+		Proposal->FlushTO = Rejected->FlushTO;
+		adopted = TRUE;
+	}
+
+	if (Rejected->Flags & CFG_QOS)
+	{
+		if (Rejected->Flow.ServiceType == BTHPS3_L2CAP_SERVICE_TYPE_GUARANTEED)
+		{
+			//
+			// Only the values we set ourselves are compared
+			// 
+			adopted = adopted
+				|| !(Requested->Flags & CFG_QOS)
+				|| Rejected->Flow.ServiceType != Requested->Flow.ServiceType
+				|| Rejected->Flow.Latency != Requested->Flow.Latency
+				|| Rejected->Flow.DelayVariation != Requested->Flow.DelayVariation;
+
+			Proposal->Flags |= CFG_QOS;
+			Proposal->Flow = Rejected->Flow;
+		}
+		else
+		{
+			adopted = adopted || (Requested->Flags & CFG_QOS);
+
+			Proposal->Flags &= ~CFG_QOS;
+			RtlZeroMemory(&Proposal->Flow, sizeof(Proposal->Flow));
+		}
+	}
+
+	if (!adopted)
+	{
+		Proposal->Flags &= ~(CFG_QOS | CFG_FLUSHTO);
+		Proposal->FlushTO = 0;
+		RtlZeroMemory(&Proposal->Flow, sizeof(Proposal->Flow));
+	}
+}
+
+//
+// Records the configuration the remote device requested for its outgoing traffic
+// 
+// The request is accepted as-is, like before.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+L2CAP_PS3_ChannelConfigRequested(
+	_In_ PBTHPS3_CLIENT_L2CAP_CHANNEL Channel,
+	_In_ PINDICATION_PARAMETERS Parameters
+)
+{
+	BTHPS3_CHANNEL_QOS qos;
+
+	L2CAP_PS3_ChannelCopyConfig(&Parameters->Parameters.ConfigRequest.RequestedParams, &qos);
+
+	const KIRQL irql = ExAcquireSpinLockExclusive(&Channel->Config.Lock);
+	Channel->Config.Remote = qos;
+	ExReleaseSpinLockExclusive(&Channel->Config.Lock, irql);
+
+	TraceVerbose(
+		TRACE_L2CAP,
+		"Channel 0x%p remote config: flags 0x%X, MTU %d, flush timeout %d, service type %d, latency %d",
+		Channel,
+		qos.Flags,
+		qos.Mtu,
+		qos.FlushTimeout,
+		qos.ServiceType,
+		qos.Latency
+	);
+}
+
+//
+// Records the outcome of our configuration request, proposes new values if it got rejected
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+L2CAP_PS3_ChannelConfigResponded(
+	_In_ PBTHPS3_CLIENT_L2CAP_CHANNEL Channel,
+	_In_ PINDICATION_PARAMETERS Parameters
+)
+{
+	BTHPS3_CHANNEL_QOS qos;
+
+	if (Parameters->Parameters.ConfigResponse.Response == CONFIG_STATUS_SUCCESS)
+	{
+		L2CAP_PS3_ChannelCopyConfig(&Parameters->Parameters.ConfigResponse.CurrentParams, &qos);
+
+		const KIRQL irql = ExAcquireSpinLockExclusive(&Channel->Config.Lock);
+		Channel->Config.Local = qos;
+		ExReleaseSpinLockExclusive(&Channel->Config.Lock, irql);
+
+		TraceVerbose(
+			TRACE_L2CAP,
+			"Channel 0x%p local config: flags 0x%X, MTU %d, flush timeout %d, service type %d, latency %d",
+			Channel,
+			qos.Flags,
+			qos.Mtu,
+			qos.FlushTimeout,
+			qos.ServiceType,
+			qos.Latency
+		);
+
+		return;
+	}
+
+	InterlockedIncrement(&Channel->Config.Rejects);
+
+	L2CAP_PS3_ChannelCounterProposal(
+		&Parameters->Parameters.ConfigResponse.RequestedParams,
+		&Parameters->Parameters.ConfigResponse.RejectedParams,
+		&Parameters->Parameters.ConfigResponse.NewRequestParams
+	);
+
+	TraceInformation(
+		TRACE_L2CAP,
+		"Channel 0x%p config rejected (%d), proposing flush timeout %d, service type %d",
+		Channel,
+		Parameters->Parameters.ConfigResponse.Response,
+		Parameters->Parameters.ConfigResponse.NewRequestParams.FlushTO,
+		Parameters->Parameters.ConfigResponse.NewRequestParams.Flow.ServiceType
+	);
+}
+
+//
+// Copies the recorded configuration of a channel
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+L2CAP_PS3_ChannelGetConfig(
+	_In_ PBTHPS3_CLIENT_L2CAP_CHANNEL Channel,
+	_Out_ PBTHPS3_CHANNEL_STATS Stats
+)
+{
+	const KIRQL irql = ExAcquireSpinLockShared(&Channel->Config.Lock);
+	Stats->Remote = Channel->Config.Remote;
+	Stats->Local = Channel->Config.Local;
+	ExReleaseSpinLockShared(&Channel->Config.Lock, irql);
+
+	Stats->ConfigRejects = (ULONG)InterlockedCompareExchange(&Channel->Config.Rejects, 0, 0);
+}
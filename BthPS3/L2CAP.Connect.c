@@ -46,26 +46,23 @@ _IRQL_requires_max_(PASSIVE_LEVEL)
 NTSTATUS
 L2CAP_PS3_HandleRemoteConnect(
     _In_ PBTHPS3_SERVER_CONTEXT DevCtx,
-    _In_ PINDICATION_PARAMETERS ConnectParams
+    _In_ PINDICATION_PARAMETERS ConnectParams,
+    _In_ ULONGLONG IndicatedAt
 )
 {
     NTSTATUS status = STATUS_UNSUCCESSFUL;
-    struct _BRB_L2CA_OPEN_CHANNEL* brb = NULL;
-    PFN_WDF_REQUEST_COMPLETION_ROUTINE completionRoutine = NULL;
     USHORT psm = ConnectParams->Parameters.Connect.Request.PSM;
     PBTHPS3_PDO_CONTEXT pPdoCtx = NULL;
-    WDFREQUEST brbAsyncRequest = NULL;
     CHAR remoteName[BTH_MAX_NAME_SIZE];
     DS_DEVICE_TYPE deviceType = DS_DEVICE_TYPE_UNKNOWN;
+    const ULONGLONG connectStartedAt = KeQueryInterruptTime();
+    PBTHPS3_SETTINGS settings = NULL;
+    ULONGLONG phases[BTHPS3_CONNECT_PHASE_COUNT] = { 0 };
+    BOOLEAN isWarm = FALSE;
 
 
     FuncEntry(TRACE_L2CAP);
 
-    //
-    // (Try to) refresh settings from registry
-    // 
-    (void)BthPS3_SettingsContextInit(DevCtx);
-
     //
     // Look for an existing connection object and reuse that
     // 
@@ -80,13 +77,17 @@ L2CAP_PS3_HandleRemoteConnect(
     // 
     if (status == STATUS_NOT_FOUND)
     {
+        settings = BthPS3_SettingsAcquire(DevCtx);
+
+        phases[BTHPS3_CONNECT_PHASE_INDICATED] = IndicatedAt;
+
         RtlZeroMemory(remoteName, BTH_MAX_NAME_SIZE);
 
         //
         // Request remote name from radio for device identification
         // 
         if (NT_SUCCESS(status = BthPS3_GetDeviceName(
-            DevCtx->Header.IoTarget,
+            &DevCtx->Header,
             ConnectParams->BtAddress,
             remoteName
         )))
@@ -99,6 +100,8 @@ L2CAP_PS3_HandleRemoteConnect(
             );
 
             EventWriteRemoteDeviceName(NULL, ConnectParams->BtAddress, remoteName);
+
+            phases[BTHPS3_CONNECT_PHASE_NAME_RESOLVED] = KeQueryInterruptTime();
         }
         else
         {
@@ -110,23 +113,26 @@ L2CAP_PS3_HandleRemoteConnect(
 
             EventWriteFailedWithNTStatus(NULL, __FUNCTION__, L"BthPS3_GetDeviceName", status);
 
+            BthPS3_TimelineRecordFailed(&DevCtx->Header, ConnectParams->BtAddress, FALSE, status, phases);
+
             //
             // Name couldn't be resolved, drop connection
             // 
-            return L2CAP_PS3_DenyRemoteConnect(DevCtx, ConnectParams);
+            status = L2CAP_PS3_DenyRemoteConnect(DevCtx, ConnectParams);
+            BthPS3_SettingsRelease(settings);
+            return status;
         }
 
         //
         // Distinguish device type based on reported remote name
         // 
+        deviceType = BthPS3_NameMatcherLookup(settings, remoteName);
 
-        //
-        // Check if PLAYSTATION(R)3 Controller
-        // 
-        if (DevCtx->Settings.IsSIXAXISSupported
-            && StringUtil_BthNameIsInCollection(remoteName, DevCtx->Settings.SIXAXISSupportedNames)) 
+        phases[BTHPS3_CONNECT_PHASE_DEVICE_IDENTIFIED] = KeQueryInterruptTime();
+
+        switch (deviceType)
         {
-            deviceType = DS_DEVICE_TYPE_SIXAXIS;
+        case DS_DEVICE_TYPE_SIXAXIS:
 
             TraceInformation(
                 TRACE_L2CAP,
@@ -136,16 +142,8 @@ L2CAP_PS3_HandleRemoteConnect(
 
             EventWriteRemoteDeviceIdentified(NULL, ConnectParams->BtAddress, L"SIXAXIS");
 
-            goto deviceIdentified;
-        }
-
-        //
-        // Check if Navigation Controller
-        // 
-        if (DevCtx->Settings.IsNAVIGATIONSupported
-            && StringUtil_BthNameIsInCollection(remoteName, DevCtx->Settings.NAVIGATIONSupportedNames)) 
-        {
-            deviceType = DS_DEVICE_TYPE_NAVIGATION;
+            break;
+        case DS_DEVICE_TYPE_NAVIGATION:
 
             TraceInformation(
                 TRACE_L2CAP,
@@ -155,16 +153,8 @@ L2CAP_PS3_HandleRemoteConnect(
 
             EventWriteRemoteDeviceIdentified(NULL, ConnectParams->BtAddress, L"NAVIGATION");
 
-            goto deviceIdentified;
-        }
-
-        //
-        // Check if Motion Controller
-        // 
-        if (DevCtx->Settings.IsMOTIONSupported
-            && StringUtil_BthNameIsInCollection(remoteName, DevCtx->Settings.MOTIONSupportedNames)) 
-        {
-            deviceType = DS_DEVICE_TYPE_MOTION;
+            break;
+        case DS_DEVICE_TYPE_MOTION:
 
             TraceInformation(
                 TRACE_L2CAP,
@@ -174,16 +164,8 @@ L2CAP_PS3_HandleRemoteConnect(
 
             EventWriteRemoteDeviceIdentified(NULL, ConnectParams->BtAddress, L"MOTION");
 
-            goto deviceIdentified;
-        }
-
-        //
-        // Check if Wireless Controller
-        // 
-        if (DevCtx->Settings.IsWIRELESSSupported
-            && StringUtil_BthNameIsInCollection(remoteName, DevCtx->Settings.WIRELESSSupportedNames))
-        {
-            deviceType = DS_DEVICE_TYPE_WIRELESS;
+            break;
+        case DS_DEVICE_TYPE_WIRELESS:
 
             TraceInformation(
                 TRACE_L2CAP,
@@ -193,11 +175,11 @@ L2CAP_PS3_HandleRemoteConnect(
 
             EventWriteRemoteDeviceIdentified(NULL, ConnectParams->BtAddress, L"WIRELESS");
 
-            goto deviceIdentified;
+            break;
+        default:
+            break;
         }
 
-    deviceIdentified:
-
         //
         // We were not able to identify, drop it
         // 
@@ -211,56 +193,29 @@ L2CAP_PS3_HandleRemoteConnect(
 
             EventWriteRemoteDeviceNotIdentified(NULL, ConnectParams->BtAddress);
 
+            BthPS3_TimelineRecordFailed(&DevCtx->Header, ConnectParams->BtAddress, FALSE, STATUS_NOT_SUPPORTED, phases);
+
+            //
+            // Repeated attempts get denied before resolving the name or touching the filter
+            // 
+            BthPS3_DenyCacheInsert(&DevCtx->Header, ConnectParams->BtAddress, settings->DenyCacheTimeout);
+
             //
             // Filter re-routed potentially unsupported device, disable
             // 
-            if (DevCtx->Settings.AutoDisableFilter)
+            // Sent without waiting, the re-enable timer gets armed on completion
+            // 
+            if (settings->AutoDisableFilter)
             {
-                if (!NT_SUCCESS(status = BthPS3PSM_DisablePatchSync(
-                    DevCtx->PsmFilter.IoTarget,
-                    0
-                )))
-                {
-                    TraceError(
-                        TRACE_L2CAP,
-                        "BthPS3PSM_DisablePatchSync failed with status %!STATUS!",
-                        status
-                    );
-                }
-                else
-                {
-                    TraceInformation(
-                        TRACE_L2CAP,
-                        "Filter disabled"
-                    );
-
-                    EventWriteAutoDisableFilter(NULL);
-
-                    //
-                    // Fire off re-enable timer
-                    // 
-                    if (DevCtx->Settings.AutoEnableFilter)
-                    {
-                        TraceInformation(
-                            TRACE_L2CAP,
-                            "Filter disabled, re-enabling in %d seconds",
-                            DevCtx->Settings.AutoEnableFilterDelay
-                        );
-
-                        EventWriteAutoEnableFilter(NULL, DevCtx->Settings.AutoEnableFilterDelay);
-
-                        (void)WdfTimerStart(
-                            DevCtx->PsmFilter.AutoResetTimer,
-                            WDF_REL_TIMEOUT_IN_SEC(DevCtx->Settings.AutoEnableFilterDelay)
-                        );
-                    }
-                }
+                BthPS3PSM_FilterCommandSubmit(DevCtx, BthPS3PSMFilterCommandDisablePatch);
             }
 
             //
             // Unsupported device, drop connection
             // 
-            return L2CAP_PS3_DenyRemoteConnect(DevCtx, ConnectParams);
+            status = L2CAP_PS3_DenyRemoteConnect(DevCtx, ConnectParams);
+            BthPS3_SettingsRelease(settings);
+            return status;
         }
 
         //
@@ -271,6 +226,7 @@ L2CAP_PS3_HandleRemoteConnect(
             ConnectParams->BtAddress,
             deviceType,
             remoteName,
+            phases,
             &pPdoCtx
         )))
         {
@@ -281,6 +237,40 @@ L2CAP_PS3_HandleRemoteConnect(
             );
             goto exit;
         }
+
+        pPdoCtx->Linger.IsWarmConnect = FALSE;
+        pPdoCtx->Linger.ConnectStartedAt = (psm == PSM_DS3_HID_CONTROL) ? connectStartedAt : 0;
+    }
+    else if (NT_SUCCESS(status) && psm == PSM_DS3_HID_CONTROL)
+    {
+        //
+        // Device came back while its PDO is kept, rebind channels to it
+        // 
+        switch (BthPS3_PDO_LeaveLinger(pPdoCtx))
+        {
+        case LingerStateLingering:
+            pPdoCtx->Linger.IsWarmConnect = TRUE;
+            pPdoCtx->Linger.ConnectStartedAt = connectStartedAt;
+            isWarm = TRUE;
+
+            phases[BTHPS3_CONNECT_PHASE_INDICATED] = IndicatedAt;
+            BthPS3_PDO_TimelineStart(pPdoCtx, TRUE, phases);
+            break;
+        case LingerStateExpired:
+            TraceInformation(
+                TRACE_L2CAP,
+                "PDO of device %012llX is being destroyed, dropping connection",
+                ConnectParams->BtAddress
+            );
+
+            //
+            // Device will retry once the old PDO is gone
+            // 
+            return L2CAP_PS3_DenyRemoteConnect(DevCtx, ConnectParams);
+        default:
+            pPdoCtx->Linger.ConnectStartedAt = 0;
+            break;
+        }
     }
 
     if (pPdoCtx == NULL)
@@ -289,6 +279,73 @@ L2CAP_PS3_HandleRemoteConnect(
         goto exit;
     }
 
+    //
+    // Accept connection on behalf of PDO
+    // 
+    status = L2CAP_PS3_SendConnectResponse(DevCtx, pPdoCtx, ConnectParams);
+
+    //
+    // Channel busy is a harmless race, refuse the connection and keep the PDO
+    // 
+    if (status == STATUS_INVALID_DEVICE_STATE)
+    {
+        TraceInformation(
+            TRACE_L2CAP,
+            "Channel of device %012llX busy, refusing connection",
+            ConnectParams->BtAddress
+        );
+
+        status = L2CAP_PS3_DenyRemoteConnect(DevCtx, ConnectParams);
+        pPdoCtx = NULL;
+    }
+
+exit:
+
+    if (settings)
+    {
+        BthPS3_SettingsRelease(settings);
+    }
+
+    if (!NT_SUCCESS(status) && pPdoCtx)
+    {
+        BthPS3_PDO_Destroy(&DevCtx->Header, pPdoCtx);
+    }
+
+    if (!NT_SUCCESS(status))
+    {
+        EventWriteL2CAPRemoteConnectFailed(NULL, psm, status);
+    }
+
+    //
+    // Only connects which started a timeline, the PDO one won't complete anymore
+    // 
+    if (!NT_SUCCESS(status) && phases[BTHPS3_CONNECT_PHASE_INDICATED] != 0)
+    {
+        BthPS3_TimelineRecordFailed(&DevCtx->Header, ConnectParams->BtAddress, isWarm, status, phases);
+    }
+
+    FuncExit(TRACE_L2CAP, "status=%!STATUS!", status);
+
+    return status;
+}
+
+//
+// Sends the connect response BRB for an existing PDO
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS
+L2CAP_PS3_SendConnectResponse(
+    _In_ PBTHPS3_SERVER_CONTEXT DevCtx,
+    _In_ PBTHPS3_PDO_CONTEXT PdoCtx,
+    _In_ PINDICATION_PARAMETERS ConnectParams
+)
+{
+    NTSTATUS status;
+    struct _BRB_L2CA_OPEN_CHANNEL* brb = NULL;
+    PFN_WDF_REQUEST_COMPLETION_ROUTINE completionRoutine = NULL;
+    const USHORT psm = ConnectParams->Parameters.Connect.Request.PSM;
+    PBTHPS3_CLIENT_L2CAP_CHANNEL channel = NULL;
+
     //
     // Adjust control flow depending on PSM
     // 
@@ -296,28 +353,50 @@ L2CAP_PS3_HandleRemoteConnect(
     {
     case PSM_DS3_HID_CONTROL:
         completionRoutine = L2CAP_PS3_ControlConnectResponseCompleted;
-        pPdoCtx->HidControlChannel.ChannelHandle = ConnectParams->ConnectionHandle;
-        brbAsyncRequest = pPdoCtx->HidControlChannel.ConnectDisconnectRequest;
-        brb = (struct _BRB_L2CA_OPEN_CHANNEL*)&(pPdoCtx->HidControlChannel.ConnectDisconnectBrb);
+        channel = &PdoCtx->HidControlChannel;
         break;
     case PSM_DS3_HID_INTERRUPT:
         completionRoutine = L2CAP_PS3_InterruptConnectResponseCompleted;
-        pPdoCtx->HidInterruptChannel.ChannelHandle = ConnectParams->ConnectionHandle;
-        brbAsyncRequest = pPdoCtx->HidInterruptChannel.ConnectDisconnectRequest;
-        brb = (struct _BRB_L2CA_OPEN_CHANNEL*)&(pPdoCtx->HidInterruptChannel.ConnectDisconnectBrb);
+        channel = &PdoCtx->HidInterruptChannel;
         break;
     default:
-        status = STATUS_INVALID_PARAMETER;
-        goto exit;
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    // Channel must be idle, its request and BRB get reused below
+    // 
+    if (!L2CAP_PS3_ChannelTransition(channel, ChannelEventConnect, NULL))
+    {
+        TraceError(
+            TRACE_L2CAP,
+            "Channel for PSM 0x%04X is busy (state: %d)",
+            psm,
+            L2CAP_PS3_ChannelGetState(channel)
+        );
+
+        return STATUS_INVALID_DEVICE_STATE;
     }
 
+    //
+    // Tuning of this device type, the profile is copied so the snapshot can go
+    // 
+    const PBTHPS3_SETTINGS settings = BthPS3_SettingsAcquire(DevCtx);
+    channel->Profile = settings->ChannelProfiles[PdoCtx->DeviceType];
+    const BOOLEAN requestLowLatencyQos = (settings->RequestLowLatencyQos != 0);
+    BthPS3_SettingsRelease(settings);
+
+    channel->ChannelHandle = ConnectParams->ConnectionHandle;
+    const WDFREQUEST brbAsyncRequest = channel->ConnectDisconnectRequest;
+    brb = (struct _BRB_L2CA_OPEN_CHANNEL*)&(channel->ConnectDisconnectBrb);
+
     CLIENT_CONNECTION_REQUEST_REUSE(brbAsyncRequest);
     DevCtx->Header.ProfileDrvInterface.BthReuseBrb((PBRB)brb, BRB_L2CA_OPEN_CHANNEL_RESPONSE);
 
     //
     // Pass connection object along as context
     // 
-    brb->Hdr.ClientContext[0] = pPdoCtx;
+    brb->Hdr.ClientContext[0] = PdoCtx;
 
     brb->BtAddress = ConnectParams->BtAddress;
     brb->Psm = psm;
@@ -330,12 +409,12 @@ L2CAP_PS3_HandleRemoteConnect(
     brb->ConfigIn.Flags = 0;
 
     //
-    // Set expected and preferred MTU to max value
+    // Set expected and preferred MTU to profile value
     // 
     brb->ConfigOut.Flags |= CFG_MTU;
-    brb->ConfigOut.Mtu.Max = L2CAP_MAX_MTU;
+    brb->ConfigOut.Mtu.Max = channel->Profile.Mtu;
     brb->ConfigOut.Mtu.Min = L2CAP_MIN_MTU;
-    brb->ConfigOut.Mtu.Preferred = L2CAP_MAX_MTU;
+    brb->ConfigOut.Mtu.Preferred = channel->Profile.Mtu;
 
     brb->ConfigIn.Flags = CFG_MTU;
     brb->ConfigIn.Mtu.Max = brb->ConfigOut.Mtu.Max;
@@ -343,26 +422,38 @@ L2CAP_PS3_HandleRemoteConnect(
     brb->ConfigIn.Mtu.Preferred = brb->ConfigOut.Mtu.Preferred;
 
     //
-    // Remaining L2CAP defaults
+    // Flush and link timeout of the profile, remaining L2CAP defaults
     // 
-    brb->ConfigOut.FlushTO.Max = L2CAP_DEFAULT_FLUSHTO;
+    brb->ConfigOut.FlushTO.Max = channel->Profile.FlushTimeout;
     brb->ConfigOut.FlushTO.Min = L2CAP_MIN_FLUSHTO;
-    brb->ConfigOut.FlushTO.Preferred = L2CAP_DEFAULT_FLUSHTO;
+    brb->ConfigOut.FlushTO.Preferred = channel->Profile.FlushTimeout;
     brb->ConfigOut.ExtraOptions = 0;
     brb->ConfigOut.NumExtraOptions = 0;
-    brb->ConfigOut.LinkTO = 0;
+    brb->ConfigOut.LinkTO = channel->Profile.LinkTimeout;
+
+    //
+    // Ask for guaranteed service, a rejection gets answered with the values the remote accepts
+    // 
+    if (requestLowLatencyQos)
+    {
+        brb->ConfigOut.Flags |= CFG_QOS;
+        RtlZeroMemory(&brb->ConfigOut.Flow, sizeof(brb->ConfigOut.Flow));
+        brb->ConfigOut.Flow.ServiceType = BTHPS3_L2CAP_SERVICE_TYPE_GUARANTEED;
+        brb->ConfigOut.Flow.Latency = BTHPS3_L2CAP_LOW_LATENCY_US;
+        brb->ConfigOut.Flow.DelayVariation = MAXULONG;
+    }
 
     //
     // Max count of MTUs to stay buffered until discarded
     // 
-    brb->IncomingQueueDepth = 10;
+    brb->IncomingQueueDepth = channel->Profile.IncomingQueueDepth;
 
     //
-    // Get notifications about disconnect and QOS
+    // Get notifications about disconnect, QOS and received packets (queue fill level)
     //
-    brb->CallbackFlags = CALLBACK_DISCONNECT | CALLBACK_CONFIG_QOS;
+    brb->CallbackFlags = CALLBACK_DISCONNECT | CALLBACK_CONFIG_QOS | CALLBACK_RECV_PACKET;
     brb->Callback = &L2CAP_PS3_ConnectionIndicationCallback;
-    brb->CallbackContext = pPdoCtx;
+    brb->CallbackContext = PdoCtx;
     brb->ReferenceObject = (PVOID)WdfDeviceWdmGetDeviceObject(DevCtx->Header.Device);
 
     //
@@ -382,21 +473,66 @@ L2CAP_PS3_HandleRemoteConnect(
             "BthPS3_SendBrbAsync failed with status %!STATUS!",
             status
         );
+
+        (void)L2CAP_PS3_ChannelTransition(channel, ChannelEventConnectFailed, NULL);
     }
 
-exit:
+    return status;
+}
 
-    if (!NT_SUCCESS(status) && pPdoCtx)
+//
+// Accepts a connection from a device with an established PDO without leaving DISPATCH_LEVEL
+// 
+// Handles the HID Interrupt channel of a device which already has its HID
+// Control channel connected, returns STATUS_NOT_FOUND for everything else
+// (new devices, control channel reconnects) which requires PASSIVE_LEVEL.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS
+L2CAP_PS3_HandleKnownRemoteConnect(
+    _In_ PBTHPS3_SERVER_CONTEXT DevCtx,
+    _In_ PINDICATION_PARAMETERS ConnectParams
+)
+{
+    NTSTATUS status = STATUS_NOT_FOUND;
+
+    if (ConnectParams->Parameters.Connect.Request.PSM != PSM_DS3_HID_INTERRUPT)
     {
-        BthPS3_PDO_Destroy(&DevCtx->Header, pPdoCtx);
+        return status;
     }
 
-    if (!NT_SUCCESS(status))
+    const PBTHPS3_PDO_CONTEXT pPdoCtx = BthPS3_ClientsTable_LookupAndReference(
+        &DevCtx->Header,
+        ConnectParams->BtAddress
+    );
+
+    if (pPdoCtx == NULL)
     {
-        EventWriteL2CAPRemoteConnectFailed(NULL, psm, status);
+        return status;
     }
 
-    FuncExit(TRACE_L2CAP, "status=%!STATUS!", status);
+    if (L2CAP_PS3_ChannelGetState(&pPdoCtx->HidControlChannel) == ConnectionStateConnected)
+    {
+        TraceVerbose(
+            TRACE_L2CAP,
+            "Accepting connection from known device %012llX at IRQL %!irql!",
+            ConnectParams->BtAddress,
+            KeGetCurrentIrql()
+        );
+
+        status = L2CAP_PS3_SendConnectResponse(DevCtx, pPdoCtx, ConnectParams);
+
+        //
+        // Channel still busy with a previous connection, the PDO itself is
+        // fine so answer here instead of failing over to the slow path
+        // 
+        if (status == STATUS_INVALID_DEVICE_STATE)
+        {
+            status = L2CAP_PS3_DenyRemoteConnect(DevCtx, ConnectParams);
+        }
+    }
+
+    WdfObjectDereference(WdfObjectContextGetObject(pPdoCtx));
 
     return status;
 }
@@ -37,6 +37,7 @@
 
 #include "Driver.h"
 #include "L2CAP.Disconnect.tmh"
+#include "BthPS3ETW.h"
 
 
 _IRQL_requires_max_(PASSIVE_LEVEL)
@@ -50,7 +51,7 @@ L2CAP_PS3_HandleRemoteDisconnect(
 	PBTHPS3_SERVER_CONTEXT pDevCtx = NULL;
 	PBTHPS3_PDO_CONTEXT pPdoCtx = Context;
 	LARGE_INTEGER timeout;
-	timeout.QuadPart = 0;
+	timeout.QuadPart = WDF_REL_TIMEOUT_IN_SEC(1);
 
 	FuncEntryArguments(TRACE_L2CAP, "pdoContext=0x%p", DisconnectParams->ConnectionHandle);
 
@@ -92,69 +93,98 @@ L2CAP_PS3_HandleRemoteDisconnect(
 		);
 	}
 
+	//
+	// Announce teardown before checking the channel states so a close completing
+	// in between either sees this flag or leaves both channels disconnected here
+	// 
+	InterlockedExchange(&pPdoCtx->TeardownPending, TRUE);
+
 	//
 	// Both channels are gone, invoke clean-up
 	// 
-	if (pPdoCtx->HidControlChannel.ConnectionState == ConnectionStateDisconnected
-		&& pPdoCtx->HidInterruptChannel.ConnectionState == ConnectionStateDisconnected)
+	if (L2CAP_PS3_ChannelGetState(&pPdoCtx->HidControlChannel) == ConnectionStateDisconnected
+		&& L2CAP_PS3_ChannelGetState(&pPdoCtx->HidInterruptChannel) == ConnectionStateDisconnected
+		&& InterlockedCompareExchange(&pPdoCtx->TeardownPending, FALSE, TRUE) == TRUE)
 	{
+		PVOID disconnectEvents[] =
+		{
+			&pPdoCtx->HidControlChannel.DisconnectEvent,
+			&pPdoCtx->HidInterruptChannel.DisconnectEvent
+		};
+
 		TraceVerbose(
 			TRACE_L2CAP,
 			"Both channels are gone, awaiting clean-up"
 		);
 
-		status = KeWaitForSingleObject(
-			&pPdoCtx->HidControlChannel.DisconnectEvent,
+		//
+		// The state is published before the transition signals the event, the
+		// close completion may still be in between on another processor
+		// 
+		status = KeWaitForMultipleObjects(
+			ARRAYSIZE(disconnectEvents),
+			disconnectEvents,
+			WaitAll,
 			Executive,
 			KernelMode,
 			FALSE,
-			&timeout
+			&timeout,
+			NULL
 		);
-		if (!NT_SUCCESS(status))
+		if (!NT_SUCCESS(status) || status == STATUS_TIMEOUT)
 		{
-			TraceError(
-				TRACE_L2CAP,
-				"HID Control - KeWaitForSingleObject failed with status %!STATUS!",
-				status
-			);
-
 			//
-			// TODO: react properly to this!
+			// Both channels already report closed so no transfer can be left
+			// behind, the clean-up below is safe to continue regardless
 			// 
-		}
-
-		status = KeWaitForSingleObject(
-			&pPdoCtx->HidInterruptChannel.DisconnectEvent,
-			Executive,
-			KernelMode,
-			FALSE,
-			&timeout
-		);
-		if (!NT_SUCCESS(status))
-		{
-			TraceError(
+			TraceEvents(
+				TRACE_LEVEL_WARNING,
 				TRACE_L2CAP,
-				"HID Interrupt - KeWaitForSingleObject failed with status %!STATUS!",
+				"KeWaitForMultipleObjects failed with status %!STATUS!, cleaning up anyway",
 				status
 			);
-
-			//
-			// TODO: react properly to this!
-			// 
 		}
 
 		//
-		// TODO: old PDO destruction happened here
+		// Keep PDO around for a quick reconnect, if configured
 		// 
+		if (BthPS3_PDO_EnterLinger(pPdoCtx))
+		{
+			FuncExit(TRACE_L2CAP, "status=%!STATUS!", status);
+
+			return status;
+		}
 
 		BthPS3_PDO_Destroy(&pDevCtx->Header, pPdoCtx);
 	}
+	else
+	{
+		TraceVerbose(
+			TRACE_L2CAP,
+			"Channel close still pending, clean-up continues on its completion"
+		);
+	}
 
 	FuncExit(TRACE_L2CAP, "status=%!STATUS!", status);
 
 	return status;
 }
 
+//
+// Channel of a PDO an indication is meant for
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+static PBTHPS3_CLIENT_L2CAP_CHANNEL
+L2CAP_PS3_ChannelFromHandle(
+	_In_ PBTHPS3_PDO_CONTEXT PdoCtx,
+	_In_ L2CAP_CHANNEL_HANDLE ChannelHandle
+)
+{
+	return (ChannelHandle == PdoCtx->HidControlChannel.ChannelHandle)
+		? &PdoCtx->HidControlChannel
+		: &PdoCtx->HidInterruptChannel;
+}
+
 //
 // Gets invoked on remote disconnect or configuration request
 // 
@@ -217,15 +247,14 @@ L2CAP_PS3_ConnectionIndicationCallback(
 		qwi.IndicationParameters = *Parameters;
 		qwi.Context.Pdo = pPdoCtx;
 
-		if (!NT_SUCCESS(status = DMF_QueuedWorkItem_Enqueue(
-			pPdoCtx->DevCtxHdr->QueuedWorkItemModule,
-			&qwi,
-			sizeof(BTHPS3_QWI_CONTEXT)
+		if (!NT_SUCCESS(status = BthPS3_QueuedWorkItemEnqueue(
+			pPdoCtx->DevCtxHdr,
+			&qwi
 		)))
 		{
 			TraceError(
 				TRACE_BTH,
-				"DMF_QueuedWorkItem_Enqueue failed with status %!STATUS!",
+				"BthPS3_QueuedWorkItemEnqueue failed with status %!STATUS!",
 				status
 			);
 
@@ -241,6 +270,10 @@ L2CAP_PS3_ConnectionIndicationCallback(
 		//
 		// This catches QOS configuration request and inherently succeeds it
 		// 
+		L2CAP_PS3_ChannelConfigRequested(
+			L2CAP_PS3_ChannelFromHandle(pPdoCtx, Parameters->ConnectionHandle),
+			Parameters
+		);
 
 		break;
 
@@ -248,10 +281,32 @@ L2CAP_PS3_ConnectionIndicationCallback(
 
 		TraceVerbose(TRACE_L2CAP, "IndicationRemoteConfigResponse");
 
+		L2CAP_PS3_ChannelConfigResponded(
+			L2CAP_PS3_ChannelFromHandle(pPdoCtx, Parameters->ConnectionHandle),
+			Parameters
+		);
+
 		break;
 
 	case IndicationFreeExtraOptions:
 		break;
+
+	case IndicationRecvPacket:
+	{
+		//
+		// Radio buffers more packets than we read, count it so the profile can be tuned
+		// 
+		const PBTHPS3_CLIENT_L2CAP_CHANNEL channel =
+			L2CAP_PS3_ChannelFromHandle(pPdoCtx, Parameters->ConnectionHandle);
+
+		if (Parameters->Parameters.RecvPacket.TotalQueueLength >= channel->Profile.IncomingQueueDepth)
+		{
+			InterlockedIncrement(&channel->QueueDepthReached);
+		}
+
+		break;
+	}
+
 	default:
 		//
 		// We don't expect any other indications on this callback
@@ -273,52 +328,58 @@ L2CAP_PS3_RemoteDisconnect(
 	_In_ PBTHPS3_CLIENT_L2CAP_CHANNEL Channel
 )
 {
-	struct _BRB_L2CA_CLOSE_CHANNEL* disconnectBrb = NULL;
+	BTHPS3_CONNECTION_STATE previousState;
 
 	FuncEntry(TRACE_L2CAP);
 
-	WdfSpinLockAcquire(Channel->ConnectionStateLock);
-
-	if (Channel->ConnectionState == ConnectionStateConnecting)
+	if (!L2CAP_PS3_ChannelTransition(Channel, ChannelEventDisconnect, &previousState))
 	{
 		//
-		// If the connection is not completed yet set the state 
-		// to disconnecting.
-		// In such case we should send CLOSE_CHANNEL Brb down after 
-		// we receive connect completion.
+		// Do nothing if we are not connected
 		//
 
-		Channel->ConnectionState = ConnectionStateDisconnecting;
+		FuncExit(TRACE_L2CAP, "returns=FALSE");
+		return FALSE;
+	}
 
+	if (previousState == ConnectionStateConnecting)
+	{
 		//
-		// Clear event to indicate that we are in disconnecting
-		// state. It will be set when disconnect is completed
+		// If the connection is not completed yet we should send 
+		// CLOSE_CHANNEL Brb down after we receive connect completion.
 		//
-		KeClearEvent(&Channel->DisconnectEvent);
 
-		WdfSpinLockRelease(Channel->ConnectionStateLock);
+		FuncExit(TRACE_L2CAP, "returns=TRUE");
 		return TRUE;
 	}
 
-	if (Channel->ConnectionState != ConnectionStateConnected)
+	//
+	// Don't leave pending transfers to fail one by one, the close completes sooner without them
+	// 
+	if (Channel->Owner != NULL)
 	{
-		//
-		// Do nothing if we are not connected
-		//
-
-		WdfSpinLockRelease(Channel->ConnectionStateLock);
-		FuncExit(TRACE_L2CAP, "returns=FALSE");
-		return FALSE;
+		L2CAP_PS3_CancelTransfers(Channel->Owner, Channel);
 	}
 
-	Channel->ConnectionState = ConnectionStateDisconnecting;
-	WdfSpinLockRelease(Channel->ConnectionStateLock);
+	L2CAP_PS3_SendChannelClose(CtxHdr, RemoteAddress, Channel);
 
-	//
-	// We are now sending the disconnect, so clear the event.
-	//
+	FuncExit(TRACE_L2CAP, "returns=TRUE");
 
-	KeClearEvent(&Channel->DisconnectEvent);
+	return TRUE;
+}
+
+//
+// Sends the close request of a channel in Disconnecting state
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+L2CAP_PS3_SendChannelClose(
+	_In_ PBTHPS3_DEVICE_CONTEXT_HEADER CtxHdr,
+	_In_ BTH_ADDR RemoteAddress,
+	_In_ PBTHPS3_CLIENT_L2CAP_CHANNEL Channel
+)
+{
+	struct _BRB_L2CA_CLOSE_CHANNEL* disconnectBrb = NULL;
 
 	CLIENT_CONNECTION_REQUEST_REUSE(Channel->ConnectDisconnectRequest);
 	CtxHdr->ProfileDrvInterface.BthReuseBrb(
@@ -343,10 +404,6 @@ L2CAP_PS3_RemoteDisconnect(
 		L2CAP_PS3_ChannelDisconnectCompleted,
 		Channel
 	);
-
-	FuncExit(TRACE_L2CAP, "returns=TRUE");
-
-	return TRUE;
 }
 
 //
@@ -367,18 +424,197 @@ L2CAP_PS3_ChannelDisconnectCompleted(
 
 	FuncEntryArguments(TRACE_L2CAP, "status=%!STATUS!", Params->IoStatus.Status);
 
-	WdfSpinLockAcquire(channel->ConnectionStateLock);
-	channel->ConnectionState = ConnectionStateDisconnected;
-	WdfSpinLockRelease(channel->ConnectionStateLock);
+	//
+	// Disconnect complete, sets the event
+	//
+	(void)L2CAP_PS3_ChannelTransition(channel, ChannelEventDisconnected, NULL);
+
+	const PBTHPS3_PDO_CONTEXT pPdoCtx = channel->Owner;
 
 	//
-	// Disconnect complete, set the event
+	// Last close of a remote disconnect, continue clean-up at PASSIVE_LEVEL
+	// 
+	if (pPdoCtx != NULL
+		&& L2CAP_PS3_ChannelGetState(&pPdoCtx->HidControlChannel) == ConnectionStateDisconnected
+		&& L2CAP_PS3_ChannelGetState(&pPdoCtx->HidInterruptChannel) == ConnectionStateDisconnected
+		&& InterlockedCompareExchange(&pPdoCtx->TeardownPending, FALSE, TRUE) == TRUE)
+	{
+		NTSTATUS status;
+		BTHPS3_QWI_CONTEXT qwi;
+
+		RtlZeroMemory(&qwi, sizeof(BTHPS3_QWI_CONTEXT));
+
+		//
+		// No connection handle, only the clean-up part will run
+		// 
+		qwi.IndicationCode = IndicationRemoteDisconnect;
+		qwi.IndicationParameters.BtAddress = pPdoCtx->RemoteAddress;
+		qwi.Context.Pdo = pPdoCtx;
+
+		if (!NT_SUCCESS(status = BthPS3_QueuedWorkItemEnqueue(
+			pPdoCtx->DevCtxHdr,
+			&qwi
+		)))
+		{
+			TraceError(
+				TRACE_L2CAP,
+				"BthPS3_QueuedWorkItemEnqueue failed with status %!STATUS!",
+				status
+			);
+		}
+	}
+
+	FuncExitNoReturn(TRACE_L2CAP);
+}
+
+//
+// Closes the channels of all clients concurrently and waits for them to finish
+// 
+// Used on radio removal so the children don't each block their own clean-up
+// for up to several seconds one after the other.
+// 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+L2CAP_PS3_DisconnectAll(
+	_In_ PBTHPS3_DEVICE_CONTEXT_HEADER CtxHdr
+)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	WDF_OBJECT_ATTRIBUTES attributes;
+	WDFMEMORY memory = NULL;
+	PKWAIT_BLOCK waitBlocks = NULL;
+	PVOID* events = NULL;
+	WDFDEVICE* clients = NULL;
+	ULONG clientCount = 0;
+	ULONG eventCount = 0;
+	const ULONGLONG startedAt = KeQueryInterruptTime();
+	const ULONGLONG deadline = startedAt + WDF_ABS_TIMEOUT_IN_SEC(5);
+
+	FuncEntry(TRACE_L2CAP);
+
+	WdfWaitLockAcquire(CtxHdr->ClientsLock, NULL);
+
+	do
+	{
+		const ULONG count = WdfCollectionGetCount(CtxHdr->Clients);
+
+		if (count == 0)
+		{
+			break;
+		}
+
+		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+		attributes.ParentObject = CtxHdr->Device;
+
+		//
+		// Wait blocks first for alignment, followed by event and client arrays
+		// 
+		if (!NT_SUCCESS(status = WdfMemoryCreate(
+			&attributes,
+			NonPagedPoolNx,
+			POOLTAG_BTHPS3,
+			(sizeof(KWAIT_BLOCK) * MAXIMUM_WAIT_OBJECTS)
+			+ (sizeof(PVOID) * 2 * count)
+			+ (sizeof(WDFDEVICE) * count),
+			&memory,
+			(PVOID*)&waitBlocks
+		)))
+		{
+			TraceError(
+				TRACE_L2CAP,
+				"WdfMemoryCreate failed with status %!STATUS!",
+				status
+			);
+			break;
+		}
+
+		events = (PVOID*)&waitBlocks[MAXIMUM_WAIT_OBJECTS];
+		clients = (WDFDEVICE*)&events[2 * count];
+
+		//
+		// Issue all closes before waiting on any of them
+		// 
+		for (ULONG index = 0; index < count; index++)
+		{
+			const WDFDEVICE device = WdfCollectionGetItem(CtxHdr->Clients, index);
+			const PBTHPS3_PDO_CONTEXT pPdoCtx = GetPdoContext(device);
+
+			WdfObjectReference(device);
+			clients[clientCount++] = device;
+
+			(void)L2CAP_PS3_RemoteDisconnect(CtxHdr, pPdoCtx->RemoteAddress, &pPdoCtx->HidControlChannel);
+			(void)L2CAP_PS3_RemoteDisconnect(CtxHdr, pPdoCtx->RemoteAddress, &pPdoCtx->HidInterruptChannel);
+
+			events[eventCount++] = &pPdoCtx->HidControlChannel.DisconnectEvent;
+			events[eventCount++] = &pPdoCtx->HidInterruptChannel.DisconnectEvent;
+		}
+
+	} while (FALSE);
+
+	WdfWaitLockRelease(CtxHdr->ClientsLock);
+
+	if (clientCount == 0)
+	{
+		FuncExit(TRACE_L2CAP, "status=%!STATUS!", status);
+
+		return;
+	}
+
+	//
+	// One shared deadline, waited on in batches of MAXIMUM_WAIT_OBJECTS
+	// 
+	for (ULONG index = 0; index < eventCount; index += MAXIMUM_WAIT_OBJECTS)
+	{
+		const ULONGLONG now = KeQueryInterruptTime();
+		LARGE_INTEGER timeout;
+
+		timeout.QuadPart = (now < deadline) ? -(LONGLONG)(deadline - now) : 0;
+
+		status = KeWaitForMultipleObjects(
+			min(eventCount - index, MAXIMUM_WAIT_OBJECTS),
+			&events[index],
+			WaitAll,
+			Executive,
+			KernelMode,
+			FALSE,
+			&timeout,
+			waitBlocks
+		);
+
+		if (!NT_SUCCESS(status) || status == STATUS_TIMEOUT)
+		{
+			TraceError(
+				TRACE_L2CAP,
+				"KeWaitForMultipleObjects failed with status %!STATUS!",
+				status
+			);
+			break;
+		}
+	}
+
+	for (ULONG index = 0; index < clientCount; index++)
+	{
+		WdfObjectDereference(clients[index]);
+	}
+
+	if (memory != NULL)
+	{
+		WdfObjectDelete(memory);
+	}
+
 	//
-	KeSetEvent(
-		&channel->DisconnectEvent,
-		0,
-		FALSE
+	// Interrupt time is in 100ns units
+	// 
+	const LONG64 elapsedUs = (LONG64)((KeQueryInterruptTime() - startedAt) / 10);
+
+	TraceInformation(
+		TRACE_L2CAP,
+		"Disconnected %d clients in %lld us",
+		clientCount,
+		elapsedUs
 	);
 
-	FuncExitNoReturn(TRACE_L2CAP);
+	EventWriteAllClientsDisconnected(NULL, clientCount, (UINT64)elapsedUs, status);
+
+	FuncExit(TRACE_L2CAP, "status=%!STATUS!", status);
 }
@@ -39,6 +39,244 @@
 #include "L2CAP.Transfer.tmh"
 
 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+static VOID
+L2CAP_PS3_SendDeferredControlTransaction(
+    _In_ PBTHPS3_PDO_CONTEXT ClientConnection,
+    _In_ WDFREQUEST Request
+);
+
+//
+// Adds a request to the in-flight list before it gets sent to the radio
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+static VOID
+L2CAP_PS3_TransferTrack(
+    _In_ PBTHPS3_PDO_CONTEXT ClientConnection,
+    _In_ WDFREQUEST Request,
+    _In_ PBTHPS3_CLIENT_L2CAP_CHANNEL Channel
+)
+{
+    const PBTHPS3_TRANSFER_CONTEXT pTransfer = GetTransferContext(Request);
+
+    pTransfer->Channel = Channel;
+    pTransfer->CancelIssued = FALSE;
+    pTransfer->IsConsumerRead = FALSE;
+
+    WdfSpinLockAcquire(ClientConnection->TransfersInFlight.Lock);
+    InsertTailList(&ClientConnection->TransfersInFlight.List, &pTransfer->Link);
+    WdfSpinLockRelease(ClientConnection->TransfersInFlight.Lock);
+}
+
+//
+// Removes a request from the in-flight list, must happen before it gets completed
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+static VOID
+L2CAP_PS3_TransferUntrack(
+    _In_ PBTHPS3_PDO_CONTEXT ClientConnection,
+    _In_ WDFREQUEST Request
+)
+{
+    const PBTHPS3_TRANSFER_CONTEXT pTransfer = GetTransferContext(Request);
+
+    WdfSpinLockAcquire(ClientConnection->TransfersInFlight.Lock);
+    RemoveEntryList(&pTransfer->Link);
+    InitializeListHead(&pTransfer->Link);
+    WdfSpinLockRelease(ClientConnection->TransfersInFlight.Lock);
+}
+
+//
+// Adds a consumer control read to the in-flight list unless a transaction owns the channel
+// 
+// Checked under the lock L2CAP_PS3_StartControlTransaction inspects
+// ConsumerReads with, so either the read stays back or the transaction waits.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+static BOOLEAN
+L2CAP_PS3_ConsumerReadTrack(
+    _In_ PBTHPS3_PDO_CONTEXT ClientConnection,
+    _In_ WDFREQUEST Request
+)
+{
+    const PBTHPS3_TRANSFER_CONTEXT pTransfer = GetTransferContext(Request);
+    BOOLEAN tracked = FALSE;
+
+    pTransfer->Channel = &ClientConnection->HidControlChannel;
+    pTransfer->CancelIssued = FALSE;
+    pTransfer->IsConsumerRead = TRUE;
+
+    WdfSpinLockAcquire(ClientConnection->TransfersInFlight.Lock);
+
+    if (!ClientConnection->ControlTransaction.OwnsChannel)
+    {
+        InsertTailList(&ClientConnection->TransfersInFlight.List, &pTransfer->Link);
+        ClientConnection->ControlTransaction.ConsumerReads++;
+        tracked = TRUE;
+    }
+
+    WdfSpinLockRelease(ClientConnection->TransfersInFlight.Lock);
+
+    return tracked;
+}
+
+//
+// Removes a consumer control read from the in-flight list
+// 
+// Returns the deferred transaction if this was the last consumer read it
+// waited for, the caller has to send it. IsParked tells if the read got
+// cancelled to make room for that transaction.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+static WDFREQUEST
+L2CAP_PS3_ConsumerReadUntrack(
+    _In_ PBTHPS3_PDO_CONTEXT ClientConnection,
+    _In_ WDFREQUEST Request,
+    _Out_opt_ PBOOLEAN IsParked
+)
+{
+    const PBTHPS3_TRANSFER_CONTEXT pTransfer = GetTransferContext(Request);
+    WDFREQUEST transaction = NULL;
+
+    WdfSpinLockAcquire(ClientConnection->TransfersInFlight.Lock);
+
+    RemoveEntryList(&pTransfer->Link);
+    InitializeListHead(&pTransfer->Link);
+
+    if (IsParked != NULL)
+    {
+        *IsParked = pTransfer->CancelIssued && ClientConnection->ControlTransaction.OwnsChannel;
+    }
+
+    if (--ClientConnection->ControlTransaction.ConsumerReads == 0)
+    {
+        transaction = ClientConnection->ControlTransaction.Deferred;
+        ClientConnection->ControlTransaction.Deferred = NULL;
+    }
+
+    WdfSpinLockRelease(ClientConnection->TransfersInFlight.Lock);
+
+    return transaction;
+}
+
+//
+// Puts a consumer control read cancelled for a transaction back into its queue
+// 
+// The cancel got issued by us, it's cleared from the IRP or the queue would
+// complete the request right away. A consumer cancel crossing ours is lost
+// that way, the read simply gets sent again once the transaction ended.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+static BOOLEAN
+L2CAP_PS3_ConsumerReadPark(
+    _In_ PBTHPS3_PDO_CONTEXT ClientConnection,
+    _In_ WDFREQUEST Request
+)
+{
+    BOOLEAN ownsChannel;
+
+    WdfRequestWdmGetIrp(Request)->Cancel = FALSE;
+
+    if (!NT_SUCCESS(WdfRequestRequeue(Request)))
+    {
+        return FALSE;
+    }
+
+    WdfSpinLockAcquire(ClientConnection->TransfersInFlight.Lock);
+    ownsChannel = ClientConnection->ControlTransaction.OwnsChannel;
+    WdfSpinLockRelease(ClientConnection->TransfersInFlight.Lock);
+
+    //
+    // Transaction ended meanwhile and may have dispatched before the requeue
+    // 
+    if (!ownsChannel
+        && L2CAP_PS3_ChannelGetState(&ClientConnection->HidControlChannel) == ConnectionStateConnected)
+    {
+        BthPS3_PDO_DispatchHidControlRead(ClientConnection->Queues.HidControlReadRequests, ClientConnection);
+    }
+
+    return TRUE;
+}
+
+//
+// Cancels transfers sent on a channel (or any channel if NULL)
+// 
+// Requests are referenced under the lock and cancelled outside of it since
+// cancellation may invoke the completion routine on this very thread.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+static VOID
+L2CAP_PS3_CancelTransfersMatching(
+    _In_ PBTHPS3_PDO_CONTEXT ClientConnection,
+    _In_opt_ PBTHPS3_CLIENT_L2CAP_CHANNEL Channel,
+    _In_ BOOLEAN ConsumerReadsOnly
+)
+{
+    WDFREQUEST batch[L2CAP_PS3_CANCEL_BATCH_SIZE];
+    ULONG count;
+    ULONG cancelled = 0;
+
+    do
+    {
+        count = 0;
+
+        WdfSpinLockAcquire(ClientConnection->TransfersInFlight.Lock);
+
+        for (PLIST_ENTRY entry = ClientConnection->TransfersInFlight.List.Flink;
+            entry != &ClientConnection->TransfersInFlight.List && count < ARRAYSIZE(batch);
+            entry = entry->Flink)
+        {
+            const PBTHPS3_TRANSFER_CONTEXT pTransfer = CONTAINING_RECORD(entry, BTHPS3_TRANSFER_CONTEXT, Link);
+
+            if (pTransfer->CancelIssued
+                || (Channel != NULL && pTransfer->Channel != Channel)
+                || (ConsumerReadsOnly && !pTransfer->IsConsumerRead))
+            {
+                continue;
+            }
+
+            pTransfer->CancelIssued = TRUE;
+
+            batch[count] = WdfObjectContextGetObject(pTransfer);
+            WdfObjectReference(batch[count]);
+            count++;
+        }
+
+        WdfSpinLockRelease(ClientConnection->TransfersInFlight.Lock);
+
+        for (ULONG index = 0; index < count; index++)
+        {
+            if (WdfRequestCancelSentRequest(batch[index]))
+            {
+                cancelled++;
+            }
+
+            WdfObjectDereference(batch[index]);
+        }
+
+    } while (count == ARRAYSIZE(batch));
+
+    TraceVerbose(
+        TRACE_L2CAP,
+        "Cancelled %d in-flight transfers of device %012llX",
+        cancelled,
+        ClientConnection->RemoteAddress
+    );
+}
+
+//
+// Cancels all transfers sent on a channel (or any channel if NULL)
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+L2CAP_PS3_CancelTransfers(
+    _In_ PBTHPS3_PDO_CONTEXT ClientConnection,
+    _In_opt_ PBTHPS3_CLIENT_L2CAP_CHANNEL Channel
+)
+{
+    L2CAP_PS3_CancelTransfersMatching(ClientConnection, Channel, FALSE);
+}
+
 //
 // Submits an outgoing control request
 // 
@@ -70,9 +308,10 @@ L2CAP_PS3_SendControlTransferAsync(
     }
 
     //
-    // Used in completion routine to free BRB
+    // Used in completion routine to free BRB and untrack request
     // 
     brb->Hdr.ClientContext[0] = ClientConnection->DevCtxHdr;
+    brb->Hdr.ClientContext[1] = ClientConnection;
 
     //
     // Set channel properties
@@ -87,6 +326,8 @@ L2CAP_PS3_SendControlTransferAsync(
     //
     // Submit request
     // 
+    L2CAP_PS3_TransferTrack(ClientConnection, Request, &ClientConnection->HidControlChannel);
+
     status = BthPS3_SendBrbAsync(
         ClientConnection->DevCtxHdr->IoTarget,
         Request,
@@ -104,6 +345,7 @@ L2CAP_PS3_SendControlTransferAsync(
             status
         );
 
+        L2CAP_PS3_TransferUntrack(ClientConnection, Request);
         ClientConnection->DevCtxHdr->ProfileDrvInterface.BthFreeBrb((PBRB)brb);
     }
 
@@ -124,6 +366,7 @@ L2CAP_PS3_ReadControlTransferAsync(
 )
 {
     NTSTATUS status;
+    WDFREQUEST transaction = NULL;
     struct _BRB_L2CA_ACL_TRANSFER* brb = NULL;
 
     //
@@ -141,9 +384,10 @@ L2CAP_PS3_ReadControlTransferAsync(
     }
 
     //
-    // Used in completion routine to free BRB
+    // Used in completion routine to free BRB and untrack request
     // 
     brb->Hdr.ClientContext[0] = ClientConnection->DevCtxHdr;
+    brb->Hdr.ClientContext[1] = ClientConnection;
 
     //
     // Set channel properties
@@ -156,8 +400,19 @@ L2CAP_PS3_ReadControlTransferAsync(
     brb->BufferSize = (ULONG)BufferLength;
 
     //
-    // Submit request
+    // Submit request, unless a transaction waits for the reply
+    // 
+    if (!L2CAP_PS3_ConsumerReadTrack(ClientConnection, Request))
+    {
+        ClientConnection->DevCtxHdr->ProfileDrvInterface.BthFreeBrb((PBRB)brb);
+        return STATUS_DEVICE_BUSY;
+    }
+
+    //
+    // Keeps the request valid for the cancel check below
     // 
+    WdfObjectReference(Request);
+
     status = BthPS3_SendBrbAsync(
         ClientConnection->DevCtxHdr->IoTarget,
         Request,
@@ -175,8 +430,30 @@ L2CAP_PS3_ReadControlTransferAsync(
             status
         );
 
+        transaction = L2CAP_PS3_ConsumerReadUntrack(ClientConnection, Request, NULL);
         ClientConnection->DevCtxHdr->ProfileDrvInterface.BthFreeBrb((PBRB)brb);
     }
+    else
+    {
+        //
+        // A transaction started between tracking and sending, its cancel had no effect
+        // 
+        WdfSpinLockAcquire(ClientConnection->TransfersInFlight.Lock);
+        const BOOLEAN cancel = GetTransferContext(Request)->CancelIssued;
+        WdfSpinLockRelease(ClientConnection->TransfersInFlight.Lock);
+
+        if (cancel)
+        {
+            (void)WdfRequestCancelSentRequest(Request);
+        }
+    }
+
+    WdfObjectDereference(Request);
+
+    if (transaction != NULL)
+    {
+        L2CAP_PS3_SendDeferredControlTransaction(ClientConnection, transaction);
+    }
 
     return status;
 }
@@ -212,9 +489,10 @@ L2CAP_PS3_ReadInterruptTransferAsync(
     }
 
     //
-    // Used in completion routine to free BRB
+    // Used in completion routine to free BRB, update read statistics and untrack request
     // 
     brb->Hdr.ClientContext[0] = ClientConnection->DevCtxHdr;
+    brb->Hdr.ClientContext[1] = ClientConnection;
 
     //
     // Set channel properties
@@ -229,6 +507,8 @@ L2CAP_PS3_ReadInterruptTransferAsync(
     //
     // Submit request
     // 
+    L2CAP_PS3_TransferTrack(ClientConnection, Request, &ClientConnection->HidInterruptChannel);
+
     status = BthPS3_SendBrbAsync(
         ClientConnection->DevCtxHdr->IoTarget,
         Request,
@@ -246,6 +526,7 @@ L2CAP_PS3_ReadInterruptTransferAsync(
             status
         );
 
+        L2CAP_PS3_TransferUntrack(ClientConnection, Request);
         ClientConnection->DevCtxHdr->ProfileDrvInterface.BthFreeBrb((PBRB)brb);
     }
 
@@ -283,9 +564,10 @@ L2CAP_PS3_SendInterruptTransferAsync(
     }
 
     //
-    // Used in completion routine to free BRB
+    // Used in completion routine to free BRB and untrack request
     // 
     brb->Hdr.ClientContext[0] = ClientConnection->DevCtxHdr;
+    brb->Hdr.ClientContext[1] = ClientConnection;
 
     //
     // Set channel properties
@@ -302,6 +584,8 @@ L2CAP_PS3_SendInterruptTransferAsync(
     //
     // Submit request
     // 
+    L2CAP_PS3_TransferTrack(ClientConnection, Request, &ClientConnection->HidInterruptChannel);
+
     status = BthPS3_SendBrbAsync(
         ClientConnection->DevCtxHdr->IoTarget,
         Request,
@@ -319,12 +603,392 @@ L2CAP_PS3_SendInterruptTransferAsync(
             status
         );
 
+        L2CAP_PS3_TransferUntrack(ClientConnection, Request);
+        ClientConnection->DevCtxHdr->ProfileDrvInterface.BthFreeBrb((PBRB)brb);
+    }
+
+    return status;
+}
+
+//
+// Translates a HANDSHAKE result code
+// 
+static NTSTATUS
+L2CAP_PS3_HandshakeToNtStatus(
+    _In_ UCHAR Result
+)
+{
+    switch (Result)
+    {
+    case 0x00: // SUCCESSFUL
+        return STATUS_SUCCESS;
+    case 0x01: // NOT_READY
+        return STATUS_DEVICE_NOT_READY;
+    case 0x02: // ERR_INVALID_REPORT_ID
+    case 0x04: // ERR_INVALID_PARAMETER
+        return STATUS_INVALID_PARAMETER;
+    case 0x03: // ERR_UNSUPPORTED_REQUEST
+        return STATUS_NOT_SUPPORTED;
+    case 0x0F: // ERR_FATAL
+        return STATUS_DEVICE_PROTOCOL_ERROR;
+    default: // ERR_UNKNOWN
+        return STATUS_UNSUCCESSFUL;
+    }
+}
+
+//
+// Submits one transaction stage with the remaining transaction time as timeout
+// 
+static NTSTATUS
+L2CAP_PS3_SendControlTransactionStage(
+    _In_ PBTHPS3_PDO_CONTEXT ClientConnection,
+    _In_ WDFREQUEST Request,
+    _In_ struct _BRB_L2CA_ACL_TRANSFER* Brb,
+    _In_ PFN_WDF_REQUEST_COMPLETION_ROUTINE CompletionRoutine
+)
+{
+    WDF_REQUEST_SEND_OPTIONS options;
+    const ULONGLONG now = KeQueryInterruptTime();
+
+    if (now >= ClientConnection->ControlTransaction.Deadline)
+    {
+        return STATUS_IO_TIMEOUT;
+    }
+
+    WDF_REQUEST_SEND_OPTIONS_INIT(&options, WDF_REQUEST_SEND_OPTION_TIMEOUT);
+    WDF_REQUEST_SEND_OPTIONS_SET_TIMEOUT(
+        &options,
+        -(LONGLONG)(ClientConnection->ControlTransaction.Deadline - now)
+    );
+
+    Brb->Hdr.ClientContext[0] = ClientConnection->DevCtxHdr;
+    Brb->Hdr.ClientContext[1] = ClientConnection;
+
+    Brb->BtAddress = ClientConnection->RemoteAddress;
+    Brb->ChannelHandle = ClientConnection->HidControlChannel.ChannelHandle;
+    Brb->BufferMDL = NULL;
+
+    L2CAP_PS3_TransferTrack(ClientConnection, Request, &ClientConnection->HidControlChannel);
+
+    const NTSTATUS status = BthPS3_SendBrbAsyncEx(
+        ClientConnection->DevCtxHdr->IoTarget,
+        Request,
+        (PBRB)Brb,
+        sizeof(*Brb),
+        CompletionRoutine,
+        Brb,
+        &options
+    );
+
+    if (!NT_SUCCESS(status))
+    {
+        L2CAP_PS3_TransferUntrack(ClientConnection, Request);
+    }
+
+    return status;
+}
+
+//
+// Submits the reply read stage, reusing the BRB of the previous stage
+// 
+static NTSTATUS
+L2CAP_PS3_ReadControlTransactionReply(
+    _In_ PBTHPS3_PDO_CONTEXT ClientConnection,
+    _In_ WDFREQUEST Request,
+    _In_ struct _BRB_L2CA_ACL_TRANSFER* Brb
+)
+{
+    NTSTATUS status;
+    PVOID buffer = NULL;
+    size_t length = 0;
+
+    if (!NT_SUCCESS(status = WdfRequestRetrieveOutputBuffer(
+        Request,
+        1,
+        &buffer,
+        &length
+    )))
+    {
+        return status;
+    }
+
+    ClientConnection->DevCtxHdr->ProfileDrvInterface.BthReuseBrb(
+        (PBRB)Brb,
+        BRB_L2CA_ACL_TRANSFER
+    );
+
+    Brb->TransferFlags = ACL_TRANSFER_DIRECTION_IN | ACL_SHORT_TRANSFER_OK;
+    Brb->Buffer = buffer;
+    Brb->BufferSize = (ULONG)length;
+
+    return L2CAP_PS3_SendControlTransactionStage(
+        ClientConnection,
+        Request,
+        Brb,
+        L2CAP_PS3_AsyncReadControlTransactionCompleted
+    );
+}
+
+//
+// Finishes the current transaction and starts the next queued one
+// 
+static VOID
+L2CAP_PS3_CompleteControlTransaction(
+    _In_ PBTHPS3_PDO_CONTEXT ClientConnection,
+    _In_ WDFREQUEST Request,
+    _In_ NTSTATUS Status,
+    _In_ size_t Length
+)
+{
+    TraceVerbose(
+        TRACE_L2CAP,
+        "Control transaction completed with status %!STATUS! (length: %Iu)",
+        Status,
+        Length
+    );
+
+    WdfRequestCompleteWithInformation(Request, Status, Length);
+
+    L2CAP_PS3_EndControlTransaction(ClientConnection);
+
+    BthPS3_PDO_DispatchHidControlTransaction(
+        ClientConnection->Queues.HidControlTransactionRequests,
+        ClientConnection
+    );
+}
+
+//
+// Submits the request part of a control transaction
+// 
+// The reply gets read into the output buffer of the same request once the
+// request has been sent. The control channel must be owned exclusively
+// (ControlTransaction.InFlight) by the caller.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS
+L2CAP_PS3_SendControlTransactionAsync(
+    _In_ PBTHPS3_PDO_CONTEXT ClientConnection,
+    _In_ WDFREQUEST Request
+)
+{
+    NTSTATUS status;
+    PUCHAR buffer = NULL;
+    size_t length = 0;
+    ULONG timeoutMs;
+    struct _BRB_L2CA_ACL_TRANSFER* brb = NULL;
+
+    if (!NT_SUCCESS(status = WdfRequestRetrieveInputBuffer(
+        Request,
+        sizeof(BTHPS3_HID_CONTROL_TRANSACTION) + 1,
+        (PVOID*)&buffer,
+        &length
+    )))
+    {
+        return status;
+    }
+
+    timeoutMs = ((PBTHPS3_HID_CONTROL_TRANSACTION)buffer)->TimeoutMs;
+
+    buffer += sizeof(BTHPS3_HID_CONTROL_TRANSACTION);
+    length -= sizeof(BTHPS3_HID_CONTROL_TRANSACTION);
+
+    //
+    // Only requests the device answers to make a transaction
+    // 
+    switch (BTHPS3_HIDP_TRANS_TYPE(buffer[0]))
+    {
+    case BTHPS3_HIDP_TRANS_GET_REPORT:
+    case BTHPS3_HIDP_TRANS_GET_PROTOCOL:
+        ClientConnection->ControlTransaction.ExpectData = TRUE;
+        break;
+    case BTHPS3_HIDP_TRANS_SET_REPORT:
+    case BTHPS3_HIDP_TRANS_SET_PROTOCOL:
+        ClientConnection->ControlTransaction.ExpectData = FALSE;
+        break;
+    default:
+        TraceError(
+            TRACE_L2CAP,
+            "Unsupported transaction type 0x%02X",
+            buffer[0]
+        );
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (timeoutMs == 0)
+    {
+        timeoutMs = BTHPS3_HID_CONTROL_TRANSACTION_TIMEOUT_MS;
+    }
+
+    ClientConnection->ControlTransaction.Deadline =
+        KeQueryInterruptTime() + (ULONGLONG)timeoutMs * 10000;
+
+    //
+    // Allocate BRB, reused for the reply read
+    // 
+    brb = (struct _BRB_L2CA_ACL_TRANSFER*)
+        ClientConnection->DevCtxHdr->ProfileDrvInterface.BthAllocateBrb(
+            BRB_L2CA_ACL_TRANSFER,
+            POOLTAG_BTHPS3
+        );
+
+    if (brb == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    brb->TransferFlags = ACL_TRANSFER_DIRECTION_OUT;
+    brb->Buffer = buffer;
+    brb->BufferSize = (ULONG)length;
+
+    status = L2CAP_PS3_SendControlTransactionStage(
+        ClientConnection,
+        Request,
+        brb,
+        L2CAP_PS3_AsyncSendControlTransactionCompleted
+    );
+
+    if (!NT_SUCCESS(status))
+    {
+        TraceError(
+            TRACE_L2CAP,
+            "L2CAP_PS3_SendControlTransactionStage failed with status %!STATUS!",
+            status
+        );
+
         ClientConnection->DevCtxHdr->ProfileDrvInterface.BthFreeBrb((PBRB)brb);
     }
 
     return status;
 }
 
+//
+// Sends a transaction the last cancelled consumer read held back
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+static VOID
+L2CAP_PS3_SendDeferredControlTransaction(
+    _In_ PBTHPS3_PDO_CONTEXT ClientConnection,
+    _In_ WDFREQUEST Request
+)
+{
+    NTSTATUS status;
+
+    if (!NT_SUCCESS(status = L2CAP_PS3_SendControlTransactionAsync(
+        ClientConnection,
+        Request
+    )))
+    {
+        TraceError(
+            TRACE_L2CAP,
+            "L2CAP_PS3_SendControlTransactionAsync failed with status %!STATUS!",
+            status
+        );
+
+        L2CAP_PS3_CompleteControlTransaction(ClientConnection, Request, status, 0);
+    }
+}
+
+//
+// Takes the control channel over for a transaction
+// 
+// A consumer control read at the radio would take the reply, so consumer
+// reads and writes are held in their queues and reads already sent get
+// cancelled and requeued. The transaction is sent right away if none were
+// pending, else by the completion of the last cancelled read. The caller must have set
+// ControlTransaction.InFlight and releases it with
+// L2CAP_PS3_EndControlTransaction if this fails.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS
+L2CAP_PS3_StartControlTransaction(
+    _In_ PBTHPS3_PDO_CONTEXT ClientConnection,
+    _In_ WDFREQUEST Request
+)
+{
+    BOOLEAN isDeferred = FALSE;
+
+    WdfIoQueueStop(ClientConnection->Queues.HidControlReadRequests, NULL, NULL);
+    WdfIoQueueStop(ClientConnection->Queues.HidControlWriteRequests, NULL, NULL);
+
+    //
+    // Queues are stopped first, reads turned away below can't come right back
+    // 
+    WdfSpinLockAcquire(ClientConnection->TransfersInFlight.Lock);
+
+    ClientConnection->ControlTransaction.OwnsChannel = TRUE;
+
+    if (ClientConnection->ControlTransaction.ConsumerReads > 0)
+    {
+        ClientConnection->ControlTransaction.Deferred = Request;
+        isDeferred = TRUE;
+    }
+
+    WdfSpinLockRelease(ClientConnection->TransfersInFlight.Lock);
+
+    if (!isDeferred)
+    {
+        return L2CAP_PS3_SendControlTransactionAsync(ClientConnection, Request);
+    }
+
+    TraceVerbose(
+        TRACE_L2CAP,
+        "Control transaction of device %012llX waits for consumer reads to cancel",
+        ClientConnection->RemoteAddress
+    );
+
+    //
+    // Request is owned by the last read completion from here on
+    // 
+    L2CAP_PS3_CancelTransfersMatching(ClientConnection, &ClientConnection->HidControlChannel, TRUE);
+
+    return STATUS_SUCCESS;
+}
+
+//
+// Releases the control channel and resumes held consumer reads and writes
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+L2CAP_PS3_EndControlTransaction(
+    _In_ PBTHPS3_PDO_CONTEXT ClientConnection
+)
+{
+    const WDFQUEUE queues[] =
+    {
+        ClientConnection->Queues.HidControlReadRequests,
+        ClientConnection->Queues.HidControlWriteRequests
+    };
+
+    WdfSpinLockAcquire(ClientConnection->TransfersInFlight.Lock);
+    ClientConnection->ControlTransaction.OwnsChannel = FALSE;
+    WdfSpinLockRelease(ClientConnection->TransfersInFlight.Lock);
+
+    InterlockedExchange(&ClientConnection->ControlTransaction.InFlight, 0);
+
+    for (ULONG index = 0; index < ARRAYSIZE(queues); index++)
+    {
+        const WDF_IO_QUEUE_STATE state = WdfIoQueueGetState(queues[index], NULL, NULL);
+
+        //
+        // Don't revive a queue purged on removal
+        // 
+        if ((state & WdfIoQueueAcceptRequests) && !(state & WdfIoQueueDispatchRequests))
+        {
+            WdfIoQueueStart(queues[index]);
+        }
+    }
+
+    //
+    // Requests requeued while stopped don't necessarily notify again, while
+    // disconnected they stay queued for the reconnect to pick up
+    // 
+    if (L2CAP_PS3_ChannelGetState(&ClientConnection->HidControlChannel) == ConnectionStateConnected)
+    {
+        BthPS3_PDO_DispatchHidControlRead(ClientConnection->Queues.HidControlReadRequests, ClientConnection);
+        BthPS3_PDO_DispatchHidControlWrite(ClientConnection->Queues.HidControlWriteRequests, ClientConnection);
+    }
+}
+
 //
 // Outgoing control transfer has been completed
 // 
@@ -340,9 +1004,13 @@ L2CAP_PS3_AsyncSendControlTransferCompleted(
         (struct _BRB_L2CA_ACL_TRANSFER*)Context;
     PBTHPS3_DEVICE_CONTEXT_HEADER deviceCtxHdr =
         (PBTHPS3_DEVICE_CONTEXT_HEADER)brb->Hdr.ClientContext[0];
+    PBTHPS3_PDO_CONTEXT pPdoCtx =
+        (PBTHPS3_PDO_CONTEXT)brb->Hdr.ClientContext[1];
 
     UNREFERENCED_PARAMETER(Target);
 
+    L2CAP_PS3_TransferUntrack(pPdoCtx, Request);
+
     TraceVerbose(
         TRACE_L2CAP,
         "Control transfer request completed with status %!STATUS!",
@@ -369,9 +1037,15 @@ L2CAP_PS3_AsyncReadControlTransferCompleted(
         (struct _BRB_L2CA_ACL_TRANSFER*)Context;
     PBTHPS3_DEVICE_CONTEXT_HEADER deviceCtxHdr =
         (PBTHPS3_DEVICE_CONTEXT_HEADER)brb->Hdr.ClientContext[0];
+    PBTHPS3_PDO_CONTEXT pPdoCtx =
+        (PBTHPS3_PDO_CONTEXT)brb->Hdr.ClientContext[1];
+
+    BOOLEAN isParked = FALSE;
 
     UNREFERENCED_PARAMETER(Target);
 
+    const WDFREQUEST transaction = L2CAP_PS3_ConsumerReadUntrack(pPdoCtx, Request, &isParked);
+
     TraceVerbose(
         TRACE_L2CAP,
         "Control read transfer request completed with status %!STATUS!",
@@ -380,10 +1054,199 @@ L2CAP_PS3_AsyncReadControlTransferCompleted(
 
     length = brb->BufferSize;
     deviceCtxHdr->ProfileDrvInterface.BthFreeBrb((PBRB)brb);
-    WdfRequestCompleteWithInformation(
+
+    //
+    // Held until the transaction ended, the consumer doesn't get to see this
+    // 
+    if (isParked
+        && Params->IoStatus.Status == STATUS_CANCELLED
+        && L2CAP_PS3_ConsumerReadPark(pPdoCtx, Request))
+    {
+        TraceVerbose(
+            TRACE_L2CAP,
+            "Control read transfer parked for transaction"
+        );
+    }
+    else
+    {
+        WdfRequestCompleteWithInformation(
+            Request,
+            Params->IoStatus.Status,
+            length
+        );
+    }
+
+    if (transaction != NULL)
+    {
+        L2CAP_PS3_SendDeferredControlTransaction(pPdoCtx, transaction);
+    }
+}
+
+//
+// Request part of control transaction has been sent
+// 
+void
+L2CAP_PS3_AsyncSendControlTransactionCompleted(
+    _In_ WDFREQUEST Request,
+    _In_ WDFIOTARGET Target,
+    _In_ PWDF_REQUEST_COMPLETION_PARAMS Params,
+    _In_ WDFCONTEXT Context
+)
+{
+    NTSTATUS status = Params->IoStatus.Status;
+    struct _BRB_L2CA_ACL_TRANSFER* brb =
+        (struct _BRB_L2CA_ACL_TRANSFER*)Context;
+    PBTHPS3_DEVICE_CONTEXT_HEADER deviceCtxHdr =
+        (PBTHPS3_DEVICE_CONTEXT_HEADER)brb->Hdr.ClientContext[0];
+    PBTHPS3_PDO_CONTEXT pPdoCtx =
+        (PBTHPS3_PDO_CONTEXT)brb->Hdr.ClientContext[1];
+
+    UNREFERENCED_PARAMETER(Target);
+
+    L2CAP_PS3_TransferUntrack(pPdoCtx, Request);
+
+    TraceVerbose(
+        TRACE_L2CAP,
+        "Control transaction request sent with status %!STATUS!",
+        status
+    );
+
+    if (NT_SUCCESS(status)
+        && NT_SUCCESS(status = L2CAP_PS3_ReadControlTransactionReply(pPdoCtx, Request, brb)))
+    {
+        return;
+    }
+
+    deviceCtxHdr->ProfileDrvInterface.BthFreeBrb((PBRB)brb);
+    L2CAP_PS3_CompleteControlTransaction(pPdoCtx, Request, status, 0);
+}
+
+//
+// Reply part of control transaction has been received
+// 
+void
+L2CAP_PS3_AsyncReadControlTransactionCompleted(
+    _In_ WDFREQUEST Request,
+    _In_ WDFIOTARGET Target,
+    _In_ PWDF_REQUEST_COMPLETION_PARAMS Params,
+    _In_ WDFCONTEXT Context
+)
+{
+    size_t length = 0;
+    NTSTATUS status = Params->IoStatus.Status;
+    struct _BRB_L2CA_ACL_TRANSFER* brb =
+        (struct _BRB_L2CA_ACL_TRANSFER*)Context;
+    PBTHPS3_DEVICE_CONTEXT_HEADER deviceCtxHdr =
+        (PBTHPS3_DEVICE_CONTEXT_HEADER)brb->Hdr.ClientContext[0];
+    PBTHPS3_PDO_CONTEXT pPdoCtx =
+        (PBTHPS3_PDO_CONTEXT)brb->Hdr.ClientContext[1];
+
+    UNREFERENCED_PARAMETER(Target);
+
+    L2CAP_PS3_TransferUntrack(pPdoCtx, Request);
+
+    TraceVerbose(
+        TRACE_L2CAP,
+        "Control transaction reply received with status %!STATUS!",
+        status
+    );
+
+    if (NT_SUCCESS(status) && brb->BufferSize > 0)
+    {
+        const UCHAR header = ((PUCHAR)brb->Buffer)[0];
+
+        switch (BTHPS3_HIDP_TRANS_TYPE(header))
+        {
+        case BTHPS3_HIDP_TRANS_HANDSHAKE:
+            status = L2CAP_PS3_HandshakeToNtStatus(BTHPS3_HIDP_TRANS_PARAM(header));
+
+            //
+            // A GET_* must be answered with DATA or an error
+            // 
+            if (NT_SUCCESS(status) && pPdoCtx->ControlTransaction.ExpectData)
+            {
+                status = STATUS_DEVICE_PROTOCOL_ERROR;
+            }
+            break;
+        case BTHPS3_HIDP_TRANS_DATA:
+            if (pPdoCtx->ControlTransaction.ExpectData)
+            {
+                break;
+            }
+            // fall through
+        default:
+            //
+            // Not the reply we're waiting for, keep reading until timeout
+            // 
+            TraceInformation(
+                TRACE_L2CAP,
+                "Unexpected control channel message 0x%02X, reading again",
+                header
+            );
+
+            if (NT_SUCCESS(status = L2CAP_PS3_ReadControlTransactionReply(pPdoCtx, Request, brb)))
+            {
+                return;
+            }
+            break;
+        }
+
+        if (NT_SUCCESS(status))
+        {
+            length = brb->BufferSize;
+        }
+    }
+    else if (NT_SUCCESS(status))
+    {
+        status = STATUS_DEVICE_PROTOCOL_ERROR;
+    }
+
+    deviceCtxHdr->ProfileDrvInterface.BthFreeBrb((PBRB)brb);
+    L2CAP_PS3_CompleteControlTransaction(pPdoCtx, Request, status, length);
+}
+
+//
+// Sends an interrupt read again after its report got suppressed
+// 
+// Uses the whole output buffer of the request (past the header for timestamped
+// reads), the completed BRB only tells how much the suppressed report took.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+static NTSTATUS
+L2CAP_PS3_ResubmitInterruptRead(
+    _In_ PBTHPS3_PDO_CONTEXT ClientConnection,
+    _In_ WDFREQUEST Request
+)
+{
+    NTSTATUS status;
+    PUCHAR buffer = NULL;
+    size_t length = 0;
+
+    if (!NT_SUCCESS(status = WdfRequestRetrieveOutputBuffer(
         Request,
-        Params->IoStatus.Status,
-        length
+        0,
+        (PVOID*)&buffer,
+        &length
+    )))
+    {
+        return status;
+    }
+
+    //
+    // Size got validated on dispatch
+    // 
+    if (BthPS3_PDO_IsTimestampedInterruptRead(Request))
+    {
+        buffer += sizeof(BTHPS3_HID_INTERRUPT_READ_HEADER);
+        length -= sizeof(BTHPS3_HID_INTERRUPT_READ_HEADER);
+    }
+
+    return L2CAP_PS3_ReadInterruptTransferAsync(
+        ClientConnection,
+        Request,
+        buffer,
+        length,
+        L2CAP_PS3_AsyncReadInterruptTransferCompleted
     );
 }
 
@@ -399,25 +1262,82 @@ L2CAP_PS3_AsyncReadInterruptTransferCompleted(
 )
 {
     size_t length = 0;
+    const LARGE_INTEGER timestamp = KeQueryPerformanceCounter(NULL);
+    NTSTATUS status = Params->IoStatus.Status;
+    PBTHPS3_HID_INTERRUPT_READ_HEADER header = NULL;
     struct _BRB_L2CA_ACL_TRANSFER* brb =
         (struct _BRB_L2CA_ACL_TRANSFER*)Context;
     PBTHPS3_DEVICE_CONTEXT_HEADER deviceCtxHdr =
         (PBTHPS3_DEVICE_CONTEXT_HEADER)brb->Hdr.ClientContext[0];
+    PBTHPS3_PDO_CONTEXT pPdoCtx =
+        (PBTHPS3_PDO_CONTEXT)brb->Hdr.ClientContext[1];
 
     UNREFERENCED_PARAMETER(Target);
 
+    L2CAP_PS3_TransferUntrack(pPdoCtx, Request);
+
     TraceVerbose(
         TRACE_L2CAP,
         "Interrupt read transfer request completed with status %!STATUS! (remaining: %d)",
-        Params->IoStatus.Status,
+        status,
         brb->RemainingBufferSize
     );
 
     length = brb->BufferSize;
+    PUCHAR buffer = brb->Buffer;
     deviceCtxHdr->ProfileDrvInterface.BthFreeBrb((PBRB)brb);
+
+    //
+    // Hold the request back and read again if nothing relevant changed
+    // 
+    if (NT_SUCCESS(status)
+        && BthPS3_PDO_IsDuplicateInputReport(pPdoCtx, buffer, length)
+        && NT_SUCCESS(L2CAP_PS3_ResubmitInterruptRead(pPdoCtx, Request)))
+    {
+        InterlockedIncrement(&pPdoCtx->InterruptReadStats.SuppressedCount);
+        return;
+    }
+
+    if (!NT_SUCCESS(status))
+    {
+        //
+        // Cancellation is caused by the consumer, no report got lost
+        // 
+        if (status != STATUS_CANCELLED)
+        {
+            InterlockedIncrement(&pPdoCtx->InterruptReadStats.DroppedCount);
+        }
+
+        WdfRequestComplete(Request, status);
+        return;
+    }
+
+    const ULONG sequenceNumber = (ULONG)InterlockedIncrement(&pPdoCtx->InterruptReadStats.SequenceNumber);
+    const ULONG droppedCount = (ULONG)InterlockedExchange(&pPdoCtx->InterruptReadStats.DroppedCount, 0);
+    const ULONG suppressedCount = (ULONG)InterlockedExchange(&pPdoCtx->InterruptReadStats.SuppressedCount, 0);
+
+    //
+    // Report got read past the header, fill it in
+    // 
+    if (BthPS3_PDO_IsTimestampedInterruptRead(Request)
+        && NT_SUCCESS(WdfRequestRetrieveOutputBuffer(
+            Request,
+            sizeof(BTHPS3_HID_INTERRUPT_READ_HEADER),
+            (PVOID*)&header,
+            NULL
+        )))
+    {
+        header->Timestamp = timestamp.QuadPart;
+        header->SequenceNumber = sequenceNumber;
+        header->DroppedCount = droppedCount;
+        header->SuppressedCount = suppressedCount;
+
+        length += sizeof(BTHPS3_HID_INTERRUPT_READ_HEADER);
+    }
+
     WdfRequestCompleteWithInformation(
         Request,
-        Params->IoStatus.Status,
+        status,
         length
     );
 }
@@ -437,9 +1357,13 @@ L2CAP_PS3_AsyncSendInterruptTransferCompleted(
         (struct _BRB_L2CA_ACL_TRANSFER*)Context;
     PBTHPS3_DEVICE_CONTEXT_HEADER deviceCtxHdr =
         (PBTHPS3_DEVICE_CONTEXT_HEADER)brb->Hdr.ClientContext[0];
+    PBTHPS3_PDO_CONTEXT pPdoCtx =
+        (PBTHPS3_PDO_CONTEXT)brb->Hdr.ClientContext[1];
 
     UNREFERENCED_PARAMETER(Target);
 
+    L2CAP_PS3_TransferUntrack(pPdoCtx, Request);
+
     TraceVerbose(
         TRACE_L2CAP,
         "Interrupt OUT transfer request completed with status %!STATUS!",
@@ -56,6 +56,7 @@ L2CAP_PS3_ControlConnectResponseCompleted(
 	NTSTATUS status;
 	struct _BRB_L2CA_OPEN_CHANNEL* brb = NULL;
 	PBTHPS3_PDO_CONTEXT pPdoCtx = NULL;
+	BTHPS3_CONNECTION_STATE previousState;
 
 	UNREFERENCED_PARAMETER(Request);
 	UNREFERENCED_PARAMETER(Target);
@@ -73,16 +74,21 @@ L2CAP_PS3_ControlConnectResponseCompleted(
 	// 
 	if (NT_SUCCESS(status))
 	{
-		WdfSpinLockAcquire(pPdoCtx->HidControlChannel.ConnectionStateLock);
-
-		pPdoCtx->HidControlChannel.ConnectionState = ConnectionStateConnected;
-
 		//
-		// This will be set again once disconnect has occurred
+		// Clears the disconnect event, or sends the close if one got requested meanwhile
 		// 
-		KeClearEvent(&pPdoCtx->HidControlChannel.DisconnectEvent);
+		if (!L2CAP_PS3_ChannelTransition(&pPdoCtx->HidControlChannel, ChannelEventConnected, &previousState)
+			|| previousState != ConnectionStateConnecting)
+		{
+			TraceVerbose(
+				TRACE_L2CAP,
+				"HID Control Channel closed while connecting (state: %d)",
+				previousState
+			);
 
-		WdfSpinLockRelease(pPdoCtx->HidControlChannel.ConnectionStateLock);
+			FuncExitNoReturn(TRACE_L2CAP);
+			return;
+		}
 
 		TraceInformation(
 			TRACE_L2CAP,
@@ -91,6 +97,8 @@ L2CAP_PS3_ControlConnectResponseCompleted(
 
 		EventWriteHidControlChannelConnected(NULL);
 
+		BthPS3_PDO_TimelineMark(pPdoCtx, BTHPS3_CONNECT_PHASE_CONTROL_CONNECTED);
+
 		//
 		// Channel connected, queues ready to start processing
 		// 
@@ -124,6 +132,21 @@ L2CAP_PS3_ControlConnectResponseCompleted(
 
 			EventWriteFailedWithNTStatus(NULL, __FUNCTION__, L"WdfIoQueueReadyNotify (HidControlWriteRequests)", status);
 		}
+
+		if (!NT_SUCCESS(status = WdfIoQueueReadyNotify(
+			pPdoCtx->Queues.HidControlTransactionRequests,
+			BthPS3_PDO_DispatchHidControlTransaction,
+			pPdoCtx
+		)))
+		{
+			TraceError(
+				TRACE_L2CAP,
+				"WdfIoQueueReadyNotify (HidControlTransactionRequests) failed with status %!STATUS!",
+				status
+			);
+
+			EventWriteFailedWithNTStatus(NULL, __FUNCTION__, L"WdfIoQueueReadyNotify (HidControlTransactionRequests)", status);
+		}
 	}
 	else
 	{
@@ -135,6 +158,8 @@ L2CAP_PS3_ControlConnectResponseCompleted(
 
 		EventWriteFailedWithNTStatus(NULL, __FUNCTION__, L"", Params->IoStatus.Status);
 
+		(void)L2CAP_PS3_ChannelTransition(&pPdoCtx->HidControlChannel, ChannelEventConnectFailed, NULL);
+
 		BthPS3_PDO_Destroy(pPdoCtx->DevCtxHdr, pPdoCtx);
 	}
 
@@ -155,6 +180,7 @@ L2CAP_PS3_InterruptConnectResponseCompleted(
 	NTSTATUS status;
 	struct _BRB_L2CA_OPEN_CHANNEL* brb = NULL;
 	PBTHPS3_PDO_CONTEXT pPdoCtx = NULL;
+	BTHPS3_CONNECTION_STATE previousState;
 	BTHPS3_CONNECTION_STATE controlState;
 
 	UNREFERENCED_PARAMETER(Request);
@@ -173,16 +199,21 @@ L2CAP_PS3_InterruptConnectResponseCompleted(
 	// 
 	if (NT_SUCCESS(status))
 	{
-		WdfSpinLockAcquire(pPdoCtx->HidInterruptChannel.ConnectionStateLock);
-
-		pPdoCtx->HidInterruptChannel.ConnectionState = ConnectionStateConnected;
-
 		//
-		// This will be set again once disconnect has occurred
+		// Clears the disconnect event, or sends the close if one got requested meanwhile
 		// 
-		KeClearEvent(&pPdoCtx->HidInterruptChannel.DisconnectEvent);
+		if (!L2CAP_PS3_ChannelTransition(&pPdoCtx->HidInterruptChannel, ChannelEventConnected, &previousState)
+			|| previousState != ConnectionStateConnecting)
+		{
+			TraceVerbose(
+				TRACE_L2CAP,
+				"HID Interrupt Channel closed while connecting (state: %d)",
+				previousState
+			);
 
-		WdfSpinLockRelease(pPdoCtx->HidInterruptChannel.ConnectionStateLock);
+			FuncExitNoReturn(TRACE_L2CAP);
+			return;
+		}
 
 		TraceInformation(
 			TRACE_L2CAP,
@@ -194,9 +225,7 @@ L2CAP_PS3_InterruptConnectResponseCompleted(
 		//
 		// Control channel is expected to be established by now
 		// 
-		WdfSpinLockAcquire(pPdoCtx->HidControlChannel.ConnectionStateLock);
-		controlState = pPdoCtx->HidInterruptChannel.ConnectionState;
-		WdfSpinLockRelease(pPdoCtx->HidControlChannel.ConnectionStateLock);
+		controlState = L2CAP_PS3_ChannelGetState(&pPdoCtx->HidControlChannel);
 
 		if (controlState != ConnectionStateConnected)
 		{
@@ -244,9 +273,15 @@ L2CAP_PS3_InterruptConnectResponseCompleted(
 		}
 
 		EventWriteRemoteDeviceOnline(NULL, pPdoCtx->RemoteAddress);
+
+		BthPS3_PDO_RecordConnectLatency(pPdoCtx);
+
+		BthPS3_PDO_TimelineMark(pPdoCtx, BTHPS3_CONNECT_PHASE_INTERRUPT_CONNECTED);
 	}
 	else
 	{
+		(void)L2CAP_PS3_ChannelTransition(&pPdoCtx->HidInterruptChannel, ChannelEventConnectFailed, NULL);
+
 		goto failedDrop;
 	}
 
@@ -41,13 +41,59 @@
 typedef struct _BTHPS3_PDO_CONTEXT              *PBTHPS3_PDO_CONTEXT;
 typedef struct _BTHPS3_CLIENT_L2CAP_CHANNEL     *PBTHPS3_CLIENT_L2CAP_CHANNEL;
 
+//
+// Bluetooth HID transaction types (upper nibble of the header byte)
+// 
+#define BTHPS3_HIDP_TRANS_HANDSHAKE         0x00
+#define BTHPS3_HIDP_TRANS_HID_CONTROL       0x10
+#define BTHPS3_HIDP_TRANS_GET_REPORT        0x40
+#define BTHPS3_HIDP_TRANS_SET_REPORT        0x50
+#define BTHPS3_HIDP_TRANS_GET_PROTOCOL      0x60
+#define BTHPS3_HIDP_TRANS_SET_PROTOCOL      0x70
+#define BTHPS3_HIDP_TRANS_DATA              0xA0
+
+#define BTHPS3_HIDP_TRANS_TYPE(_hdr_)       ((_hdr_) & 0xF0)
+#define BTHPS3_HIDP_TRANS_PARAM(_hdr_)      ((_hdr_) & 0x0F)
+
+//
+// Transaction timeout if the caller didn't supply one
+// 
+#define BTHPS3_HID_CONTROL_TRANSACTION_TIMEOUT_MS   1000
+
+//
+// L2CAP flow specification service types
+// 
+#define BTHPS3_L2CAP_SERVICE_TYPE_BEST_EFFORT   0x01
+#define BTHPS3_L2CAP_SERVICE_TYPE_GUARANTEED    0x02
+
+//
+// Access latency (in microseconds) requested with low latency QoS, two baseband slots
+// 
+#define BTHPS3_L2CAP_LOW_LATENCY_US             1250
+
 _IRQL_requires_max_(PASSIVE_LEVEL)
 NTSTATUS
 L2CAP_PS3_HandleRemoteConnect(
+    _In_ PBTHPS3_SERVER_CONTEXT DevCtx,
+    _In_ PINDICATION_PARAMETERS ConnectParams,
+    _In_ ULONGLONG IndicatedAt
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS
+L2CAP_PS3_HandleKnownRemoteConnect(
     _In_ PBTHPS3_SERVER_CONTEXT DevCtx,
     _In_ PINDICATION_PARAMETERS ConnectParams
 );
 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS
+L2CAP_PS3_SendConnectResponse(
+    _In_ PBTHPS3_SERVER_CONTEXT DevCtx,
+    _In_ PBTHPS3_PDO_CONTEXT PdoCtx,
+    _In_ PINDICATION_PARAMETERS ConnectParams
+);
+
 _IRQL_requires_max_(PASSIVE_LEVEL)
 NTSTATUS
 L2CAP_PS3_HandleRemoteDisconnect(
@@ -117,6 +163,26 @@ L2CAP_PS3_SendInterruptTransferAsync(
     _In_ PFN_WDF_REQUEST_COMPLETION_ROUTINE CompletionRoutine
 );
 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS
+L2CAP_PS3_SendControlTransactionAsync(
+    _In_ PBTHPS3_PDO_CONTEXT ClientConnection,
+    _In_ WDFREQUEST Request
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS
+L2CAP_PS3_StartControlTransaction(
+    _In_ PBTHPS3_PDO_CONTEXT ClientConnection,
+    _In_ WDFREQUEST Request
+);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+L2CAP_PS3_EndControlTransaction(
+    _In_ PBTHPS3_PDO_CONTEXT ClientConnection
+);
+
 _IRQL_requires_max_(DISPATCH_LEVEL)
 BOOLEAN
 L2CAP_PS3_RemoteDisconnect(
@@ -125,13 +191,41 @@ L2CAP_PS3_RemoteDisconnect(
     _In_ PBTHPS3_CLIENT_L2CAP_CHANNEL Channel
 );
 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+L2CAP_PS3_SendChannelClose(
+    _In_ PBTHPS3_DEVICE_CONTEXT_HEADER CtxHdr,
+    _In_ BTH_ADDR RemoteAddress,
+    _In_ PBTHPS3_CLIENT_L2CAP_CHANNEL Channel
+);
+
 EVT_WDF_REQUEST_COMPLETION_ROUTINE L2CAP_PS3_ChannelDisconnectCompleted;
 
+//
+// In-flight transfers referenced per pass while cancelling
+// 
+#define L2CAP_PS3_CANCEL_BATCH_SIZE     16
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+L2CAP_PS3_CancelTransfers(
+    _In_ PBTHPS3_PDO_CONTEXT ClientConnection,
+    _In_opt_ PBTHPS3_CLIENT_L2CAP_CHANNEL Channel
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+L2CAP_PS3_DisconnectAll(
+    _In_ PBTHPS3_DEVICE_CONTEXT_HEADER CtxHdr
+);
+
 //
 // HID Control Channel Completion Routines
 // 
 EVT_WDF_REQUEST_COMPLETION_ROUTINE L2CAP_PS3_AsyncReadControlTransferCompleted;
 EVT_WDF_REQUEST_COMPLETION_ROUTINE L2CAP_PS3_AsyncSendControlTransferCompleted;
+EVT_WDF_REQUEST_COMPLETION_ROUTINE L2CAP_PS3_AsyncSendControlTransactionCompleted;
+EVT_WDF_REQUEST_COMPLETION_ROUTINE L2CAP_PS3_AsyncReadControlTransactionCompleted;
 
 //
 // HID Interrupt Channel Completion Routines
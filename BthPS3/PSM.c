@@ -37,161 +37,735 @@
 
 #include "Driver.h"
 #include "psm.tmh"
+#include "BthPS3ETW.h"
 
 
- //
- // Request filter driver to disable PSM patching (PASSIVE_LEVEL only)
- // 
-_IRQL_requires_max_(PASSIVE_LEVEL)
-NTSTATUS
-BthPS3PSM_DisablePatchSync(
-	WDFIOTARGET IoTarget,
-	ULONG DeviceIndex
+typedef
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+EVT_BTHPS3PSM_FILTER_COMMAND_COMPLETED(
+	_In_ PBTHPS3_SERVER_CONTEXT Context,
+	_In_ NTSTATUS Status
+);
+
+typedef EVT_BTHPS3PSM_FILTER_COMMAND_COMPLETED* PFN_BTHPS3PSM_FILTER_COMMAND_COMPLETED;
+
+static EVT_BTHPS3PSM_FILTER_COMMAND_COMPLETED BthPS3PSM_EvtEnablePatchCompleted;
+static EVT_BTHPS3PSM_FILTER_COMMAND_COMPLETED BthPS3PSM_EvtDisablePatchCompleted;
+
+//
+// Requested patch state and completion callback of each filter command
+// 
+static const struct
+{
+	ULONG IsEnabled;
+
+	PFN_BTHPS3PSM_FILTER_COMMAND_COMPLETED Completed;
+
+} G_FilterCommands[BthPS3PSMFilterCommandCount] =
+{
+	{ FALSE, NULL },
+	{ TRUE, BthPS3PSM_EvtEnablePatchCompleted },
+	{ FALSE, BthPS3PSM_EvtDisablePatchCompleted },
+};
+
+//
+// Filter enabled patching (again)
+// 
+_Use_decl_annotations_
+static VOID
+BthPS3PSM_EvtEnablePatchCompleted(
+	PBTHPS3_SERVER_CONTEXT Context,
+	NTSTATUS Status
 )
 {
-	WDF_MEMORY_DESCRIPTOR MemoryDescriptor;
-	BTHPS3PSM_DISABLE_PSM_PATCHING payload;
+	UNREFERENCED_PARAMETER(Context);
 
-	payload.DeviceIndex = DeviceIndex;
+	if (!NT_SUCCESS(Status))
+	{
+		TraceVerbose(
+			TRACE_PSM,
+			"PSM Filter enable request failed with status %!STATUS!",
+			Status
+		);
 
-	WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
-		&MemoryDescriptor,
-		(PVOID)&payload,
-		sizeof(payload)
-	);
+		EventWriteFilterAutoEnabledFailed(NULL, Status);
+		return;
+	}
 
-	return WdfIoTargetSendIoctlSynchronously(
-		IoTarget,
-		NULL,
-		IOCTL_BTHPS3PSM_DISABLE_PSM_PATCHING,
-		&MemoryDescriptor,
-		NULL,
-		NULL,
-		NULL
+	TraceVerbose(
+		TRACE_PSM,
+		"PSM Filter enable request finished"
 	);
+
+	EventWriteFilterAutoEnabledSuccessfully(NULL);
 }
 
 //
-// Request filter driver to enable PSM patching (PASSIVE_LEVEL only)
+// Filter disabled patching, schedule re-enabling it if configured
 // 
-_IRQL_requires_max_(PASSIVE_LEVEL)
-NTSTATUS
-BthPS3PSM_EnablePatchSync(
-	WDFIOTARGET IoTarget,
-	ULONG DeviceIndex
+_Use_decl_annotations_
+static VOID
+BthPS3PSM_EvtDisablePatchCompleted(
+	PBTHPS3_SERVER_CONTEXT Context,
+	NTSTATUS Status
 )
 {
-	WDF_MEMORY_DESCRIPTOR MemoryDescriptor;
-	BTHPS3PSM_ENABLE_PSM_PATCHING payload;
-
-	payload.DeviceIndex = DeviceIndex;
+	if (!NT_SUCCESS(Status))
+	{
+		TraceError(
+			TRACE_PSM,
+			"PSM Filter disable request failed with status %!STATUS!",
+			Status
+		);
+		return;
+	}
 
-	WDF_MEMORY_DESCRIPTOR_INIT_BUFFER(
-		&MemoryDescriptor,
-		(PVOID)&payload,
-		sizeof(payload)
+	TraceInformation(
+		TRACE_PSM,
+		"Filter disabled"
 	);
 
-	return WdfIoTargetSendIoctlSynchronously(
-		IoTarget,
-		NULL,
-		IOCTL_BTHPS3PSM_ENABLE_PSM_PATCHING,
-		&MemoryDescriptor,
-		NULL,
-		NULL,
-		NULL
-	);
+	EventWriteAutoDisableFilter(NULL);
+
+	if (Context->PsmFilter.Stopping)
+	{
+		return;
+	}
+
+	const PBTHPS3_SETTINGS settings = BthPS3_SettingsAcquire(Context);
+
+	//
+	// Fire off re-enable timer
+	// 
+	if (settings->AutoEnableFilter)
+	{
+		TraceInformation(
+			TRACE_PSM,
+			"Filter disabled, re-enabling in %d seconds",
+			settings->AutoEnableFilterDelay
+		);
+
+		EventWriteAutoEnableFilter(NULL, settings->AutoEnableFilterDelay);
+
+		(void)WdfTimerStart(
+			Context->PsmFilter.AutoResetTimer,
+			WDF_REL_TIMEOUT_IN_SEC(settings->AutoEnableFilterDelay)
+		);
+	}
+
+	BthPS3_SettingsRelease(settings);
 }
 
-_IRQL_requires_max_(DISPATCH_LEVEL)
+//
+// Allocates the request and payload all filter commands get sent with
+// 
+_IRQL_requires_max_(PASSIVE_LEVEL)
 NTSTATUS
-BthPS3PSM_EnablePatchAsync(
-	WDFIOTARGET IoTarget,
-	ULONG DeviceIndex
+BthPS3PSM_FilterPipelineInit(
+	PBTHPS3_SERVER_CONTEXT Context
 )
 {
-	NTSTATUS                        status = STATUS_UNSUCCESSFUL;
-	WDFREQUEST                      request;
-	WDF_OBJECT_ATTRIBUTES           attribs;
-	PBTHPS3PSM_ENABLE_PSM_PATCHING  pPayload;
-	WDFMEMORY                       memory;
+	NTSTATUS status;
+	WDF_OBJECT_ATTRIBUTES attributes;
+
+	FuncEntry(TRACE_PSM);
+
+	KeInitializeEvent(&Context->PsmFilter.Idle, NotificationEvent, TRUE);
+
+	Context->PsmFilter.IsRadioResolved = FALSE;
+	Context->PsmFilter.InFlight = BthPS3PSMFilterCommandNone;
+	Context->PsmFilter.Pending = BthPS3PSMFilterCommandNone;
+	Context->PsmFilter.Sent = FALSE;
+	Context->PsmFilter.Stopping = FALSE;
+
+	do
+	{
+		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+		attributes.ParentObject = Context->PsmFilter.IoTarget;
+
+		if (!NT_SUCCESS(status = WdfRequestCreate(
+			&attributes,
+			Context->PsmFilter.IoTarget,
+			&Context->PsmFilter.AsyncRequest
+		)))
+		{
+			TraceError(
+				TRACE_PSM,
+				"WdfRequestCreate failed with status %!STATUS!",
+				status
+			);
+			break;
+		}
 
-	UNREFERENCED_PARAMETER(IoTarget);
-	UNREFERENCED_PARAMETER(DeviceIndex);
+		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+		attributes.ParentObject = Context->PsmFilter.AsyncRequest;
 
-	WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
+		//
+		// Carries the link of our radio, filled in by BthPS3PSM_FilterResolveRadio
+		// 
+		if (!NT_SUCCESS(status = WdfMemoryCreate(
+			&attributes,
+			NonPagedPoolNx,
+			POOLTAG_BTHPS3,
+			sizeof(BTHPS3PSM_SET_PSM_PATCHING_BY_LINK),
+			&Context->PsmFilter.AsyncPayload,
+			NULL
+		)))
+		{
+			TraceError(
+				TRACE_PSM,
+				"WdfMemoryCreate failed with status %!STATUS!",
+				status
+			);
+			break;
+		}
 
+		WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+		attributes.ParentObject = Context->PsmFilter.AsyncRequest;
+
+		if (!NT_SUCCESS(status = WdfSpinLockCreate(
+			&attributes,
+			&Context->PsmFilter.Lock
+		)))
+		{
+			TraceError(
+				TRACE_PSM,
+				"WdfSpinLockCreate failed with status %!STATUS!",
+				status
+			);
+			break;
+		}
+
+	} while (FALSE);
+
+	FuncExit(TRACE_PSM, "status=%!STATUS!", status);
+
+	return status;
+}
+
+//
+// Turns the user-mode form of a symbolic link into one the object manager resolves
+// 
+static VOID
+BthPS3PSM_NormalizeSymbolicLink(
+	_Inout_ PUNICODE_STRING LinkName
+)
+{
 	//
-	// Create new request (this is fired infrequently so no reuse)
+	// "\\?\" and "\??\" are equal in length, only the second character differs
 	// 
-	if (!NT_SUCCESS(status = WdfRequestCreate(&attribs,
-		IoTarget,
-		&request)))
+	if (LinkName->Length >= 4 * sizeof(WCHAR)
+		&& LinkName->Buffer[0] == L'\\'
+		&& LinkName->Buffer[1] == L'\\'
+		&& LinkName->Buffer[2] == L'?'
+		&& LinkName->Buffer[3] == L'\\')
 	{
-		return status;
+		LinkName->Buffer[1] = L'?';
 	}
+}
 
-	//
-	// Associate payload with request
-	// 
-	WDF_OBJECT_ATTRIBUTES_INIT(&attribs);
-	attribs.ParentObject = request;
+//
+// Opens the radio a filter instance is attached to and compares its address with ours
+// 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+static NTSTATUS
+BthPS3PSM_FilterDeviceMatchesRadio(
+	_In_ PBTHPS3_SERVER_CONTEXT Context,
+	_In_ PCUNICODE_STRING LinkName,
+	_Out_ PBOOLEAN IsMatch
+)
+{
+	NTSTATUS status;
+	WDFIOTARGET radioTarget = NULL;
+	WDF_IO_TARGET_OPEN_PARAMS openParams;
+	BTH_ADDR radioAddress = 0;
 
-	//
-	// Create payload memory
-	// 
-	if (!NT_SUCCESS(status = WdfMemoryCreate(&attribs,
-		NonPagedPoolNx,
-		POOLTAG_BTHPS3,
-		sizeof(BTHPS3PSM_ENABLE_PSM_PATCHING),
-		&memory,
-		(PVOID)&pPayload)))
+	*IsMatch = FALSE;
+
+	do
+	{
+		if (!NT_SUCCESS(status = WdfIoTargetCreate(
+			Context->Header.Device,
+			WDF_NO_OBJECT_ATTRIBUTES,
+			&radioTarget
+		)))
+		{
+			TraceError(
+				TRACE_PSM,
+				"WdfIoTargetCreate failed with status %!STATUS!",
+				status
+			);
+			break;
+		}
+
+		WDF_IO_TARGET_OPEN_PARAMS_INIT_OPEN_BY_NAME(
+			&openParams,
+			LinkName,
+			STANDARD_RIGHTS_ALL
+		);
+
+		if (!NT_SUCCESS(status = WdfIoTargetOpen(
+			radioTarget,
+			&openParams
+		)))
+		{
+			TraceError(
+				TRACE_PSM,
+				"WdfIoTargetOpen for %wZ failed with status %!STATUS!",
+				LinkName,
+				status
+			);
+			break;
+		}
+
+		if (!NT_SUCCESS(status = BthPS3_GetRadioAddress(
+			radioTarget,
+			&radioAddress
+		)))
+		{
+			TraceError(
+				TRACE_PSM,
+				"BthPS3_GetRadioAddress failed with status %!STATUS!",
+				status
+			);
+			break;
+		}
+
+		*IsMatch = (radioAddress == Context->Header.LocalBthAddr);
+
+		TraceVerbose(
+			TRACE_PSM,
+			"Radio %wZ has address %012llX (match: %d)",
+			LinkName,
+			radioAddress,
+			*IsMatch
+		);
+
+	} while (FALSE);
+
+	if (radioTarget != NULL)
 	{
-		return status;
+		WdfObjectDelete(radioTarget);
 	}
 
-	pPayload->DeviceIndex = DeviceIndex;
+	return status;
+}
+
+//
+// Finds the filter instance attached to our radio
+// 
+// The filter keeps one collection entry per radio, each reporting the symbolic
+// link of its radio. The radio behind each link is asked for its address until
+// one equals ours. Commands then address the filter instance by that link, as
+// collection indexes shift when other radios get removed. Requires the local
+// radio address to be known.
+// 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+NTSTATUS
+BthPS3PSM_FilterResolveRadio(
+	PBTHPS3_SERVER_CONTEXT Context
+)
+{
+	NTSTATUS status = STATUS_SUCCESS;
+	WDFMEMORY memory = NULL;
+	WDF_MEMORY_DESCRIPTOR memoryDescriptor;
+	ULONG index;
+	ULONG count = 0;
+	BOOLEAN isResolved = FALSE;
+	const PBTHPS3PSM_SET_PSM_PATCHING_BY_LINK pPayload =
+		WdfMemoryGetBuffer(Context->PsmFilter.AsyncPayload, NULL);
+
+	FuncEntry(TRACE_PSM);
 
 	//
-	// Format async request
+	// No command can be in flight before the radio is resolved, the payload is ours
 	// 
-	if (!NT_SUCCESS(status = WdfIoTargetFormatRequestForIoctl(
-		IoTarget,
-		request,
-		IOCTL_BTHPS3PSM_ENABLE_PSM_PATCHING,
-		memory,
-		NULL,
-		NULL,
-		NULL
-	)))
+	RtlZeroMemory(pPayload, sizeof(BTHPS3PSM_SET_PSM_PATCHING_BY_LINK));
+
+	do
 	{
-		return status;
+		if (!NT_SUCCESS(status = WdfMemoryCreate(
+			WDF_NO_OBJECT_ATTRIBUTES,
+			NonPagedPoolNx,
+			POOLTAG_BTHPS3,
+			sizeof(BTHPS3PSM_GET_PSM_PATCHING),
+			&memory,
+			NULL
+		)))
+		{
+			TraceError(
+				TRACE_PSM,
+				"WdfMemoryCreate failed with status %!STATUS!",
+				status
+			);
+			break;
+		}
+
+		const PBTHPS3PSM_GET_PSM_PATCHING pGet = WdfMemoryGetBuffer(memory, NULL);
+
+		WDF_MEMORY_DESCRIPTOR_INIT_HANDLE(&memoryDescriptor, memory, NULL);
+
+		for (index = 0; index < BTHPS3PSM_MAX_FILTER_DEVICES; index++)
+		{
+			UNICODE_STRING linkName;
+			BOOLEAN isMatch = FALSE;
+
+			RtlZeroMemory(pGet, sizeof(BTHPS3PSM_GET_PSM_PATCHING));
+			pGet->DeviceIndex = index;
+
+			status = WdfIoTargetSendIoctlSynchronously(
+				Context->PsmFilter.IoTarget,
+				NULL,
+				IOCTL_BTHPS3PSM_GET_PSM_PATCHING,
+				&memoryDescriptor,
+				&memoryDescriptor,
+				NULL,
+				NULL
+			);
+
+			//
+			// Past the last filter instance
+			// 
+			if (status == STATUS_NO_SUCH_DEVICE)
+			{
+				status = STATUS_SUCCESS;
+				break;
+			}
+
+			if (!NT_SUCCESS(status))
+			{
+				TraceError(
+					TRACE_PSM,
+					"IOCTL_BTHPS3PSM_GET_PSM_PATCHING for index %d failed with status %!STATUS!",
+					index,
+					status
+				);
+				break;
+			}
+
+			count++;
+
+			pGet->SymbolicLinkName[BTHPS3_MAX_DEVICE_ID_LEN - 1] = L'\0';
+
+			if (!NT_SUCCESS(RtlInitUnicodeStringEx(&linkName, pGet->SymbolicLinkName))
+				|| linkName.Length == 0)
+			{
+				continue;
+			}
+
+			//
+			// The filter compares against the link as it reported it
+			// 
+			RtlCopyMemory(
+				pPayload->SymbolicLinkName,
+				pGet->SymbolicLinkName,
+				sizeof(pPayload->SymbolicLinkName)
+			);
+
+			BthPS3PSM_NormalizeSymbolicLink(&linkName);
+
+			if (NT_SUCCESS(BthPS3PSM_FilterDeviceMatchesRadio(Context, &linkName, &isMatch))
+				&& isMatch)
+			{
+				isResolved = TRUE;
+				break;
+			}
+		}
+
+		if (!NT_SUCCESS(status))
+		{
+			break;
+		}
+
+		//
+		// A single radio can only be ours, keeps working if its address couldn't be matched
+		// 
+		if (!isResolved && count == 1 && pPayload->SymbolicLinkName[0] != L'\0')
+		{
+			isResolved = TRUE;
+		}
+
+		if (!isResolved)
+		{
+			status = STATUS_NOT_FOUND;
+
+			TraceEvents(TRACE_LEVEL_WARNING,
+				TRACE_PSM,
+				"None of %d filter instances is attached to radio %012llX",
+				count,
+				Context->Header.LocalBthAddr
+			);
+			break;
+		}
+
+		TraceInformation(
+			TRACE_PSM,
+			"Radio %012llX is filter device %ws",
+			Context->Header.LocalBthAddr,
+			pPayload->SymbolicLinkName
+		);
+
+	} while (FALSE);
+
+	if (memory != NULL)
+	{
+		WdfObjectDelete(memory);
+	}
+
+	Context->PsmFilter.IsRadioResolved = isResolved;
+
+	FuncExit(TRACE_PSM, "status=%!STATUS!", status);
+
+	return status;
+}
+
+//
+// Finishes the in-flight command and returns the one to send next, if any
+// 
+// The command counts as in flight until its completion callback returned, so
+// stopping the pipeline also waits for a re-enable timer armed by it.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+static BTHPS3PSM_FILTER_COMMAND
+BthPS3PSM_FilterCommandDone(
+	PBTHPS3_SERVER_CONTEXT Context,
+	NTSTATUS Status
+)
+{
+	WdfSpinLockAcquire(Context->PsmFilter.Lock);
+	const BTHPS3PSM_FILTER_COMMAND done = Context->PsmFilter.InFlight;
+	Context->PsmFilter.Sent = FALSE;
+	WdfSpinLockRelease(Context->PsmFilter.Lock);
+
+	G_FilterCommands[done].Completed(Context, Status);
+
+	WdfSpinLockAcquire(Context->PsmFilter.Lock);
+
+	const BTHPS3PSM_FILTER_COMMAND next = Context->PsmFilter.Stopping
+		? BthPS3PSMFilterCommandNone
+		: Context->PsmFilter.Pending;
+
+	Context->PsmFilter.Pending = BthPS3PSMFilterCommandNone;
+	Context->PsmFilter.InFlight = next;
+
+	if (next == BthPS3PSMFilterCommandNone)
+	{
+		KeSetEvent(&Context->PsmFilter.Idle, IO_NO_INCREMENT, FALSE);
+	}
+
+	WdfSpinLockRelease(Context->PsmFilter.Lock);
+
+	TraceVerbose(
+		TRACE_PSM,
+		"PSM Filter command %d finished with status %!STATUS!, next: %d",
+		done,
+		Status,
+		next
+	);
+
+	return next;
+}
+
+//
+// Sends commands with the preallocated request until one is pending at the filter
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+static VOID
+BthPS3PSM_FilterCommandSend(
+	PBTHPS3_SERVER_CONTEXT Context,
+	BTHPS3PSM_FILTER_COMMAND Command
+)
+{
+	NTSTATUS status;
+	WDF_REQUEST_REUSE_PARAMS reuseParams;
+
+	while (Command != BthPS3PSMFilterCommandNone)
+	{
+		const PBTHPS3PSM_SET_PSM_PATCHING_BY_LINK pPayload =
+			WdfMemoryGetBuffer(Context->PsmFilter.AsyncPayload, NULL);
+
+		pPayload->IsEnabled = G_FilterCommands[Command].IsEnabled;
+
+		WDF_REQUEST_REUSE_PARAMS_INIT(&reuseParams, WDF_REQUEST_REUSE_NO_FLAGS, STATUS_SUCCESS);
+		(void)WdfRequestReuse(Context->PsmFilter.AsyncRequest, &reuseParams);
+
+		//
+		// Never patch a radio other than ours
+		// 
+		if (!Context->PsmFilter.IsRadioResolved)
+		{
+			status = STATUS_NO_SUCH_DEVICE;
+		}
+		else if (NT_SUCCESS(status = WdfIoTargetFormatRequestForIoctl(
+			Context->PsmFilter.IoTarget,
+			Context->PsmFilter.AsyncRequest,
+			IOCTL_BTHPS3PSM_SET_PSM_PATCHING_BY_LINK,
+			Context->PsmFilter.AsyncPayload,
+			NULL,
+			NULL,
+			NULL
+		)))
+		{
+			WdfRequestSetCompletionRoutine(
+				Context->PsmFilter.AsyncRequest,
+				BthPS3PSM_FilterRequestCompletionRoutine,
+				Context
+			);
+
+			//
+			// Stopping may have begun while the request was prepared
+			// 
+			WdfSpinLockAcquire(Context->PsmFilter.Lock);
+			const BOOLEAN stopping = Context->PsmFilter.Stopping;
+			Context->PsmFilter.Sent = !stopping;
+			WdfSpinLockRelease(Context->PsmFilter.Lock);
+
+			if (stopping)
+			{
+				status = STATUS_CANCELLED;
+			}
+			else if (WdfRequestSend(
+				Context->PsmFilter.AsyncRequest,
+				Context->PsmFilter.IoTarget,
+				NULL
+			))
+			{
+				return;
+			}
+			else
+			{
+				status = WdfRequestGetStatus(Context->PsmFilter.AsyncRequest);
+			}
+		}
+
+		TraceError(
+			TRACE_PSM,
+			"Sending PSM Filter command %d failed with status %!STATUS!",
+			Command,
+			status
+		);
+
+		Command = BthPS3PSM_FilterCommandDone(Context, status);
+	}
+}
+
+//
+// Queues a command to the filter without waiting for it
+// 
+// Only one command is in flight at a time. A command identical to the latest
+// one submitted is dropped, a different one replaces the pending command
+// since only the most recent patch state matters.
+// 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+VOID
+BthPS3PSM_FilterCommandSubmit(
+	PBTHPS3_SERVER_CONTEXT Context,
+	BTHPS3PSM_FILTER_COMMAND Command
+)
+{
+	BOOLEAN send = FALSE;
+	BOOLEAN coalesced = FALSE;
+
+	WdfSpinLockAcquire(Context->PsmFilter.Lock);
+
+	if (Context->PsmFilter.Stopping)
+	{
+		coalesced = TRUE;
+	}
+	else if (Context->PsmFilter.InFlight == BthPS3PSMFilterCommandNone)
+	{
+		Context->PsmFilter.InFlight = Command;
+		KeClearEvent(&Context->PsmFilter.Idle);
+		send = TRUE;
+	}
+	else if (Context->PsmFilter.Pending == Command
+		|| (Context->PsmFilter.Pending == BthPS3PSMFilterCommandNone && Context->PsmFilter.InFlight == Command))
+	{
+		coalesced = TRUE;
+	}
+	else if (Context->PsmFilter.InFlight == Command)
+	{
+		//
+		// The in-flight command already is the latest wish, drop the opposite pending one
+		// 
+		Context->PsmFilter.Pending = BthPS3PSMFilterCommandNone;
+		coalesced = TRUE;
+	}
+	else
+	{
+		Context->PsmFilter.Pending = Command;
+	}
+
+	WdfSpinLockRelease(Context->PsmFilter.Lock);
+
+	if (coalesced)
+	{
+		const LONG total = InterlockedIncrement(&Context->PsmFilter.Coalesced);
+
+		TraceVerbose(
+			TRACE_PSM,
+			"PSM Filter command %d coalesced (total: %d)",
+			Command,
+			total
+		);
+	}
+
+	if (send)
+	{
+		BthPS3PSM_FilterCommandSend(Context, Command);
+	}
+}
+
+//
+// Stops sending commands and waits for the in-flight one to finish
+// 
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+BthPS3PSM_FilterPipelineStop(
+	PBTHPS3_SERVER_CONTEXT Context
+)
+{
+	FuncEntry(TRACE_PSM);
+
+	if (Context->PsmFilter.Lock == NULL)
+	{
+		FuncExitNoReturn(TRACE_PSM);
+		return;
 	}
 
+	WdfSpinLockAcquire(Context->PsmFilter.Lock);
+	Context->PsmFilter.Stopping = TRUE;
+	Context->PsmFilter.Pending = BthPS3PSMFilterCommandNone;
+	const BOOLEAN sent = Context->PsmFilter.Sent;
+	WdfSpinLockRelease(Context->PsmFilter.Lock);
+
 	//
-	// Assign a fixed completion routine
+	// Once stopping, the request doesn't get reused, so cancelling can't hit a resend
 	// 
-	WdfRequestSetCompletionRoutine(
-		request,
-		BthPS3PSM_FilterRequestCompletionRoutine,
+	if (sent)
+	{
+		(void)WdfRequestCancelSentRequest(Context->PsmFilter.AsyncRequest);
+	}
+
+	(void)KeWaitForSingleObject(
+		&Context->PsmFilter.Idle,
+		Executive,
+		KernelMode,
+		FALSE,
 		NULL
 	);
 
 	//
-	// Send it
+	// A disable completing above may have armed it, firing now only gets dropped
 	// 
-	if (WdfRequestSend(request,
-		IoTarget,
-		NULL) == FALSE)
-	{
-		return WdfRequestGetStatus(request);
-	}
+	(void)WdfTimerStop(Context->PsmFilter.AutoResetTimer, TRUE);
 
-	return status;
+	FuncExitNoReturn(TRACE_PSM);
 }
 
 //
-// Async filter enable request has completed
+// Filter command request has completed
 // 
 void BthPS3PSM_FilterRequestCompletionRoutine(
 	WDFREQUEST Request,
@@ -200,15 +774,13 @@ void BthPS3PSM_FilterRequestCompletionRoutine(
 	WDFCONTEXT Context
 )
 {
+	const PBTHPS3_SERVER_CONTEXT pCtx = Context;
+
+	UNREFERENCED_PARAMETER(Request);
 	UNREFERENCED_PARAMETER(Target);
-	UNREFERENCED_PARAMETER(Params);
-	UNREFERENCED_PARAMETER(Context);
 
-	TraceVerbose(
-		TRACE_PSM,
-		"PSM Filter enable request finished with status %!STATUS!",
-		WdfRequestGetStatus(Request)
+	BthPS3PSM_FilterCommandSend(
+		pCtx,
+		BthPS3PSM_FilterCommandDone(pCtx, Params->IoStatus.Status)
 	);
-
-	WdfObjectDelete(Request);
 }
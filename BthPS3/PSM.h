@@ -37,25 +37,34 @@
 
 #pragma once
 
+//
+// Upper bound of filter instances probed while resolving our radio
+// 
+#define BTHPS3PSM_MAX_FILTER_DEVICES        16
+
 _IRQL_requires_max_(PASSIVE_LEVEL)
 NTSTATUS
-BthPS3PSM_DisablePatchSync(
-	WDFIOTARGET IoTarget,
-	ULONG DeviceIndex
+BthPS3PSM_FilterPipelineInit(
+	PBTHPS3_SERVER_CONTEXT Context
 );
 
 _IRQL_requires_max_(PASSIVE_LEVEL)
 NTSTATUS
-BthPS3PSM_EnablePatchSync(
-	WDFIOTARGET IoTarget,
-	ULONG DeviceIndex
+BthPS3PSM_FilterResolveRadio(
+	PBTHPS3_SERVER_CONTEXT Context
 );
 
 _IRQL_requires_max_(DISPATCH_LEVEL)
-NTSTATUS
-BthPS3PSM_EnablePatchAsync(
-    WDFIOTARGET IoTarget,
-    ULONG DeviceIndex
+VOID
+BthPS3PSM_FilterCommandSubmit(
+	PBTHPS3_SERVER_CONTEXT Context,
+	BTHPS3PSM_FILTER_COMMAND Command
+);
+
+_IRQL_requires_max_(PASSIVE_LEVEL)
+VOID
+BthPS3PSM_FilterPipelineStop(
+	PBTHPS3_SERVER_CONTEXT Context
 );
 
 EVT_WDF_REQUEST_COMPLETION_ROUTINE BthPS3PSM_FilterRequestCompletionRoutine;
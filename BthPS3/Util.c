@@ -39,67 +39,57 @@
 #include <ntstrsafe.h>
 #include "util.tmh"
 
+#if defined(_M_AMD64)
+#include <emmintrin.h>
+#elif defined(_M_ARM64)
+#include <arm64_neon.h>
+#endif
+
 //
-// Compares a remote name (UTF8 char*) to a WDFSTRING
+// Compares two buffers, ignoring bits cleared in Mask
 // 
 BOOLEAN
-StringUtil_BthNameIsEqual(
-    PCHAR Lhs,
-    WDFSTRING Rhs
+MemoryUtil_IsEqualMasked(
+    const UCHAR* Lhs,
+    const UCHAR* Rhs,
+    const UCHAR* Mask,
+    size_t Length
 )
 {
-    NTSTATUS status;
-    UNICODE_STRING usRhs;
-    DECLARE_UNICODE_STRING_SIZE(usLhs, BTH_MAX_NAME_SIZE);
-
-    //
-    // WDFSTRING to UNICODE_STRING
-    // 
-    WdfStringGetUnicodeString(
-        Rhs,
-        &usRhs
-    );
+    size_t i = 0;
 
-    //
-    // CHAR to UNICODE_STRING
-    // 
-    if (!NT_SUCCESS(status = RtlUnicodeStringPrintf(&usLhs, L"%hs", Lhs))) 
+#if defined(_M_AMD64)
+    for (; i + sizeof(__m128i) <= Length; i += sizeof(__m128i))
     {
-        TraceError(
-            TRACE_UTIL,
-            "RtlUnicodeStringPrintf failed with status %!STATUS!",
-            status
+        const __m128i diff = _mm_and_si128(
+            _mm_xor_si128(
+                _mm_loadu_si128((const __m128i*)(Lhs + i)),
+                _mm_loadu_si128((const __m128i*)(Rhs + i))
+            ),
+            _mm_loadu_si128((const __m128i*)(Mask + i))
         );
-    }
-
-    TraceVerbose(
-        TRACE_UTIL,
-        "LHS: \"%wZ\" RHS: \"%wZ\"",
-        &usLhs, &usRhs
-    );
 
-    //
-    // Compare case-insensitive
-    // 
-    return RtlEqualUnicodeString(&usLhs, &usRhs, TRUE);
-}
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF)
+            return FALSE;
+    }
+#elif defined(_M_ARM64)
+    for (; i + sizeof(uint8x16_t) <= Length; i += sizeof(uint8x16_t))
+    {
+        const uint8x16_t diff = vandq_u8(
+            veorq_u8(vld1q_u8(Lhs + i), vld1q_u8(Rhs + i)),
+            vld1q_u8(Mask + i)
+        );
 
-//
-// Checks if a remote name (UTF8 char*) is within a WDFCOLLECTION
-// 
-BOOLEAN
-StringUtil_BthNameIsInCollection(
-    PCHAR Entry,
-    WDFCOLLECTION Array
-)
-{
-    ULONG i;
+        if (vmaxvq_u8(diff) != 0)
+            return FALSE;
+    }
+#endif
 
-    for (i = 0; i < WdfCollectionGetCount(Array); i++)
+    for (; i < Length; i++)
     {
-        if (StringUtil_BthNameIsEqual(Entry, WdfCollectionGetItem(Array, i)))
-            return TRUE;
+        if ((Lhs[i] ^ Rhs[i]) & Mask[i])
+            return FALSE;
     }
 
-    return FALSE;
+    return TRUE;
 }
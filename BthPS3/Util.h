@@ -38,13 +38,9 @@
 #pragma once
 
 BOOLEAN
-StringUtil_BthNameIsEqual(
-    PCHAR Lhs,
-    WDFSTRING Rhs
-);
-
-BOOLEAN
-StringUtil_BthNameIsInCollection(
-    PCHAR Entry,
-    WDFCOLLECTION Array
+MemoryUtil_IsEqualMasked(
+    const UCHAR* Lhs,
+    const UCHAR* Rhs,
+    const UCHAR* Mask,
+    size_t Length
 );
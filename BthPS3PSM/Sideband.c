@@ -271,7 +271,9 @@ VOID BthPS3PSM_SidebandIoDeviceControl(
     PBTHPS3PSM_ENABLE_PSM_PATCHING pEnable = NULL;
     PBTHPS3PSM_DISABLE_PSM_PATCHING pDisable = NULL;
     PBTHPS3PSM_GET_PSM_PATCHING pGet = NULL;
+    PBTHPS3PSM_SET_PSM_PATCHING_BY_LINK pSetByLink = NULL;
     UNICODE_STRING linkName;
+    UNICODE_STRING requestedLinkName;
     WDF_WORKITEM_CONFIG wiCfg;
     WDF_OBJECT_ATTRIBUTES attributes;
     WDFWORKITEM workItem = NULL;
@@ -504,11 +506,13 @@ VOID BthPS3PSM_SidebandIoDeviceControl(
                     linkName.Length
                 );
 
+                RtlZeroMemory(pGet->SymbolicLinkName, sizeof(pGet->SymbolicLinkName));
+
                 // Source isn't NULL-terminated, so take that into account
-                if (linkName.Length <= (BTHPS3_MAX_DEVICE_ID_LEN - 1))
+                if ((linkName.Length / sizeof(WCHAR)) <= (BTHPS3_MAX_DEVICE_ID_LEN - 1))
                 {
                     RtlCopyMemory(pGet->SymbolicLinkName, linkName.Buffer, linkName.Length);
-                    pGet->SymbolicLinkName[linkName.Length] = '\0'; // NULL-terminate
+                    pGet->SymbolicLinkName[linkName.Length / sizeof(WCHAR)] = L'\0'; // NULL-terminate
                 }
 
                 WdfRequestSetInformation(Request, sizeof(BTHPS3PSM_GET_PSM_PATCHING));
@@ -519,6 +523,97 @@ VOID BthPS3PSM_SidebandIoDeviceControl(
 
         break;
 
+#pragma endregion
+
+#pragma region IOCTL_BTHPS3PSM_SET_PSM_PATCHING_BY_LINK
+
+    case IOCTL_BTHPS3PSM_SET_PSM_PATCHING_BY_LINK:
+
+        status = WdfRequestRetrieveInputBuffer(
+            Request,
+            sizeof(BTHPS3PSM_SET_PSM_PATCHING_BY_LINK),
+            (void*)&pSetByLink,
+            &length
+        );
+
+        if (!NT_SUCCESS(status) || length != sizeof(BTHPS3PSM_SET_PSM_PATCHING_BY_LINK))
+        {
+            TraceEvents(
+                TRACE_LEVEL_ERROR,
+                TRACE_SIDEBAND,
+                "WdfRequestRetrieveInputBuffer failed with status %!STATUS!",
+                status
+            );
+            EventWriteFailedWithNTStatus(NULL, __FUNCTION__, L"WdfRequestRetrieveInputBuffer", status);
+
+            break;
+        }
+
+        pSetByLink->SymbolicLinkName[BTHPS3_MAX_DEVICE_ID_LEN - 1] = L'\0';
+
+        if (!NT_SUCCESS(status = RtlInitUnicodeStringEx(&requestedLinkName, pSetByLink->SymbolicLinkName)))
+        {
+            break;
+        }
+
+        status = STATUS_NO_SUCH_DEVICE;
+
+        WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+        for (ULONG index = 0; index < WdfCollectionGetCount(FilterDeviceCollection); index++)
+        {
+            device = WdfCollectionGetItem(FilterDeviceCollection, index);
+            pDevCtx = DeviceGetContext(device);
+
+            WdfStringGetUnicodeString(pDevCtx->SymbolicLinkName, &linkName);
+
+            if (!RtlEqualUnicodeString(&linkName, &requestedLinkName, TRUE))
+            {
+                continue;
+            }
+
+            pDevCtx->IsPsmPatchingEnabled = (pSetByLink->IsEnabled > 0);
+
+            TraceEvents(
+                TRACE_LEVEL_VERBOSE,
+                TRACE_SIDEBAND,
+                "PSM patch set to %d for device %wZ",
+                pDevCtx->IsPsmPatchingEnabled,
+                &linkName
+            );
+
+            //
+            // Prepare async saving at PASSIVE_LEVEL
+            // 
+            WDF_WORKITEM_CONFIG_INIT(&wiCfg, BthPS3PSM_EvtSaveConfigToRegistry);
+            WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+            attributes.ParentObject = device;
+
+            if (!NT_SUCCESS(status = WdfWorkItemCreate(
+                &wiCfg,
+                &attributes,
+                &workItem
+            )))
+            {
+                TraceError(
+                    TRACE_SIDEBAND,
+                    "WdfWorkItemCreate failed with status %!STATUS!",
+                    status
+                );
+                EventWriteFailedWithNTStatus(NULL, __FUNCTION__, L"WdfWorkItemCreate", status);
+            }
+            else
+            {
+                WdfWorkItemEnqueue(workItem);
+            }
+
+            break;
+        }
+
+        WdfWaitLockRelease(FilterDeviceCollectionLock);
+
+        break;
+
 #pragma endregion
 
     default:
@@ -64,6 +64,13 @@ DEFINE_GUID(BTHPS3_SERVICE_GUID,
 DEFINE_GUID(GUID_DEVINTERFACE_BTHPS3, 
 	0x968e1849, 0x73b1, 0x4876, 0xb8, 0xa, 0xed, 0x6d, 0xd1, 0x71, 0x48, 0x9b);
 
+//
+// Bus (radio) interface GUID, serves diagnostics not bound to a child device
+// 
+DEFINE_GUID(GUID_DEVINTERFACE_BTHPS3_BUS,
+    0x4e099da8, 0x91ab, 0x47b3, 0x90, 0x28, 0x80, 0x82, 0x5a, 0xb8, 0xbf, 0xad);
+// {4e099da8-91ab-47b3-9028-80825ab8bfad}
+
 //
 // Filter device enumeration interface GUID
 // 
@@ -245,6 +252,31 @@ DEFINE_GUID(GUID_DEVINTERFACE_BTHPS3_WIRELESS,
 // 
 #define BTHPS3_REG_VALUE_CHILD_IDLE_TIMEOUT     L"ChildIdleTimeout"
 
+//
+// Hold back input reports equal to the previous one (ignoring sensor data)
+// 
+#define BTHPS3_REG_VALUE_SUPPRESS_DUPLICATE_REPORTS     L"SuppressDuplicateReports"
+
+//
+// Time (in milliseconds) after which a duplicate input report is delivered anyway
+// 
+#define BTHPS3_REG_VALUE_DUPLICATE_REPORT_HOLD_TIME     L"DuplicateReportHoldTime"
+
+//
+// Time (in milliseconds) a disconnected child device stays plugged in awaiting reconnect
+// 
+#define BTHPS3_REG_VALUE_CHILD_LINGER_TIMEOUT   L"ChildLingerTimeout"
+
+//
+// Request guaranteed service with minimal latency when accepting HID channels
+// 
+#define BTHPS3_REG_VALUE_REQUEST_LOW_LATENCY_QOS    L"RequestLowLatencyQos"
+
+//
+// Time (in seconds) connections of an unsupported device get denied without identifying it again (0 = disabled)
+// 
+#define BTHPS3_REG_VALUE_DENY_CACHE_TIMEOUT     L"DenyCacheTimeout"
+
 //
 // Should the profile driver attempt to auto-enable the patch again
 // 
@@ -303,6 +335,39 @@ DEFINE_GUID(GUID_DEVINTERFACE_BTHPS3_WIRELESS,
 #define BTHPS3_REG_VALUE_WIRELESS_SUPPORTED_NAMES       L"WIRELESSSupportedNames"
 
 
+//
+// L2CAP MTU (in bytes) offered on the HID channels of a device type
+// 
+#define BTHPS3_REG_VALUE_SIXAXIS_CHANNEL_MTU                L"SIXAXISChannelMtu"
+#define BTHPS3_REG_VALUE_NAVIGATION_CHANNEL_MTU             L"NAVIGATIONChannelMtu"
+#define BTHPS3_REG_VALUE_MOTION_CHANNEL_MTU                 L"MOTIONChannelMtu"
+#define BTHPS3_REG_VALUE_WIRELESS_CHANNEL_MTU               L"WIRELESSChannelMtu"
+
+//
+// L2CAP flush timeout (in milliseconds, 0xFFFF for infinite) of a device type
+// 
+#define BTHPS3_REG_VALUE_SIXAXIS_FLUSH_TIMEOUT              L"SIXAXISFlushTimeout"
+#define BTHPS3_REG_VALUE_NAVIGATION_FLUSH_TIMEOUT           L"NAVIGATIONFlushTimeout"
+#define BTHPS3_REG_VALUE_MOTION_FLUSH_TIMEOUT               L"MOTIONFlushTimeout"
+#define BTHPS3_REG_VALUE_WIRELESS_FLUSH_TIMEOUT             L"WIRELESSFlushTimeout"
+
+//
+// ACL link timeout (in 0.625 ms slots, 0 for stack default) of a device type
+// 
+#define BTHPS3_REG_VALUE_SIXAXIS_LINK_TIMEOUT               L"SIXAXISLinkTimeout"
+#define BTHPS3_REG_VALUE_NAVIGATION_LINK_TIMEOUT            L"NAVIGATIONLinkTimeout"
+#define BTHPS3_REG_VALUE_MOTION_LINK_TIMEOUT                L"MOTIONLinkTimeout"
+#define BTHPS3_REG_VALUE_WIRELESS_LINK_TIMEOUT              L"WIRELESSLinkTimeout"
+
+//
+// Incoming packets buffered per channel until discarded for a device type
+// 
+#define BTHPS3_REG_VALUE_SIXAXIS_INCOMING_QUEUE_DEPTH       L"SIXAXISIncomingQueueDepth"
+#define BTHPS3_REG_VALUE_NAVIGATION_INCOMING_QUEUE_DEPTH    L"NAVIGATIONIncomingQueueDepth"
+#define BTHPS3_REG_VALUE_MOTION_INCOMING_QUEUE_DEPTH        L"MOTIONIncomingQueueDepth"
+#define BTHPS3_REG_VALUE_WIRELESS_INCOMING_QUEUE_DEPTH      L"WIRELESSIncomingQueueDepth"
+
+
 //
 // Occupied slots information
 // 
@@ -313,6 +378,18 @@ DEFINE_GUID(GUID_DEVINTERFACE_BTHPS3_WIRELESS,
 // 
 #define BTHPS3_REG_VALUE_SLOT_NO    L"SlotNo"
 
+//
+// Remote address to slot assignments as BTHPS3_SLOT_MAP_RECORD array
+// 
+// Stored in the Devices sub-key, outside of the watched Parameters values
+// 
+#define BTHPS3_REG_VALUE_SLOT_MAP   L"SlotMap"
+
+//
+// Sub-key of Parameters holding per-device data
+// 
+#define BTHPS3_REG_KEY_DEVICES      L"Devices"
+
 #pragma endregion
 
 //
@@ -389,6 +466,35 @@ typedef enum _DS_DEVICE_TYPE
 // 
 #define IOCTL_BTHPS3_HID_INTERRUPT_WRITE        BUSENUM_W_IOCTL (IOCTL_BTHPS3_BASE + 0x203)
 
+// 
+// Read from interrupt channel, prefixed with BTHPS3_HID_INTERRUPT_READ_HEADER
+// 
+#define IOCTL_BTHPS3_HID_INTERRUPT_READ_TIMESTAMPED BUSENUM_R_IOCTL (IOCTL_BTHPS3_BASE + 0x204)
+
+// 
+// Write a HID request to control channel and read the matching reply
+// 
+#define IOCTL_BTHPS3_HID_CONTROL_TRANSACTION    BUSENUM_RW_IOCTL (IOCTL_BTHPS3_BASE + 0x205)
+
+// 
+// Retrieve setup timelines of the most recent connections as BTHPS3_CONNECT_TIMELINES
+// 
+// Served on GUID_DEVINTERFACE_BTHPS3_BUS, also covers connects which never got a PDO
+// 
+#define IOCTL_BTHPS3_GET_CONNECT_TIMELINES      BUSENUM_R_IOCTL (IOCTL_BTHPS3_BASE + 0x206)
+
+// 
+// Retrieve L2CAP channel parameters and counters of a device as BTHPS3_CHANNEL_INFO
+// 
+#define IOCTL_BTHPS3_GET_CHANNEL_INFO           BUSENUM_R_IOCTL (IOCTL_BTHPS3_BASE + 0x207)
+
+// 
+// Retrieve deny cache statistics of the radio as BTHPS3_DENY_CACHE_STATS
+// 
+// Served on GUID_DEVINTERFACE_BTHPS3_BUS
+// 
+#define IOCTL_BTHPS3_GET_DENY_CACHE_STATS       BUSENUM_R_IOCTL (IOCTL_BTHPS3_BASE + 0x208)
+
 
 /*************************************************************/
 /* I/O control codes for filter control device communication */
@@ -409,8 +515,233 @@ typedef enum _DS_DEVICE_TYPE
 // 
 #define IOCTL_BTHPS3PSM_GET_PSM_PATCHING        BUSENUM_R_IOCTL (IOCTL_BTHPS3_BASE + 0x302)
 
+//
+// Enable or disable PSM patch for the radio with a supplied symbolic link
+// 
+// Unlike the device index, the link doesn't change when other radios come or go
+// 
+#define IOCTL_BTHPS3PSM_SET_PSM_PATCHING_BY_LINK    BUSENUM_W_IOCTL (IOCTL_BTHPS3_BASE + 0x303)
+
 #include <pshpack1.h>
 
+//
+// Output header for IOCTL_BTHPS3_HID_INTERRUPT_READ_TIMESTAMPED
+// 
+// The report bytes directly follow this header in the output buffer
+// 
+typedef struct _BTHPS3_HID_INTERRUPT_READ_HEADER
+{
+    //
+    // QueryPerformanceCounter value sampled when the transfer completed
+    // 
+    OUT LONGLONG Timestamp;
+
+    //
+    // Per-device counter incremented for every delivered report
+    // 
+    OUT ULONG SequenceNumber;
+
+    //
+    // Reports lost since the previously delivered report
+    // 
+    OUT ULONG DroppedCount;
+
+    //
+    // Reports suppressed as duplicates since the previously delivered report
+    // 
+    OUT ULONG SuppressedCount;
+
+} BTHPS3_HID_INTERRUPT_READ_HEADER, *PBTHPS3_HID_INTERRUPT_READ_HEADER;
+
+//
+// Input header for IOCTL_BTHPS3_HID_CONTROL_TRANSACTION
+// 
+// The HID request (e.g. GET_REPORT, SET_REPORT) directly follows this header
+// in the input buffer, the output buffer receives the HANDSHAKE or DATA reply
+// 
+// Control reads and writes are held while the transaction is in progress,
+// pending IOCTL_BTHPS3_HID_CONTROL_READ requests are resumed afterwards.
+// 
+typedef struct _BTHPS3_HID_CONTROL_TRANSACTION
+{
+    //
+    // Time in milliseconds the whole transaction may take, 0 for default
+    // 
+    IN ULONG TimeoutMs;
+
+} BTHPS3_HID_CONTROL_TRANSACTION, *PBTHPS3_HID_CONTROL_TRANSACTION;
+
+//
+// Steps of a connection setup, in the order they usually complete
+// 
+typedef enum _BTHPS3_CONNECT_PHASE
+{
+    //
+    // First HID Control connect indication arrived
+    // 
+    BTHPS3_CONNECT_PHASE_INDICATED = 0,
+    BTHPS3_CONNECT_PHASE_NAME_RESOLVED,
+    BTHPS3_CONNECT_PHASE_DEVICE_IDENTIFIED,
+    BTHPS3_CONNECT_PHASE_SLOT_ASSIGNED,
+    BTHPS3_CONNECT_PHASE_PDO_PLUGGED,
+    BTHPS3_CONNECT_PHASE_CONTROL_CONNECTED,
+    BTHPS3_CONNECT_PHASE_INTERRUPT_CONNECTED,
+    //
+    // PDO finished SelfManagedIoInit
+    // 
+    BTHPS3_CONNECT_PHASE_PDO_READY,
+
+    BTHPS3_CONNECT_PHASE_COUNT
+
+} BTHPS3_CONNECT_PHASE;
+
+//
+// Phase not passed, e.g. PDO creation on reconnect of a lingering device
+// 
+#define BTHPS3_CONNECT_PHASE_SKIPPED    0xFFFFFFFF
+
+//
+// Number of timelines kept by the driver
+// 
+#define BTHPS3_CONNECT_TIMELINES_MAX    16
+
+//
+// Setup timeline of a single connection
+// 
+typedef struct _BTHPS3_CONNECT_TIMELINE
+{
+    OUT UINT64 RemoteAddress;
+
+    //
+    // Connection reused a lingering PDO
+    // 
+    OUT BOOLEAN IsWarm;
+
+    //
+    // STATUS_SUCCESS once the device got ready, otherwise why the connect was dropped
+    // 
+    OUT LONG Status;
+
+    //
+    // Microseconds from indication to each phase, BTHPS3_CONNECT_PHASE_SKIPPED if not passed
+    // 
+    OUT ULONG PhaseUs[BTHPS3_CONNECT_PHASE_COUNT];
+
+} BTHPS3_CONNECT_TIMELINE, *PBTHPS3_CONNECT_TIMELINE;
+
+//
+// Output of IOCTL_BTHPS3_GET_CONNECT_TIMELINES
+// 
+typedef struct _BTHPS3_CONNECT_TIMELINES
+{
+    //
+    // Valid entries in Timelines, newest first
+    // 
+    OUT ULONG Count;
+
+    OUT BTHPS3_CONNECT_TIMELINE Timelines[BTHPS3_CONNECT_TIMELINES_MAX];
+
+} BTHPS3_CONNECT_TIMELINES, *PBTHPS3_CONNECT_TIMELINES;
+
+//
+// Configuration of one direction of an L2CAP channel
+// 
+typedef struct _BTHPS3_CHANNEL_QOS
+{
+    //
+    // CFG_* flags of the options present, zero if no configuration happened
+    // 
+    OUT ULONG Flags;
+
+    OUT USHORT Mtu;
+
+    OUT USHORT FlushTimeout;
+
+    //
+    // L2CAP flow specification service type (0 no traffic, 1 best effort, 2 guaranteed)
+    // 
+    OUT UCHAR ServiceType;
+
+    //
+    // Maximum acceptable delay in microseconds, 0xFFFFFFFF for don't care
+    // 
+    OUT ULONG Latency;
+
+    OUT ULONG PeakBandwidth;
+
+} BTHPS3_CHANNEL_QOS, *PBTHPS3_CHANNEL_QOS;
+
+//
+// Parameters and counters of a single L2CAP channel
+// 
+typedef struct _BTHPS3_CHANNEL_STATS
+{
+    //
+    // Values requested in the last connect response
+    // 
+    OUT USHORT Mtu;
+
+    OUT USHORT FlushTimeout;
+
+    OUT USHORT LinkTimeout;
+
+    OUT ULONG IncomingQueueDepth;
+
+    //
+    // Packets received while IncomingQueueDepth packets were buffered already
+    // 
+    OUT ULONG QueueDepthReached;
+
+    //
+    // Configuration requested by the remote device for its outgoing traffic
+    // 
+    OUT BTHPS3_CHANNEL_QOS Remote;
+
+    //
+    // Configuration accepted by the remote device for our outgoing traffic
+    // 
+    OUT BTHPS3_CHANNEL_QOS Local;
+
+    //
+    // Configuration requests of ours the remote device rejected
+    // 
+    OUT ULONG ConfigRejects;
+
+} BTHPS3_CHANNEL_STATS, *PBTHPS3_CHANNEL_STATS;
+
+//
+// Output of IOCTL_BTHPS3_GET_CHANNEL_INFO
+// 
+typedef struct _BTHPS3_CHANNEL_INFO
+{
+    OUT BTHPS3_CHANNEL_STATS HidControl;
+
+    OUT BTHPS3_CHANNEL_STATS HidInterrupt;
+
+} BTHPS3_CHANNEL_INFO, *PBTHPS3_CHANNEL_INFO;
+
+//
+// Output of IOCTL_BTHPS3_GET_DENY_CACHE_STATS
+// 
+typedef struct _BTHPS3_DENY_CACHE_STATS
+{
+    //
+    // Connection requests checked against the cache
+    // 
+    OUT ULONG Lookups;
+
+    //
+    // Connection requests denied by the cache
+    // 
+    OUT ULONG Hits;
+
+    //
+    // Addresses currently denied
+    // 
+    OUT ULONG Entries;
+
+} BTHPS3_DENY_CACHE_STATS, *PBTHPS3_DENY_CACHE_STATS;
+
 //
 // Payload for IOCTL_BTHPS3PSM_ENABLE_PSM_PATCHING
 // 
@@ -442,6 +773,20 @@ typedef struct _BTHPS3PSM_GET_PSM_PATCHING
 
 } BTHPS3PSM_GET_PSM_PATCHING, *PBTHPS3PSM_GET_PSM_PATCHING;
 
+//
+// Payload for IOCTL_BTHPS3PSM_SET_PSM_PATCHING_BY_LINK
+// 
+typedef struct _BTHPS3PSM_SET_PSM_PATCHING_BY_LINK
+{
+    IN ULONG IsEnabled;
+
+    //
+    // As reported by IOCTL_BTHPS3PSM_GET_PSM_PATCHING, NULL-terminated
+    // 
+    IN WCHAR SymbolicLinkName[BTHPS3_MAX_DEVICE_ID_LEN];
+
+} BTHPS3PSM_SET_PSM_PATCHING_BY_LINK, *PBTHPS3PSM_SET_PSM_PATCHING_BY_LINK;
+
 #include <poppack.h>
 
 #pragma endregion
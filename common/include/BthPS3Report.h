@@ -0,0 +1,733 @@
+/**********************************************************************************
+ *                                                                                *
+ * BthPS3 - Windows kernel-mode Bluetooth profile and bus driver                  *
+ *                                                                                *
+ * BSD 3-Clause License                                                           *
+ *                                                                                *
+ * Copyright (c) 2018-2023, Nefarius Software Solutions e.U.                      *
+ * All rights reserved.                                                           *
+ *                                                                                *
+ * Redistribution and use in source and binary forms, with or without             *
+ * modification, are permitted provided that the following conditions are met:    *
+ *                                                                                *
+ * 1. Redistributions of source code must retain the above copyright notice, this *
+ *    list of conditions and the following disclaimer.                            *
+ *                                                                                *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,   *
+ *    this list of conditions and the following disclaimer in the documentation   *
+ *    and/or other materials provided with the distribution.                      *
+ *                                                                                *
+ * 3. Neither the name of the copyright holder nor the names of its               *
+ *    contributors may be used to endorse or promote products derived from        *
+ *    this software without specific prior written permission.                    *
+ *                                                                                *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"    *
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE      *
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE *
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE   *
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL     *
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR     *
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER     *
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,  *
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE  *
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.           *
+ *                                                                                *
+ **********************************************************************************/
+
+
+#pragma once
+
+//
+// Decoder for raw input reports as delivered by IOCTL_BTHPS3_HID_INTERRUPT_READ
+// 
+// Requires BthPS3.h to be included first. Reports are expected including the
+// leading 0xA1 (DATA | INPUT) transaction header byte. Decoded state is kept in
+// struct-of-arrays form so consumers can process many reports column by column.
+// 
+
+#if defined(_M_AMD64)
+#include <emmintrin.h>
+#elif defined(_M_ARM64)
+#include <arm64_neon.h>
+#endif
+
+//
+// Number of reports a BTHPS3_REPORT_BATCH holds, multiple of 16
+// 
+#define BTHPS3_REPORT_BATCH_CAPACITY                64
+
+//
+// Minimum report sizes (including 0xA1 header)
+// 
+#define BTHPS3_SIXAXIS_REPORT_MIN_SIZE              BTHPS3_SIXAXIS_HID_INPUT_REPORT_SIZE
+#define BTHPS3_MOTION_REPORT_MIN_SIZE               0x2D
+#define BTHPS3_WIRELESS_REPORT_MIN_SIZE             0x1C
+
+//
+// Normalized button bits
+// 
+#define BTHPS3_REPORT_BUTTON_SELECT                 0x00000001 // SHARE on WIRELESS
+#define BTHPS3_REPORT_BUTTON_L3                     0x00000002
+#define BTHPS3_REPORT_BUTTON_R3                     0x00000004
+#define BTHPS3_REPORT_BUTTON_START                  0x00000008 // OPTIONS on WIRELESS
+#define BTHPS3_REPORT_BUTTON_DPAD_UP                0x00000010
+#define BTHPS3_REPORT_BUTTON_DPAD_RIGHT             0x00000020
+#define BTHPS3_REPORT_BUTTON_DPAD_DOWN              0x00000040
+#define BTHPS3_REPORT_BUTTON_DPAD_LEFT              0x00000080
+#define BTHPS3_REPORT_BUTTON_L2                     0x00000100
+#define BTHPS3_REPORT_BUTTON_R2                     0x00000200
+#define BTHPS3_REPORT_BUTTON_L1                     0x00000400
+#define BTHPS3_REPORT_BUTTON_R1                     0x00000800
+#define BTHPS3_REPORT_BUTTON_TRIANGLE               0x00001000
+#define BTHPS3_REPORT_BUTTON_CIRCLE                 0x00002000
+#define BTHPS3_REPORT_BUTTON_CROSS                  0x00004000
+#define BTHPS3_REPORT_BUTTON_SQUARE                 0x00008000
+#define BTHPS3_REPORT_BUTTON_PS                     0x00010000
+#define BTHPS3_REPORT_BUTTON_MOVE                   0x00020000 // MOTION only
+#define BTHPS3_REPORT_BUTTON_T                      0x00040000 // MOTION only
+#define BTHPS3_REPORT_BUTTON_TOUCHPAD               0x00080000 // WIRELESS only
+
+//
+// Pressure sensitive buttons (SIXAXIS, NAVIGATION)
+// 
+typedef enum _BTHPS3_REPORT_PRESSURE
+{
+    BthPS3ReportPressureDpadUp = 0,
+    BthPS3ReportPressureDpadRight,
+    BthPS3ReportPressureDpadDown,
+    BthPS3ReportPressureDpadLeft,
+    BthPS3ReportPressureL2,
+    BthPS3ReportPressureR2,
+    BthPS3ReportPressureL1,
+    BthPS3ReportPressureR1,
+    BthPS3ReportPressureTriangle,
+    BthPS3ReportPressureCircle,
+    BthPS3ReportPressureCross,
+    BthPS3ReportPressureSquare,
+
+    BthPS3ReportPressureCount
+
+} BTHPS3_REPORT_PRESSURE;
+
+//
+// Decoded state of up to BTHPS3_REPORT_BATCH_CAPACITY reports
+// 
+// Sticks and triggers are 0-255, motion sensors are signed and centered on 0.
+// Fields a device type doesn't provide are zero.
+// 
+typedef struct DECLSPEC_ALIGN(16) _BTHPS3_REPORT_BATCH
+{
+    ULONG Buttons[BTHPS3_REPORT_BATCH_CAPACITY];
+
+    UCHAR LeftStickX[BTHPS3_REPORT_BATCH_CAPACITY];
+    UCHAR LeftStickY[BTHPS3_REPORT_BATCH_CAPACITY];
+    UCHAR RightStickX[BTHPS3_REPORT_BATCH_CAPACITY];
+    UCHAR RightStickY[BTHPS3_REPORT_BATCH_CAPACITY];
+
+    UCHAR LeftTrigger[BTHPS3_REPORT_BATCH_CAPACITY];
+    UCHAR RightTrigger[BTHPS3_REPORT_BATCH_CAPACITY];
+
+    UCHAR Pressure[BthPS3ReportPressureCount][BTHPS3_REPORT_BATCH_CAPACITY];
+
+    SHORT AccelX[BTHPS3_REPORT_BATCH_CAPACITY];
+    SHORT AccelY[BTHPS3_REPORT_BATCH_CAPACITY];
+    SHORT AccelZ[BTHPS3_REPORT_BATCH_CAPACITY];
+
+    SHORT GyroX[BTHPS3_REPORT_BATCH_CAPACITY];
+    SHORT GyroY[BTHPS3_REPORT_BATCH_CAPACITY];
+    SHORT GyroZ[BTHPS3_REPORT_BATCH_CAPACITY];
+
+    //
+    // Number of occupied entries
+    // 
+    ULONG Count;
+
+} BTHPS3_REPORT_BATCH, *PBTHPS3_REPORT_BATCH;
+
+//
+// Resets a batch to hold no reports
+// 
+static __inline VOID
+BthPS3_Report_BatchInit(
+    _Out_ PBTHPS3_REPORT_BATCH Batch
+)
+{
+    RtlZeroMemory(Batch, sizeof(*Batch));
+}
+
+//
+// Clears a single entry
+// 
+static __inline VOID
+BthPS3_Report_ClearEntry(
+    _Inout_ PBTHPS3_REPORT_BATCH Batch,
+    _In_ ULONG Index
+)
+{
+    ULONG p;
+
+    Batch->Buttons[Index] = 0;
+    Batch->LeftStickX[Index] = Batch->LeftStickY[Index] = 0x80;
+    Batch->RightStickX[Index] = Batch->RightStickY[Index] = 0x80;
+    Batch->LeftTrigger[Index] = Batch->RightTrigger[Index] = 0;
+
+    for (p = 0; p < BthPS3ReportPressureCount; p++)
+        Batch->Pressure[p][Index] = 0;
+
+    Batch->AccelX[Index] = Batch->AccelY[Index] = Batch->AccelZ[Index] = 0;
+    Batch->GyroX[Index] = Batch->GyroY[Index] = Batch->GyroZ[Index] = 0;
+}
+
+#define BTHPS3_REPORT_U16_LE(_r_, _o_)  ((USHORT)((_r_)[(_o_)] | ((_r_)[(_o_) + 1] << 8)))
+#define BTHPS3_REPORT_U16_BE(_r_, _o_)  ((USHORT)(((_r_)[(_o_)] << 8) | (_r_)[(_o_) + 1]))
+
+//
+// SIXAXIS and NAVIGATION: 0xA1 0x01, buttons at 3-5, sticks at 7-10, pressure
+// at 15-26, accelerometer and gyro as big-endian 10-bit values at 42-49
+// 
+static __inline BOOLEAN
+BthPS3_Report_DecodeSixaxis(
+    _In_reads_bytes_(Length) const UCHAR* Report,
+    _In_ ULONG Length,
+    _Inout_ PBTHPS3_REPORT_BATCH Batch,
+    _In_ ULONG Index
+)
+{
+    ULONG p;
+
+    if (Length < BTHPS3_SIXAXIS_REPORT_MIN_SIZE || Report[0] != 0xA1 || Report[1] != 0x01)
+        return FALSE;
+
+    Batch->Buttons[Index] = Report[3] | (Report[4] << 8) | ((Report[5] & 0x01) << 16);
+
+    Batch->LeftStickX[Index] = Report[7];
+    Batch->LeftStickY[Index] = Report[8];
+    Batch->RightStickX[Index] = Report[9];
+    Batch->RightStickY[Index] = Report[10];
+
+    for (p = 0; p < BthPS3ReportPressureCount; p++)
+        Batch->Pressure[p][Index] = Report[15 + p];
+
+    Batch->LeftTrigger[Index] = Report[15 + BthPS3ReportPressureL2];
+    Batch->RightTrigger[Index] = Report[15 + BthPS3ReportPressureR2];
+
+    Batch->AccelX[Index] = (SHORT)(BTHPS3_REPORT_U16_BE(Report, 42) - 0x200);
+    Batch->AccelY[Index] = (SHORT)(BTHPS3_REPORT_U16_BE(Report, 44) - 0x200);
+    Batch->AccelZ[Index] = (SHORT)(BTHPS3_REPORT_U16_BE(Report, 46) - 0x200);
+    Batch->GyroX[Index] = 0;
+    Batch->GyroY[Index] = 0;
+    Batch->GyroZ[Index] = (SHORT)(BTHPS3_REPORT_U16_BE(Report, 48) - 0x200);
+
+    return TRUE;
+}
+
+//
+// MOTION: 0xA1 0x01, buttons at 2-5, trigger at 6, two accelerometer samples
+// at 14-25 and two gyro samples at 26-37 as little-endian values offset by
+// 0x8000, the second (newer) sample is decoded
+// 
+static __inline BOOLEAN
+BthPS3_Report_DecodeMotion(
+    _In_reads_bytes_(Length) const UCHAR* Report,
+    _In_ ULONG Length,
+    _Inout_ PBTHPS3_REPORT_BATCH Batch,
+    _In_ ULONG Index
+)
+{
+    ULONG p;
+
+    if (Length < BTHPS3_MOTION_REPORT_MIN_SIZE || Report[0] != 0xA1 || Report[1] != 0x01)
+        return FALSE;
+
+    Batch->Buttons[Index] = (Report[2] & 0x09)
+        | ((Report[3] & 0xF0) << 8)
+        | ((Report[4] & 0x01) << 16)
+        | ((Report[5] & 0xC0) << 11);
+
+    Batch->LeftStickX[Index] = Batch->LeftStickY[Index] = 0x80;
+    Batch->RightStickX[Index] = Batch->RightStickY[Index] = 0x80;
+
+    for (p = 0; p < BthPS3ReportPressureCount; p++)
+        Batch->Pressure[p][Index] = 0;
+
+    Batch->LeftTrigger[Index] = 0;
+    Batch->RightTrigger[Index] = Report[6];
+
+    Batch->AccelX[Index] = (SHORT)(BTHPS3_REPORT_U16_LE(Report, 20) - 0x8000);
+    Batch->AccelY[Index] = (SHORT)(BTHPS3_REPORT_U16_LE(Report, 22) - 0x8000);
+    Batch->AccelZ[Index] = (SHORT)(BTHPS3_REPORT_U16_LE(Report, 24) - 0x8000);
+    Batch->GyroX[Index] = (SHORT)(BTHPS3_REPORT_U16_LE(Report, 32) - 0x8000);
+    Batch->GyroY[Index] = (SHORT)(BTHPS3_REPORT_U16_LE(Report, 34) - 0x8000);
+    Batch->GyroZ[Index] = (SHORT)(BTHPS3_REPORT_U16_LE(Report, 36) - 0x8000);
+
+    return TRUE;
+}
+
+//
+// WIRELESS: 0xA1 0x11 (full report), sticks at 4-7, hat and buttons at 8-10,
+// triggers at 11-12, gyro and accelerometer as little-endian signed at 16-27
+// 
+static __inline BOOLEAN
+BthPS3_Report_DecodeWireless(
+    _In_reads_bytes_(Length) const UCHAR* Report,
+    _In_ ULONG Length,
+    _Inout_ PBTHPS3_REPORT_BATCH Batch,
+    _In_ ULONG Index
+)
+{
+    static const UCHAR hatToDpad[16] = { 0x1, 0x3, 0x2, 0x6, 0x4, 0xC, 0x8, 0x9 };
+    const UCHAR* r;
+    ULONG buttons;
+    ULONG p;
+
+    if (Length < BTHPS3_WIRELESS_REPORT_MIN_SIZE || Report[0] != 0xA1 || Report[1] != 0x11)
+        return FALSE;
+
+    r = Report;
+
+    buttons = hatToDpad[r[8] & 0x0F] << 4;
+    if (r[8] & 0x10) buttons |= BTHPS3_REPORT_BUTTON_SQUARE;
+    if (r[8] & 0x20) buttons |= BTHPS3_REPORT_BUTTON_CROSS;
+    if (r[8] & 0x40) buttons |= BTHPS3_REPORT_BUTTON_CIRCLE;
+    if (r[8] & 0x80) buttons |= BTHPS3_REPORT_BUTTON_TRIANGLE;
+    if (r[9] & 0x01) buttons |= BTHPS3_REPORT_BUTTON_L1;
+    if (r[9] & 0x02) buttons |= BTHPS3_REPORT_BUTTON_R1;
+    if (r[9] & 0x04) buttons |= BTHPS3_REPORT_BUTTON_L2;
+    if (r[9] & 0x08) buttons |= BTHPS3_REPORT_BUTTON_R2;
+    if (r[9] & 0x10) buttons |= BTHPS3_REPORT_BUTTON_SELECT;
+    if (r[9] & 0x20) buttons |= BTHPS3_REPORT_BUTTON_START;
+    if (r[9] & 0x40) buttons |= BTHPS3_REPORT_BUTTON_L3;
+    if (r[9] & 0x80) buttons |= BTHPS3_REPORT_BUTTON_R3;
+    if (r[10] & 0x01) buttons |= BTHPS3_REPORT_BUTTON_PS;
+    if (r[10] & 0x02) buttons |= BTHPS3_REPORT_BUTTON_TOUCHPAD;
+
+    Batch->Buttons[Index] = buttons;
+
+    Batch->LeftStickX[Index] = r[4];
+    Batch->LeftStickY[Index] = r[5];
+    Batch->RightStickX[Index] = r[6];
+    Batch->RightStickY[Index] = r[7];
+
+    for (p = 0; p < BthPS3ReportPressureCount; p++)
+        Batch->Pressure[p][Index] = 0;
+
+    Batch->LeftTrigger[Index] = r[11];
+    Batch->RightTrigger[Index] = r[12];
+
+    Batch->GyroX[Index] = (SHORT)BTHPS3_REPORT_U16_LE(r, 16);
+    Batch->GyroY[Index] = (SHORT)BTHPS3_REPORT_U16_LE(r, 18);
+    Batch->GyroZ[Index] = (SHORT)BTHPS3_REPORT_U16_LE(r, 20);
+    Batch->AccelX[Index] = (SHORT)BTHPS3_REPORT_U16_LE(r, 22);
+    Batch->AccelY[Index] = (SHORT)BTHPS3_REPORT_U16_LE(r, 24);
+    Batch->AccelZ[Index] = (SHORT)BTHPS3_REPORT_U16_LE(r, 26);
+
+    return TRUE;
+}
+
+//
+// Reference implementation, decodes a single report into entry Index
+// 
+// Invalid reports leave a cleared entry behind and return FALSE
+// 
+static __inline BOOLEAN
+BthPS3_Report_DecodeScalar(
+    _In_ DS_DEVICE_TYPE DeviceType,
+    _In_reads_bytes_(Length) const UCHAR* Report,
+    _In_ ULONG Length,
+    _Inout_ PBTHPS3_REPORT_BATCH Batch,
+    _In_ ULONG Index
+)
+{
+    BOOLEAN ret = FALSE;
+
+    switch (DeviceType)
+    {
+    case DS_DEVICE_TYPE_SIXAXIS:
+    case DS_DEVICE_TYPE_NAVIGATION:
+        ret = BthPS3_Report_DecodeSixaxis(Report, Length, Batch, Index);
+        break;
+    case DS_DEVICE_TYPE_MOTION:
+        ret = BthPS3_Report_DecodeMotion(Report, Length, Batch, Index);
+        break;
+    case DS_DEVICE_TYPE_WIRELESS:
+        ret = BthPS3_Report_DecodeWireless(Report, Length, Batch, Index);
+        break;
+    default:
+        break;
+    }
+
+    if (!ret)
+        BthPS3_Report_ClearEntry(Batch, Index);
+
+    return ret;
+}
+
+#if defined(_M_AMD64)
+
+//
+// Transposes a 16x16 byte matrix, row i becomes column i
+// 
+static __inline VOID
+BthPS3_Report_Transpose16x16(
+    _Inout_updates_(16) __m128i* Rows
+)
+{
+    __m128i t[16];
+    int stage, k;
+
+    for (stage = 0; stage < 4; stage++)
+    {
+        for (k = 0; k < 8; k++)
+        {
+            t[2 * k] = _mm_unpacklo_epi8(Rows[k], Rows[k + 8]);
+            t[2 * k + 1] = _mm_unpackhi_epi8(Rows[k], Rows[k + 8]);
+        }
+
+        for (k = 0; k < 16; k++)
+            Rows[k] = t[k];
+    }
+}
+
+//
+// Loads bytes [Offset, Offset + 16) of 16 reports and stores them per column
+// 
+static __inline VOID
+BthPS3_Report_LoadColumns16(
+    _In_ const UCHAR* Reports,
+    _In_ ULONG Stride,
+    _In_ ULONG Offset,
+    _Out_writes_(16) __m128i* Columns
+)
+{
+    int k;
+
+    for (k = 0; k < 16; k++)
+        Columns[k] = _mm_loadu_si128((const __m128i*)(Reports + (SIZE_T)k * Stride + Offset));
+
+    BthPS3_Report_Transpose16x16(Columns);
+}
+
+//
+// Combines two byte columns to 16 big-endian values minus 0x200
+// 
+static __inline VOID
+BthPS3_Report_StoreBigEndian10(
+    _In_ __m128i High,
+    _In_ __m128i Low,
+    _Out_writes_(16) SHORT* Destination
+)
+{
+    const __m128i center = _mm_set1_epi16(0x200);
+
+    _mm_store_si128((__m128i*)Destination, _mm_sub_epi16(_mm_unpacklo_epi8(Low, High), center));
+    _mm_store_si128((__m128i*)(Destination + 8), _mm_sub_epi16(_mm_unpackhi_epi8(Low, High), center));
+}
+
+//
+// Decodes 16 valid SIXAXIS/NAVIGATION reports into entries [Index, Index + 16)
+// 
+static __inline VOID
+BthPS3_Report_DecodeSixaxis16(
+    _In_ const UCHAR* Reports,
+    _In_ ULONG Stride,
+    _Inout_ PBTHPS3_REPORT_BATCH Batch,
+    _In_ ULONG Index
+)
+{
+    __m128i c[16];
+    __m128i lo, hi;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i psMask = _mm_set1_epi8(0x01);
+    int k;
+
+    //
+    // Bytes 3-18: buttons, sticks, D-Pad pressure
+    // 
+    BthPS3_Report_LoadColumns16(Reports, Stride, 3, c);
+
+    lo = _mm_unpacklo_epi8(c[0], c[1]);
+    hi = _mm_and_si128(c[2], psMask);
+    _mm_store_si128((__m128i*)&Batch->Buttons[Index + 0], _mm_unpacklo_epi16(lo, _mm_unpacklo_epi8(hi, zero)));
+    _mm_store_si128((__m128i*)&Batch->Buttons[Index + 4], _mm_unpackhi_epi16(lo, _mm_unpacklo_epi8(hi, zero)));
+    lo = _mm_unpackhi_epi8(c[0], c[1]);
+    _mm_store_si128((__m128i*)&Batch->Buttons[Index + 8], _mm_unpacklo_epi16(lo, _mm_unpackhi_epi8(hi, zero)));
+    _mm_store_si128((__m128i*)&Batch->Buttons[Index + 12], _mm_unpackhi_epi16(lo, _mm_unpackhi_epi8(hi, zero)));
+
+    _mm_store_si128((__m128i*)&Batch->LeftStickX[Index], c[4]);
+    _mm_store_si128((__m128i*)&Batch->LeftStickY[Index], c[5]);
+    _mm_store_si128((__m128i*)&Batch->RightStickX[Index], c[6]);
+    _mm_store_si128((__m128i*)&Batch->RightStickY[Index], c[7]);
+
+    for (k = 0; k < 4; k++)
+        _mm_store_si128((__m128i*)&Batch->Pressure[k][Index], c[12 + k]);
+
+    //
+    // Bytes 19-34: remaining pressure values
+    // 
+    BthPS3_Report_LoadColumns16(Reports, Stride, 19, c);
+
+    for (k = 4; k < BthPS3ReportPressureCount; k++)
+        _mm_store_si128((__m128i*)&Batch->Pressure[k][Index], c[k - 4]);
+
+    _mm_store_si128((__m128i*)&Batch->LeftTrigger[Index], c[BthPS3ReportPressureL2 - 4]);
+    _mm_store_si128((__m128i*)&Batch->RightTrigger[Index], c[BthPS3ReportPressureR2 - 4]);
+
+    //
+    // Bytes 34-49: motion sensors at 42-49
+    // 
+    BthPS3_Report_LoadColumns16(Reports, Stride, 34, c);
+
+    BthPS3_Report_StoreBigEndian10(c[8], c[9], &Batch->AccelX[Index]);
+    BthPS3_Report_StoreBigEndian10(c[10], c[11], &Batch->AccelY[Index]);
+    BthPS3_Report_StoreBigEndian10(c[12], c[13], &Batch->AccelZ[Index]);
+    BthPS3_Report_StoreBigEndian10(c[14], c[15], &Batch->GyroZ[Index]);
+
+    _mm_store_si128((__m128i*)&Batch->GyroX[Index], zero);
+    _mm_store_si128((__m128i*)&Batch->GyroX[Index + 8], zero);
+    _mm_store_si128((__m128i*)&Batch->GyroY[Index], zero);
+    _mm_store_si128((__m128i*)&Batch->GyroY[Index + 8], zero);
+}
+
+#endif
+
+//
+// Decodes Count reports spaced Stride bytes apart, appending them to Batch
+// 
+// Each report must be at least Length bytes in size, a Length beyond Stride
+// is cut to Stride as reports can't overlap. Returns the number of valid
+// reports, invalid ones occupy a cleared entry to keep indices aligned.
+// SIXAXIS/NAVIGATION reports are decoded 16 at a time using SSE2 on x64.
+// 
+static __inline ULONG
+BthPS3_Report_DecodeBatch(
+    _In_ DS_DEVICE_TYPE DeviceType,
+    _In_ const UCHAR* Reports,
+    _In_ ULONG Stride,
+    _In_ ULONG Length,
+    _In_ ULONG Count,
+    _Inout_ PBTHPS3_REPORT_BATCH Batch
+)
+{
+    ULONG valid = 0;
+    ULONG i = 0;
+
+    if (Count > BTHPS3_REPORT_BATCH_CAPACITY - Batch->Count)
+        Count = BTHPS3_REPORT_BATCH_CAPACITY - Batch->Count;
+
+    if (Count > 1 && Length > Stride)
+        Length = Stride;
+
+#if defined(_M_AMD64)
+    if ((DeviceType == DS_DEVICE_TYPE_SIXAXIS || DeviceType == DS_DEVICE_TYPE_NAVIGATION)
+        && Length >= BTHPS3_SIXAXIS_REPORT_MIN_SIZE
+        && (Batch->Count % 16) == 0)
+    {
+        for (; i + 16 <= Count; i += 16)
+        {
+            const UCHAR* group = Reports + (SIZE_T)i * Stride;
+            ULONG k;
+
+            for (k = 0; k < 16; k++)
+            {
+                if (group[(SIZE_T)k * Stride] != 0xA1 || group[(SIZE_T)k * Stride + 1] != 0x01)
+                    break;
+            }
+
+            //
+            // Leave groups containing invalid reports to the scalar path
+            // 
+            if (k < 16)
+                break;
+
+            BthPS3_Report_DecodeSixaxis16(group, Stride, Batch, Batch->Count + i);
+            valid += 16;
+        }
+    }
+#endif
+
+    for (; i < Count; i++)
+    {
+        if (BthPS3_Report_DecodeScalar(
+            DeviceType,
+            Reports + (SIZE_T)i * Stride,
+            Length,
+            Batch,
+            Batch->Count + i
+        ))
+            valid++;
+    }
+
+    Batch->Count += Count;
+
+    return valid;
+}
+
+//
+// Floats per sample emitted by BthPS3_Motion_ExtractImu:
+// timestamp, accelerometer X/Y/Z, gyro X/Y/Z, magnetometer X/Y/Z
+// 
+#define BTHPS3_MOTION_IMU_SAMPLE_FLOATS             10
+
+//
+// MOTION reports carry two accelerometer/gyro samples each
+// 
+#define BTHPS3_MOTION_IMU_SAMPLES_PER_REPORT        2
+
+//
+// State kept between reports of the same MOTION device
+// 
+typedef struct DECLSPEC_ALIGN(16) _BTHPS3_MOTION_IMU_EXTRACTOR
+{
+    //
+    // Per-float scale factors for both samples of a report
+    // 
+    float Scale[BTHPS3_MOTION_IMU_SAMPLE_FLOATS * BTHPS3_MOTION_IMU_SAMPLES_PER_REPORT];
+
+    //
+    // Unwrapped device timestamp of the last report
+    // 
+    ULONGLONG Ticks;
+
+    USHORT PreviousTimestamp;
+
+    BOOLEAN HasPrevious;
+
+} BTHPS3_MOTION_IMU_EXTRACTOR, *PBTHPS3_MOTION_IMU_EXTRACTOR;
+
+//
+// Prepares an extractor, scales convert raw sensor units (e.g. to g, rad/s)
+// 
+static __inline VOID
+BthPS3_Motion_ImuInit(
+    _Out_ PBTHPS3_MOTION_IMU_EXTRACTOR Extractor,
+    _In_ float AccelScale,
+    _In_ float GyroScale,
+    _In_ float MagScale
+)
+{
+    ULONG i;
+
+    RtlZeroMemory(Extractor, sizeof(*Extractor));
+
+    for (i = 0; i < BTHPS3_MOTION_IMU_SAMPLES_PER_REPORT; i++)
+    {
+        float* scale = &Extractor->Scale[i * BTHPS3_MOTION_IMU_SAMPLE_FLOATS];
+
+        //
+        // Timestamps are computed in half ticks to allow interpolation
+        // 
+        scale[0] = 0.5f;
+        scale[1] = scale[2] = scale[3] = AccelScale;
+        scale[4] = scale[5] = scale[6] = GyroScale;
+        scale[7] = scale[8] = scale[9] = MagScale;
+    }
+}
+
+#define BTHPS3_MOTION_S16(_r_, _o_)     ((LONG)BTHPS3_REPORT_U16_LE(_r_, _o_) - 0x8000)
+#define BTHPS3_MOTION_S12(_v_)          (((LONG)((ULONG)(_v_) << 20)) >> 20)
+
+//
+// Extracts both IMU samples of Count MOTION reports spaced Stride bytes apart
+// 
+// Writes BTHPS3_MOTION_IMU_SAMPLE_FLOATS floats per sample to Samples, which
+// must hold Count * BTHPS3_MOTION_IMU_SAMPLES_PER_REPORT samples. Timestamps
+// are device ticks relative to *BaseTicks, the unwrapped time of the report
+// preceding this call. The older sample of each report is stamped half-way
+// between the previous and the current report; with no previous report both
+// samples get the report time. The magnetometer is sampled once per report
+// and repeated. Invalid reports are skipped, returns the number of samples.
+// Like BthPS3_Report_DecodeBatch a Length beyond Stride is cut to Stride.
+// 
+// In kernel mode this uses SSE2/NEON registers, callers on x64 and ARM64 may
+// use it at any IRQL where floating point is otherwise allowed.
+// 
+static __inline ULONG
+BthPS3_Motion_ExtractImu(
+    _Inout_ PBTHPS3_MOTION_IMU_EXTRACTOR Extractor,
+    _In_ const UCHAR* Reports,
+    _In_ ULONG Stride,
+    _In_ ULONG Length,
+    _In_ ULONG Count,
+    _Out_writes_(Count * BTHPS3_MOTION_IMU_SAMPLES_PER_REPORT * BTHPS3_MOTION_IMU_SAMPLE_FLOATS) float* Samples,
+    _Out_opt_ PULONGLONG BaseTicks
+)
+{
+    const ULONGLONG base = Extractor->Ticks;
+    LONG raw[BTHPS3_MOTION_IMU_SAMPLE_FLOATS * BTHPS3_MOTION_IMU_SAMPLES_PER_REPORT];
+    ULONG samples = 0;
+    ULONG i, k;
+
+    if (BaseTicks)
+        *BaseTicks = base;
+
+    if (Count > 1 && Length > Stride)
+        Length = Stride;
+
+    if (Length < BTHPS3_MOTION_REPORT_MIN_SIZE)
+        return 0;
+
+    for (i = 0; i < Count; i++)
+    {
+        const UCHAR* r = Reports + (SIZE_T)i * Stride;
+        float* out = Samples + (SIZE_T)samples * BTHPS3_MOTION_IMU_SAMPLE_FLOATS;
+
+        if (r[0] != 0xA1 || r[1] != 0x01)
+            continue;
+
+        const USHORT timestamp = (USHORT)((r[12] << 8) | r[44]);
+        const USHORT delta = Extractor->HasPrevious ? (USHORT)(timestamp - Extractor->PreviousTimestamp) : 0;
+
+        //
+        // Older sample half-way since the previous report, newer one at report time
+        // 
+        raw[0] = (LONG)(2 * (Extractor->Ticks - base)) + delta;
+        raw[10] = (LONG)(2 * (Extractor->Ticks - base)) + 2 * delta;
+
+        raw[1] = BTHPS3_MOTION_S16(r, 14);
+        raw[2] = BTHPS3_MOTION_S16(r, 16);
+        raw[3] = BTHPS3_MOTION_S16(r, 18);
+        raw[4] = BTHPS3_MOTION_S16(r, 26);
+        raw[5] = BTHPS3_MOTION_S16(r, 28);
+        raw[6] = BTHPS3_MOTION_S16(r, 30);
+
+        raw[11] = BTHPS3_MOTION_S16(r, 20);
+        raw[12] = BTHPS3_MOTION_S16(r, 22);
+        raw[13] = BTHPS3_MOTION_S16(r, 24);
+        raw[14] = BTHPS3_MOTION_S16(r, 32);
+        raw[15] = BTHPS3_MOTION_S16(r, 34);
+        raw[16] = BTHPS3_MOTION_S16(r, 36);
+
+        raw[7] = raw[17] = BTHPS3_MOTION_S12(((r[39] & 0x0F) << 8) | r[40]);
+        raw[8] = raw[18] = BTHPS3_MOTION_S12((r[41] << 4) | (r[42] >> 4));
+        raw[9] = raw[19] = BTHPS3_MOTION_S12(((r[42] & 0x0F) << 8) | r[43]);
+
+#if defined(_M_AMD64)
+        for (k = 0; k < ARRAYSIZE(raw); k += 4)
+        {
+            _mm_storeu_ps(out + k, _mm_mul_ps(
+                _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)&raw[k])),
+                _mm_load_ps(&Extractor->Scale[k])
+            ));
+        }
+#elif defined(_M_ARM64)
+        for (k = 0; k < ARRAYSIZE(raw); k += 4)
+        {
+            vst1q_f32(out + k, vmulq_f32(
+                vcvtq_f32_s32(vld1q_s32((const int32_t*)&raw[k])),
+                vld1q_f32(&Extractor->Scale[k])
+            ));
+        }
+#else
+        for (k = 0; k < ARRAYSIZE(raw); k++)
+            out[k] = (float)raw[k] * Extractor->Scale[k];
+#endif
+
+        Extractor->Ticks += delta;
+        Extractor->PreviousTimestamp = timestamp;
+        Extractor->HasPrevious = TRUE;
+
+        samples += BTHPS3_MOTION_IMU_SAMPLES_PER_REPORT;
+    }
+
+    return samples;
+}